@@ -488,17 +488,16 @@ struct logging_state {
     bool output_was_produced;
 };
 
-static char *do_log(char *log_line, void *param)
+static void do_log(const char *log_line, size_t len, void *param)
 {
     libreport_client_log(log_line);
-    return log_line;
 }
 
-static char *do_log2(char *log_line, void *param)
+static void do_log2(const char *log_line, size_t len, void *param)
 {
     struct logging_state *l_state = param;
-    l_state->output_was_produced |= (log_line[0] != '\0');
-    return do_log(log_line, param);
+    l_state->output_was_produced |= (len != 0);
+    do_log(log_line, len, param);
 }
 
 static int export_config_and_run_event(
@@ -582,7 +581,9 @@ static problem_data_t *load_problem_data_if_not_yet(problem_data_t *problem_data
     {
         return NULL;
     }
-    problem_data = create_problem_data_from_dump_dir(dd);
+    /* Usually, only a few elements are needed (rating, not-reportable),
+     * so don't read the whole dump directory */
+    problem_data = create_problem_data_from_dump_dir_lazy(dd);
     dd_close(dd);
     return problem_data;
 }
@@ -753,7 +754,7 @@ int select_and_run_one_event(const char *dump_dir_name, const char *pfx, int int
     libreport_list_free_with_free(list_events);
 
     struct run_event_state *run_state = new_run_event_state();
-    run_state->logging_callback = do_log;
+    run_state->logging_line_callback = do_log;
     int r = interactive
                 ? run_event_on_dir_name_interactively(run_state, dump_dir_name, event_name)
                 : run_event_on_dir_name_batch(run_state, dump_dir_name, event_name)
@@ -775,7 +776,7 @@ static int run_event_chain_real(struct run_event_state *run_state,
     int retval = 0;
 
     /* Blergh. */
-    run_state->logging_callback = do_log2;
+    run_state->logging_line_callback = do_log2;
     run_state->logging_param = &l_state;
 
     for (GList *eitem = chain; eitem; eitem = g_list_next(eitem))
@@ -67,6 +67,7 @@ int main(int argc, char** argv)
         "\n""   or: & [-vspy] -e EVENT PROBLEM_DIR"
         "\n""   or: & [-vspy] -d PROBLEM_DIR"
         "\n""   or: & [-vspy] -x PROBLEM_DIR"
+        "\n""   or: & [-vsp] --rebuild-index SPOOL_DIR"
     );
     enum {
         OPT_list_events  = 1 << 0,
@@ -78,10 +79,11 @@ int main(int argc, char** argv)
         OPT_v            = 1 << 6,
         OPT_s            = 1 << 7,
         OPT_p            = 1 << 8,
+        OPT_rebuild_index = 1 << 9,
         /* An virtual option used when no other operation is specified */
-        OPT_workflow     = 1 << 9,
-        OPTMASK_op       = OPT_list_events|OPT_run_event|OPT_delete|OPT_expert|OPT_version,
-        OPTMASK_need_arg = OPT_run_event|OPT_delete|OPT_expert|OPT_workflow
+        OPT_workflow     = 1 << 10,
+        OPTMASK_op       = OPT_list_events|OPT_run_event|OPT_delete|OPT_expert|OPT_version|OPT_rebuild_index,
+        OPTMASK_need_arg = OPT_run_event|OPT_delete|OPT_expert|OPT_workflow|OPT_rebuild_index
     };
     /* Keep enum above and order of options below in sync! */
     struct options program_options[] = {
@@ -95,6 +97,7 @@ int main(int argc, char** argv)
         OPT__VERBOSE(&libreport_g_verbose),
         OPT_BOOL(     's', NULL     , NULL,                    _("Log to syslog")),
         OPT_BOOL(     'p', NULL     , NULL,                    _("Add program names to log")),
+        OPT_BOOL(       0, "rebuild-index", NULL,              _("Rebuild the index of problem directories in SPOOL_DIR")),
         OPT_END()
     };
     unsigned opts = libreport_parse_opts(argc, argv, program_options, program_usage_string);
@@ -135,6 +138,9 @@ int main(int argc, char** argv)
 
     char *dump_dir_name = argv[0];
 
+    if (op == OPT_rebuild_index)
+        return spool_index_rebuild(dump_dir_name) < 0;
+
     /* Get settings */
     load_event_config_data();
 
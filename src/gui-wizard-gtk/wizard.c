@@ -1406,11 +1406,10 @@ static void run_event_gtk_error(const char *error_line, void *param)
     update_command_run_log(error_line, (struct analyze_event_data *)param);
 }
 
-static char *run_event_gtk_logging(char *log_line, void *param)
+static void run_event_gtk_logging(const char *log_line, size_t len, void *param)
 {
     struct analyze_event_data *evd = (struct analyze_event_data *)param;
     update_command_run_log(log_line, evd);
-    return log_line;
 }
 
 static void log_request_response_communication(const char *request, const char *response, struct analyze_event_data *evd)
@@ -1749,7 +1748,7 @@ static void start_event_run(const char *event_name)
      */
 
     struct run_event_state *state = new_run_event_state();
-    state->logging_callback = run_event_gtk_logging;
+    state->logging_line_callback = run_event_gtk_logging;
     state->error_callback = run_event_gtk_error;
     state->alert_callback = run_event_gtk_alert;
     state->ask_callback = run_event_gtk_ask;
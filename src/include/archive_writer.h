@@ -0,0 +1,117 @@
+/*
+    Compressed tar archive writer
+
+    Copyright (C) 2024  ABRT team
+    Copyright (C) 2024  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    ----
+
+    The writer produces GNU tar archives compressed by gzip, xz or zstd
+    without spawning any child process. The compressed stream is passed to a
+    sink callback, so the archive can be written to a file as well as to a
+    network connection.
+
+    gzip data are compressed in independent blocks by a pool of threads and
+    joined into a single gzip member (the same technique pigz uses). xz and
+    zstd use the multi-threaded encoders of their libraries.
+*/
+#ifndef LIBREPORT_ARCHIVE_WRITER_H_
+#define LIBREPORT_ARCHIVE_WRITER_H_
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum archive_compression {
+    ARCHIVE_COMPRESSION_GZIP,
+    ARCHIVE_COMPRESSION_XZ,
+    ARCHIVE_COMPRESSION_ZSTD,
+};
+
+/* Deduces the compression from the archive file name suffix
+ *
+ * The supported suffixes are '.tar.gz', '.tgz', '.tar.xz' and '.tar.zst'.
+ *
+ * @return enum archive_compression; -ENOSYS if the suffix is not known or
+ * libreport was built without support for the compression
+ */
+int archive_compression_from_name(const char *archive_name);
+
+/* Consumes compressed data
+ *
+ * @return 0 on success; otherwise -errno
+ */
+typedef int (*archive_sink_fn)(const void *buf, size_t size, void *param);
+
+/* Archive sink writing to the file descriptor pointed to by param (int *) */
+int archive_fd_sink(const void *buf, size_t size, void *param);
+
+struct archive_writer;
+
+/* Creates a new archive writer
+ *
+ * @param threads Number of compression threads, 0 means the number of
+ * online processors
+ *
+ * Initialization errors are reported by the first archive_writer_add_*()
+ * or archive_writer_finish() call.
+ */
+struct archive_writer *archive_writer_new(enum archive_compression compression, unsigned threads,
+        archive_sink_fn sink, void *sink_param);
+
+/* Appends a regular file to the archive
+ *
+ * Exactly st->st_size bytes are archived: the contents is truncated if the
+ * file grows and padded with zeros if it shrinks while being read.
+ *
+ * @param name File name in the archive
+ * @param st Result of fstat(fd) - mode, owner and mtime are taken from it
+ * @return 0 on success; otherwise -errno
+ */
+int archive_writer_add_fd(struct archive_writer *aw, const char *name, int fd, const struct stat *st);
+
+/* Appends a regular file with the given contents to the archive
+ *
+ * The file is owned by the current process' effective user and group.
+ *
+ * @return 0 on success; otherwise -errno
+ */
+int archive_writer_add_data(struct archive_writer *aw, const char *name,
+        const void *data, size_t size, mode_t mode, time_t mtime);
+
+/* Writes the end of the archive and flushes all compressed data to the sink
+ *
+ * No other files can be added afterwards.
+ *
+ * @return 0 on success; otherwise -errno (the first error of the writer)
+ */
+int archive_writer_finish(struct archive_writer *aw);
+
+/* Releases the writer and waits for its compression threads
+ *
+ * The archive is incomplete if archive_writer_finish() was not called.
+ */
+void archive_writer_free(struct archive_writer *aw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
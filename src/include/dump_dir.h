@@ -24,7 +24,9 @@
 /* For const_string_vector_const_ptr_t */
 #include "libreport_types.h"
 #include "report_result.h"
+#include "archive_writer.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -73,6 +75,14 @@ extern uid_t dd_g_super_user_uid;
  */
 extern gid_t dd_g_fs_group_gid;
 
+/* Number of threads compressing archives created via dd_create_archive()
+ *
+ * The default value is 0 which means the number of online processors.
+ *
+ * See libreport_get_global_archive_compression_threads().
+ */
+extern unsigned dd_g_archive_threads;
+
 /******************************************************************************/
 /* Dump Directory                                                             */
 /******************************************************************************/
@@ -115,6 +125,14 @@ struct dump_dir {
      * dd_get_meta_data_dir_fd()
      */
     int dd_md_fd;
+    /* The dump directory has been modified since it was locked and its
+     * record in the spool index must be refreshed when it is unlocked.
+     */
+    int modified;
+    /* Never use this member directly, see dd_set_item_compression() */
+    long item_compression;
+    /* Never use this member directly, it is loaded on demand */
+    GHashTable *compressed_items;
 };
 
 void dd_close(struct dump_dir *dd);
@@ -206,6 +224,66 @@ int dd_get_next_file(struct dump_dir *dd, char **short_name, char **full_name);
  */
 void dd_clear_next_file(struct dump_dir *dd);
 
+/* Flags for dd_item_iterator_init() */
+enum {
+    /* Fill in size and mtime of iterated items (costs one statx per item) */
+    DD_ITEM_ITERATOR_STAT = (1 << 0),
+};
+
+/* Information about a dump directory item filled by dd_item_iterator_next()
+ */
+struct dd_item_info {
+    /* Borrowed, valid until the next call of dd_item_iterator_next() */
+    const char *name;
+    /* One of DT_* values */
+    unsigned char type;
+    ino_t inode;
+    /* -1 if DD_ITEM_ITERATOR_STAT was not passed */
+    off_t size;
+    /* -1 if DD_ITEM_ITERATOR_STAT was not passed */
+    time_t mtime;
+};
+
+/* Iterator going through regular files of a dump directory
+ *
+ * The iterator is meant to be allocated by the caller (usually on stack) and
+ * does not allocate any memory. Directory entries are read in batches, the
+ * buffer holds all entries of an ordinary dump directory.
+ *
+ * Never use the members directly.
+ */
+struct dd_item_iterator {
+    int dir_fd;
+    int flags;
+    unsigned pos;
+    unsigned end;
+    /* Buffer for raw directory entries (uint64_t for proper alignment) */
+    uint64_t buf[512];
+};
+
+/* Initializes the iterator
+ *
+ * The iterator uses its own file descriptor of the dump directory, therefore
+ * it does not interfere with dd_init_next_file().
+ *
+ * @param dd Dump directory
+ * @param iter Iterator allocated by the caller
+ * @param flags DD_ITEM_ITERATOR_* flags
+ * @return 0 on success; otherwise -errno
+ */
+int dd_item_iterator_init(struct dump_dir *dd, struct dd_item_iterator *iter, int flags);
+
+/* Fills info with the next regular file of the dump directory
+ *
+ * @return 1 if the next item was read, 0 at the end and -errno on errors.
+ */
+int dd_item_iterator_next(struct dd_item_iterator *iter, struct dd_item_info *info);
+
+/* Releases the resources held by the iterator. It is safe to call this
+ * function more times.
+ */
+void dd_item_iterator_destroy(struct dd_item_iterator *iter);
+
 char *load_text_file(const char *path, unsigned flags);
 
 char* dd_load_text_ext(const struct dump_dir *dd, const char *name, unsigned flags);
@@ -258,6 +336,8 @@ off_t dd_copy_fd(struct dump_dir *dd, const char *name, int fd, int copy_flags,
  * @param dd Dump Directory
  * @param name The name of the element
  * @param statbuf See 'man 2 stat'
+ * st_size of a compressed item is the size of its uncompressed contents.
+ *
  * @return -EINVAL if name is invalid element name, -EMEDIUMTYPE if name is not
  *  regular file, -errno on errors and 0 on success.
  */
@@ -266,6 +346,8 @@ int dd_item_stat(struct dump_dir *dd, const char *name, struct stat *statbuf);
 /* Returns value less than 0 if any error occured; otherwise returns size of an
  * item in Bytes. If an item does not exist returns 0 instead of an error
  * value.
+ *
+ * The size of a compressed item is the size of its uncompressed contents.
  */
 long dd_get_item_size(struct dump_dir *dd, const char *name);
 
@@ -288,6 +370,9 @@ int dd_delete_item(struct dump_dir *dd, const char *name);
  * O_RDONLY - opens an existing item for reading
  * O_RDWR - removes an item, creates its file and opens the file for reading and writing
  *
+ * A compressed item is opened for reading as an anonymous file with the
+ * uncompressed contents.
+ *
  * @param dd Dump directory
  * @param name The name of the item
  * @param flags One of these : O_RDONLY, O_RDWR
@@ -295,6 +380,44 @@ int dd_delete_item(struct dump_dir *dd, const char *name);
  */
 int dd_open_item(struct dump_dir *dd, const char *name, int flags);
 
+/* The smallest threshold accepted by dd_set_item_compression() */
+#define DD_ITEM_COMPRESSION_MIN_THRESHOLD 4096
+
+/* Stores large text items compressed
+ *
+ * Items saved by dd_save_text() whose size is at least threshold Bytes are
+ * stored compressed by zstd. The setting is kept in the meta-data of the dump
+ * directory.
+ *
+ * dd_load_text*(), dd_open_item*(), dd_item_stat(), dd_get_item_size(),
+ * dd_create_archive() and problem_data_load_from_dump_dir*() decompress the
+ * items transparently. Programs reading the files of the dump directory
+ * directly see the compressed data.
+ *
+ * @param threshold Minimal size of compressed items; 0 stops compressing new
+ * items, the already compressed items remain compressed.
+ * @return 0 on success; -EINVAL if threshold is lower than
+ * DD_ITEM_COMPRESSION_MIN_THRESHOLD; -ENOSYS if libreport was built without
+ * zstd; otherwise -errno
+ */
+int dd_set_item_compression(struct dump_dir *dd, size_t threshold);
+
+/* Replaces a file descriptor of a dump directory item opened for reading by a
+ * file descriptor of an anonymous file with the uncompressed contents if the
+ * item is stored compressed.
+ *
+ * Use it whenever an item opened by openat(dd->dd_fd, ...) is read; the size
+ * of the contents is provided by dd_item_stat().
+ *
+ * @param dd Dump directory
+ * @param name The name of the item
+ * @param fd File descriptor of the item, the function closes it if it
+ * returns another file descriptor or an error
+ * @param compressed Set to true if the item is compressed (can be NULL)
+ * @return The file descriptor of the item's contents; otherwise -errno
+ */
+int dd_decompress_item_fd(struct dump_dir *dd, const char *name, int fd, bool *compressed);
+
 /* Returns a FILE for the given name. The function is limited to open
  * an element read only, write only or create new.
  *
@@ -477,7 +600,12 @@ struct dump_dir *create_dump_dir_ext(const char *base_dir_name, const char *type
  *
  * The archive type is deduced from archive_name suffix. The supported archive
  * suffixes are the following:
- *   - '.tag.gz' (note: the implementation uses child gzip process)
+ *   - '.tar.gz' and '.tgz'
+ *   - '.tar.xz' (if libreport was built with liblzma)
+ *   - '.tar.zst' (if libreport was built with libzstd)
+ *
+ * The archive is compressed in-process by dd_g_archive_threads threads. See
+ * archive_writer_new().
  *
  * The archive will include only the files that are not in the exclude_elements
  * list. See libreport_get_global_always_excluded_elements().
@@ -485,13 +613,23 @@ struct dump_dir *create_dump_dir_ext(const char *base_dir_name, const char *type
  * The argument "flags" is currently unused.
  *
  * @return 0 on success; otherwise non-0 value. -ENOSYS if archive type is not
- * supported. -EEXIST if the archive file already exists. -ECHILD if child
- * process fails. Other negative values can be converted to errno values by
- * turning them positive.
+ * supported. -EEXIST if the archive file already exists. Other negative
+ * values can be converted to errno values by turning them positive.
  */
 int dd_create_archive(struct dump_dir *dd, const char *archive_name,
         const_string_vector_const_ptr_t exclude_elements, int flags);
 
+/* Writes a compressed archive of the dump directory contents to the sink
+ *
+ * Works like dd_create_archive() but instead of creating a file, passes the
+ * compressed data to sink (e.g. to upload the archive while it is being
+ * created).
+ *
+ * @return 0 on success; otherwise -errno or the first error returned by sink
+ */
+int dd_write_archive(struct dump_dir *dd, enum archive_compression compression,
+        const_string_vector_const_ptr_t exclude_elements, archive_sink_fn sink, void *sink_param);
+
 #ifdef __cplusplus
 }
 #endif
@@ -34,6 +34,14 @@ void libreport_free_global_configuration(void);
 
 string_vector_ptr_t libreport_get_global_always_excluded_elements(void);
 
+/**
+ * Returns the number of threads used to compress problem data archives
+ *
+ * @return 0 if the number is not configured, which means the number of online
+ * processors
+ */
+unsigned libreport_get_global_archive_compression_threads(void);
+
 bool libreport_get_global_create_private_ticket(void);
 
 /**
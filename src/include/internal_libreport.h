@@ -95,6 +95,8 @@ int vdprintf(int d, const char *format, va_list ap);
 /* Pull in entire public libreport API */
 #include "global_configuration.h"
 #include "dump_dir.h"
+#include "spool_index.h"
+#include "archive_writer.h"
 #include "event_config.h"
 #include "problem_data.h"
 #include "report.h"
@@ -143,6 +145,8 @@ char *libreport_xmalloc_fopen_fgetline_fclose(const char *filename);
 
 
 typedef enum {
+        /* Recreate holes of the source file (SEEK_HOLE) and turn zero blocks
+         * of non-seekable sources into holes */
         COPYFD_SPARSE = 1 << 0,
 } libreport_copyfd_flags;
 
@@ -182,6 +186,26 @@ int libreport_decompress_file(const char *path_in, const char *path_out, mode_t
 int libreport_decompress_file_ext_at(const char *path_in, int dir_fd, const char *path_out,
         mode_t mode_out, uid_t uid, gid_t gid, int src_flags, int dst_flags);
 
+/* Random access to compressed data
+ *
+ * Supported are single-stream xz files and zstd files whose frames record
+ * their content size. Only the blocks (frames) overlapping the requested
+ * range are decompressed, so the smaller blocks the compressor used, the
+ * cheaper the access is (e.g. xz -T0, xz --block-size or pzstd, which
+ * writes multiple frames).
+ *
+ * libreport_decompress_index_new() returns NULL if the format is not
+ * supported or the data has no usable index. The index does not take
+ * ownership of fd; fd must stay open until the index is freed.
+ */
+struct decompress_index;
+struct decompress_index *libreport_decompress_index_new(int fd);
+void libreport_decompress_index_free(struct decompress_index *index);
+/* Returns the size of decompressed data */
+uint64_t libreport_decompress_index_size(const struct decompress_index *index);
+/* Returns the number of bytes read, 0 at the end of data or -errno */
+ssize_t libreport_decompress_index_pread(struct decompress_index *index, void *buf, size_t count, uint64_t offset);
+
 // NB: will return short read on error, not -1,
 // if some data was read before error occurred
 void libreport_xread(int fd, void *buf, size_t count);
@@ -197,9 +221,56 @@ char *libreport_malloc_readlink(const char *linkname);
 char *libreport_malloc_readlinkat(int dir_fd, const char *linkname);
 
 
+/* The number of chars of base64 encoded length bytes, without terminator */
+#define LIBREPORT_BASE64_LENGTH(length) (4 * (((length) + 2) / 3))
+
 /* Returns malloc'ed block */
 char *libreport_encode_base64(const void *src, int length);
 
+/* Incremental base64 encoder of data passed in chunks of any size.
+ * The output equals libreport_encode_base64() of the concatenated chunks.
+ */
+struct base64_encoder
+{
+    unsigned char pending[3];
+    unsigned pending_len;
+};
+void libreport_base64_encoder_init(struct base64_encoder *enc);
+/* Encodes the chunk to dst, which must have room for
+ * LIBREPORT_BASE64_LENGTH(length) chars. Up to 2 bytes are kept for the next
+ * call. Returns the number of written chars, no terminator is written.
+ */
+size_t libreport_base64_encode_update(struct base64_encoder *enc, char *dst,
+                const void *src, size_t length);
+/* Writes the kept bytes with padding, up to 4 chars, and returns their number */
+size_t libreport_base64_encode_final(struct base64_encoder *enc, char *dst);
+
+/* The maximal number of bytes decoded from length base64 chars */
+#define LIBREPORT_BASE64_DECODED_LENGTH(length) (((length) + 3) / 4 * 3)
+
+/* Returns malloc'ed block with the decoded bytes and stores their number in
+ * size_p, or NULL if src is not valid padded base64. White space is ignored.
+ */
+char *libreport_decode_base64(const char *src, size_t length, size_t *size_p);
+
+/* Incremental base64 decoder of text passed in chunks of any size */
+struct base64_decoder
+{
+    unsigned char pending[4];
+    unsigned pending_len;
+    unsigned padding;
+};
+void libreport_base64_decoder_init(struct base64_decoder *dec);
+/* Decodes the chunk to dst, which must have room for
+ * LIBREPORT_BASE64_DECODED_LENGTH(length) bytes. Up to 3 chars are kept for
+ * the next call. Returns the number of written bytes, or -1 if the chunk
+ * is not valid base64.
+ */
+ssize_t libreport_base64_decode_update(struct base64_decoder *dec, void *dst,
+                const char *src, size_t length);
+/* Returns 0 if the decoded text ended with a complete group, -1 otherwise */
+int libreport_base64_decode_final(struct base64_decoder *dec);
+
 /* Returns NULL if the string needs no sanitizing.
  * control_chars_to_sanitize is a bit mask.
  * If Nth bit is set, Nth control char will be sanitized (replaced by [XX]).
@@ -212,6 +283,22 @@ enum {
     SANITIZE_CR  = (1 << 13),
 };
 
+/* Returns -1 if the buffer contains a control char other than white spaces.
+ * Otherwise returns the number of DEL chars and bytes which are not a part of
+ * a valid UTF-8 sequence. An incomplete sequence at the end of the buffer is
+ * not counted, because the buffer can be a prefix of a longer text.
+ */
+long libreport_utf8_count_bad_bytes(const char *buf, size_t len);
+
+/* SIMD instruction sets of the running CPU used by the text and codec
+ * kernels, the result is a bit mask of the following values
+ */
+enum {
+    LIBREPORT_SIMD_SSSE3 = (1 << 0),
+    LIBREPORT_SIMD_AVX2  = (1 << 1),
+};
+unsigned libreport_simd_features(void);
+
 int libreport_try_atou(const char *numstr, unsigned *value);
 unsigned libreport_xatou(const char *numstr);
 int libreport_try_atoi(const char *numstr, int *value);
@@ -258,6 +345,10 @@ enum {
  * env_vec: list of variables to set in environment (if string has
  * "VAR=VAL" form) or unset in environment (if string has no '=' char).
  *
+ * The child is started by posix_spawn, so the cost does not grow with
+ * the size of the calling process. fork is used if posix_spawn cannot do
+ * what is asked for (e.g. EXECFLG_SETGUID) or if it fails to execute argv.
+ *
  * Returns pid.
  */
 pid_t libreport_fork_execv_on_steroids(int flags,
@@ -292,12 +383,146 @@ void libreport_glib_init(void);
 void libreport_list_free_with_free(GList *list);
 
 double libreport_get_dirsize(const char *pPath);
+/* Keeps a spool usage tracker (see below) of the last pPath, so repeated
+ * calls measure only the changed entries. Without inotify, every call walks
+ * all entries.
+ */
 double libreport_get_dirsize_find_largest_dir(
                 const char *pPath,
                 char **worst_dir, /* can be NULL */
                 const char *excluded /* can be NULL */
 );
 
+/* Tracks sizes of entries of a spool directory and ranks its problem
+ * directories for deletion.
+ *
+ * The spool directory is scanned once, then only the changed entries are
+ * measured again (via inotify). The first scan takes the sizes of problem
+ * directories from the spool index, see spool_index.h. The tracker is meant to
+ * be kept by daemons checking their quota repeatedly. A tracker must not be
+ * used by more threads at once.
+ */
+struct spool_usage;
+
+/* @return NULL if spool_dir cannot be opened */
+struct spool_usage *libreport_spool_usage_new(const char *spool_dir);
+void libreport_spool_usage_free(struct spool_usage *su);
+
+/* Returns the inotify file descriptor (or -1), the descriptor becomes
+ * readable when something in the spool directory changes. Daemons can add it
+ * to their main loops and query the tracker only when needed.
+ */
+int libreport_spool_usage_get_fd(struct spool_usage *su);
+
+/* Returns total size of the spool directory in bytes */
+double libreport_spool_usage_total(struct spool_usage *su);
+
+/* Returns up to count names of problem directories that should be deleted
+ * first (the largest size * age first); the list must be freed with
+ * libreport_list_free_with_free()
+ *
+ * @param excluded Name of a directory which must not be returned or NULL
+ */
+GList *libreport_spool_usage_victims(struct spool_usage *su, unsigned count, const char *excluded);
+
+/* Persistent cache of parsed configuration
+ *
+ * Parsed data are stored as GVariant values under string keys together with
+ * the stat data of the files they were parsed from. A cached value is
+ * returned only if none of its source files has changed since.
+ *
+ * The cache lives in LOCALSTATEDIR/cache/libreport for root and in
+ * $XDG_CACHE_HOME/libreport for other users; $LIBREPORT_CONFIG_CACHE_DIR
+ * overrides the directory. Failures to read or write the cache are not
+ * errors, the callers just parse the files again.
+ */
+struct config_cache;
+struct config_cache_sources;
+
+/* @return NULL if the cache is disabled by $LIBREPORT_NO_CONFIG_CACHE; all
+ * config_cache functions accept NULL cache.
+ */
+struct config_cache *libreport_config_cache_open(const char *name);
+/* Writes stored values and frees the cache */
+void libreport_config_cache_close(struct config_cache *cache);
+
+/* @param sources If not NULL, receives the files the value was parsed from
+ * (free with libreport_config_cache_sources_free())
+ * @return A new reference to the value or NULL
+ */
+GVariant *libreport_config_cache_lookup(struct config_cache *cache, const char *key,
+        struct config_cache_sources **sources);
+/* Takes the floating reference of value; sources are copied */
+void libreport_config_cache_store(struct config_cache *cache, const char *key,
+        struct config_cache_sources *sources, GVariant *value);
+
+/* Files the cached data depend on
+ *
+ * Add the files before they are read, so changes made during parsing are
+ * detected next time.
+ */
+struct config_cache_sources *libreport_config_cache_sources_new(void);
+void libreport_config_cache_sources_free(struct config_cache_sources *sources);
+/* Directories can be added too, their mtime changes with their entries */
+void libreport_config_cache_sources_add(struct config_cache_sources *sources, const char *path);
+bool libreport_config_cache_sources_changed(const struct config_cache_sources *sources);
+
+/* Loads the event description of a newly created event_config from the
+ * cache or from the file; the parsed description is stored in the cache
+ */
+void libreport_load_event_description_cached(struct config_cache *cache,
+        event_config_t *event_config, const char *filename);
+/* Like load_workflow_description_from_file() but the workflow description is
+ * taken from workflow_cache and the descriptions of its events from
+ * event_cache
+ */
+void libreport_load_workflow_description_cached(struct config_cache *workflow_cache,
+        struct config_cache *event_cache, workflow_t *workflow, const char *filename);
+
+/* Cache files holding a serialized GVariant (s<entries_type>), the string
+ * identifies the format of the entries
+ *
+ * libreport_cache_dir() returns the directory named by $dir_env, or the
+ * default cache directory described above.
+ *
+ * libreport_cache_file_read() ignores files of other users, symbolic links
+ * and files of another format; it returns a new reference to the entries or
+ * NULL. libreport_cache_file_write() replaces the file atomically and takes
+ * the floating reference of entries; it returns 0 or -EIO.
+ */
+char *libreport_cache_dir(const char *dir_env);
+GVariant *libreport_cache_file_read(const char *path, const char *format, const char *entries_type);
+int libreport_cache_file_write(const char *path, const char *format, GVariant *entries);
+
+/* Cache of duplicate searches shared by the reporters
+ *
+ * Maps tracker URL, product, version, component and duphash to the bug the
+ * problem was reported to and the bug status. The component is the one the
+ * duplicate search matched, or NULL if the search ignored components. Entries expire after
+ * DUPHASH_CACHE_TTL_DEFAULT seconds; $LIBREPORT_DUPHASH_CACHE_TTL overrides
+ * it and $LIBREPORT_NO_DUPHASH_CACHE disables the cache.
+ *
+ * The cache file lives in the same directory as the configuration cache;
+ * $LIBREPORT_DUPHASH_CACHE_DIR overrides the directory. Failures to read or
+ * write the cache are not errors, the reporters just search the tracker.
+ */
+#define DUPHASH_CACHE_TTL_DEFAULT (24 * 60 * 60)
+
+/* @param status If not NULL, receives the malloced bug status
+ * @return true if an unexpired entry was found
+ */
+bool libreport_duphash_cache_lookup(const char *tracker_url, const char *product,
+        const char *version, const char *component, const char *duphash,
+        int *bug_id, char **status);
+void libreport_duphash_cache_store(const char *tracker_url, const char *product,
+        const char *version, const char *component, const char *duphash,
+        int bug_id, const char *status);
+/* Call when the bug has changed in a way the entry does not reflect or the
+ * cached bug turned out to be wrong
+ */
+void libreport_duphash_cache_invalidate(const char *tracker_url, const char *product,
+        const char *version, const char *component, const char *duphash);
+
 int libreport_ndelay_on(int fd);
 int libreport_ndelay_off(int fd);
 int libreport_close_on_exec_on(int fd);
@@ -802,6 +1027,14 @@ int delete_dump_dir_possibly_using_abrtd(const char *dump_dir_name);
  * Returns NULL if copying failed. In this case, logs a message before returning. */
 struct dump_dir *libreport_steal_directory(const char *base_dir, const char *dump_dir_name);
 
+/* The compressed items of a dump directory (see dd_set_item_compression())
+ *
+ * The table is owned by dd; take a reference to use it after dd_close().
+ */
+GHashTable *libreport_dd_get_compressed_items(struct dump_dir *dd);
+/* Like dd_decompress_item_fd() for a list of compressed items */
+int libreport_decompress_item_fd(GHashTable *compressed_items, const char *name, int fd, bool *compressed);
+
 /* Resolves if the given user is in given group
  *
  * @param uid user ID
@@ -20,11 +20,16 @@
 #define LIBREPORT_CURL_H_
 
 #include <curl/curl.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* The handle shares DNS cache, TLS sessions and connections with the other
+ * handles created by this function in the same thread, hence the connections
+ * to the same server are reused by the following requests. The handle must
+ * not be used by other threads. */
 CURL* xcurl_easy_init();
 
 /* Set proxy according to the url and call curl_easy_perform */
@@ -75,7 +80,22 @@ enum {
     POST_DATA_FROMFILE_AS_FORM_DATA = -4,
     POST_DATA_STRING_AS_FORM_DATA = -5,
     POST_DATA_GET = -6,
+    /* data points to post_reader_t */
+    POST_DATA_FROMREADER = -7,
 };
+
+/* Produces the POSTed data while they are being sent */
+typedef struct post_reader {
+    /* Called like CURLOPT_READFUNCTION with param as its last argument,
+     * returns 0 at the end of data or CURL_READFUNC_ABORT on error */
+    curl_read_callback read;
+    void *param;
+    /* The exact number of bytes produced by read */
+    off_t size;
+} post_reader_t;
+
+/* The request has "User-Agent: ABRT/<version>" unless additional_headers
+ * contain another User-Agent */
 int
 post(post_state_t *state,
                 const char *url,
@@ -113,6 +133,16 @@ post_string_as_form_data(post_state_t *state,
                      str, POST_DATA_STRING_AS_FORM_DATA);
 }
 static inline int
+post_from_reader(post_state_t *state,
+                const char *url,
+                const char *content_type,
+                const char **additional_headers,
+                const post_reader_t *reader)
+{
+    return post(state, url, content_type, additional_headers,
+                     (const char *)reader, POST_DATA_FROMREADER);
+}
+static inline int
 post_file(post_state_t *state,
                 const char *url,
                 const char *content_type,
@@ -154,6 +184,44 @@ char *libreport_upload_file_ext(post_state_t *post_state,
                 const char *filename,
                 int flags);
 
+/* Passes data to the upload stream
+ *
+ * @return 0 on success; otherwise -errno (-EPIPE if the upload was aborted)
+ */
+typedef int (*upload_stream_write_fn)(const void *buf, size_t size, void *stream);
+
+/* Generates the uploaded data by calling write(buf, size, stream)
+ *
+ * The producer runs in its own thread while the data are being sent. It is
+ * called again if the upload is re-tried with updated credentials.
+ *
+ * @return 0 on success; otherwise -errno
+ */
+typedef int (*upload_stream_producer_fn)(upload_stream_write_fn write, void *stream, void *param);
+
+/* Returns true if the data for url can be streamed without knowing their
+ * size in advance (i.e. the protocol is not SCP)
+ */
+bool libreport_upload_stream_is_supported(const char *url);
+
+/* Uploads data generated by producer to url
+ *
+ * Works like libreport_upload_file_ext() where name is used instead of the
+ * file name, but the data are passed to curl through a bounded buffer while
+ * they are being generated. HTTP uses chunked transfer encoding; if the
+ * server refuses it, the function fails and post_state->http_resp_code is
+ * 411.
+ *
+ * @return Resulting URL on success (the URL does not contain userinfo);
+ * otherwise NULL.
+ */
+char *libreport_upload_stream_ext(post_state_t *post_state,
+                const char *url,
+                const char *name,
+                upload_stream_producer_fn producer,
+                void *producer_param,
+                int flags);
+
 #ifdef __cplusplus
 }
 #endif
@@ -57,6 +57,8 @@ struct problem_item {
     int      allowed_by_reporter;  /* 0 "no", 1 "yes" */
     int      default_by_reporter;  /* 0 "no", 1 "yes" */
     int      required_by_reporter; /* 0 "no", 1 "yes" */
+    /* Private: non-NULL until the content of a lazily loaded item is read */
+    struct problem_item_source *source;
 };
 typedef struct problem_item problem_item;
 
@@ -99,10 +101,8 @@ void problem_data_add_text_editable(problem_data_t *problem_data,
 /* "name" can be NULL: */
 void problem_data_add_file(problem_data_t *pd, const char *name, const char *path);
 
-static inline struct problem_item *problem_data_get_item_or_NULL(problem_data_t *problem_data, const char *key)
-{
-    return (struct problem_item *)g_hash_table_lookup(problem_data, key);
-}
+/* Reads the item's content if it was loaded lazily: */
+struct problem_item *problem_data_get_item_or_NULL(problem_data_t *problem_data, const char *key);
 char *problem_data_get_content_or_NULL(problem_data_t *problem_data, const char *key);
 /* Aborts if key is not found: */
 char *problem_data_get_content_or_die(problem_data_t *problem_data, const char *key);
@@ -148,7 +148,26 @@ int problem_data_load_dump_dir_element(struct dump_dir *dd, const char *name, ch
 
 void problem_data_load_from_dump_dir(problem_data_t *problem_data, struct dump_dir *dd, char **excluding);
 
+/* Same as problem_data_load_from_dump_dir() but only names of the elements
+ * are loaded. An element is opened, classified and read on the first call of
+ * problem_data_get_item_or_NULL() or problem_data_get_content_or_NULL(),
+ * which all libreport formatters use. Until then, the item has no content and
+ * no flags, so code iterating over the hash table directly must look the items
+ * up through problem_data_get_item_or_NULL().
+ *
+ * The problem data keeps its own file descriptor of the dump directory,
+ * hence dd can be closed right after the call. The contents are read without
+ * holding the dump directory lock. An element which cannot be read becomes
+ * an empty text item.
+ *
+ * @param dd Dump directory
+ * @param problem_data Problem data object to fill
+ * @param excluding NULL or a list of element names to skip
+ */
+void problem_data_load_from_dump_dir_lazy(problem_data_t *problem_data, struct dump_dir *dd, char **excluding);
+
 problem_data_t *create_problem_data_from_dump_dir(struct dump_dir *dd);
+problem_data_t *create_problem_data_from_dump_dir_lazy(struct dump_dir *dd);
 /* Helper for typical operation in reporters: */
 problem_data_t *create_problem_data_for_reporting(const char *dump_dir_name);
 
@@ -38,6 +38,8 @@ struct run_event_state {
      * Otherwise should return log_line (it will be freed by caller)
      *
      * The default value prints log_line with trailing newline to stdout.
+     *
+     * Not used if logging_line_callback is set.
      */
     char* (*logging_callback)(char *log_line, void *param);
     void *logging_param;
@@ -139,12 +141,26 @@ struct run_event_state {
     GPtrArray *extra_environment;
 
     /* Internal data for async command execution */
-    GList *rule_list;
+    GList *rule_list; /* unused, rules are kept in rule_set */
     pid_t command_pid;
     int command_out_fd;
     int command_in_fd;
     int process_status;
     struct strbuf *command_output;
+    struct rule_set *rule_set;
+    bool *rules_done;
+
+    /* The maximum number of commands run_event_on_dir_name() runs at once;
+     * 0 means the number of online processors. Only rules annotated by
+     * HANDLER= condition run concurrently, see report_event.conf(5).
+     */
+    unsigned max_concurrent_commands;
+
+    /* If set, it is called instead of logging_callback, with logging_param.
+     * log_line is NUL terminated, len is its length. log_line is valid only
+     * during the call, which avoids copying of every line.
+     */
+    void (*logging_line_callback)(const char *log_line, size_t len, void *param);
 };
 struct run_event_state *new_run_event_state(void);
 void free_run_event_state(struct run_event_state *state);
@@ -167,6 +183,9 @@ struct rule {
  * returns 1. */
 int prepare_commands(struct run_event_state *state);
 /*
+ * Runs the rules one by one in the configuration order; HANDLER= and AFTER=
+ * annotations are ignored.
+ *
  * Returns -1 if no more commands needs to be executed,
  * else sets state->command_pid and state->command_out_fd and returns >=0.
  * execflags can be e.g. EXECFLG_SETPGID to put the event handling process
@@ -190,6 +209,42 @@ GList *load_rule_list(GList *rule_list, const char *conf_file_name, unsigned rec
 /* Cleans up rule list created by load_rule_list */
 void free_rule_list(GList *rule_list);
 
+/* Compiled rules
+ *
+ * Rules are indexed by their EVENT value, regular expressions are compiled
+ * only once and every element used in conditions is loaded at most once per
+ * evaluation. prepare_commands() and list_possible_events() share one rule
+ * set per process; it is re-loaded only if the configuration changes.
+ */
+struct rule_set;
+
+/* Loads and compiles rules from config file and the files it includes.
+ * Never returns NULL; the set is empty if there are no rules.
+ */
+struct rule_set *rule_set_load(const char *conf_file_name);
+
+/* Releases the rule set */
+void rule_set_free(struct rule_set *set);
+
+/* Returns the number of rules */
+unsigned rule_set_count(const struct rule_set *set);
+
+/* Returns false if any of the files the rules were loaded from has changed */
+bool rule_set_is_up_to_date(const struct rule_set *set);
+
+/* Like list_possible_events() but uses the passed rule set
+ *
+ * @param dd Dump directory to match, or NULL
+ * @param pd Problem data to match, or NULL
+ * @param dump_dir_name Opened if both dd and pd are NULL; if it is NULL too,
+ *                      all conditions except EVENT are assumed to match
+ */
+char *rule_set_list_possible_events(struct rule_set *set,
+        struct dump_dir *dd,
+        problem_data_t *pd,
+        const char *dump_dir_name,
+        const char *pfx);
+
 /* Synchronous command execution */
 
 /* The function believes that a state param value is fully initialized and
@@ -206,10 +261,36 @@ int consume_event_command_output(struct run_event_state *state, const char *dump
 
 /* Returns exit code of first failed action, or first nonzero return value
  * of post_run_callback. If all actions are successful, returns 0.
+ *
+ * Independent rules annotated by HANDLER= run concurrently (see
+ * max_concurrent_commands). After a failure no more commands are started,
+ * but the running ones are waited for.
  */
 int run_event_on_dir_name(struct run_event_state *state, const char *dump_dir_name, const char *event);
 int run_event_on_problem_data(struct run_event_state *state, problem_data_t *data, const char *event);
 
+/* Runs the event on many directories, at most max_workers of them at once
+ * (0 means the number of online processors).
+ *
+ * Commands of one directory run one after another like with
+ * run_event_on_dir_name() but without HANDLER= concurrency. Every directory
+ * has its own state, so the logging, ask and alert callbacks and
+ * post_run_callback get the params of the directory. All callbacks are
+ * called from the calling thread.
+ *
+ * @param states A state for every directory
+ * @param dump_dir_names The directories
+ * @param retvals If not NULL, receives the run_event_on_dir_name() return
+ *                value of every directory
+ * @return The number of directories for which the event failed
+ */
+unsigned run_event_on_dir_names(struct run_event_state *const *states,
+                const char *const *dump_dir_names,
+                unsigned count,
+                const char *event,
+                unsigned max_workers,
+                int *retvals);
+
 
 /* Querying for possible events */
 
@@ -0,0 +1,179 @@
+/*
+    Index of problem directories in a spool directory
+
+    Copyright (C) 2024  ABRT team
+    Copyright (C) 2024  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    ----
+
+    The index is a file in the spool directory (e.g. /var/spool/abrt) holding
+    one fixed-size record per entry of the spool directory. The file can be
+    read and listed without touching the problem directories at all.
+
+    The index is opt-in: it is kept up to date by dd_close() and dd_delete()
+    only if it already exists. Use spool_index_rebuild() to create it.
+
+    File layout:
+
+      struct spool_index_header
+      struct spool_index_record[header.records]
+
+    All numbers are stored in the native byte order, the index is never
+    shared between machines. The records form an open addressing hash table:
+    the record of a problem directory is the first one with its name starting
+    at index name_hash % header.records, wrapping around at the end. Records
+    with zero flags are unused and at least one record is always unused.
+
+    Besides problem directories, the index has a record of every other
+    directory and regular file in the spool directory except the index itself
+    (e.g. a stray directory or a problem directory which is being created), so
+    that the index can be compared with the entries of the spool directory.
+
+    The sizes are recorded when a problem directory is modified through
+    libreport. Files written directly into a problem directory, e.g. by
+    event scripts, are accounted on the next modification or rebuild.
+
+    Writers hold an exclusive flock() on the spool directory. Readers hold a
+    shared one while they copy the file. The index is stale when the entries
+    of the spool directory do not match its records. Then spool_index_open()
+    fails and the readers scan the spool directory instead.
+*/
+#ifndef LIBREPORT_SPOOL_INDEX_H_
+#define LIBREPORT_SPOOL_INDEX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct dump_dir;
+
+#define SPOOL_INDEX_FILE_NAME ".problems.idx"
+#define SPOOL_INDEX_MAGIC "LRSPIDX"
+#define SPOOL_INDEX_VERSION 3
+
+enum {
+    /* Some problem directories could not be indexed (e.g. too long name) */
+    SPOOL_INDEX_INCOMPLETE = (1 << 0),
+};
+
+struct spool_index_header {
+    char magic[8];
+    uint32_t version;
+    /* sizeof(struct spool_index_record) */
+    uint32_t record_size;
+    /* Number of all records */
+    uint64_t records;
+    /* Number of used records */
+    uint64_t used;
+    uint32_t flags;
+    uint32_t reserved;
+    /* The mtime of the spool directory when its entries were known to
+     * match the records, or 0 */
+    int64_t spool_mtime_sec;
+    int64_t spool_mtime_nsec;
+};
+
+enum {
+    /* The record describes an existing entry of the spool directory */
+    SPOOL_INDEX_RECORD_USED = (1 << 0),
+    /* The entry is not a problem directory, only its name and size are
+     * valid */
+    SPOOL_INDEX_RECORD_NOT_PROBLEM = (1 << 1),
+};
+
+/* On-disk record, all strings are NUL terminated */
+struct spool_index_record {
+    uint32_t name_hash;
+    uint32_t flags;
+    int64_t time;
+    /* Equals to time if the problem has no last_occurrence */
+    int64_t last_occurrence;
+    /* Sum of sizes of all regular files, including the subdirectories */
+    uint64_t size;
+    uint32_t count;
+    uint32_t owner;
+    /* Base name of the problem directory */
+    char dirname[128];
+    char type[32];
+    char uuid[66];
+    char duphash[66];
+    char reserved[4];
+};
+
+/* FNV-1a hash of the base name of a problem directory */
+uint32_t spool_index_name_hash(const char *name);
+
+struct spool_index;
+
+/* Reads the index of the spool directory
+ *
+ * The index is copied to memory, so it does not block updates.
+ *
+ * @return NULL if the index does not exist, is damaged, incomplete or does
+ * not match the entries of the spool directory. The caller should scan the
+ * spool directory instead.
+ */
+struct spool_index *spool_index_open(const char *spool_dir);
+
+void spool_index_close(struct spool_index *index);
+
+/* Iterates over the records of all entries
+ *
+ * Initialize *pos to 0 before the first call. The returned record is valid
+ * until spool_index_close(). Check SPOOL_INDEX_RECORD_NOT_PROBLEM to skip
+ * the entries which are not problem directories.
+ *
+ * @return NULL at the end
+ */
+const struct spool_index_record *spool_index_next(const struct spool_index *index, size_t *pos);
+
+/* @return The record of the entry called name or NULL */
+const struct spool_index_record *spool_index_find(const struct spool_index *index, const char *name);
+
+/* Scans all problem directories in the spool directory and atomically
+ * replaces the index
+ *
+ * @return Number of indexed problem directories; otherwise -errno.
+ */
+int spool_index_rebuild(const char *spool_dir);
+
+/* Creates or updates the record of the dump directory in the index of its
+ * parent directory. The dump directory must be locked.
+ *
+ * Does nothing if the parent directory has no index.
+ *
+ * @return 0 on success or if there is no index; otherwise -errno
+ */
+int spool_index_update_dump_dir(struct dump_dir *dd);
+
+/* Removes the record of the problem directory from the index of its parent
+ * directory.
+ *
+ * Does nothing if the parent directory has no index.
+ *
+ * @return 0 on success or if there is no index; otherwise -errno
+ */
+int spool_index_remove_dump_dir(const char *dump_dir_name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
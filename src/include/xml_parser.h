@@ -27,6 +27,10 @@ struct my_parse_data
     bool in_event_list;
     bool exact_name;
     bool exact_description;
+    /* Cache of event descriptions, may be NULL */
+    struct config_cache *event_cache;
+    /* Expanded names of the workflow's events */
+    GList *event_names;
 };
 
 /**
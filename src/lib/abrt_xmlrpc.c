@@ -19,6 +19,21 @@
 #include "internal_libreport.h"
 #include "abrt_xmlrpc.h"
 #include "proxies.h"
+#include "libreport_curl.h"
+
+/* The number of bytes of the streamed data read and encoded at once,
+ * a multiple of 3 to encode every chunk without leftovers */
+#define ABRT_XMLRPC_STREAM_CHUNK (48 * 1024)
+
+/* The prefix of the serialized string standing for the streamed data, every
+ * call appends random digits so that other parameters cannot contain it */
+#define ABRT_XMLRPC_STREAM_MARKER_PREFIX "abrt-xmlrpc-stream-data-"
+
+#ifdef VERSION
+# define ABRT_XMLRPC_USER_AGENT PACKAGE_NAME"/"VERSION
+#else
+# define ABRT_XMLRPC_USER_AGENT "abrt"
+#endif
 
 struct abrt_xmlrpc_param_pair
 {
@@ -64,11 +79,7 @@ struct abrt_xmlrpc *abrt_xmlrpc_new_client(const char *url, int ssl_verify)
     /* curlParms.network_interface = NULL; - done by memset */
     curl_parms.no_ssl_verifypeer = !ssl_verify;
     curl_parms.no_ssl_verifyhost = !ssl_verify;
-#ifdef VERSION
-    curl_parms.user_agent        = PACKAGE_NAME"/"VERSION;
-#else
-    curl_parms.user_agent        = "abrt";
-#endif
+    curl_parms.user_agent        = ABRT_XMLRPC_USER_AGENT;
 
     proxies = get_proxy_list(url);
     /* Use the first proxy from the list */
@@ -91,6 +102,9 @@ struct abrt_xmlrpc *abrt_xmlrpc_new_client(const char *url, int ssl_verify)
     if (env.fault_occurred)
         abrt_xmlrpc_die(&env);
 
+    ax->ax_url = libreport_xstrdup(url);
+    ax->ax_ssl_verify = ssl_verify;
+
     ax->ax_server_info = xmlrpc_server_info_new(&env, url);
     if (env.fault_occurred)
     {
@@ -122,6 +136,7 @@ void abrt_xmlrpc_free_client(struct abrt_xmlrpc *ax)
 
     g_list_free(ax->ax_session_params);
 
+    free(ax->ax_url);
     free(ax);
 }
 
@@ -138,8 +153,9 @@ void abrt_xmlrpc_client_add_session_param_string(xmlrpc_env *env, struct abrt_xm
     ax->ax_session_params = g_list_append(ax->ax_session_params, new_ses_param);
 }
 
-/* internal helper function */
-static xmlrpc_value *abrt_xmlrpc_call_params_internal(xmlrpc_env *env, struct abrt_xmlrpc *ax, const char *method, xmlrpc_value *params)
+/* Returns the parameter array of a call: params extended by the session
+ * parameters */
+static xmlrpc_value *abrt_xmlrpc_call_array_new(xmlrpc_env *env, struct abrt_xmlrpc *ax, xmlrpc_value *params)
 {
     xmlrpc_value *array = xmlrpc_array_new(env);
     if (env->fault_occurred)
@@ -172,13 +188,21 @@ static xmlrpc_value *abrt_xmlrpc_call_params_internal(xmlrpc_env *env, struct ab
     if (env->fault_occurred)
         abrt_xmlrpc_die(env);
 
+    if (destroy_params)
+        xmlrpc_DECREF(params);
+
+    return array;
+}
+
+/* internal helper function */
+static xmlrpc_value *abrt_xmlrpc_call_params_internal(xmlrpc_env *env, struct abrt_xmlrpc *ax, const char *method, xmlrpc_value *params)
+{
+    xmlrpc_value *array = abrt_xmlrpc_call_array_new(env, ax, params);
+
     xmlrpc_value *result = NULL;
     xmlrpc_client_call2(env, ax->ax_client, ax->ax_server_info, method,
                         array, &result);
 
-    if (destroy_params)
-        xmlrpc_DECREF(params);
-
     xmlrpc_DECREF(array);
     return result;
 }
@@ -236,6 +260,19 @@ void abrt_xmlrpc_array_append_string(xmlrpc_env *env, xmlrpc_value *array, const
     xmlrpc_DECREF(val);
 }
 
+void abrt_xmlrpc_array_append_int(xmlrpc_env *env, xmlrpc_value *array, int value)
+{
+    xmlrpc_value *val = xmlrpc_int_new(env, value);
+    if (env->fault_occurred)
+        abrt_xmlrpc_die(env);
+
+    xmlrpc_array_append_item(env, array, val);
+    if (env->fault_occurred)
+        abrt_xmlrpc_die(env);
+
+    xmlrpc_DECREF(val);
+}
+
 xmlrpc_value *abrt_xmlrpc_params_new(xmlrpc_env *env)
 {
     xmlrpc_value *params = xmlrpc_struct_new(env);
@@ -285,6 +322,410 @@ xmlrpc_value *abrt_xmlrpc_call_full(xmlrpc_env *env, struct abrt_xmlrpc *ax,
     return result;
 }
 
+struct abrt_xmlrpc_stream
+{
+    /* The serialized call before and after the data */
+    char *head;
+    char *tail;
+    int fd;
+    /* The number of bytes to be read from fd */
+    off_t remaining;
+    struct base64_encoder encoder;
+    char *chunk;
+    char *encoded;
+    /* The data not passed to curl yet */
+    const char *out;
+    size_t out_len;
+    enum {
+        STREAM_HEAD,
+        STREAM_DATA,
+        STREAM_TAIL,
+        STREAM_END,
+    } stage;
+};
+
+/* Makes the next part of the request available in stream->out */
+static bool abrt_xmlrpc_stream_next(struct abrt_xmlrpc_stream *stream)
+{
+    switch (stream->stage)
+    {
+    case STREAM_HEAD:
+        stream->out = stream->head;
+        stream->out_len = strlen(stream->head);
+        stream->stage = STREAM_DATA;
+        break;
+
+    case STREAM_DATA:
+        stream->out = stream->encoded;
+        if (stream->remaining == 0)
+        {
+            stream->out_len = libreport_base64_encode_final(&stream->encoder, stream->encoded);
+            stream->stage = STREAM_TAIL;
+            break;
+        }
+
+        const size_t size = MIN(stream->remaining, ABRT_XMLRPC_STREAM_CHUNK);
+        const ssize_t r = libreport_full_read(stream->fd, stream->chunk, size);
+        if (r < 0)
+        {
+            perror_msg("Can't read the attached data");
+            return false;
+        }
+        if ((size_t)r != size)
+        {
+            error_msg("The attached data were truncated while being sent");
+            return false;
+        }
+
+        stream->remaining -= r;
+        stream->out_len = libreport_base64_encode_update(&stream->encoder,
+                                                         stream->encoded, stream->chunk, r);
+        break;
+
+    case STREAM_TAIL:
+        stream->out = stream->tail;
+        stream->out_len = strlen(stream->tail);
+        stream->stage = STREAM_END;
+        break;
+
+    case STREAM_END:
+        break;
+    }
+
+    return true;
+}
+
+static size_t abrt_xmlrpc_stream_read(char *buffer, size_t size, size_t nitems, void *param)
+{
+    struct abrt_xmlrpc_stream *stream = param;
+    const size_t room = size * nitems;
+    size_t written = 0;
+
+    while (written < room)
+    {
+        if (stream->out_len == 0)
+        {
+            if (stream->stage == STREAM_END)
+                break;
+            if (!abrt_xmlrpc_stream_next(stream))
+                return CURL_READFUNC_ABORT;
+            continue;
+        }
+
+        const size_t n = MIN(room - written, stream->out_len);
+        memcpy(buffer + written, stream->out, n);
+        written += n;
+        stream->out += n;
+        stream->out_len -= n;
+    }
+
+    return written;
+}
+
+xmlrpc_value *abrt_xmlrpc_call_params_with_fd(xmlrpc_env *env, struct abrt_xmlrpc *ax,
+                                              const char *method, xmlrpc_value *params,
+                                              const char *member, int fd, off_t size)
+{
+    /* The call is serialized with a marker string in place of the data and
+     * the marker is replaced by the encoded data while they are being sent
+     */
+    char *marker_value = libreport_xasprintf(ABRT_XMLRPC_STREAM_MARKER_PREFIX"%08x%08x",
+                                             g_random_int(), g_random_int());
+    xmlrpc_value *marker = xmlrpc_string_new(env, marker_value);
+    if (env->fault_occurred)
+        abrt_xmlrpc_die(env);
+
+    xmlrpc_struct_set_value(env, params, member, marker);
+    if (env->fault_occurred)
+        abrt_xmlrpc_die(env);
+
+    xmlrpc_DECREF(marker);
+
+    xmlrpc_value *array = abrt_xmlrpc_call_array_new(env, ax, params);
+
+    xmlrpc_mem_block *xml = xmlrpc_mem_block_new(env, 0);
+    if (env->fault_occurred)
+        abrt_xmlrpc_die(env);
+
+    xmlrpc_serialize_call(env, xml, method, array);
+    if (env->fault_occurred)
+        abrt_xmlrpc_die(env);
+
+    xmlrpc_DECREF(array);
+
+    char *marker_xml = libreport_xasprintf("<value><string>%s</string></value>", marker_value);
+    free(marker_value);
+    const size_t marker_len = strlen(marker_xml);
+
+    const char *call = XMLRPC_MEMBLOCK_CONTENTS(char, xml);
+    const size_t call_len = XMLRPC_MEMBLOCK_SIZE(char, xml);
+    const char *data = memmem(call, call_len, marker_xml, marker_len);
+    /* The marker must be there exactly once */
+    if (data == NULL
+     || memmem(data + marker_len, call + call_len - data - marker_len, marker_xml, marker_len) != NULL)
+    {
+        xmlrpc_env_set_fault(env, XMLRPC_INTERNAL_ERROR, "Can't find the attached data in the call");
+        xmlrpc_mem_block_free(xml);
+        free(marker_xml);
+        return NULL;
+    }
+    free(marker_xml);
+
+    const char *rest = data + marker_len;
+    struct abrt_xmlrpc_stream stream = {
+        .head = libreport_xasprintf("%.*s<value><base64>", (int)(data - call), call),
+        .tail = libreport_xasprintf("</base64></value>%.*s", (int)(call + call_len - rest), rest),
+        .fd = fd,
+        .remaining = size,
+        .chunk = libreport_xmalloc(ABRT_XMLRPC_STREAM_CHUNK),
+        .encoded = libreport_xmalloc(LIBREPORT_BASE64_LENGTH(ABRT_XMLRPC_STREAM_CHUNK)),
+        .stage = STREAM_HEAD,
+    };
+    libreport_base64_encoder_init(&stream.encoder);
+    xmlrpc_mem_block_free(xml);
+
+    post_reader_t reader = {
+        .read = abrt_xmlrpc_stream_read,
+        .param = &stream,
+        .size = strlen(stream.head) + LIBREPORT_BASE64_LENGTH(size) + strlen(stream.tail),
+    };
+
+    int flags = POST_WANT_BODY | POST_WANT_ERROR_MSG;
+    if (ax->ax_ssl_verify)
+        flags |= POST_WANT_SSL_VERIFY;
+    post_state_t *state = new_post_state(flags);
+    /* The same User-Agent as of the calls sent by xmlrpc-c */
+    static const char *const headers[] = {
+        "User-Agent: "ABRT_XMLRPC_USER_AGENT,
+        NULL,
+    };
+    post_from_reader(state, ax->ax_url, "text/xml", (const char **)headers, &reader);
+
+    xmlrpc_value *result = NULL;
+    if (state->curl_result != 0)
+        xmlrpc_env_set_fault_formatted(env, XMLRPC_NETWORK_ERROR, "%s",
+                state->curl_error_msg ? state->curl_error_msg : "Can't send the request");
+    else if (state->http_resp_code != 200)
+        xmlrpc_env_set_fault_formatted(env, XMLRPC_NETWORK_ERROR,
+                "HTTP response code is %d, not 200", state->http_resp_code);
+    else
+    {
+        int fault_code;
+        const char *fault_string = NULL;
+        xmlrpc_parse_response2(env, state->body, state->body_size,
+                               &result, &fault_code, &fault_string);
+        if (!env->fault_occurred && fault_string != NULL)
+        {
+            xmlrpc_env_set_fault(env, fault_code, fault_string);
+            xmlrpc_strfree(fault_string);
+            result = NULL;
+        }
+    }
+
+    free_post_state(state);
+    free(stream.encoded);
+    free(stream.chunk);
+    free(stream.tail);
+    free(stream.head);
+
+    return result;
+}
+
+void abrt_xmlrpc_start_call_params(xmlrpc_env *env, struct abrt_xmlrpc *ax,
+                                   const char *method, xmlrpc_value *params,
+                                   xmlrpc_response_handler handler, void *user_data)
+{
+    xmlrpc_value *array = abrt_xmlrpc_call_array_new(env, ax, params);
+
+    xmlrpc_client_start_rpc(env, ax->ax_client, ax->ax_server_info, method,
+                            array, handler, user_data);
+
+    xmlrpc_DECREF(array);
+}
+
+void abrt_xmlrpc_finish_calls(struct abrt_xmlrpc *ax)
+{
+    xmlrpc_client_event_loop_finish(ax->ax_client);
+}
+
+/* "Requested method not found" of the specification for fault code
+ * interoperability, Bugzilla uses it for unknown methods */
+#define ABRT_XMLRPC_METHOD_NOT_FOUND (-32601)
+
+enum {
+    ABRT_XMLRPC_MULTICALL_DONE,
+    /* The server doesn't know system.multicall */
+    ABRT_XMLRPC_MULTICALL_UNSUPPORTED,
+    /* The request failed, e.g. the server is not reachable */
+    ABRT_XMLRPC_MULTICALL_FAILED,
+};
+
+/* Sends the calls in one system.multicall request, returns
+ * ABRT_XMLRPC_MULTICALL_DONE or one of the failures with env set.
+ *
+ * The only parameter of system.multicall is an array of structures with
+ * members methodName and params, the result is an array with an item for
+ * every call.
+ */
+static int abrt_xmlrpc_multicall(xmlrpc_env *env, struct abrt_xmlrpc *ax,
+                                 struct abrt_xmlrpc_batch_call *calls, unsigned count)
+{
+    xmlrpc_value *multicalls = abrt_xmlrpc_array_new(env);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        xmlrpc_value *call = abrt_xmlrpc_params_new(env);
+        abrt_xmlrpc_params_add_string(env, call, "methodName", calls[i].bc_method);
+
+        xmlrpc_value *array = abrt_xmlrpc_call_array_new(env, ax, calls[i].bc_params);
+        abrt_xmlrpc_params_add_array(env, call, "params", array);
+        xmlrpc_DECREF(array);
+
+        xmlrpc_array_append_item(env, multicalls, call);
+        if (env->fault_occurred)
+            abrt_xmlrpc_die(env);
+
+        xmlrpc_DECREF(call);
+    }
+
+    xmlrpc_value *array = abrt_xmlrpc_array_new(env);
+    xmlrpc_array_append_item(env, array, multicalls);
+    if (env->fault_occurred)
+        abrt_xmlrpc_die(env);
+
+    xmlrpc_DECREF(multicalls);
+
+    xmlrpc_value *result = NULL;
+    xmlrpc_client_call2(env, ax->ax_client, ax->ax_server_info, "system.multicall",
+                        array, &result);
+    xmlrpc_DECREF(array);
+
+    if (env->fault_occurred)
+    {
+        if (env->fault_code == XMLRPC_NO_SUCH_METHOD_ERROR
+         || env->fault_code == ABRT_XMLRPC_METHOD_NOT_FOUND)
+            return ABRT_XMLRPC_MULTICALL_UNSUPPORTED;
+
+        return ABRT_XMLRPC_MULTICALL_FAILED;
+    }
+
+    if (xmlrpc_value_type(result) != XMLRPC_TYPE_ARRAY
+     || (unsigned)xmlrpc_array_size(env, result) != count)
+    {
+        xmlrpc_env_set_fault(env, XMLRPC_PARSE_ERROR, "Unexpected system.multicall response");
+        xmlrpc_DECREF(result);
+        return ABRT_XMLRPC_MULTICALL_UNSUPPORTED;
+    }
+
+    /* Every item is either a fault structure or an array holding the result */
+    for (unsigned i = 0; i < count; ++i)
+    {
+        xmlrpc_value *item = NULL;
+        xmlrpc_array_read_item(env, result, i, &item);
+        if (env->fault_occurred)
+            abrt_xmlrpc_die(env);
+
+        if (xmlrpc_value_type(item) == XMLRPC_TYPE_ARRAY && xmlrpc_array_size(env, item) == 1)
+            xmlrpc_array_read_item(env, item, 0, &calls[i].bc_result);
+        else if (xmlrpc_value_type(item) == XMLRPC_TYPE_STRUCT)
+        {
+            int fault_code = 0;
+            const char *fault_string = NULL;
+            xmlrpc_decompose_value(env, item, "{s:i,s:s,*}",
+                                   "faultCode", &fault_code,
+                                   "faultString", &fault_string);
+            if (!env->fault_occurred)
+            {
+                xmlrpc_env_set_fault(&calls[i].bc_fault, fault_code, fault_string);
+                xmlrpc_strfree(fault_string);
+            }
+        }
+        else
+            xmlrpc_env_set_fault(env, XMLRPC_PARSE_ERROR, "Unexpected system.multicall response item");
+
+        xmlrpc_DECREF(item);
+
+        /* A malformed item fails only its call */
+        if (env->fault_occurred)
+        {
+            xmlrpc_env_set_fault(&calls[i].bc_fault, env->fault_code, env->fault_string);
+            xmlrpc_env_clean(env);
+            xmlrpc_env_init(env);
+        }
+    }
+
+    xmlrpc_DECREF(result);
+    return ABRT_XMLRPC_MULTICALL_DONE;
+}
+
+static void abrt_xmlrpc_batch_call_done(const char *server_url, const char *method_name,
+                xmlrpc_value *param_array, void *user_data,
+                xmlrpc_env *fault, xmlrpc_value *result)
+{
+    struct abrt_xmlrpc_batch_call *call = user_data;
+
+    if (fault->fault_occurred)
+        xmlrpc_env_set_fault(&call->bc_fault, fault->fault_code, fault->fault_string);
+    else
+    {
+        /* The result is released once the handler returns */
+        xmlrpc_INCREF(result);
+        call->bc_result = result;
+    }
+}
+
+void abrt_xmlrpc_call_batch(struct abrt_xmlrpc *ax,
+                            struct abrt_xmlrpc_batch_call *calls, unsigned count)
+{
+    for (unsigned i = 0; i < count; ++i)
+    {
+        calls[i].bc_result = NULL;
+        xmlrpc_env_init(&calls[i].bc_fault);
+    }
+
+    if (!ax->ax_no_multicall)
+    {
+        xmlrpc_env env;
+        xmlrpc_env_init(&env);
+        const int r = abrt_xmlrpc_multicall(&env, ax, calls, count);
+        if (r == ABRT_XMLRPC_MULTICALL_FAILED)
+        {
+            /* The calls would fail the same way */
+            for (unsigned i = 0; i < count; ++i)
+                xmlrpc_env_set_fault(&calls[i].bc_fault, env.fault_code, env.fault_string);
+        }
+        else if (r == ABRT_XMLRPC_MULTICALL_UNSUPPORTED)
+        {
+            log_notice("Can't use system.multicall, sending the calls separately: %s", env.fault_string);
+            ax->ax_no_multicall = 1;
+        }
+        xmlrpc_env_clean(&env);
+
+        if (r != ABRT_XMLRPC_MULTICALL_UNSUPPORTED)
+            return;
+    }
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        xmlrpc_env env;
+        xmlrpc_env_init(&env);
+        abrt_xmlrpc_start_call_params(&env, ax, calls[i].bc_method, calls[i].bc_params,
+                                      abrt_xmlrpc_batch_call_done, calls + i);
+        if (env.fault_occurred)
+            xmlrpc_env_set_fault(&calls[i].bc_fault, env.fault_code, env.fault_string);
+        xmlrpc_env_clean(&env);
+    }
+
+    abrt_xmlrpc_finish_calls(ax);
+}
+
+void abrt_xmlrpc_batch_call_clean(struct abrt_xmlrpc_batch_call *call)
+{
+    if (call->bc_result)
+        xmlrpc_DECREF(call->bc_result);
+    call->bc_result = NULL;
+    xmlrpc_env_clean(&call->bc_fault);
+}
+
 /* die or return expected results */
 xmlrpc_value *abrt_xmlrpc_call(struct abrt_xmlrpc *ax,
                                const char *method, const char *format, ...)
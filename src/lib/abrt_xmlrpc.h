@@ -37,10 +37,25 @@ struct abrt_xmlrpc {
     xmlrpc_client *ax_client;
     xmlrpc_server_info *ax_server_info;
     GList *ax_session_params;
+    /* For the calls sent without ax_client */
+    char *ax_url;
+    int ax_ssl_verify;
+    /* The server doesn't support system.multicall */
+    int ax_no_multicall;
+};
+
+/* A call sent by abrt_xmlrpc_call_batch() */
+struct abrt_xmlrpc_batch_call {
+    const char *bc_method;
+    xmlrpc_value *bc_params;
+    /* The result, or NULL with bc_fault set */
+    xmlrpc_value *bc_result;
+    xmlrpc_env bc_fault;
 };
 
 xmlrpc_value *abrt_xmlrpc_array_new(xmlrpc_env *env);
 void abrt_xmlrpc_array_append_string(xmlrpc_env *env, xmlrpc_value *array, const char *value);
+void abrt_xmlrpc_array_append_int(xmlrpc_env *env, xmlrpc_value *array, int value);
 
 xmlrpc_value *abrt_xmlrpc_params_new(xmlrpc_env *env);
 void abrt_xmlrpc_params_add_string(xmlrpc_env *env, xmlrpc_value *params, const char *name, const char *value);
@@ -63,6 +78,41 @@ xmlrpc_value *abrt_xmlrpc_call_params(xmlrpc_env *env, struct abrt_xmlrpc *ax,
 xmlrpc_value *abrt_xmlrpc_call_full(xmlrpc_env *enf, struct abrt_xmlrpc *ax,
                                    const char *method, const char *format, ...);
 
+/* Calls the method with params extended by the member holding size bytes
+ * read from fd as base64. The data are read and encoded while the request is
+ * being sent, so they are never held in memory as a whole.
+ *
+ * Returns NULL with env set on failure.
+ */
+xmlrpc_value *abrt_xmlrpc_call_params_with_fd(xmlrpc_env *env, struct abrt_xmlrpc *ax,
+                                              const char *method, xmlrpc_value *params,
+                                              const char *member, int fd, off_t size);
+
+/* Starts the call without waiting for its result, the handler is called from
+ * abrt_xmlrpc_finish_calls() once the call is finished. Several calls may run
+ * at once and the handlers may start new calls.
+ */
+void abrt_xmlrpc_start_call_params(xmlrpc_env *env, struct abrt_xmlrpc *ax,
+                                   const char *method, xmlrpc_value *params,
+                                   xmlrpc_response_handler handler, void *user_data);
+
+/* Processes the started calls until all of them are finished
+ *
+ * A call started by a handler of the last running call may be left running,
+ * call the function again then.
+ */
+void abrt_xmlrpc_finish_calls(struct abrt_xmlrpc *ax);
+
+/* Sends the calls in one system.multicall request, or as concurrent requests
+ * if the server doesn't support system.multicall, and waits for all of them.
+ * If the system.multicall request fails for another reason, every call gets
+ * its fault. The results and faults of the calls are released by
+ * abrt_xmlrpc_batch_call_clean().
+ */
+void abrt_xmlrpc_call_batch(struct abrt_xmlrpc *ax,
+                            struct abrt_xmlrpc_batch_call *calls, unsigned count);
+void abrt_xmlrpc_batch_call_clean(struct abrt_xmlrpc_batch_call *call);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,872 @@
+/*
+    Copyright (C) 2024  ABRT team
+    Copyright (C) 2024  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <zlib.h>
+#include "internal_libreport.h"
+
+#ifdef HAVE_LZMA
+# include <lzma.h>
+#endif
+
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+#endif
+
+#define TAR_BLOCK_SIZE 512
+
+/* Size of the buffer for reading files and for compressed data */
+#define IO_BUFFER_SIZE (128 * 1024)
+
+/* Parallel gzip compresses the input in blocks of this size. Every block is
+ * primed with the last 32KiB (the deflate window) of the previous block, so
+ * the compression ratio is almost the same as with a single stream.
+ */
+#define GZIP_BLOCK_SIZE (128 * 1024)
+#define GZIP_DICT_SIZE (32 * 1024)
+
+/* GNU tar header */
+struct tar_header {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+};
+
+struct gzip_job {
+    GMutex lock;
+    GCond cond;
+    /* Protected by lock */
+    bool done;
+    int error;
+
+    bool last;
+    unsigned char *in;
+    size_t in_size;
+    unsigned char dict[GZIP_DICT_SIZE];
+    size_t dict_size;
+
+    unsigned char *out;
+    size_t out_size;
+    size_t out_capacity;
+    uLong crc;
+
+    z_stream strm;
+    bool strm_ready;
+};
+
+struct archive_writer {
+    enum archive_compression compression;
+    archive_sink_fn sink;
+    void *sink_param;
+    /* The first error, the writer is unusable once it is set */
+    int error;
+    bool finished;
+
+    unsigned char *io_buffer;
+    unsigned char *out_buffer;
+
+    /* Single-threaded gzip */
+    z_stream gz;
+    bool gz_ready;
+
+    /* Parallel gzip - jobs form a ring where jobs_pending submitted jobs
+     * start at jobs_first and the job being filled follows them
+     */
+    GThreadPool *pool;
+    struct gzip_job *jobs;
+    unsigned jobs_count;
+    unsigned jobs_first;
+    unsigned jobs_pending;
+    struct gzip_job *current;
+    unsigned char dict[GZIP_DICT_SIZE];
+    size_t dict_size;
+    uLong crc;
+    uint32_t isize;
+
+#ifdef HAVE_LZMA
+    lzma_stream xz;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+
+    /* Cache of the last looked up user and group names */
+    uid_t uname_uid;
+    char uname[32];
+    gid_t gname_gid;
+    char gname[32];
+};
+
+int archive_compression_from_name(const char *archive_name)
+{
+    if (libreport_suffixcmp(archive_name, ".tar.gz") == 0
+     || libreport_suffixcmp(archive_name, ".tgz") == 0)
+        return ARCHIVE_COMPRESSION_GZIP;
+
+#ifdef HAVE_LZMA
+    if (libreport_suffixcmp(archive_name, ".tar.xz") == 0)
+        return ARCHIVE_COMPRESSION_XZ;
+#endif
+
+#ifdef HAVE_ZSTD
+    if (libreport_suffixcmp(archive_name, ".tar.zst") == 0)
+        return ARCHIVE_COMPRESSION_ZSTD;
+#endif
+
+    return -ENOSYS;
+}
+
+int archive_fd_sink(const void *buf, size_t size, void *param)
+{
+    const int fd = *(int *)param;
+
+    if (libreport_full_write(fd, buf, size) != (ssize_t)size)
+        return errno ? -errno : -EIO;
+
+    return 0;
+}
+
+static int archive_writer_fail(struct archive_writer *aw, int error)
+{
+    if (aw->error == 0)
+        aw->error = error;
+
+    return aw->error;
+}
+
+static int archive_writer_sink(struct archive_writer *aw, const void *buf, size_t size)
+{
+    if (size == 0)
+        return 0;
+
+    const int r = aw->sink(buf, size, aw->sink_param);
+    if (r != 0)
+        return archive_writer_fail(aw, r);
+
+    return 0;
+}
+
+/******************************************************************************/
+/* Parallel gzip                                                              */
+/******************************************************************************/
+
+static int gzip_job_deflate(struct gzip_job *job)
+{
+    z_stream *const strm = &job->strm;
+
+    if (!job->strm_ready)
+    {
+        /* Raw deflate, the gzip header and trailer are written by the writer */
+        if (deflateInit2(strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                    /*memLevel*/8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return -ENOMEM;
+
+        job->strm_ready = true;
+    }
+    else
+        deflateReset(strm);
+
+    if (job->dict_size != 0)
+        deflateSetDictionary(strm, job->dict, job->dict_size);
+
+    /* Z_SYNC_FLUSH terminates the block on a byte boundary, so the next job's
+     * output can be appended directly. Only the last block is final.
+     */
+    const int flush = job->last ? Z_FINISH : Z_SYNC_FLUSH;
+    const size_t bound = deflateBound(strm, job->in_size) + 16;
+    if (job->out_capacity < bound)
+    {
+        job->out = libreport_xrealloc(job->out, bound);
+        job->out_capacity = bound;
+    }
+
+    strm->next_in = job->in;
+    strm->avail_in = job->in_size;
+    job->out_size = 0;
+
+    for (;;)
+    {
+        strm->next_out = job->out + job->out_size;
+        strm->avail_out = job->out_capacity - job->out_size;
+
+        const int r = deflate(strm, flush);
+        job->out_size = job->out_capacity - strm->avail_out;
+
+        if (r == Z_STREAM_ERROR)
+            return -EINVAL;
+
+        if (strm->avail_out != 0 && (!job->last || r == Z_STREAM_END))
+            break;
+
+        job->out_capacity *= 2;
+        job->out = libreport_xrealloc(job->out, job->out_capacity);
+    }
+
+    return 0;
+}
+
+static void gzip_job_run(gpointer data, gpointer user_data)
+{
+    struct gzip_job *job = data;
+
+    const int r = gzip_job_deflate(job);
+    job->crc = crc32(crc32(0L, Z_NULL, 0), job->in, job->in_size);
+
+    g_mutex_lock(&job->lock);
+    job->error = r;
+    job->done = true;
+    g_cond_signal(&job->cond);
+    g_mutex_unlock(&job->lock);
+}
+
+/* Passes the output of the oldest submitted job to the sink
+ *
+ * @return 1 if the job was written, 0 if wait is false and the job is not
+ * finished yet; otherwise -errno
+ */
+static int gzip_write_job(struct archive_writer *aw, bool wait)
+{
+    struct gzip_job *job = &aw->jobs[aw->jobs_first];
+
+    g_mutex_lock(&job->lock);
+    if (!wait && !job->done)
+    {
+        g_mutex_unlock(&job->lock);
+        return 0;
+    }
+
+    while (!job->done)
+        g_cond_wait(&job->cond, &job->lock);
+    g_mutex_unlock(&job->lock);
+
+    aw->jobs_first = (aw->jobs_first + 1) % aw->jobs_count;
+    --aw->jobs_pending;
+
+    if (job->error != 0)
+    {
+        error_msg("Failed to compress data");
+        return archive_writer_fail(aw, job->error);
+    }
+
+    aw->crc = crc32_combine(aw->crc, job->crc, job->in_size);
+    aw->isize += (uint32_t)job->in_size;
+
+    const int r = archive_writer_sink(aw, job->out, job->out_size);
+    return r != 0 ? r : 1;
+}
+
+static int gzip_submit_job(struct archive_writer *aw, bool last)
+{
+    struct gzip_job *job = aw->current;
+    aw->current = NULL;
+
+    job->last = last;
+    job->done = false;
+    job->error = 0;
+
+    memcpy(job->dict, aw->dict, aw->dict_size);
+    job->dict_size = aw->dict_size;
+
+    /* Remember the tail of the input for the next job */
+    if (job->in_size >= GZIP_DICT_SIZE)
+    {
+        memcpy(aw->dict, job->in + job->in_size - GZIP_DICT_SIZE, GZIP_DICT_SIZE);
+        aw->dict_size = GZIP_DICT_SIZE;
+    }
+    else
+    {
+        const size_t keep = MIN(aw->dict_size, GZIP_DICT_SIZE - job->in_size);
+        memmove(aw->dict, aw->dict + aw->dict_size - keep, keep);
+        memcpy(aw->dict + keep, job->in, job->in_size);
+        aw->dict_size = keep + job->in_size;
+    }
+
+    ++aw->jobs_pending;
+
+    GError *error = NULL;
+    if (!g_thread_pool_push(aw->pool, job, &error))
+    {
+        log_notice("Compressing in the main thread: %s", error->message);
+        g_error_free(error);
+        gzip_job_run(job, NULL);
+    }
+
+    /* Don't wait, but pass all already compressed data to the sink */
+    int r;
+    while (aw->jobs_pending != 0 && (r = gzip_write_job(aw, /*wait*/false)) != 0)
+        if (r < 0)
+            return r;
+
+    return 0;
+}
+
+/* Makes the next free job in the ring the current one, waits for the oldest
+ * job if all jobs are in use
+ */
+static int gzip_acquire_job(struct archive_writer *aw)
+{
+    if (aw->jobs_pending == aw->jobs_count)
+    {
+        const int r = gzip_write_job(aw, /*wait*/true);
+        if (r < 0)
+            return r;
+    }
+
+    struct gzip_job *job = &aw->jobs[(aw->jobs_first + aw->jobs_pending) % aw->jobs_count];
+    if (job->in == NULL)
+        job->in = libreport_xmalloc(GZIP_BLOCK_SIZE);
+    job->in_size = 0;
+    aw->current = job;
+
+    return 0;
+}
+
+static int gzip_mt_write(struct archive_writer *aw, const void *data, size_t size)
+{
+    const unsigned char *src = data;
+
+    while (size != 0)
+    {
+        if (aw->current == NULL)
+        {
+            const int r = gzip_acquire_job(aw);
+            if (r != 0)
+                return r;
+        }
+
+        struct gzip_job *job = aw->current;
+        const size_t chunk = MIN(size, GZIP_BLOCK_SIZE - job->in_size);
+        memcpy(job->in + job->in_size, src, chunk);
+        job->in_size += chunk;
+        src += chunk;
+        size -= chunk;
+
+        if (job->in_size == GZIP_BLOCK_SIZE)
+        {
+            const int r = gzip_submit_job(aw, /*last*/false);
+            if (r != 0)
+                return r;
+        }
+    }
+
+    return 0;
+}
+
+static int gzip_mt_finish(struct archive_writer *aw)
+{
+    int r;
+
+    /* The final block might be empty, but it must exist */
+    if (aw->current == NULL && (r = gzip_acquire_job(aw)) != 0)
+        return r;
+
+    if ((r = gzip_submit_job(aw, /*last*/true)) != 0)
+        return r;
+
+    while (aw->jobs_pending != 0)
+        if ((r = gzip_write_job(aw, /*wait*/true)) < 0)
+            return r;
+
+    const unsigned char trailer[8] = {
+        aw->crc & 0xff, (aw->crc >> 8) & 0xff, (aw->crc >> 16) & 0xff, (aw->crc >> 24) & 0xff,
+        aw->isize & 0xff, (aw->isize >> 8) & 0xff, (aw->isize >> 16) & 0xff, (aw->isize >> 24) & 0xff,
+    };
+
+    return archive_writer_sink(aw, trailer, sizeof(trailer));
+}
+
+static int gzip_mt_init(struct archive_writer *aw, unsigned threads)
+{
+    GError *error = NULL;
+    aw->pool = g_thread_pool_new(gzip_job_run, NULL, threads, /*exclusive*/TRUE, &error);
+    if (aw->pool == NULL)
+    {
+        error_msg("Can't create compression threads: %s", error->message);
+        g_error_free(error);
+        return -EAGAIN;
+    }
+
+    /* Two jobs per thread keep the threads busy while the output of the
+     * oldest job is being written
+     */
+    aw->jobs_count = threads * 2;
+    aw->jobs = libreport_xzalloc(aw->jobs_count * sizeof(*aw->jobs));
+    for (unsigned i = 0; i < aw->jobs_count; ++i)
+    {
+        g_mutex_init(&aw->jobs[i].lock);
+        g_cond_init(&aw->jobs[i].cond);
+    }
+
+    aw->crc = crc32(0L, Z_NULL, 0);
+
+    /* Single member, no file name, no modification time, OS Unix */
+    static const unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+    return archive_writer_sink(aw, header, sizeof(header));
+}
+
+/******************************************************************************/
+/* Single stream compressors                                                  */
+/******************************************************************************/
+
+static int gzip_st_code(struct archive_writer *aw, const void *data, size_t size, int flush)
+{
+    aw->gz.next_in = (Bytef *)data;
+    aw->gz.avail_in = size;
+
+    int r;
+    do
+    {
+        aw->gz.next_out = aw->out_buffer;
+        aw->gz.avail_out = IO_BUFFER_SIZE;
+
+        r = deflate(&aw->gz, flush);
+        if (r == Z_STREAM_ERROR)
+        {
+            error_msg("Failed to compress data");
+            return archive_writer_fail(aw, -EINVAL);
+        }
+
+        const int sr = archive_writer_sink(aw, aw->out_buffer, IO_BUFFER_SIZE - aw->gz.avail_out);
+        if (sr != 0)
+            return sr;
+    }
+    while (aw->gz.avail_out == 0 || (flush == Z_FINISH && r != Z_STREAM_END));
+
+    return 0;
+}
+
+#ifdef HAVE_LZMA
+static int xz_code(struct archive_writer *aw, const void *data, size_t size, lzma_action action)
+{
+    aw->xz.next_in = data;
+    aw->xz.avail_in = size;
+
+    lzma_ret r;
+    do
+    {
+        aw->xz.next_out = aw->out_buffer;
+        aw->xz.avail_out = IO_BUFFER_SIZE;
+
+        r = lzma_code(&aw->xz, action);
+        if (r != LZMA_OK && r != LZMA_STREAM_END)
+        {
+            error_msg("Failed to compress data: lzma error %d", r);
+            return archive_writer_fail(aw, r == LZMA_MEM_ERROR ? -ENOMEM : -EINVAL);
+        }
+
+        const int sr = archive_writer_sink(aw, aw->out_buffer, IO_BUFFER_SIZE - aw->xz.avail_out);
+        if (sr != 0)
+            return sr;
+    }
+    while (aw->xz.avail_in != 0 || (action == LZMA_FINISH && r != LZMA_STREAM_END));
+
+    return 0;
+}
+#endif /*HAVE_LZMA*/
+
+#ifdef HAVE_ZSTD
+static int zstd_code(struct archive_writer *aw, const void *data, size_t size, ZSTD_EndDirective mode)
+{
+    ZSTD_inBuffer in = { .src = data, .size = size, .pos = 0 };
+
+    size_t remaining;
+    do
+    {
+        ZSTD_outBuffer out = { .dst = aw->out_buffer, .size = IO_BUFFER_SIZE, .pos = 0 };
+
+        remaining = ZSTD_compressStream2(aw->zstd, &out, &in, mode);
+        if (ZSTD_isError(remaining))
+        {
+            error_msg("Failed to compress data: %s", ZSTD_getErrorName(remaining));
+            return archive_writer_fail(aw, -EINVAL);
+        }
+
+        const int sr = archive_writer_sink(aw, out.dst, out.pos);
+        if (sr != 0)
+            return sr;
+    }
+    while (in.pos != in.size || (mode == ZSTD_e_end && remaining != 0));
+
+    return 0;
+}
+#endif /*HAVE_ZSTD*/
+
+/******************************************************************************/
+/* Writer                                                                     */
+/******************************************************************************/
+
+static int archive_writer_write(struct archive_writer *aw, const void *data, size_t size)
+{
+    if (aw->error != 0)
+        return aw->error;
+
+    switch (aw->compression)
+    {
+        case ARCHIVE_COMPRESSION_GZIP:
+            if (aw->pool != NULL)
+                return gzip_mt_write(aw, data, size);
+            return gzip_st_code(aw, data, size, Z_NO_FLUSH);
+#ifdef HAVE_LZMA
+        case ARCHIVE_COMPRESSION_XZ:
+            return xz_code(aw, data, size, LZMA_RUN);
+#endif
+#ifdef HAVE_ZSTD
+        case ARCHIVE_COMPRESSION_ZSTD:
+            return zstd_code(aw, data, size, ZSTD_e_continue);
+#endif
+        default:
+            return archive_writer_fail(aw, -ENOSYS);
+    }
+}
+
+static int archive_writer_write_zeros(struct archive_writer *aw, size_t size)
+{
+    static const unsigned char zeros[2 * TAR_BLOCK_SIZE];
+
+    while (size != 0)
+    {
+        const size_t chunk = MIN(size, sizeof(zeros));
+        const int r = archive_writer_write(aw, zeros, chunk);
+        if (r != 0)
+            return r;
+
+        size -= chunk;
+    }
+
+    return 0;
+}
+
+/* Stores the value as an octal number, or in the GNU base-256 encoding if
+ * it does not fit (files larger than 8GiB, big UIDs)
+ */
+static void tar_header_number(char *field, size_t length, uint64_t value)
+{
+    if (value < (1ULL << (3 * (length - 1))))
+    {
+        field[length - 1] = '\0';
+        for (size_t i = length - 1; i-- > 0; value >>= 3)
+            field[i] = '0' + (value & 7);
+    }
+    else
+    {
+        for (size_t i = length; i-- > 1; value >>= 8)
+            field[i] = value & 0xff;
+        field[0] = (char)0x80;
+    }
+}
+
+static void tar_header_user(struct archive_writer *aw, struct tar_header *header, uid_t uid, gid_t gid)
+{
+    if (aw->uname_uid != uid)
+    {
+        struct passwd *pw = getpwuid(uid);
+        /* Longer names are truncated, the field must end with NUL */
+        strncpy(aw->uname, pw ? pw->pw_name : "", sizeof(aw->uname) - 1);
+        aw->uname[sizeof(aw->uname) - 1] = '\0';
+        aw->uname_uid = uid;
+    }
+
+    if (aw->gname_gid != gid)
+    {
+        struct group *gr = getgrgid(gid);
+        strncpy(aw->gname, gr ? gr->gr_name : "", sizeof(aw->gname) - 1);
+        aw->gname[sizeof(aw->gname) - 1] = '\0';
+        aw->gname_gid = gid;
+    }
+
+    memcpy(header->uname, aw->uname, sizeof(header->uname));
+    memcpy(header->gname, aw->gname, sizeof(header->gname));
+}
+
+static int tar_write_header(struct archive_writer *aw, char typeflag, const char *name,
+        uint64_t size, mode_t mode, uid_t uid, gid_t gid, time_t mtime)
+{
+    struct tar_header header;
+    memset(&header, 0, sizeof(header));
+
+    strncpy(header.name, name, sizeof(header.name));
+    tar_header_number(header.mode, sizeof(header.mode), mode & 07777);
+    tar_header_number(header.uid, sizeof(header.uid), uid);
+    tar_header_number(header.gid, sizeof(header.gid), gid);
+    tar_header_number(header.size, sizeof(header.size), size);
+    tar_header_number(header.mtime, sizeof(header.mtime), mtime < 0 ? 0 : mtime);
+    header.typeflag = typeflag;
+    /* GNU magic "ustar  \0" spans magic and version */
+    memcpy(header.magic, "ustar  ", sizeof(header.magic) + sizeof(header.version));
+
+    if (typeflag != 'L')
+        tar_header_user(aw, &header, uid, gid);
+
+    memset(header.chksum, ' ', sizeof(header.chksum));
+    unsigned checksum = 0;
+    for (size_t i = 0; i < sizeof(header); ++i)
+        checksum += ((unsigned char *)&header)[i];
+    tar_header_number(header.chksum, sizeof(header.chksum) - 1, checksum);
+
+    return archive_writer_write(aw, &header, sizeof(header));
+}
+
+static int tar_write_padding(struct archive_writer *aw, uint64_t size)
+{
+    return archive_writer_write_zeros(aw, (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE);
+}
+
+static int tar_write_file_header(struct archive_writer *aw, const char *name,
+        uint64_t size, mode_t mode, uid_t uid, gid_t gid, time_t mtime)
+{
+    const size_t name_length = strlen(name);
+    if (name_length > sizeof(((struct tar_header *)NULL)->name))
+    {
+        /* GNU long name extension: the name is stored in a pseudo file */
+        int r = tar_write_header(aw, 'L', "././@LongLink", name_length + 1, 0, 0, 0, 0);
+        if (r == 0)
+            r = archive_writer_write(aw, name, name_length + 1);
+        if (r == 0)
+            r = tar_write_padding(aw, name_length + 1);
+        if (r != 0)
+            return r;
+    }
+
+    return tar_write_header(aw, '0', name, size, mode, uid, gid, mtime);
+}
+
+struct archive_writer *archive_writer_new(enum archive_compression compression, unsigned threads,
+        archive_sink_fn sink, void *sink_param)
+{
+    struct archive_writer *aw = libreport_xzalloc(sizeof(*aw));
+    aw->compression = compression;
+    aw->sink = sink;
+    aw->sink_param = sink_param;
+    aw->io_buffer = libreport_xmalloc(IO_BUFFER_SIZE);
+    aw->out_buffer = libreport_xmalloc(IO_BUFFER_SIZE);
+    aw->uname_uid = (uid_t)-1;
+    aw->gname_gid = (gid_t)-1;
+
+    if (threads == 0)
+        threads = g_get_num_processors();
+
+    log_debug("Creating archive using %u threads", threads);
+
+    switch (compression)
+    {
+        case ARCHIVE_COMPRESSION_GZIP:
+            if (threads > 1)
+            {
+                aw->error = gzip_mt_init(aw, threads);
+                break;
+            }
+
+            /* windowBits + 16 = gzip header and trailer */
+            if (deflateInit2(&aw->gz, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16,
+                        /*memLevel*/8, Z_DEFAULT_STRATEGY) != Z_OK)
+            {
+                error_msg("Failed to initialize gzip compression");
+                aw->error = -ENOMEM;
+            }
+            else
+                aw->gz_ready = true;
+            break;
+#ifdef HAVE_LZMA
+        case ARCHIVE_COMPRESSION_XZ:
+        {
+            lzma_ret r;
+            aw->xz = (lzma_stream)LZMA_STREAM_INIT;
+            if (threads > 1)
+            {
+                lzma_mt mt = {
+                    .threads = threads,
+                    .preset = LZMA_PRESET_DEFAULT,
+                    .check = LZMA_CHECK_CRC64,
+                };
+                r = lzma_stream_encoder_mt(&aw->xz, &mt);
+            }
+            else
+                r = lzma_easy_encoder(&aw->xz, LZMA_PRESET_DEFAULT, LZMA_CHECK_CRC64);
+
+            if (r != LZMA_OK)
+            {
+                error_msg("Failed to initialize xz compression: lzma error %d", r);
+                aw->error = r == LZMA_MEM_ERROR ? -ENOMEM : -EINVAL;
+            }
+            break;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case ARCHIVE_COMPRESSION_ZSTD:
+            aw->zstd = ZSTD_createCCtx();
+            if (aw->zstd == NULL)
+            {
+                error_msg("Failed to initialize zstd compression");
+                aw->error = -ENOMEM;
+                break;
+            }
+
+            ZSTD_CCtx_setParameter(aw->zstd, ZSTD_c_compressionLevel, ZSTD_CLEVEL_DEFAULT);
+            ZSTD_CCtx_setParameter(aw->zstd, ZSTD_c_checksumFlag, 1);
+            if (threads > 1
+             && ZSTD_isError(ZSTD_CCtx_setParameter(aw->zstd, ZSTD_c_nbWorkers, threads)))
+                log_notice("zstd library does not support multi-threaded compression");
+            break;
+#endif
+        default:
+            aw->error = -ENOSYS;
+    }
+
+    return aw;
+}
+
+int archive_writer_add_fd(struct archive_writer *aw, const char *name, int fd, const struct stat *st)
+{
+    if (aw->error != 0)
+        return aw->error;
+
+    if (aw->finished || !S_ISREG(st->st_mode))
+        return -EINVAL;
+
+    int r = tar_write_file_header(aw, name, st->st_size, st->st_mode, st->st_uid, st->st_gid, st->st_mtime);
+
+    /* Once the header is written, every error leaves the archive broken */
+    uint64_t remaining = st->st_size;
+    while (r == 0 && remaining != 0)
+    {
+        const ssize_t rd = libreport_safe_read(fd, aw->io_buffer, MIN(remaining, IO_BUFFER_SIZE));
+        if (rd < 0)
+        {
+            perror_msg("Can't read '%s'", name);
+            return archive_writer_fail(aw, -errno);
+        }
+
+        if (rd == 0)
+        {
+            log_warning("File '%s' shrank by %llu bytes; padding with zeros", name,
+                    (unsigned long long)remaining);
+            r = archive_writer_write_zeros(aw, remaining);
+            break;
+        }
+
+        r = archive_writer_write(aw, aw->io_buffer, rd);
+        remaining -= rd;
+    }
+
+    if (r == 0)
+        r = tar_write_padding(aw, st->st_size);
+
+    return r;
+}
+
+int archive_writer_add_data(struct archive_writer *aw, const char *name,
+        const void *data, size_t size, mode_t mode, time_t mtime)
+{
+    if (aw->error != 0)
+        return aw->error;
+
+    if (aw->finished)
+        return -EINVAL;
+
+    int r = tar_write_file_header(aw, name, size, mode, geteuid(), getegid(), mtime);
+    if (r == 0)
+        r = archive_writer_write(aw, data, size);
+    if (r == 0)
+        r = tar_write_padding(aw, size);
+
+    return r;
+}
+
+int archive_writer_finish(struct archive_writer *aw)
+{
+    if (aw->error != 0)
+        return aw->error;
+
+    if (aw->finished)
+        return -EINVAL;
+
+    /* End of archive - two zero blocks */
+    int r = archive_writer_write_zeros(aw, 2 * TAR_BLOCK_SIZE);
+    if (r != 0)
+        return r;
+
+    aw->finished = true;
+
+    switch (aw->compression)
+    {
+        case ARCHIVE_COMPRESSION_GZIP:
+            if (aw->pool != NULL)
+                return gzip_mt_finish(aw);
+            return gzip_st_code(aw, NULL, 0, Z_FINISH);
+#ifdef HAVE_LZMA
+        case ARCHIVE_COMPRESSION_XZ:
+            return xz_code(aw, NULL, 0, LZMA_FINISH);
+#endif
+#ifdef HAVE_ZSTD
+        case ARCHIVE_COMPRESSION_ZSTD:
+            return zstd_code(aw, NULL, 0, ZSTD_e_end);
+#endif
+        default:
+            return archive_writer_fail(aw, -ENOSYS);
+    }
+}
+
+void archive_writer_free(struct archive_writer *aw)
+{
+    if (aw == NULL)
+        return;
+
+    /* Let the threads finish all queued jobs */
+    if (aw->pool != NULL)
+        g_thread_pool_free(aw->pool, /*immediate*/FALSE, /*wait*/TRUE);
+
+    for (unsigned i = 0; i < aw->jobs_count; ++i)
+    {
+        struct gzip_job *job = &aw->jobs[i];
+        if (job->strm_ready)
+            deflateEnd(&job->strm);
+        free(job->in);
+        free(job->out);
+        g_mutex_clear(&job->lock);
+        g_cond_clear(&job->cond);
+    }
+    free(aw->jobs);
+
+    if (aw->gz_ready)
+        deflateEnd(&aw->gz);
+
+#ifdef HAVE_LZMA
+    if (aw->compression == ARCHIVE_COMPRESSION_XZ)
+        lzma_end(&aw->xz);
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx(aw->zstd);
+#endif
+
+    free(aw->io_buffer);
+    free(aw->out_buffer);
+    free(aw);
+}
@@ -18,11 +18,163 @@
 */
 #include "internal_libreport.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+# include <immintrin.h>
+#endif
+
 static const char hexdigits_locase[] = "0123456789abcdef";
 
+/*
+ * Vector kernels
+ *
+ * The kernels convert whole blocks and return the number of consumed bytes
+ * (hex digit pairs); the callers convert the rest. Which implementation is
+ * used is decided at run time according to the features of the CPU.
+ */
+static size_t bin2hex_blocks_none(char *dst, const unsigned char *src, size_t count)
+{
+	return 0;
+}
+
+static size_t hex2bin_blocks_none(char *dst, const char *src, size_t count)
+{
+	return 0;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("ssse3")))
+static size_t bin2hex_blocks_ssse3(char *dst, const unsigned char *src, size_t count)
+{
+	const __m128i digits = _mm_loadu_si128((const __m128i *)hexdigits_locase);
+	const __m128i lo_mask = _mm_set1_epi8(0x0f);
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16, dst += 32) {
+		const __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+		const __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(in, 4), lo_mask));
+		const __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(in, lo_mask));
+		_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi8(hi, lo));
+	}
+	return i;
+}
+
+/* Returns false if any of the chars is not a hex digit */
+__attribute__((target("ssse3")))
+static inline bool hex2bin_values_ssse3(__m128i in, __m128i *out)
+{
+	/* Signed comparisons are fine, the chars above 0x7f are invalid anyway */
+	const __m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+	                                       _mm_cmplt_epi8(in, _mm_set1_epi8('9' + 1)));
+	const __m128i lower = _mm_or_si128(in, _mm_set1_epi8(0x20));
+	const __m128i is_letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+	                                        _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+	if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xffff)
+		return false;
+
+	const __m128i values = _mm_or_si128(_mm_and_si128(is_digit, _mm_sub_epi8(in, _mm_set1_epi8('0'))),
+	                                    _mm_andnot_si128(is_digit, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+	/* High nibble * 16 + low nibble for every pair */
+	*out = _mm_maddubs_epi16(values, _mm_set1_epi16(0x0110));
+	return true;
+}
+
+__attribute__((target("ssse3")))
+static size_t hex2bin_blocks_ssse3(char *dst, const char *src, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16, dst += 16) {
+		__m128i lo, hi;
+		if (!hex2bin_values_ssse3(_mm_loadu_si128((const __m128i *)(src + 2 * i)), &lo)
+		 || !hex2bin_values_ssse3(_mm_loadu_si128((const __m128i *)(src + 2 * i + 16)), &hi))
+			break;
+		_mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t bin2hex_blocks_avx2(char *dst, const unsigned char *src, size_t count)
+{
+	const __m256i digits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hexdigits_locase));
+	const __m256i lo_mask = _mm256_set1_epi8(0x0f);
+	size_t i = 0;
+
+	for (; i + 32 <= count; i += 32, dst += 64) {
+		/* Quadwords 0 2 1 3, so that the unpacking keeps the order */
+		const __m256i in = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i *)(src + i)), 0xD8);
+		const __m256i hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(in, 4), lo_mask));
+		const __m256i lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(in, lo_mask));
+		_mm256_storeu_si256((__m256i *)dst, _mm256_unpacklo_epi8(hi, lo));
+		_mm256_storeu_si256((__m256i *)(dst + 32), _mm256_unpackhi_epi8(hi, lo));
+	}
+	return i + bin2hex_blocks_ssse3(dst, src + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static size_t hex2bin_blocks_avx2(char *dst, const char *src, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 32 <= count; i += 32, dst += 32) {
+		__m256i values[2];
+		for (int j = 0; j < 2; j++) {
+			const __m256i in = _mm256_loadu_si256((const __m256i *)(src + 2 * i + 32 * j));
+			const __m256i is_digit = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('0' - 1)),
+			                                          _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), in));
+			const __m256i lower = _mm256_or_si256(in, _mm256_set1_epi8(0x20));
+			const __m256i is_letter = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+			                                           _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+			if (_mm256_movemask_epi8(_mm256_or_si256(is_digit, is_letter)) != -1)
+				return i + hex2bin_blocks_ssse3(dst, src + 2 * i, count - i);
+
+			const __m256i digit = _mm256_and_si256(is_digit, _mm256_sub_epi8(in, _mm256_set1_epi8('0')));
+			const __m256i letter = _mm256_andnot_si256(is_digit, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10)));
+			values[j] = _mm256_maddubs_epi16(_mm256_or_si256(digit, letter), _mm256_set1_epi16(0x0110));
+		}
+		/* packus works per lane, put the quadwords back in order */
+		const __m256i packed = _mm256_packus_epi16(values[0], values[1]);
+		_mm256_storeu_si256((__m256i *)dst, _mm256_permute4x64_epi64(packed, 0xD8));
+	}
+	return i + hex2bin_blocks_ssse3(dst, src + 2 * i, count - i);
+}
+#endif
+
+static size_t bin2hex_blocks(char *dst, const unsigned char *src, size_t count)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+	const unsigned simd = libreport_simd_features();
+	if (simd & LIBREPORT_SIMD_AVX2)
+		return bin2hex_blocks_avx2(dst, src, count);
+	if (simd & LIBREPORT_SIMD_SSSE3)
+		return bin2hex_blocks_ssse3(dst, src, count);
+#endif
+	return bin2hex_blocks_none(dst, src, count);
+}
+
+static size_t hex2bin_blocks(char *dst, const char *src, size_t count)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+	const unsigned simd = libreport_simd_features();
+	if (simd & LIBREPORT_SIMD_AVX2)
+		return hex2bin_blocks_avx2(dst, src, count);
+	if (simd & LIBREPORT_SIMD_SSSE3)
+		return hex2bin_blocks_ssse3(dst, src, count);
+#endif
+	return hex2bin_blocks_none(dst, src, count);
+}
+
 /* Emit a string of hex representation of bytes */
 char *libreport_bin2hex(char *dst, const char *str, int count)
 {
+	if (count > 0) {
+		const size_t done = bin2hex_blocks(dst, (const unsigned char *)str, count);
+		dst += 2 * done;
+		str += done;
+		count -= done;
+	}
+
 	while (count) {
 		unsigned char c = *str++;
 		/* put lowercase hex digits */
@@ -40,6 +192,15 @@ char *libreport_hex2bin(char *dst, const char *str, int count)
 	 * of strings like "xx:x:x:xx:xx:xx:xxxxxx"
 	 * (IPv6, ethernet addresses and the like).
 	 */
+	if (count > 0) {
+		/* The kernels must not read past the terminator */
+		const size_t digits = strnlen(str, 2 * (size_t)count);
+		const size_t done = hex2bin_blocks(dst, str, digits / 2);
+		dst += done;
+		str += 2 * done;
+		count -= done;
+	}
+
 	errno = EINVAL;
 	while (*str && count) {
 		uint8_t val;
@@ -30,8 +30,18 @@
 # define LR_DECOMPRESS_FORK_EXECVP
 #endif
 
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+#else
+# define LR_DECOMPRESS_FORK_EXECVP
+#endif
+
+/* Size of buffers for compressed and decompressed data */
+#define DECOMPRESS_BUFFER_SIZE (1024 * 1024)
+
 static const uint8_t s_xz_magic[6] = { 0xFD, 0x37, 0x7A, 0x58, 0x5A, 0x00 };
 static const uint8_t s_lz4_magic[4] = { 0x04, 0x22, 0x4D, 0x18 };
+static const uint8_t s_zstd_magic[4] = { 0x28, 0xB5, 0x2F, 0xFD };
 
 static bool
 is_format(const char *name, const uint8_t *header, size_t hl, const uint8_t *magic, size_t ml)
@@ -103,60 +113,229 @@ decompress_using_fork_execvp(const char** cmd, int fdi, int fdo)
 }
 #endif
 
+/* Reserves space for the decompressed data, so the file system can allocate
+ * the output file in as few extents as possible.
+ */
+static void
+preallocate_output(int fdo, uint64_t size)
+{
+    struct stat st;
+    if (size == 0 || fstat(fdo, &st) != 0 || !S_ISREG(st.st_mode))
+        return;
+
+    const off_t pos = lseek(fdo, 0, SEEK_CUR);
+    if (pos < 0)
+        return;
+
+    /* The file size is set by the writes, so nothing is left behind if the
+     * decompression fails. */
+    if (fallocate(fdo, FALLOC_FL_KEEP_SIZE, pos, size) != 0)
+        log_debug("Can't preallocate %llu Bytes: %s", (unsigned long long)size, strerror(errno));
+}
+
+#ifdef HAVE_LZMA
+/* Reads the index of a single-stream xz file
+ *
+ * @param header_flags Receives the Stream Flags
+ * @return NULL if the file has no single index
+ */
+static lzma_index *
+xz_read_index(int fdi, uint64_t file_size, lzma_stream_flags *header_flags)
+{
+    uint8_t header[LZMA_STREAM_HEADER_SIZE];
+    if (pread(fdi, header, sizeof(header), 0) != sizeof(header))
+        return NULL;
+
+    if (lzma_stream_header_decode(header_flags, header) != LZMA_OK)
+        return NULL;
+
+    /* Skip Stream Padding */
+    uint64_t end = file_size;
+    uint32_t padding = 0;
+    while (end >= 2 * LZMA_STREAM_HEADER_SIZE + sizeof(padding)
+           && pread(fdi, &padding, sizeof(padding), end - sizeof(padding)) == sizeof(padding)
+           && padding == 0)
+        end -= sizeof(padding);
+
+    if (end < 2 * LZMA_STREAM_HEADER_SIZE)
+        return NULL;
+
+    uint8_t footer[LZMA_STREAM_HEADER_SIZE];
+    if (pread(fdi, footer, sizeof(footer), end - sizeof(footer)) != sizeof(footer))
+        return NULL;
+
+    lzma_stream_flags footer_flags;
+    if (lzma_stream_footer_decode(&footer_flags, footer) != LZMA_OK
+        || lzma_stream_flags_compare(header_flags, &footer_flags) != LZMA_OK
+        || footer_flags.backward_size > end - 2 * LZMA_STREAM_HEADER_SIZE)
+        return NULL;
+
+    const size_t index_size = footer_flags.backward_size;
+    uint8_t *index_data = libreport_xmalloc(index_size);
+    if (pread(fdi, index_data, index_size, end - sizeof(footer) - index_size) != (ssize_t)index_size)
+    {
+        free(index_data);
+        return NULL;
+    }
+
+    lzma_index *idx = NULL;
+    uint64_t memlimit = UINT64_MAX;
+    size_t in_pos = 0;
+    const lzma_ret ret = lzma_index_buffer_decode(&idx, &memlimit, NULL, index_data, &in_pos, index_size);
+    free(index_data);
+    if (ret != LZMA_OK)
+    {
+        log_debug("Failed to decode XZ index: code %d", ret);
+        return NULL;
+    }
+
+    /* Concatenated streams would need to walk all Stream Headers */
+    if (lzma_index_stream_size(idx) != end)
+    {
+        log_debug("XZ file with more streams has no single index");
+        lzma_index_end(idx, NULL);
+        return NULL;
+    }
+
+    return idx;
+}
+
+/* Returns the size of decompressed data recorded in the index of a
+ * single-stream xz file or 0 */
+static uint64_t
+xz_decompressed_size(int fdi, uint64_t file_size)
+{
+    lzma_stream_flags header_flags;
+    lzma_index *idx = xz_read_index(fdi, file_size, &header_flags);
+    if (idx == NULL)
+        return 0;
+
+    const uint64_t size = lzma_index_uncompressed_size(idx);
+    lzma_index_end(idx, NULL);
+    return size;
+}
+#endif /*HAVE_LZMA*/
+
+#ifdef HAVE_ZSTD
+/* The longest zstd frame header, ZSTD_FRAMEHEADERSIZE_MAX is not in the
+ * stable API */
+#define ZSTD_FRAME_HEADER_SIZE_MAX 18
+
+/* Returns the content size recorded in the header of the first zstd frame
+ * or 0; files with more frames are larger, but walking all frames would cost
+ * more than the preallocation saves */
+static uint64_t
+zstd_decompressed_size(int fdi)
+{
+    uint8_t header[ZSTD_FRAME_HEADER_SIZE_MAX];
+    const ssize_t r = pread(fdi, header, sizeof(header), 0);
+    if (r <= 0)
+        return 0;
+
+    const unsigned long long size = ZSTD_getFrameContentSize(header, r);
+    if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR)
+        return 0;
+
+    return size;
+}
+#endif /*HAVE_ZSTD*/
+
+/* Returns the size of decompressed data or 0 if it is not known */
+static uint64_t
+decompressed_size(int fdi)
+{
+    struct stat st;
+    uint8_t header[6];
+    if (fstat(fdi, &st) != 0 || !S_ISREG(st.st_mode)
+        || pread(fdi, header, sizeof(header), 0) != sizeof(header))
+        return 0;
+
+#ifdef HAVE_LZMA
+    if (memcmp(header, s_xz_magic, sizeof(s_xz_magic)) == 0)
+        return xz_decompressed_size(fdi, st.st_size);
+#endif
+#ifdef HAVE_ZSTD
+    if (memcmp(header, s_zstd_magic, sizeof(s_zstd_magic)) == 0)
+        return zstd_decompressed_size(fdi);
+#endif
+
+    return 0;
+}
+
 static int
 decompress_fd_xz(int fdi, int fdo)
 {
 #ifdef HAVE_LZMA
-    uint8_t buf_in[BUFSIZ];
-    uint8_t buf_out[BUFSIZ];
+    preallocate_output(fdo, decompressed_size(fdi));
 
     lzma_stream strm = LZMA_STREAM_INIT;
-    lzma_ret ret = lzma_stream_decoder(&strm, UINT64_MAX, 0);
+#if LZMA_VERSION >= 50040002
+    /* Blocks of files compressed by multi-threaded xz are decompressed in
+     * parallel; other files are decompressed in a single thread */
+    lzma_mt mt = {
+        .flags = LZMA_CONCATENATED,
+        .threads = lzma_cputhreads(),
+        .timeout = 0,
+        .memlimit_threading = lzma_physmem() / 4,
+        .memlimit_stop = UINT64_MAX,
+    };
+    if (mt.threads == 0)
+        mt.threads = 1;
+    lzma_ret ret = lzma_stream_decoder_mt(&strm, &mt);
+#else
+    lzma_ret ret = lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED);
+#endif
     if (ret != LZMA_OK)
     {
-        close(fdi);
-        close(fdo);
         log_error("Failed to initialize XZ decoder: code %d", ret);
         return -ENOMEM;
     }
 
+    uint8_t *const buf_in = libreport_xmalloc(DECOMPRESS_BUFFER_SIZE);
+    uint8_t *const buf_out = libreport_xmalloc(DECOMPRESS_BUFFER_SIZE);
+    int r = 0;
+
     lzma_action action = LZMA_RUN;
 
     strm.next_out = buf_out;
-    strm.avail_out = sizeof(buf_out);
+    strm.avail_out = DECOMPRESS_BUFFER_SIZE;
 
     for (;;)
     {
         if (strm.avail_in == 0 && action == LZMA_RUN)
         {
-            strm.next_in = buf_in;
-            strm.avail_in = libreport_safe_read(fdi, buf_in, sizeof(buf_in));
-
-            if (strm.avail_in < 0)
+            const ssize_t rd = libreport_safe_read(fdi, buf_in, DECOMPRESS_BUFFER_SIZE);
+            if (rd < 0)
             {
                 perror_msg("Failed to read source core file");
-                close(fdi);
-                close(fdo);
-                lzma_end(&strm);
-                return -1;
+                r = -1;
+                break;
             }
 
-            if (strm.avail_in == 0)
+            strm.next_in = buf_in;
+            strm.avail_in = rd;
+
+            if (rd == 0)
                 action = LZMA_FINISH;
         }
 
         ret = lzma_code(&strm, action);
 
+        if (ret != LZMA_OK && ret != LZMA_STREAM_END)
+        {
+            log_error("Failed to decompress XZ data: code %d", ret);
+            r = -EBADMSG;
+            break;
+        }
+
         if (strm.avail_out == 0 || ret == LZMA_STREAM_END)
         {
-            const ssize_t n = sizeof(buf_out) - strm.avail_out;
-            if (n != libreport_safe_write(fdo, buf_out, n))
+            const ssize_t n = DECOMPRESS_BUFFER_SIZE - strm.avail_out;
+            if (n != libreport_full_write(fdo, buf_out, n))
             {
                 perror_msg("Failed to write decompressed data");
-                close(fdi);
-                close(fdo);
-                lzma_end(&strm);
-                return -1;
+                r = -1;
+                break;
             }
 
             if (ret == LZMA_STREAM_END)
@@ -166,17 +345,91 @@ decompress_fd_xz(int fdi, int fdo)
             }
 
             strm.next_out = buf_out;
-            strm.avail_out = sizeof(buf_out);
+            strm.avail_out = DECOMPRESS_BUFFER_SIZE;
         }
     }
 
-    return 0;
+    lzma_end(&strm);
+    free(buf_out);
+    free(buf_in);
+    return r;
 #else /*HAVE_LZMA*/
     const char *cmd[] = { "xzcat", "-d", "-", NULL };
     return decompress_using_fork_execvp(cmd, fdi, fdo);
 #endif /*HAVE_LZMA*/
 }
 
+static int
+decompress_fd_zstd(int fdi, int fdo)
+{
+#ifdef HAVE_ZSTD
+    preallocate_output(fdo, decompressed_size(fdi));
+
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    if (dctx == NULL)
+    {
+        log_error("Failed to initialize zstd decoder");
+        return -ENOMEM;
+    }
+
+    uint8_t *const buf_in = libreport_xmalloc(DECOMPRESS_BUFFER_SIZE);
+    uint8_t *const buf_out = libreport_xmalloc(DECOMPRESS_BUFFER_SIZE);
+    int r = 0;
+    /* 0 at the end of a frame */
+    size_t hint = 1;
+
+    for (;;)
+    {
+        const ssize_t rd = libreport_safe_read(fdi, buf_in, DECOMPRESS_BUFFER_SIZE);
+        if (rd < 0)
+        {
+            perror_msg("Failed to read source core file");
+            r = -1;
+            break;
+        }
+
+        if (rd == 0)
+        {
+            if (hint != 0)
+            {
+                log_error("Truncated zstd data");
+                r = -EBADMSG;
+            }
+            break;
+        }
+
+        ZSTD_inBuffer in = { buf_in, rd, 0 };
+        while (in.pos < in.size)
+        {
+            ZSTD_outBuffer out = { buf_out, DECOMPRESS_BUFFER_SIZE, 0 };
+            hint = ZSTD_decompressStream(dctx, &out, &in);
+            if (ZSTD_isError(hint))
+            {
+                log_error("Failed to decompress zstd data: %s", ZSTD_getErrorName(hint));
+                r = -EBADMSG;
+                goto finito;
+            }
+
+            if ((ssize_t)out.pos != libreport_full_write(fdo, buf_out, out.pos))
+            {
+                perror_msg("Failed to write decompressed data");
+                r = -1;
+                goto finito;
+            }
+        }
+    }
+
+finito:
+    ZSTD_freeDCtx(dctx);
+    free(buf_out);
+    free(buf_in);
+    return r;
+#else /*HAVE_ZSTD*/
+    const char *cmd[] = { "zstd", "-dc", "-", NULL };
+    return decompress_using_fork_execvp(cmd, fdi, fdo);
+#endif /*HAVE_ZSTD*/
+}
+
 static int
 decompress_fd_lz4(int fdi, int fdo)
 {
@@ -280,6 +533,9 @@ int libreport_decompress_fd(int fdi, int fdo)
     if (is_format("lz4", header, sizeof(header), s_lz4_magic, sizeof(s_lz4_magic)))
         return decompress_fd_lz4(fdi, fdo);
 
+    if (is_format("zstd", header, sizeof(header), s_zstd_magic, sizeof(s_zstd_magic)))
+        return decompress_fd_zstd(fdi, fdo);
+
     error_msg("Unsupported file format");
     return -1;
 }
@@ -325,3 +581,381 @@ int libreport_decompress_file(const char *path_in, const char *path_out, mode_t
     return libreport_decompress_file_ext_at(path_in, AT_FDCWD, path_out, mode_out, -1, -1,
             O_RDONLY, O_WRONLY | O_CREAT | O_EXCL | O_TRUNC);
 }
+
+/* Random access */
+
+enum decompress_index_format
+{
+    DECOMPRESS_INDEX_XZ,
+    DECOMPRESS_INDEX_ZSTD,
+};
+
+struct decompress_block
+{
+    uint64_t compressed_offset;
+    uint64_t compressed_size;
+    uint64_t uncompressed_offset;
+    uint64_t uncompressed_size;
+};
+
+struct decompress_index
+{
+    enum decompress_index_format format;
+    int fd;
+    uint64_t size;
+    struct decompress_block *blocks;
+    size_t block_count;
+    uint8_t *buffer;
+#ifdef HAVE_LZMA
+    lzma_check check;
+#endif
+#ifdef HAVE_ZSTD
+    const uint8_t *map;
+    size_t map_size;
+    ZSTD_DCtx *dctx;
+#endif
+};
+
+/* Copies the part of decompressed data starting at offset to buf
+ *
+ * @param data_offset Offset of data in decompressed stream; advanced by size
+ * @return Number of copied bytes
+ */
+static size_t
+copy_block_data(const uint8_t *data, size_t size, uint64_t *data_offset,
+        uint64_t offset, uint8_t *buf, size_t count)
+{
+    const uint64_t start = *data_offset;
+    *data_offset += size;
+
+    if (start + size <= offset)
+        return 0;
+
+    const size_t skip = offset > start ? offset - start : 0;
+    size_t n = size - skip;
+    if (n > count)
+        n = count;
+
+    memcpy(buf, data + skip, n);
+    return n;
+}
+
+#ifdef HAVE_LZMA
+static struct decompress_index *
+decompress_index_new_xz(int fd, uint64_t file_size)
+{
+    lzma_stream_flags header_flags;
+    lzma_index *idx = xz_read_index(fd, file_size, &header_flags);
+    if (idx == NULL)
+        return NULL;
+
+    struct decompress_index *index = libreport_xzalloc(sizeof(*index));
+    index->format = DECOMPRESS_INDEX_XZ;
+    index->fd = fd;
+    index->size = lzma_index_uncompressed_size(idx);
+    index->check = header_flags.check;
+    index->block_count = lzma_index_block_count(idx);
+    index->blocks = libreport_xzalloc(index->block_count * sizeof(index->blocks[0]) + 1);
+
+    lzma_index_iter iter;
+    lzma_index_iter_init(&iter, idx);
+    for (size_t i = 0; i < index->block_count && !lzma_index_iter_next(&iter, LZMA_INDEX_ITER_BLOCK); ++i)
+    {
+        index->blocks[i].compressed_offset = iter.block.compressed_file_offset;
+        index->blocks[i].compressed_size = iter.block.total_size;
+        index->blocks[i].uncompressed_offset = iter.block.uncompressed_file_offset;
+        index->blocks[i].uncompressed_size = iter.block.uncompressed_size;
+    }
+
+    lzma_index_end(idx, NULL);
+    return index;
+}
+
+static ssize_t
+decompress_block_xz(struct decompress_index *index, const struct decompress_block *block,
+        uint8_t *buf, size_t count, uint64_t offset)
+{
+    uint8_t header[LZMA_BLOCK_HEADER_SIZE_MAX];
+    if (pread(index->fd, header, 1, block->compressed_offset) != 1)
+        return -EIO;
+
+    lzma_filter filters[LZMA_FILTERS_MAX + 1];
+    lzma_block lb = {
+        .version = 1,
+        .check = index->check,
+        .filters = filters,
+        .header_size = lzma_block_header_size_decode(header[0]),
+    };
+
+    if (lb.header_size > block->compressed_size
+        || pread(index->fd, header + 1, lb.header_size - 1, block->compressed_offset + 1) != lb.header_size - 1)
+        return -EIO;
+
+    if (lzma_block_header_decode(&lb, NULL, header) != LZMA_OK)
+        return -EBADMSG;
+
+    lzma_stream strm = LZMA_STREAM_INIT;
+    lzma_ret ret = lzma_block_decoder(&strm, &lb);
+    for (size_t i = 0; filters[i].id != LZMA_VLI_UNKNOWN; ++i)
+        free(filters[i].options);
+
+    if (ret != LZMA_OK)
+        return -EBADMSG;
+
+    uint8_t *const buf_in = index->buffer;
+    uint8_t *const buf_out = index->buffer + DECOMPRESS_BUFFER_SIZE;
+    uint64_t in_offset = block->compressed_offset + lb.header_size;
+    const uint64_t in_end = block->compressed_offset + block->compressed_size;
+    uint64_t out_offset = block->uncompressed_offset;
+    size_t copied = 0;
+    ssize_t r = 0;
+
+    strm.next_out = buf_out;
+    strm.avail_out = DECOMPRESS_BUFFER_SIZE;
+
+    while (copied < count)
+    {
+        if (strm.avail_in == 0 && in_offset < in_end)
+        {
+            size_t n = in_end - in_offset < DECOMPRESS_BUFFER_SIZE ? in_end - in_offset : DECOMPRESS_BUFFER_SIZE;
+            const ssize_t rd = pread(index->fd, buf_in, n, in_offset);
+            if (rd <= 0)
+            {
+                r = rd < 0 ? -errno : -EIO;
+                break;
+            }
+
+            in_offset += rd;
+            strm.next_in = buf_in;
+            strm.avail_in = rd;
+        }
+
+        ret = lzma_code(&strm, LZMA_RUN);
+        if (ret != LZMA_OK && ret != LZMA_STREAM_END)
+        {
+            log_debug("Failed to decompress XZ block: code %d", ret);
+            r = -EBADMSG;
+            break;
+        }
+
+        if (strm.avail_out == 0 || ret == LZMA_STREAM_END)
+        {
+            copied += copy_block_data(buf_out, DECOMPRESS_BUFFER_SIZE - strm.avail_out, &out_offset,
+                    offset + copied, buf + copied, count - copied);
+
+            if (ret == LZMA_STREAM_END)
+                break;
+
+            strm.next_out = buf_out;
+            strm.avail_out = DECOMPRESS_BUFFER_SIZE;
+        }
+    }
+
+    lzma_end(&strm);
+    return r < 0 ? r : (ssize_t)copied;
+}
+#endif /*HAVE_LZMA*/
+
+#ifdef HAVE_ZSTD
+static struct decompress_index *
+decompress_index_new_zstd(int fd, uint64_t file_size)
+{
+    if (file_size > SIZE_MAX)
+        return NULL;
+
+    uint8_t *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        log_debug("Can't map zstd file: %s", strerror(errno));
+        return NULL;
+    }
+
+    struct decompress_index *index = libreport_xzalloc(sizeof(*index));
+    index->format = DECOMPRESS_INDEX_ZSTD;
+    index->fd = fd;
+    index->map = map;
+    index->map_size = file_size;
+
+    size_t allocated = 0;
+    size_t pos = 0;
+    while (pos < file_size)
+    {
+        const unsigned long long content_size = ZSTD_getFrameContentSize(map + pos, file_size - pos);
+        const size_t frame_size = ZSTD_findFrameCompressedSize(map + pos, file_size - pos);
+        if (content_size == ZSTD_CONTENTSIZE_UNKNOWN
+            || content_size == ZSTD_CONTENTSIZE_ERROR
+            || ZSTD_isError(frame_size))
+        {
+            log_debug("zstd frame at %zu does not record its content size", pos);
+            libreport_decompress_index_free(index);
+            return NULL;
+        }
+
+        /* Skippable frames have no content */
+        if (content_size != 0)
+        {
+            if (index->block_count == allocated)
+            {
+                allocated = allocated ? allocated * 2 : 16;
+                index->blocks = libreport_xrealloc(index->blocks, allocated * sizeof(index->blocks[0]));
+            }
+
+            struct decompress_block *const block = index->blocks + index->block_count++;
+            block->compressed_offset = pos;
+            block->compressed_size = frame_size;
+            block->uncompressed_offset = index->size;
+            block->uncompressed_size = content_size;
+            index->size += content_size;
+        }
+
+        pos += frame_size;
+    }
+
+    return index;
+}
+
+static ssize_t
+decompress_block_zstd(struct decompress_index *index, const struct decompress_block *block,
+        uint8_t *buf, size_t count, uint64_t offset)
+{
+    if (index->dctx == NULL)
+    {
+        index->dctx = ZSTD_createDCtx();
+        if (index->dctx == NULL)
+            return -ENOMEM;
+    }
+    else
+        ZSTD_DCtx_reset(index->dctx, ZSTD_reset_session_only);
+
+    uint8_t *const buf_out = index->buffer;
+    ZSTD_inBuffer in = { index->map + block->compressed_offset, block->compressed_size, 0 };
+    uint64_t out_offset = block->uncompressed_offset;
+    size_t copied = 0;
+    size_t hint = 1;
+
+    while (copied < count && hint != 0)
+    {
+        ZSTD_outBuffer out = { buf_out, DECOMPRESS_BUFFER_SIZE, 0 };
+        hint = ZSTD_decompressStream(index->dctx, &out, &in);
+        if (ZSTD_isError(hint))
+        {
+            log_debug("Failed to decompress zstd frame: %s", ZSTD_getErrorName(hint));
+            return -EBADMSG;
+        }
+
+        if (out.pos == 0 && in.pos == in.size)
+            return -EBADMSG;
+
+        copied += copy_block_data(buf_out, out.pos, &out_offset,
+                offset + copied, buf + copied, count - copied);
+    }
+
+    return copied;
+}
+#endif /*HAVE_ZSTD*/
+
+struct decompress_index *libreport_decompress_index_new(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return NULL;
+
+    uint8_t header[6];
+    if (pread(fd, header, sizeof(header), 0) != sizeof(header))
+        return NULL;
+
+    struct decompress_index *index = NULL;
+#ifdef HAVE_LZMA
+    if (memcmp(header, s_xz_magic, sizeof(s_xz_magic)) == 0)
+        index = decompress_index_new_xz(fd, st.st_size);
+#endif
+#ifdef HAVE_ZSTD
+    if (memcmp(header, s_zstd_magic, sizeof(s_zstd_magic)) == 0)
+        index = decompress_index_new_zstd(fd, st.st_size);
+#endif
+
+    if (index != NULL)
+        index->buffer = libreport_xmalloc(2 * DECOMPRESS_BUFFER_SIZE);
+
+    return index;
+}
+
+void libreport_decompress_index_free(struct decompress_index *index)
+{
+    if (index == NULL)
+        return;
+
+#ifdef HAVE_ZSTD
+    if (index->map != NULL)
+        munmap((void *)index->map, index->map_size);
+    ZSTD_freeDCtx(index->dctx);
+#endif
+    free(index->buffer);
+    free(index->blocks);
+    free(index);
+}
+
+uint64_t libreport_decompress_index_size(const struct decompress_index *index)
+{
+    return index->size;
+}
+
+ssize_t libreport_decompress_index_pread(struct decompress_index *index, void *buf, size_t count, uint64_t offset)
+{
+    if (offset >= index->size)
+        return 0;
+
+    if (count > index->size - offset)
+        count = index->size - offset;
+
+    if (count > SSIZE_MAX)
+        count = SSIZE_MAX;
+
+    /* Binary search for the block containing the offset */
+    size_t lo = 0;
+    size_t hi = index->block_count;
+    while (hi - lo > 1)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (index->blocks[mid].uncompressed_offset <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    size_t copied = 0;
+    for (size_t i = lo; i < index->block_count && copied < count; ++i)
+    {
+        const struct decompress_block *const block = index->blocks + i;
+        if (block->uncompressed_size == 0)
+            continue;
+
+        ssize_t r = -ENOSYS;
+        switch (index->format)
+        {
+#ifdef HAVE_LZMA
+            case DECOMPRESS_INDEX_XZ:
+                r = decompress_block_xz(index, block, (uint8_t *)buf + copied, count - copied, offset + copied);
+                break;
+#endif
+#ifdef HAVE_ZSTD
+            case DECOMPRESS_INDEX_ZSTD:
+                r = decompress_block_zstd(index, block, (uint8_t *)buf + copied, count - copied, offset + copied);
+                break;
+#endif
+            default:
+                break;
+        }
+
+        if (r < 0)
+            return copied > 0 ? (ssize_t)copied : r;
+
+        /* The block is shorter than the index says */
+        if (r == 0)
+            return copied > 0 ? (ssize_t)copied : -EBADMSG;
+
+        copied += r;
+    }
+
+    return copied;
+}
@@ -0,0 +1,399 @@
+/*
+    Copyright (C) 2024  ABRT team
+    Copyright (C) 2024  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "internal_libreport.h"
+
+// A cache file holds a single serialized GVariant:
+//
+//   (s                          format version
+//    a{s                        key
+//      (a(sbttxxx)              sources: path, exists, dev, ino, size, mtime
+//       v)})                    cached value
+//
+// GVariant copes with malformed serialized data, so a damaged cache file
+// results in cache misses, not in crashes. The cache is rewritten as a whole
+// (atomically) when a process stored new values.
+
+#define CONFIG_CACHE_FORMAT "libreport-config-cache-1"
+#define CONFIG_CACHE_ENTRY_TYPE "(a(sbttxxx)v)"
+
+/* Disables the cache, e.g. for debugging of configuration files */
+#define CONFIG_CACHE_DISABLE_ENV "LIBREPORT_NO_CONFIG_CACHE"
+/* Overrides the cache directory, e.g. for tests */
+#define CONFIG_CACHE_DIR_ENV "LIBREPORT_CONFIG_CACHE_DIR"
+
+struct config_cache_source
+{
+    char *path;
+    bool exists;
+    guint64 dev;
+    guint64 ino;
+    gint64 size;
+    gint64 mtime_sec;
+    gint64 mtime_nsec;
+};
+
+struct config_cache_sources
+{
+    GArray *sources; /* struct config_cache_source */
+};
+
+struct config_cache
+{
+    char *path;
+    /* key -> GVariant CONFIG_CACHE_ENTRY_TYPE; read from the file */
+    GHashTable *entries;
+    /* key -> GVariant CONFIG_CACHE_ENTRY_TYPE; to be written */
+    GHashTable *stored;
+};
+
+static void config_cache_source_stat(struct config_cache_source *source)
+{
+    struct stat st;
+    source->exists = (stat(source->path, &st) == 0);
+    if (!source->exists)
+        memset(&st, 0, sizeof(st));
+
+    source->dev = st.st_dev;
+    source->ino = st.st_ino;
+    source->size = st.st_size;
+    source->mtime_sec = st.st_mtim.tv_sec;
+    source->mtime_nsec = st.st_mtim.tv_nsec;
+}
+
+static bool config_cache_source_changed(const struct config_cache_source *source)
+{
+    struct config_cache_source current = { .path = source->path };
+    config_cache_source_stat(&current);
+
+    const bool changed = current.exists != source->exists
+                      || current.dev != source->dev
+                      || current.ino != source->ino
+                      || current.size != source->size
+                      || current.mtime_sec != source->mtime_sec
+                      || current.mtime_nsec != source->mtime_nsec;
+
+    if (changed)
+        log_debug("Configuration file '%s' has changed", source->path);
+
+    return changed;
+}
+
+struct config_cache_sources *libreport_config_cache_sources_new(void)
+{
+    struct config_cache_sources *sources = libreport_xzalloc(sizeof(*sources));
+    sources->sources = g_array_new(FALSE, FALSE, sizeof(struct config_cache_source));
+    return sources;
+}
+
+void libreport_config_cache_sources_free(struct config_cache_sources *sources)
+{
+    if (sources == NULL)
+        return;
+
+    for (unsigned i = 0; i < sources->sources->len; ++i)
+        free(g_array_index(sources->sources, struct config_cache_source, i).path);
+
+    g_array_free(sources->sources, TRUE);
+    free(sources);
+}
+
+void libreport_config_cache_sources_add(struct config_cache_sources *sources, const char *path)
+{
+    struct config_cache_source source = { .path = libreport_xstrdup(path) };
+    config_cache_source_stat(&source);
+    g_array_append_val(sources->sources, source);
+}
+
+bool libreport_config_cache_sources_changed(const struct config_cache_sources *sources)
+{
+    for (unsigned i = 0; i < sources->sources->len; ++i)
+        if (config_cache_source_changed(&g_array_index(sources->sources, struct config_cache_source, i)))
+            return true;
+
+    return false;
+}
+
+static GVariant *config_cache_sources_to_variant(const struct config_cache_sources *sources)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a(sbttxxx)"));
+
+    for (unsigned i = 0; i < sources->sources->len; ++i)
+    {
+        const struct config_cache_source *source = &g_array_index(sources->sources, struct config_cache_source, i);
+        g_variant_builder_add(&builder, "(sbttxxx)",
+                source->path, source->exists, source->dev, source->ino,
+                source->size, source->mtime_sec, source->mtime_nsec);
+    }
+
+    return g_variant_builder_end(&builder);
+}
+
+static struct config_cache_sources *config_cache_sources_from_variant(GVariant *variant)
+{
+    struct config_cache_sources *sources = libreport_config_cache_sources_new();
+
+    GVariantIter iter;
+    g_variant_iter_init(&iter, variant);
+    const char *path;
+    gboolean exists;
+    struct config_cache_source source;
+    while (g_variant_iter_next(&iter, "(&sbttxxx)",
+                &path, &exists, &source.dev, &source.ino,
+                &source.size, &source.mtime_sec, &source.mtime_nsec))
+    {
+        source.path = libreport_xstrdup(path);
+        source.exists = exists;
+        g_array_append_val(sources->sources, source);
+    }
+
+    return sources;
+}
+
+static struct config_cache_sources *config_cache_entry_sources(GVariant *entry)
+{
+    GVariant *variant = g_variant_get_child_value(entry, 0);
+    struct config_cache_sources *sources = config_cache_sources_from_variant(variant);
+    g_variant_unref(variant);
+    return sources;
+}
+
+char *libreport_cache_dir(const char *dir_env)
+{
+    const char *dir = getenv(dir_env);
+    if (dir != NULL && dir[0] != '\0')
+        return libreport_xstrdup(dir);
+
+    if (geteuid() == 0)
+        return libreport_xstrdup(LOCALSTATEDIR"/cache/libreport");
+
+    return libreport_concat_path_file(g_get_user_cache_dir(), "libreport");
+}
+
+GVariant *libreport_cache_file_read(const char *path, const char *format, const char *entries_type)
+{
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (errno != ENOENT)
+            log_debug("Can't open cache '%s': %s", path, strerror(errno));
+        return NULL;
+    }
+
+    /* Do not trust files written by somebody else */
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid())
+    {
+        log_debug("Ignoring cache '%s' of unexpected type or owner", path);
+        close(fd);
+        return NULL;
+    }
+
+    GError *error = NULL;
+    GMappedFile *mapped = g_mapped_file_new_from_fd(fd, /*writable:*/ FALSE, &error);
+    close(fd);
+    if (mapped == NULL)
+    {
+        log_debug("Can't map cache '%s': %s", path, error->message);
+        g_error_free(error);
+        return NULL;
+    }
+
+    GBytes *bytes = g_mapped_file_get_bytes(mapped);
+    g_mapped_file_unref(mapped);
+
+    char *type = g_strdup_printf("(s%s)", entries_type);
+    GVariant *root = g_variant_ref_sink(g_variant_new_from_bytes(G_VARIANT_TYPE(type), bytes, FALSE));
+    g_bytes_unref(bytes);
+    g_free(type);
+
+    GVariant *entries = NULL;
+    GVariant *root_format = g_variant_get_child_value(root, 0);
+    if (strcmp(g_variant_get_string(root_format, NULL), format) == 0)
+        entries = g_variant_get_child_value(root, 1);
+    else
+        log_debug("Ignoring cache '%s' of unknown format", path);
+
+    g_variant_unref(root_format);
+    g_variant_unref(root);
+    return entries;
+}
+
+int libreport_cache_file_write(const char *path, const char *format, GVariant *entries)
+{
+    GVariant *children[] = { g_variant_new_string(format), entries };
+    GVariant *root = g_variant_ref_sink(g_variant_new_tuple(children, ARRAY_SIZE(children)));
+
+    int r = 0;
+    GError *error = NULL;
+    if (!g_file_set_contents(path, g_variant_get_data(root), g_variant_get_size(root), &error))
+    {
+        r = -EIO;
+        log_debug("Can't write cache '%s': %s", path, error->message);
+        g_error_free(error);
+    }
+
+    g_variant_unref(root);
+    return r;
+}
+
+static void config_cache_read(struct config_cache *cache)
+{
+    GVariant *entries = libreport_cache_file_read(cache->path, CONFIG_CACHE_FORMAT,
+                "a{s" CONFIG_CACHE_ENTRY_TYPE "}");
+    if (entries == NULL)
+        return;
+
+    GVariantIter iter;
+    g_variant_iter_init(&iter, entries);
+    char *key;
+    GVariant *entry;
+    while (g_variant_iter_next(&iter, "{s@" CONFIG_CACHE_ENTRY_TYPE "}", &key, &entry))
+        g_hash_table_replace(cache->entries, key, entry);
+
+    g_variant_unref(entries);
+}
+
+struct config_cache *libreport_config_cache_open(const char *name)
+{
+    if (getenv(CONFIG_CACHE_DISABLE_ENV) != NULL)
+        return NULL;
+
+    struct config_cache *cache = libreport_xzalloc(sizeof(*cache));
+
+    char *dir = libreport_cache_dir(CONFIG_CACHE_DIR_ENV);
+    char *file_name = libreport_xasprintf("%s.cache", name);
+    cache->path = libreport_concat_path_file(dir, file_name);
+    free(file_name);
+    free(dir);
+
+    cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_variant_unref);
+    cache->stored = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_variant_unref);
+
+    config_cache_read(cache);
+
+    return cache;
+}
+
+static int config_cache_write(struct config_cache *cache)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{s" CONFIG_CACHE_ENTRY_TYPE "}"));
+
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+
+    g_hash_table_iter_init(&iter, cache->stored);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+        g_variant_builder_add(&builder, "{s@" CONFIG_CACHE_ENTRY_TYPE "}", (const char *)key, (GVariant *)value);
+
+    /* Keep the entries of other processes unless they are out of date */
+    g_hash_table_iter_init(&iter, cache->entries);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        if (g_hash_table_contains(cache->stored, key))
+            continue;
+
+        struct config_cache_sources *sources = config_cache_entry_sources(value);
+        const bool changed = libreport_config_cache_sources_changed(sources);
+        libreport_config_cache_sources_free(sources);
+
+        if (!changed)
+            g_variant_builder_add(&builder, "{s@" CONFIG_CACHE_ENTRY_TYPE "}", (const char *)key, (GVariant *)value);
+    }
+
+    GVariant *entries = g_variant_builder_end(&builder);
+
+    int r = 0;
+    char *dir = libreport_cache_dir(CONFIG_CACHE_DIR_ENV);
+    if (g_mkdir_with_parents(dir, geteuid() == 0 ? 0755 : 0700) != 0)
+    {
+        r = -errno;
+        log_debug("Can't create configuration cache directory '%s': %s", dir, strerror(errno));
+        g_variant_unref(g_variant_ref_sink(entries));
+    }
+    else
+        r = libreport_cache_file_write(cache->path, CONFIG_CACHE_FORMAT, entries);
+
+    free(dir);
+    return r;
+}
+
+void libreport_config_cache_close(struct config_cache *cache)
+{
+    if (cache == NULL)
+        return;
+
+    if (g_hash_table_size(cache->stored) != 0)
+        config_cache_write(cache);
+
+    g_hash_table_destroy(cache->stored);
+    g_hash_table_destroy(cache->entries);
+    free(cache->path);
+    free(cache);
+}
+
+GVariant *libreport_config_cache_lookup(struct config_cache *cache, const char *key,
+        struct config_cache_sources **sources)
+{
+    if (cache == NULL)
+        return NULL;
+
+    GVariant *entry = g_hash_table_lookup(cache->stored, key);
+    if (entry == NULL)
+        entry = g_hash_table_lookup(cache->entries, key);
+
+    if (entry == NULL)
+        return NULL;
+
+    struct config_cache_sources *entry_sources = config_cache_entry_sources(entry);
+    if (libreport_config_cache_sources_changed(entry_sources))
+    {
+        libreport_config_cache_sources_free(entry_sources);
+        return NULL;
+    }
+
+    if (sources != NULL)
+        *sources = entry_sources;
+    else
+        libreport_config_cache_sources_free(entry_sources);
+
+    GVariant *value = g_variant_get_child_value(entry, 1);
+    GVariant *unboxed = g_variant_get_variant(value);
+    g_variant_unref(value);
+
+    log_debug("Using cached configuration '%s'", key);
+    return unboxed;
+}
+
+void libreport_config_cache_store(struct config_cache *cache, const char *key,
+        struct config_cache_sources *sources, GVariant *value)
+{
+    if (cache == NULL)
+    {
+        g_variant_unref(g_variant_ref_sink(value));
+        return;
+    }
+
+    GVariant *entry = g_variant_ref_sink(g_variant_new("(@a(sbttxxx)v)",
+                config_cache_sources_to_variant(sources), value));
+
+    g_hash_table_replace(cache->stored, g_strdup(key), entry);
+}
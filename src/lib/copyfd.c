@@ -22,109 +22,402 @@
  *
  */
 #include "internal_libreport.h"
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 
-#define CONFIG_FEATURE_COPYBUF_KB 4
+#ifndef FICLONE
+# define FICLONE _IOW(0x94, 9, int)
+#endif
+
+#define CONFIG_FEATURE_COPYBUF_KB 256
+
+/* Granularity of holes created by COPYFD_SPARSE in data read by read() */
+#define SPARSE_BLOCK_SIZE 4096
+
+/* The kernel never transfers more in a single call (MAX_RW_COUNT) */
+#define KERNEL_COPY_CHUNK 0x7ffff000
 
 static const char msg_write_error[] = "write error";
 static const char msg_read_error[] = "read error";
 
+/* The copy methods ordered from the fastest one; if the kernel refuses a
+ * method, the next applicable one is tried. */
+enum copy_method {
+	COPY_FILE_RANGE,
+	COPY_SPLICE,
+	COPY_SENDFILE,
+	COPY_READ_WRITE,
+};
+
+struct copy_ctx {
+	int src_fd;
+	int dst_fd;
+	int flags;
+	enum copy_method method;
+	bool src_is_reg;
+	/* the destination ends with a hole created by lseek() */
+	bool last_was_seek;
+	char *buffer;
+	size_t buffer_size;
+};
+
+static bool is_zero_block(const char *buf, size_t size)
+{
+	/* Check a few Bytes by hand and let memcmp() compare the rest of the
+	 * block with itself shifted by those Bytes */
+	const size_t head = size < 16 ? size : 16;
+	for (size_t i = 0; i < head; ++i)
+		if (buf[i] != 0)
+			return false;
+
+	return memcmp(buf, buf + head, size - head) == 0;
+}
+
+static void next_copy_method(struct copy_ctx *ctx)
+{
+	if (ctx->method == COPY_FILE_RANGE || (ctx->method == COPY_SPLICE && ctx->src_is_reg))
+		ctx->method = COPY_SENDFILE;
+	else
+		ctx->method = COPY_READ_WRITE;
+
+	log_debug("Falling back to copy method %d", ctx->method);
+}
+
+/* Copies up to len Bytes in the kernel, without passing the data through
+ * the user space.
+ *
+ * Returns the number of copied Bytes, which is less than len at EOF or if
+ * the kernel cannot copy the data between the descriptors; -1 on errors.
+ */
+static off_t kernel_copy(struct copy_ctx *ctx, off_t len)
+{
+	off_t copied = 0;
+	while (copied < len && ctx->method != COPY_READ_WRITE) {
+		const size_t chunk = len - copied < KERNEL_COPY_CHUNK ? len - copied : KERNEL_COPY_CHUNK;
+		ssize_t r;
+
+		switch (ctx->method) {
+		case COPY_FILE_RANGE:
+			r = copy_file_range(ctx->src_fd, NULL, ctx->dst_fd, NULL, chunk, 0);
+			break;
+		case COPY_SPLICE:
+			r = splice(ctx->src_fd, NULL, ctx->dst_fd, NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+			break;
+		default:
+			r = sendfile(ctx->dst_fd, ctx->src_fd, NULL, chunk);
+			break;
+		}
+
+		if (r == 0) /* EOF or a pseudo file - let read() decide */
+			break;
+
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			/* The calls fail without touching the data if the method
+			 * is not supported for the descriptors */
+			if (errno == ENOSYS || errno == EINVAL || errno == EXDEV
+			 || errno == EOPNOTSUPP || errno == ENOTSUP || errno == EBADF
+			) {
+				next_copy_method(ctx);
+				continue;
+			}
+			perror_msg("%s", msg_write_error);
+			return -1;
+		}
+
+		copied += r;
+		ctx->last_was_seek = false;
+	}
+
+	return copied;
+}
+
+/* Writes the buffer to the destination, skipping zero blocks if sparse
+ * files are requested */
+static int write_buffer(struct copy_ctx *ctx, const char *buffer, size_t size)
+{
+	size_t pos = 0;
+	while (pos < size) {
+		size_t len = size - pos;
+		if (ctx->flags & COPYFD_SPARSE) {
+			len = 0;
+			while (pos + len < size) {
+				const size_t block = size - pos - len < SPARSE_BLOCK_SIZE ? size - pos - len : SPARSE_BLOCK_SIZE;
+				if (is_zero_block(buffer + pos + len, block)) {
+					if (len != 0)
+						break;
+					if (lseek(ctx->dst_fd, block, SEEK_CUR) < 0) {
+						ctx->flags &= ~COPYFD_SPARSE;
+						len = size - pos;
+						break;
+					}
+					ctx->last_was_seek = true;
+					pos += block;
+					continue;
+				}
+				len += block;
+			}
+			if (len == 0)
+				continue;
+		}
+
+		ssize_t wr = libreport_full_write(ctx->dst_fd, buffer + pos, len);
+		if (wr < (ssize_t)len) {
+			perror_msg("%s", msg_write_error);
+			return -1;
+		}
+		ctx->last_was_seek = false;
+		pos += len;
+	}
+
+	return 0;
+}
+
+/* Copies up to len Bytes at the current offsets.
+ *
+ * Returns the number of copied Bytes (less than len only at EOF); -1 on
+ * errors.
+ */
+static off_t copy_data(struct copy_ctx *ctx, off_t len)
+{
+	off_t copied = kernel_copy(ctx, len);
+	if (copied < 0)
+		return -1;
+
+	while (copied < len) {
+		const size_t want = len - copied < ctx->buffer_size ? len - copied : ctx->buffer_size;
+		ssize_t rd = libreport_safe_read(ctx->src_fd, ctx->buffer, want);
+		if (rd < 0) {
+			perror_msg("%s", msg_read_error);
+			return -1;
+		}
+		if (rd == 0)
+			break;
+		if (write_buffer(ctx, ctx->buffer, rd) != 0)
+			return -1;
+		copied += rd;
+	}
+
+	return copied;
+}
+
+/* Creates a copy-on-write clone of the whole source file.
+ *
+ * Returns the size of the clone; 0 if the file system cannot clone the
+ * file; -1 on errors.
+ */
+static off_t clone_file(struct copy_ctx *ctx, const struct stat *src_st, off_t limit)
+{
+	if (!ctx->src_is_reg || src_st->st_size > limit)
+		return 0;
+
+	struct stat dst_st;
+	if (fstat(ctx->dst_fd, &dst_st) != 0 || !S_ISREG(dst_st.st_mode) || dst_st.st_size != 0)
+		return 0;
+
+	/* FICLONE replaces the whole destination by the whole source */
+	if (lseek(ctx->src_fd, 0, SEEK_CUR) != 0 || lseek(ctx->dst_fd, 0, SEEK_CUR) != 0)
+		return 0;
+
+	if (ioctl(ctx->dst_fd, FICLONE, ctx->src_fd) != 0)
+		return 0;
+
+	/* The source might have grown since fstat() */
+	const off_t size = lseek(ctx->dst_fd, 0, SEEK_END);
+	if (size <= 0 || lseek(ctx->src_fd, size, SEEK_SET) != size) {
+		perror_msg("%s", msg_write_error);
+		return -1;
+	}
+
+	log_debug("Cloned %llu Bytes", (unsigned long long)size);
+	return size;
+}
+
+/* Copies up to limit Bytes of the regular source file and recreates its
+ * holes in the destination. Data beyond the size the file had when the
+ * copy started is left for the caller.
+ *
+ * Returns the number of Bytes the offsets were moved by; -1 on errors.
+ */
+static off_t copy_sparse_file(struct copy_ctx *ctx, const struct stat *src_st, off_t limit)
+{
+	const off_t src_start = lseek(ctx->src_fd, 0, SEEK_CUR);
+	const off_t dst_start = lseek(ctx->dst_fd, 0, SEEK_CUR);
+	if (src_start < 0 || dst_start < 0 || src_start >= src_st->st_size)
+		return 0;
+
+	const off_t end = src_st->st_size - src_start > limit ? src_start + limit : src_st->st_size;
+	off_t pos = src_start;
+
+	while (pos < end) {
+		off_t data = lseek(ctx->src_fd, pos, SEEK_DATA);
+		if (data < 0) {
+			if (errno != ENXIO) { /* SEEK_DATA not supported */
+				if (pos != src_start)
+					goto error;
+				return 0;
+			}
+			data = end; /* the rest is a hole */
+		}
+		if (data >= end) {
+			pos = end;
+			break;
+		}
+
+		off_t hole = lseek(ctx->src_fd, data, SEEK_HOLE);
+		if (hole < 0 || hole > end)
+			hole = end;
+
+		if (lseek(ctx->src_fd, data, SEEK_SET) != data
+		 || lseek(ctx->dst_fd, dst_start + (data - src_start), SEEK_SET) < 0
+		) {
+			goto error;
+		}
+
+		const off_t copied = copy_data(ctx, hole - data);
+		if (copied < 0)
+			return -1;
+
+		pos = data + copied;
+		if (copied < hole - data) /* the file was truncated */
+			break;
+	}
+
+	/* Leave both offsets after the copied range */
+	const off_t dst_pos = dst_start + (pos - src_start);
+	if (lseek(ctx->src_fd, pos, SEEK_SET) != pos
+	 || lseek(ctx->dst_fd, dst_pos, SEEK_SET) != dst_pos
+	) {
+		goto error;
+	}
+
+	/* The source ends with a hole */
+	struct stat dst_st;
+	if (fstat(ctx->dst_fd, &dst_st) == 0 && dst_st.st_size < dst_pos)
+		ctx->last_was_seek = true;
+
+	return pos - src_start;
+
+ error:
+	perror_msg("%s", msg_write_error);
+	return -1;
+}
+
+/* Copies up to size Bytes (everything if size is 0) from src_fd to dst_fd.
+ *
+ * The data are copied by the fastest means the kernel provides for the
+ * pair of descriptors: a reflink (FICLONE), copy_file_range(), splice() if
+ * one of the descriptors is a pipe, sendfile(), and finally read() and
+ * write() through a page-aligned buffer.
+ *
+ * If dst_fd is negative, the data are only read.
+ *
+ * Returns the number of read Bytes, which is greater than size if the
+ * source contains more data; -1 on errors.
+ */
 static off_t full_fd_action(int src_fd, int dst_fd, off_t size, int flags)
 {
 	int status = -1;
 	off_t total = 0;
-	int last_was_seek = 0;
-#if CONFIG_FEATURE_COPYBUF_KB <= 4
-	char buffer[CONFIG_FEATURE_COPYBUF_KB * 1024];
-	enum { buffer_size = sizeof(buffer) };
-#else
-	char *buffer;
-	int buffer_size;
+	struct copy_ctx ctx = {
+		.src_fd = src_fd,
+		.dst_fd = dst_fd,
+		.flags = flags,
+		.method = COPY_READ_WRITE,
+	};
 
 	/* We want page-aligned buffer, just in case kernel is clever
 	 * and can do page-aligned io more efficiently */
-	buffer = mmap(NULL, CONFIG_FEATURE_COPYBUF_KB * 1024,
+	ctx.buffer = mmap(NULL, CONFIG_FEATURE_COPYBUF_KB * 1024,
 			PROT_READ | PROT_WRITE,
 			MAP_PRIVATE | MAP_ANON,
 			/* ignored: */ -1, 0);
-	buffer_size = CONFIG_FEATURE_COPYBUF_KB * 1024;
-	if (buffer == MAP_FAILED) {
-		buffer = alloca(4 * 1024);
-		buffer_size = 4 * 1024;
+	ctx.buffer_size = CONFIG_FEATURE_COPYBUF_KB * 1024;
+	if (ctx.buffer == MAP_FAILED) {
+		ctx.buffer = alloca(4 * 1024);
+		ctx.buffer_size = 4 * 1024;
 	}
-#endif
 
 	if (src_fd < 0)
 		goto out;
 
-	if (!size) {
-		size = buffer_size;
-		status = 1; /* copy until eof */
-	}
+	/* 0 means copy until EOF */
+	const off_t limit = size ? size : (off_t)(~0ULL >> 1);
 
-	while (1) {
-		ssize_t rd, towrite;
+	struct stat src_st;
+	if (dst_fd >= 0 && fstat(src_fd, &src_st) == 0) {
+		struct stat dst_st;
+		const bool dst_ok = fstat(dst_fd, &dst_st) == 0;
 
-		rd = libreport_safe_read(src_fd, buffer, buffer_size);
+		/* Pseudo files report size 0 and some file systems return no data
+		 * for them from copy_file_range() and sendfile() */
+		ctx.src_is_reg = S_ISREG(src_st.st_mode) && src_st.st_size > 0;
 
-		if (!rd) { /* eof - all done */
-			if (last_was_seek) {
-				if (lseek(dst_fd, -1, SEEK_CUR) < 0
-				 || libreport_safe_write(dst_fd, "", 1) != 1
-				) {
-					perror_msg("%s", msg_write_error);
-					break;
+		if (ctx.src_is_reg && dst_ok && S_ISREG(dst_st.st_mode))
+			ctx.method = COPY_FILE_RANGE;
+		else if (!(flags & COPYFD_SPARSE)
+			&& (S_ISFIFO(src_st.st_mode) || (dst_ok && S_ISFIFO(dst_st.st_mode))))
+			ctx.method = COPY_SPLICE; /* zero blocks cannot be found in spliced data */
+		else if (ctx.src_is_reg)
+			ctx.method = COPY_SENDFILE;
+
+		off_t copied = clone_file(&ctx, &src_st, limit);
+		if (copied == 0 && ctx.src_is_reg && (flags & COPYFD_SPARSE))
+			copied = copy_sparse_file(&ctx, &src_st, limit);
+		if (copied < 0)
+			goto out;
+		total = copied;
+	}
+
+	/* Copy the rest, or all of it if the kernel cannot help */
+	if (total < limit) {
+		if (dst_fd >= 0) {
+			const off_t copied = copy_data(&ctx, limit - total);
+			if (copied < 0)
+				goto out;
+			total += copied;
+		} else {
+			/* dst_fd == -1 is a fake, just count the Bytes */
+			while (total < limit) {
+				ssize_t rd = libreport_safe_read(src_fd, ctx.buffer, ctx.buffer_size);
+				if (rd < 0) {
+					perror_msg("%s", msg_read_error);
+					goto out;
 				}
+				if (rd == 0)
+					break;
+				total += rd;
 			}
-			status = 0;
-			break;
 		}
+	}
+
+	/* The caller needs to be able to detect overflows (the return value
+	 * > size), so try to read more Bytes than requested. */
+	if (size && total >= limit) {
+		ssize_t rd = libreport_safe_read(src_fd, ctx.buffer, ctx.buffer_size);
 		if (rd < 0) {
 			perror_msg("%s", msg_read_error);
-			break;
+			goto out;
 		}
-		/* Add read Bytes before quiting the loop, because the caller
-		 * needs to be able to detect overflows (the return value > size). */
 		total += rd;
-		towrite = rd > size ? size : rd;
-		if (towrite == 0) {
-			/* no more Bytes to write - all done */
-			status = 0;
-			break;
-		}
-		/* dst_fd == -1 is a fake, else... */
-		if (dst_fd >= 0) {
-			if (flags & COPYFD_SPARSE) {
-				ssize_t cnt = towrite;
-				while (--cnt >= 0)
-					if (buffer[cnt] != 0)
-						goto need2write;
-				if (lseek(dst_fd, towrite, SEEK_CUR) < 0) {
-					flags &= ~COPYFD_SPARSE;
-					goto need2write;
-				}
-				last_was_seek = 1;
-			} else {
- need2write:
-				{
-				    ssize_t wr = libreport_full_write(dst_fd, buffer, towrite);
-				    if (wr < towrite) {
-				        perror_msg("%s", msg_write_error);
-				        break;
-				    }
-				    last_was_seek = 0;
-				}
-			}
-		}
-		if (status < 0) { /* if we aren't copying till EOF... */
-			size -= towrite;
+	}
+
+	/* A file ending with a hole must be extended to its full size */
+	if (ctx.last_was_seek) {
+		if (lseek(dst_fd, -1, SEEK_CUR) < 0
+		 || libreport_safe_write(dst_fd, "", 1) != 1
+		) {
+			perror_msg("%s", msg_write_error);
+			goto out;
 		}
 	}
+
+	status = 0;
  out:
 
-#if CONFIG_FEATURE_COPYBUF_KB > 4
-	if (buffer_size != 4 * 1024)
-		munmap(buffer, buffer_size);
-#endif
+	if (ctx.buffer_size != 4 * 1024)
+		munmap(ctx.buffer, ctx.buffer_size);
 	return status ? -1 : total;
 }
 
@@ -0,0 +1,36 @@
+/*
+    Copyright (C) 2024  ABRT team
+    Copyright (C) 2024  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "internal_libreport.h"
+
+unsigned libreport_simd_features(void)
+{
+    unsigned features = 0;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    /* libgcc detects the features once, the calls only read its results.
+     * The explicit init makes the results valid in constructors too. */
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3"))
+        features |= LIBREPORT_SIMD_SSSE3;
+    if (__builtin_cpu_supports("avx2"))
+        features |= LIBREPORT_SIMD_AVX2;
+#endif
+
+    return features;
+}
@@ -21,6 +21,49 @@
 #include "libreport_curl.h"
 #include "proxies.h"
 
+/*
+ * Transport shared by the curl handles of a thread
+ *
+ * The handles share the DNS cache, TLS sessions and open connections, so
+ * a reporter talking to one server several times resolves its name and does
+ * the TCP and TLS handshakes only once. libcurl doesn't support sharing of
+ * connections among threads, hence every thread has its own share and the
+ * share needs no locking.
+ */
+static void curl_share_free(gpointer share)
+{
+    const CURLSHcode r = curl_share_cleanup(share);
+    if (r != CURLSHE_OK)
+        log_debug("Can't clean up curl share handle: %s", curl_share_strerror(r));
+}
+
+static GPrivate s_curl_share = G_PRIVATE_INIT(curl_share_free);
+
+/* Returns NULL if the share can't be created, the handles work without it */
+static CURLSH *get_curl_share(void)
+{
+    CURLSH *share = g_private_get(&s_curl_share);
+    if (share)
+        return share;
+
+    share = curl_share_init();
+    if (!share)
+    {
+        log_notice("Can't create curl share handle, connections won't be reused");
+        return NULL;
+    }
+
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    /* Sharing of connections is supported since 7.57.0 */
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+
+    g_private_set(&s_curl_share, share);
+    return share;
+}
+
 /*
  * Utility functions
  */
@@ -31,6 +74,15 @@ CURL* xcurl_easy_init()
     {
         error_msg_and_die("Can't create curl handle");
     }
+
+    /* The handle must be used only by this thread */
+    CURLSH *share = get_curl_share();
+    if (share)
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+
+    /* Keep the idle shared connections alive between requests */
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+
     return curl;
 }
 
@@ -233,6 +285,135 @@ static size_t fread_with_reporting(void *ptr, size_t size, size_t nmemb, void *u
     return fread(ptr, size, nmemb, fp);
 }
 
+/*
+ * Streaming upload: the data are generated by a producer thread and passed
+ * to curl through a bounded ring buffer, so they never touch the disk.
+ */
+#define UPLOAD_STREAM_BUFFER_SIZE (4 * 1024 * 1024)
+
+struct upload_stream {
+    GMutex lock;
+    GCond cond;
+    /* Protected by lock */
+    size_t start;
+    size_t size;
+    bool eof;
+    bool closed;
+    int error;
+
+    unsigned char *buffer;
+    upload_stream_producer_fn producer;
+    void *producer_param;
+
+    unsigned long long transferred;
+    time_t last_t;
+    time_t report_interval;
+};
+
+/* "write to the ring buffer" callback of the producer */
+static int upload_stream_write(const void *buf, size_t size, void *param)
+{
+    struct upload_stream *stream = param;
+    const unsigned char *src = buf;
+
+    g_mutex_lock(&stream->lock);
+    while (size != 0)
+    {
+        while (stream->size == UPLOAD_STREAM_BUFFER_SIZE && !stream->closed)
+            g_cond_wait(&stream->cond, &stream->lock);
+
+        if (stream->closed)
+        {
+            g_mutex_unlock(&stream->lock);
+            return -EPIPE;
+        }
+
+        /* There is only one reader and one writer; the free space cannot
+         * shrink while the lock is released
+         */
+        const size_t end = (stream->start + stream->size) % UPLOAD_STREAM_BUFFER_SIZE;
+        size_t chunk = MIN(size, UPLOAD_STREAM_BUFFER_SIZE - stream->size);
+        chunk = MIN(chunk, UPLOAD_STREAM_BUFFER_SIZE - end);
+
+        g_mutex_unlock(&stream->lock);
+        memcpy(stream->buffer + end, src, chunk);
+        g_mutex_lock(&stream->lock);
+
+        stream->size += chunk;
+        g_cond_broadcast(&stream->cond);
+
+        src += chunk;
+        size -= chunk;
+    }
+    g_mutex_unlock(&stream->lock);
+
+    return 0;
+}
+
+/* "read from the ring buffer" callback */
+static size_t upload_stream_read(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    struct upload_stream *stream = userdata;
+
+    g_mutex_lock(&stream->lock);
+    while (stream->size == 0 && !stream->eof)
+        g_cond_wait(&stream->cond, &stream->lock);
+
+    if (stream->size == 0)
+    {
+        const int error = stream->error;
+        g_mutex_unlock(&stream->lock);
+        return error != 0 ? CURL_READFUNC_ABORT : 0;
+    }
+
+    const size_t start = stream->start;
+    size_t chunk = MIN(size * nmemb, stream->size);
+    chunk = MIN(chunk, UPLOAD_STREAM_BUFFER_SIZE - start);
+
+    g_mutex_unlock(&stream->lock);
+    memcpy(ptr, stream->buffer + start, chunk);
+    g_mutex_lock(&stream->lock);
+
+    stream->start = (start + chunk) % UPLOAD_STREAM_BUFFER_SIZE;
+    stream->size -= chunk;
+    g_cond_broadcast(&stream->cond);
+    g_mutex_unlock(&stream->lock);
+
+    /* Report the amount of sent data after 15 seconds,
+     * then after 30 seconds, then after 60 seconds and so on.
+     */
+    const time_t t = time(NULL);
+    if (stream->transferred == 0)
+    {
+        stream->last_t = t;
+        stream->report_interval = 15;
+    }
+    else if ((t - stream->last_t) >= stream->report_interval)
+    {
+        stream->last_t = t;
+        stream->report_interval *= 2;
+        log_warning(_("Uploaded: %llu kbytes"), stream->transferred / 1024);
+    }
+    stream->transferred += chunk;
+
+    return chunk;
+}
+
+static gpointer upload_stream_produce(gpointer data)
+{
+    struct upload_stream *stream = data;
+
+    const int r = stream->producer(upload_stream_write, stream, stream->producer_param);
+
+    g_mutex_lock(&stream->lock);
+    stream->eof = true;
+    stream->error = r;
+    g_cond_broadcast(&stream->cond);
+    g_mutex_unlock(&stream->lock);
+
+    return NULL;
+}
+
 static int curl_debug(CURL *handle, curl_infotype it, char *buf, size_t bufsize, void *unused)
 {
     if (libreport_logmode == 0)
@@ -294,13 +475,17 @@ static int curl_debug(CURL *handle, curl_infotype it, char *buf, size_t bufsize,
     return 0;
 }
 
-int
-post(post_state_t *state,
+/* Uploads the data of the stream via HTTP PUT (or an upload of the other
+ * protocols) if stream is not NULL
+ */
+static int
+post_ext(post_state_t *state,
                 const char *url,
                 const char *content_type,
                 const char **additional_headers,
                 const char *data,
-                off_t data_size)
+                off_t data_size,
+                struct upload_stream *stream)
 {
     INITIALIZE_LIBREPORT();
 
@@ -308,7 +493,8 @@ post(post_state_t *state,
     long response_code;
     post_state_t localstate;
 
-    log_debug("%s('%s','%s')", __func__, url, data);
+    log_debug("%s('%s','%s')", __func__, url,
+              (stream || data_size == POST_DATA_FROMREADER) ? "<stream>" : data);
 
     if (!state)
     {
@@ -357,14 +543,14 @@ post(post_state_t *state,
     if (state->client_ssh_private_keyfile)
         xcurl_easy_setopt_ptr(handle, CURLOPT_SSH_PRIVATE_KEYFILE, state->client_ssh_private_keyfile);
 
-    if (data_size != POST_DATA_FROMFILE_PUT && data_size != POST_DATA_GET)
+    if (stream == NULL && data_size != POST_DATA_FROMFILE_PUT && data_size != POST_DATA_GET)
     {
         // Do a HTTP POST. This also makes curl use
         // a "Content-Type: application/x-www-form-urlencoded" header.
         // (This is by far the most commonly used POST method).
         xcurl_easy_setopt_long(handle, CURLOPT_POST, 1);
     }
-    // else (only POST_DATA_FROMFILE_PUT): do HTTP PUT.
+    // else (only POST_DATA_FROMFILE_PUT and streams): do HTTP PUT.
 
     struct curl_httppost *post = NULL;
     struct curl_httppost *last = NULL;
@@ -373,7 +559,16 @@ post(post_state_t *state,
     struct curl_slist *httpheader_list = NULL;
 
     // Supply data...
-    if (data_size == POST_DATA_FROMFILE
+    if (stream != NULL)
+    {
+        // ...from the stream
+        xcurl_easy_setopt_ptr(handle, CURLOPT_READDATA, stream);
+        xcurl_easy_setopt_ptr(handle, CURLOPT_READFUNCTION, (const void*)upload_stream_read);
+        // The size is not known in advance: without CURLOPT_INFILESIZE_LARGE
+        // curl uses "Transfer-Encoding: chunked" for HTTP/1.1
+        xcurl_easy_setopt_long(handle, CURLOPT_UPLOAD, 1);
+    }
+    else if (data_size == POST_DATA_FROMFILE
      || data_size == POST_DATA_FROMFILE_PUT
     ) {
         // ...from a file
@@ -402,6 +597,14 @@ post(post_state_t *state,
             xcurl_easy_setopt_off_t(handle, CURLOPT_INFILESIZE_LARGE, sz);
         }
     }
+    else if (data_size == POST_DATA_FROMREADER)
+    {
+        // ...from the reader
+        const post_reader_t *reader = (const post_reader_t *)data;
+        xcurl_easy_setopt_ptr(handle, CURLOPT_READDATA, reader->param);
+        xcurl_easy_setopt_ptr(handle, CURLOPT_READFUNCTION, (const void*)reader->read);
+        xcurl_easy_setopt_off_t(handle, CURLOPT_POSTFIELDSIZE_LARGE, reader->size);
+    }
     else if (data_size == POST_DATA_FROMFILE_AS_FORM_DATA)
     {
         // ...from a file, in multipart/formdata format
@@ -488,17 +691,23 @@ post(post_state_t *state,
         free(content_type_header);
     }
 
+    bool user_agent = false;
     for (; additional_headers && *additional_headers; additional_headers++)
     {
         httpheader_list = curl_slist_append(httpheader_list, *additional_headers);
         if (!httpheader_list)
             error_msg_and_die("out of memory");
+        if (strncasecmp(*additional_headers, "User-Agent:", strlen("User-Agent:")) == 0)
+            user_agent = true;
     }
 
-    // Add User-Agent: ABRT/N.M
-    httpheader_list = curl_slist_append(httpheader_list, "User-Agent: ABRT/"VERSION);
-    if (!httpheader_list)
-        error_msg_and_die("out of memory");
+    // Add User-Agent: ABRT/N.M unless the caller has its own
+    if (!user_agent)
+    {
+        httpheader_list = curl_slist_append(httpheader_list, "User-Agent: ABRT/"VERSION);
+        if (!httpheader_list)
+            error_msg_and_die("out of memory");
+    }
 
     if (httpheader_list)
         xcurl_easy_setopt_ptr(handle, CURLOPT_HTTPHEADER, httpheader_list);
@@ -590,6 +799,56 @@ post(post_state_t *state,
     return response_code;
 }
 
+int
+post(post_state_t *state,
+                const char *url,
+                const char *content_type,
+                const char **additional_headers,
+                const char *data,
+                off_t data_size)
+{
+    return post_ext(state, url, content_type, additional_headers, data, data_size, /*stream*/NULL);
+}
+
+/* Uploads the stream and waits for its producer */
+static int
+post_stream(post_state_t *state,
+                const char *url,
+                const char *content_type,
+                upload_stream_producer_fn producer,
+                void *producer_param)
+{
+    struct upload_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    g_mutex_init(&stream.lock);
+    g_cond_init(&stream.cond);
+    stream.buffer = libreport_xmalloc(UPLOAD_STREAM_BUFFER_SIZE);
+    stream.producer = producer;
+    stream.producer_param = producer_param;
+
+    GThread *thread = g_thread_new("upload-stream", upload_stream_produce, &stream);
+
+    const int response_code = post_ext(state, url, content_type, /*additional_headers*/NULL,
+            /*data*/NULL, POST_DATA_FROMFILE_PUT, &stream);
+
+    /* Unblock the producer if curl gave up */
+    g_mutex_lock(&stream.lock);
+    stream.closed = true;
+    g_cond_broadcast(&stream.cond);
+    g_mutex_unlock(&stream.lock);
+
+    g_thread_join(thread);
+
+    if (stream.error != 0 && state->curl_result == 0)
+        state->curl_result = -1;
+
+    free(stream.buffer);
+    g_mutex_clear(&stream.lock);
+    g_cond_clear(&stream.cond);
+
+    return response_code;
+}
+
 /* Unlike post_file(),
  * this function will use PUT, not POST if url is "http(s)://..."
  */
@@ -602,7 +861,8 @@ char *libreport_upload_file(const char *url, const char *filename)
     return retval;
 }
 
-char *libreport_upload_file_ext(post_state_t *state, const char *url, const char *filename, int flags)
+static char *upload_ext(post_state_t *state, const char *url, const char *filename,
+        upload_stream_producer_fn producer, void *producer_param, int flags)
 {
     /* we don't want to print the whole url as it may contain password
      * rhbz#856960
@@ -664,18 +924,33 @@ char *libreport_upload_file_ext(post_state_t *state, const char *url, const char
     /* Do not include the path part of the URL as it can contain sensitive data
      * in case of typos */
     log_warning(_("Sending %s to %s//%s"), filename, scheme, hostname);
-    post(state,
+    if (producer != NULL)
+        post_stream(state,
+                whole_url,
+                /*content_type:*/ "application/octet-stream",
+                producer,
+                producer_param
+        );
+    else
+        post(state,
                 whole_url,
                 /*content_type:*/ "application/octet-stream",
                 /*additional_headers:*/ NULL,
                 /*data:*/ filename,
                 POST_DATA_FROMFILE_PUT
-    );
+        );
 
     dup2(stdin_bck, 0);
 
     int error = (state->curl_result != 0);
-    if (error)
+    if (!error && producer != NULL && state->http_resp_code == 411)
+    {
+        /* The server does not accept chunked uploads */
+        error_msg("Error while uploading: the server requires the length of the data");
+        free(whole_url);
+        whole_url = NULL;
+    }
+    else if (error)
     {
         if (state->curl_error_msg)
             error_msg("Error while uploading: '%s'", state->curl_error_msg);
@@ -733,3 +1008,28 @@ finito:
 
     return whole_url;
 }
+
+char *libreport_upload_file_ext(post_state_t *state, const char *url, const char *filename, int flags)
+{
+    return upload_ext(state, url, filename, /*producer*/NULL, /*producer_param*/NULL, flags);
+}
+
+bool libreport_upload_stream_is_supported(const char *url)
+{
+    /* SCP needs to know the size of data in advance */
+    static const char *const schemes[] = {
+        "http://", "https://", "ftp://", "ftps://", "sftp://", "file://", NULL,
+    };
+
+    for (const char *const *scheme = schemes; *scheme; ++scheme)
+        if (strncasecmp(url, *scheme, strlen(*scheme)) == 0)
+            return true;
+
+    return false;
+}
+
+char *libreport_upload_stream_ext(post_state_t *state, const char *url, const char *name,
+        upload_stream_producer_fn producer, void *producer_param, int flags)
+{
+    return upload_ext(state, url, name, producer, producer_param, flags);
+}
@@ -16,6 +16,7 @@
     with this program; if not, write to the Free Software Foundation, Inc.,
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
+#include <sys/inotify.h>
 #include "internal_libreport.h"
 
 double libreport_get_dirsize(const char *pPath)
@@ -69,6 +70,738 @@ static bool this_is_a_dd(const char *dirname)
     return dd != NULL;
 }
 
+// Spool usage tracker
+//
+// The tracker keeps the size and mtime of every entry of a spool directory
+// and a max-heap of problem directories ordered by the "weighted" size
+// (size_kbytes * age_mins), so the total size is available in O(1) and the
+// worst directories in O(log n) each.
+//
+// Changes are picked up via inotify: the spool directory is watched for
+// created and removed entries, every problem directory and its
+// subdirectories are watched for modified and removed files (the size of a
+// directory includes its subdirectories). Only the directories which got an
+// event are
+// measured again. Directories that cannot be watched (e.g. the inotify watch
+// limit is reached) are measured on every refresh and if inotify is not
+// available at all, every refresh re-scans the whole spool directory.
+//
+// The first scan takes the sizes of problem directories from the spool index
+// if the spool directory has one which matches its entries (see
+// spool_index.h), only their subdirectories are walked to be watched. A
+// problem directory modified between reading the index and watching the
+// directory keeps the indexed size until its next change.
+//
+// Ages grow with time, so the heap keys are recomputed (in memory, in O(n))
+// once they are older than SPOOL_USAGE_REKEY_SECONDS.
+
+#define SPOOL_USAGE_REKEY_SECONDS 60
+
+#define SPOOL_USAGE_DIR_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+                              | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define SPOOL_USAGE_PROBLEM_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+                                  | IN_MODIFY | IN_CLOSE_WRITE | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+#define NOT_IN_HEAP ((unsigned)-1)
+
+struct spool_usage_entry
+{
+    char *name;
+    double size;
+    time_t mtime;
+    double score;
+    /* inotify watch descriptor or -1 */
+    int wd;
+    /* inotify watch descriptors of the subdirectories */
+    GArray *subdir_wds;
+    unsigned heap_pos;
+    bool is_dir;
+    /* sosreport is being generated, the directory is not accounted */
+    bool sosreport;
+    /* The last check found out that it is not a problem directory */
+    bool not_dd;
+    /* Waits in spool_usage->dirty */
+    bool dirty;
+};
+
+struct spool_usage
+{
+    char *spool_dir;
+    int inotify_fd;
+    /* inotify watch descriptor of spool_dir */
+    int spool_wd;
+    double total;
+    /* name -> struct spool_usage_entry */
+    GHashTable *entries;
+    /* wd -> struct spool_usage_entry */
+    GHashTable *watches;
+    /* Names of entries which must be measured again */
+    GPtrArray *dirty;
+    /* Number of directories without inotify watch */
+    unsigned unwatched;
+    /* Events were lost or inotify is not available */
+    bool rescan;
+    /* The spool index, only while the first scan runs */
+    struct spool_index *index;
+
+    struct spool_usage_entry **heap;
+    unsigned heap_len;
+    unsigned heap_size;
+    /* Scores in the heap are computed for this time */
+    time_t heap_time;
+};
+
+static double spool_usage_score(const struct spool_usage_entry *entry, time_t now)
+{
+    /* Calculate "weighted" size and age
+     * w = sz_kbytes * age_mins
+     */
+    double sz = entry->size / 1024;
+    long age = (now - entry->mtime) / 60;
+    if (age > 0)
+        sz *= age;
+    return sz;
+}
+
+static void heap_set(struct spool_usage *su, unsigned pos, struct spool_usage_entry *entry)
+{
+    su->heap[pos] = entry;
+    entry->heap_pos = pos;
+}
+
+static void heap_sift_up(struct spool_usage *su, unsigned pos)
+{
+    struct spool_usage_entry *entry = su->heap[pos];
+    while (pos > 0)
+    {
+        const unsigned parent = (pos - 1) / 2;
+        if (su->heap[parent]->score >= entry->score)
+            break;
+        heap_set(su, pos, su->heap[parent]);
+        pos = parent;
+    }
+    heap_set(su, pos, entry);
+}
+
+static void heap_sift_down(struct spool_usage *su, unsigned pos)
+{
+    struct spool_usage_entry *entry = su->heap[pos];
+    while (1)
+    {
+        unsigned child = 2 * pos + 1;
+        if (child >= su->heap_len)
+            break;
+        if (child + 1 < su->heap_len && su->heap[child + 1]->score > su->heap[child]->score)
+            ++child;
+        if (su->heap[child]->score <= entry->score)
+            break;
+        heap_set(su, pos, su->heap[child]);
+        pos = child;
+    }
+    heap_set(su, pos, entry);
+}
+
+static void heap_remove(struct spool_usage *su, struct spool_usage_entry *entry)
+{
+    const unsigned pos = entry->heap_pos;
+    if (pos == NOT_IN_HEAP)
+        return;
+
+    entry->heap_pos = NOT_IN_HEAP;
+    if (pos == --su->heap_len)
+        return;
+
+    heap_set(su, pos, su->heap[su->heap_len]);
+    heap_sift_up(su, pos);
+    heap_sift_down(su, su->heap[pos]->heap_pos);
+}
+
+static void heap_update(struct spool_usage *su, struct spool_usage_entry *entry)
+{
+    entry->score = spool_usage_score(entry, su->heap_time);
+
+    if (entry->heap_pos == NOT_IN_HEAP)
+    {
+        if (su->heap_len == su->heap_size)
+        {
+            su->heap_size = su->heap_size ? su->heap_size * 2 : 64;
+            su->heap = libreport_xrealloc(su->heap, su->heap_size * sizeof(su->heap[0]));
+        }
+        heap_set(su, su->heap_len++, entry);
+    }
+
+    heap_sift_up(su, entry->heap_pos);
+    heap_sift_down(su, entry->heap_pos);
+}
+
+/* Recomputes all scores, the ages have grown since the last time */
+static void heap_rekey(struct spool_usage *su, time_t now)
+{
+    su->heap_time = now;
+
+    for (unsigned i = 0; i < su->heap_len; ++i)
+        su->heap[i]->score = spool_usage_score(su->heap[i], now);
+
+    for (unsigned i = su->heap_len / 2; i-- > 0; )
+        heap_sift_down(su, i);
+}
+
+/* Forgets the watch descriptor of the entry, the watch itself stays */
+static void spool_usage_drop_watch(struct spool_usage *su, struct spool_usage_entry *entry, int wd)
+{
+    if (entry->wd == wd)
+    {
+        entry->wd = -1;
+        ++su->unwatched;
+        return;
+    }
+
+    for (unsigned i = 0; i < entry->subdir_wds->len; ++i)
+    {
+        if (g_array_index(entry->subdir_wds, int, i) == wd)
+        {
+            g_array_remove_index_fast(entry->subdir_wds, i);
+            return;
+        }
+    }
+}
+
+/* Makes the watch report changes of the entry. Renamed directories keep
+ * their watch descriptors, so the watch may belong to another entry. */
+static void spool_usage_take_watch(struct spool_usage *su, struct spool_usage_entry *entry, int wd, bool subdir)
+{
+    struct spool_usage_entry *prev = g_hash_table_lookup(su->watches, GINT_TO_POINTER(wd));
+    if (prev == entry)
+        return;
+
+    if (prev != NULL)
+        spool_usage_drop_watch(su, prev, wd);
+
+    g_hash_table_replace(su->watches, GINT_TO_POINTER(wd), entry);
+    if (subdir)
+        g_array_append_val(entry->subdir_wds, wd);
+}
+
+static void spool_usage_unwatch(struct spool_usage *su, struct spool_usage_entry *entry)
+{
+    for (unsigned i = 0; i < entry->subdir_wds->len; ++i)
+    {
+        const int wd = g_array_index(entry->subdir_wds, int, i);
+        if (g_hash_table_lookup(su->watches, GINT_TO_POINTER(wd)) == entry)
+        {
+            g_hash_table_remove(su->watches, GINT_TO_POINTER(wd));
+            inotify_rm_watch(su->inotify_fd, wd);
+        }
+    }
+    g_array_set_size(entry->subdir_wds, 0);
+
+    if (entry->wd < 0)
+    {
+        if (entry->is_dir)
+            --su->unwatched;
+        return;
+    }
+
+    /* The same watch might have been taken over by a renamed entry */
+    if (g_hash_table_lookup(su->watches, GINT_TO_POINTER(entry->wd)) == entry)
+    {
+        g_hash_table_remove(su->watches, GINT_TO_POINTER(entry->wd));
+        inotify_rm_watch(su->inotify_fd, entry->wd);
+    }
+    entry->wd = -1;
+}
+
+static void spool_usage_watch(struct spool_usage *su, struct spool_usage_entry *entry, const char *path)
+{
+    if (su->inotify_fd >= 0)
+    {
+        const int wd = inotify_add_watch(su->inotify_fd, path, SPOOL_USAGE_PROBLEM_MASK);
+        if (wd >= 0)
+        {
+            spool_usage_take_watch(su, entry, wd, /*subdir:*/ false);
+            entry->wd = wd;
+            return;
+        }
+
+        log_info("Can't watch '%s': %s", path, strerror(errno));
+    }
+
+    ++su->unwatched;
+}
+
+static void spool_usage_watch_subdir(struct spool_usage *su, struct spool_usage_entry *entry, const char *path)
+{
+    if (entry->wd < 0)
+        return;
+
+    const int wd = inotify_add_watch(su->inotify_fd, path, SPOOL_USAGE_PROBLEM_MASK);
+    if (wd >= 0)
+    {
+        spool_usage_take_watch(su, entry, wd, /*subdir:*/ true);
+        return;
+    }
+
+    /* Partially watched entries are measured on every refresh */
+    log_info("Can't watch '%s': %s", path, strerror(errno));
+    spool_usage_unwatch(su, entry);
+    ++su->unwatched;
+}
+
+/* Watches the subdirectories of a watched entry whose size is already known */
+static void spool_usage_watch_subdirs(struct spool_usage *su, struct spool_usage_entry *entry, const char *path)
+{
+    DIR *dp = opendir(path);
+    if (dp == NULL)
+        return;
+
+    struct dirent *ep;
+    struct stat statbuf;
+    while (entry->wd >= 0 && (ep = readdir(dp)) != NULL)
+    {
+        if (libreport_dot_or_dotdot(ep->d_name)
+            || (ep->d_type != DT_DIR && ep->d_type != DT_UNKNOWN))
+        {
+            continue;
+        }
+        char *dname = libreport_concat_path_file(path, ep->d_name);
+        if (lstat(dname, &statbuf) == 0 && S_ISDIR(statbuf.st_mode))
+        {
+            spool_usage_watch_subdir(su, entry, dname);
+            spool_usage_watch_subdirs(su, entry, dname);
+        }
+        free(dname);
+    }
+    closedir(dp);
+}
+
+/* Sums the sizes like libreport_get_dirsize() and watches the subdirectories
+ * of a watched entry */
+static double spool_usage_measure(struct spool_usage *su, struct spool_usage_entry *entry, const char *path)
+{
+    DIR *dp = opendir(path);
+    if (dp == NULL)
+        return 0;
+
+    struct dirent *ep;
+    struct stat statbuf;
+    double size = 0;
+    while ((ep = readdir(dp)) != NULL)
+    {
+        if (libreport_dot_or_dotdot(ep->d_name))
+            continue;
+        char *dname = libreport_concat_path_file(path, ep->d_name);
+        if (lstat(dname, &statbuf) != 0)
+        {
+            goto next;
+        }
+        if (S_ISDIR(statbuf.st_mode))
+        {
+            spool_usage_watch_subdir(su, entry, dname);
+            size += spool_usage_measure(su, entry, dname);
+        }
+        else if (S_ISREG(statbuf.st_mode))
+        {
+            size += statbuf.st_size;
+        }
+ next:
+        free(dname);
+    }
+    closedir(dp);
+    return size;
+}
+
+static void spool_usage_entry_free(void *ptr)
+{
+    struct spool_usage_entry *entry = ptr;
+    g_array_free(entry->subdir_wds, TRUE);
+    free(entry->name);
+    free(entry);
+}
+
+static void spool_usage_remove(struct spool_usage *su, struct spool_usage_entry *entry)
+{
+    if (!entry->sosreport)
+        su->total -= entry->size;
+
+    heap_remove(su, entry);
+    spool_usage_unwatch(su, entry);
+    g_hash_table_remove(su->entries, entry->name);
+}
+
+/* Measures the entry again, adds it if it is new and removes it if it is gone */
+static void spool_usage_load(struct spool_usage *su, const char *name)
+{
+    struct spool_usage_entry *entry = g_hash_table_lookup(su->entries, name);
+    if (entry)
+        entry->dirty = false;
+
+    char *path = libreport_concat_path_file(su->spool_dir, name);
+
+    struct stat statbuf;
+    if (lstat(path, &statbuf) != 0 || !(S_ISDIR(statbuf.st_mode) || S_ISREG(statbuf.st_mode)))
+    {
+        if (entry)
+            spool_usage_remove(su, entry);
+        goto finito;
+    }
+
+    if (entry && entry->is_dir != !!S_ISDIR(statbuf.st_mode))
+    {
+        spool_usage_remove(su, entry);
+        entry = NULL;
+    }
+
+    if (entry == NULL)
+    {
+        entry = libreport_xzalloc(sizeof(*entry));
+        entry->name = libreport_xstrdup(name);
+        entry->wd = -1;
+        entry->heap_pos = NOT_IN_HEAP;
+        entry->is_dir = S_ISDIR(statbuf.st_mode);
+        entry->subdir_wds = g_array_new(FALSE, FALSE, sizeof(int));
+        g_hash_table_replace(su->entries, entry->name, entry);
+
+        if (entry->is_dir)
+            spool_usage_watch(su, entry, path);
+    }
+
+    if (!entry->sosreport)
+        su->total -= entry->size;
+
+    entry->mtime = statbuf.st_mtime;
+    entry->not_dd = false;
+
+    if (!entry->is_dir)
+    {
+        entry->size = statbuf.st_size;
+        su->total += entry->size;
+        goto finito;
+    }
+
+    char *sosreport = libreport_concat_path_file(path, "sosreport.log");
+    entry->sosreport = (lstat(sosreport, &statbuf) == 0);
+    free(sosreport);
+
+    /* Stray directories are not updated in the index */
+    const struct spool_index_record *record = NULL;
+    if (su->index)
+    {
+        record = spool_index_find(su->index, name);
+        if (record && (record->flags & SPOOL_INDEX_RECORD_NOT_PROBLEM))
+            record = NULL;
+    }
+
+    if (record)
+    {
+        spool_usage_watch_subdirs(su, entry, path);
+        entry->size = record->size;
+    }
+    else
+        entry->size = spool_usage_measure(su, entry, path);
+
+    if (entry->sosreport)
+    {
+        log_debug("Skipping %s': sosreport is being generated.", path);
+        heap_remove(su, entry);
+        goto finito;
+    }
+
+    su->total += entry->size;
+    heap_update(su, entry);
+
+finito:
+    free(path);
+}
+
+static void spool_usage_mark_dirty(struct spool_usage *su, const char *name)
+{
+    struct spool_usage_entry *entry = g_hash_table_lookup(su->entries, name);
+    if (entry)
+    {
+        if (entry->dirty)
+            return;
+        entry->dirty = true;
+    }
+
+    g_ptr_array_add(su->dirty, libreport_xstrdup(name));
+}
+
+/* Marks all known and all existing entries as dirty */
+static void spool_usage_mark_all_dirty(struct spool_usage *su)
+{
+    GHashTableIter iter;
+    void *name;
+    g_hash_table_iter_init(&iter, su->entries);
+    while (g_hash_table_iter_next(&iter, &name, NULL))
+        spool_usage_mark_dirty(su, name);
+
+    DIR *dp = opendir(su->spool_dir);
+    if (dp == NULL)
+        return;
+
+    struct dirent *ep;
+    while ((ep = readdir(dp)) != NULL)
+    {
+        if (!libreport_dot_or_dotdot(ep->d_name))
+            spool_usage_mark_dirty(su, ep->d_name);
+    }
+    closedir(dp);
+}
+
+static void spool_usage_read_events(struct spool_usage *su)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(su->inotify_fd, buf, sizeof(buf))) > 0)
+    {
+        for (char *ptr = buf; ptr < buf + len; )
+        {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            ptr += sizeof(*event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                su->rescan = true;
+                continue;
+            }
+
+            struct spool_usage_entry *entry = g_hash_table_lookup(su->watches, GINT_TO_POINTER(event->wd));
+            if (entry == NULL)
+            {
+                /* Events of removed watches are still queued */
+                if (event->wd != su->spool_wd)
+                    continue;
+
+                /* An event in the spool directory itself */
+                if (event->len != 0)
+                    spool_usage_mark_dirty(su, event->name);
+                else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+                    su->rescan = true;
+                continue;
+            }
+
+            /* Locking does not change the size, every reader locks */
+            if (event->len != 0 && strcmp(event->name, ".lock") == 0)
+                continue;
+
+            if (event->mask & IN_IGNORED)
+            {
+                /* The problem directory or its subdirectory has been removed */
+                g_hash_table_remove(su->watches, GINT_TO_POINTER(event->wd));
+                spool_usage_drop_watch(su, entry, event->wd);
+            }
+
+            spool_usage_mark_dirty(su, entry->name);
+        }
+    }
+}
+
+/* Processes all changes since the last call */
+static void spool_usage_refresh(struct spool_usage *su)
+{
+    if (su->inotify_fd >= 0)
+        spool_usage_read_events(su);
+
+    if (su->rescan)
+    {
+        su->rescan = (su->inotify_fd < 0);
+        spool_usage_mark_all_dirty(su);
+    }
+    else if (su->unwatched != 0)
+    {
+        GHashTableIter iter;
+        struct spool_usage_entry *entry;
+        g_hash_table_iter_init(&iter, su->entries);
+        while (g_hash_table_iter_next(&iter, NULL, (void **)&entry))
+        {
+            if (entry->is_dir && entry->wd < 0)
+                spool_usage_mark_dirty(su, entry->name);
+        }
+    }
+
+    for (unsigned i = 0; i < su->dirty->len; ++i)
+        spool_usage_load(su, g_ptr_array_index(su->dirty, i));
+    g_ptr_array_set_size(su->dirty, 0);
+
+    const time_t now = time(NULL);
+    if (now < su->heap_time || now - su->heap_time >= SPOOL_USAGE_REKEY_SECONDS)
+        heap_rekey(su, now);
+}
+
+struct spool_usage *libreport_spool_usage_new(const char *spool_dir)
+{
+    DIR *dp = opendir(spool_dir);
+    if (dp == NULL)
+        return NULL;
+    closedir(dp);
+
+    struct spool_usage *su = libreport_xzalloc(sizeof(*su));
+    su->spool_dir = libreport_xstrdup(spool_dir);
+    su->entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, spool_usage_entry_free);
+    su->watches = g_hash_table_new(g_direct_hash, g_direct_equal);
+    su->dirty = g_ptr_array_new_with_free_func(free);
+    su->heap_time = time(NULL);
+    su->rescan = true;
+
+    su->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (su->inotify_fd < 0)
+        log_info("Can't initialize inotify: %s", strerror(errno));
+    else if ((su->spool_wd = inotify_add_watch(su->inotify_fd, spool_dir, SPOOL_USAGE_DIR_MASK)) < 0)
+    {
+        log_info("Can't watch '%s': %s", spool_dir, strerror(errno));
+        close(su->inotify_fd);
+        su->inotify_fd = -1;
+    }
+
+    /* Read after the spool directory is watched not to miss new entries */
+    su->index = spool_index_open(spool_dir);
+    spool_usage_refresh(su);
+    spool_index_close(su->index);
+    su->index = NULL;
+
+    return su;
+}
+
+void libreport_spool_usage_free(struct spool_usage *su)
+{
+    if (su == NULL)
+        return;
+
+    if (su->inotify_fd >= 0)
+        close(su->inotify_fd);
+
+    g_hash_table_destroy(su->watches);
+    g_hash_table_destroy(su->entries);
+    g_ptr_array_free(su->dirty, TRUE);
+    free(su->heap);
+    free(su->spool_dir);
+    free(su);
+}
+
+int libreport_spool_usage_get_fd(struct spool_usage *su)
+{
+    return su->inotify_fd;
+}
+
+double libreport_spool_usage_total(struct spool_usage *su)
+{
+    spool_usage_refresh(su);
+    return su->total;
+}
+
+GList *libreport_spool_usage_victims(struct spool_usage *su, unsigned count, const char *excluded)
+{
+    spool_usage_refresh(su);
+
+    GList *victims = NULL;
+
+    /* Walk the heap in the descending order without modifying it: the next
+     * best entry is always one of the children of already visited entries.
+     */
+    GArray *frontier = g_array_new(FALSE, FALSE, sizeof(unsigned));
+    if (su->heap_len != 0)
+    {
+        unsigned root = 0;
+        g_array_append_val(frontier, root);
+    }
+
+    while (count != 0 && frontier->len != 0)
+    {
+        unsigned best = 0;
+        for (unsigned i = 1; i < frontier->len; ++i)
+            if (su->heap[g_array_index(frontier, unsigned, i)]->score
+                    > su->heap[g_array_index(frontier, unsigned, best)]->score)
+                best = i;
+
+        const unsigned pos = g_array_index(frontier, unsigned, best);
+        g_array_remove_index_fast(frontier, best);
+
+        struct spool_usage_entry *entry = su->heap[pos];
+        if (entry->score <= 0)
+            break;
+
+        for (unsigned child = 2 * pos + 1; child <= 2 * pos + 2 && child < su->heap_len; ++child)
+            g_array_append_val(frontier, child);
+
+        if (entry->not_dd || (excluded && strcmp(excluded, entry->name) == 0))
+            continue;
+
+        char *path = libreport_concat_path_file(su->spool_dir, entry->name);
+        if (!this_is_a_dd(path))
+        {
+            log_notice("'%s' isn't a problem directory, probably a stray directory?", path);
+            entry->not_dd = true;
+        }
+        else
+        {
+            victims = g_list_prepend(victims, libreport_xstrdup(entry->name));
+            --count;
+        }
+        free(path);
+    }
+
+    g_array_free(frontier, TRUE);
+    return g_list_reverse(victims);
+}
+
+/* The tracker of the last spool directory passed to
+ * libreport_get_dirsize_find_largest_dir()
+ */
+static GMutex s_largest_dir_lock;
+static struct spool_usage *s_largest_dir_usage;
+/* inotify is not available, the tracker would walk everything on every call */
+static bool s_largest_dir_no_inotify;
+
+static void __attribute__((destructor)) largest_dir_usage_free(void)
+{
+    libreport_spool_usage_free(s_largest_dir_usage);
+    s_largest_dir_usage = NULL;
+}
+
+/* @return false if the tracker cannot be used */
+static bool find_largest_dir_tracked(const char *pPath, char **worst_dir, const char *excluded, double *size)
+{
+    g_mutex_lock(&s_largest_dir_lock);
+
+    if (s_largest_dir_usage && strcmp(s_largest_dir_usage->spool_dir, pPath) != 0)
+    {
+        libreport_spool_usage_free(s_largest_dir_usage);
+        s_largest_dir_usage = NULL;
+    }
+
+    struct spool_usage *su = s_largest_dir_usage;
+    if (su == NULL && !s_largest_dir_no_inotify)
+        su = libreport_spool_usage_new(pPath);
+
+    if (su == NULL)
+    {
+        g_mutex_unlock(&s_largest_dir_lock);
+        return false;
+    }
+
+    *size = libreport_spool_usage_total(su);
+    if (worst_dir)
+    {
+        GList *victims = libreport_spool_usage_victims(su, 1, excluded);
+        if (victims)
+        {
+            *worst_dir = victims->data;
+            g_list_free(victims);
+        }
+    }
+
+    if (su->inotify_fd >= 0)
+        s_largest_dir_usage = su;
+    else
+    {
+        s_largest_dir_no_inotify = true;
+        libreport_spool_usage_free(su);
+    }
+
+    g_mutex_unlock(&s_largest_dir_lock);
+    return true;
+}
+
 double libreport_get_dirsize_find_largest_dir(
         const char *pPath,
         char **worst_dir,
@@ -77,6 +810,10 @@ double libreport_get_dirsize_find_largest_dir(
     if (worst_dir)
         *worst_dir = NULL;
 
+    double size = 0;
+    if (find_largest_dir_tracked(pPath, worst_dir, excluded, &size))
+        return size;
+
     DIR *dp = opendir(pPath);
     if (dp == NULL)
         return 0;
@@ -84,14 +821,16 @@ double libreport_get_dirsize_find_largest_dir(
     time_t cur_time = time(NULL);
     struct dirent *ep;
     struct stat statbuf;
-    double size = 0;
     double maxsz = 0;
     while ((ep = readdir(dp)) != NULL)
     {
         if (libreport_dot_or_dotdot(ep->d_name))
             continue;
         char *dname = libreport_concat_path_file(pPath, ep->d_name);
-        if (lstat(libreport_concat_path_file(dname, "sosreport.log"), &statbuf) == 0)
+        char *sosreport = libreport_concat_path_file(dname, "sosreport.log");
+        const bool sosreport_exists = (lstat(sosreport, &statbuf) == 0);
+        free(sosreport);
+        if (sosreport_exists)
         {
             log_debug("Skipping %s': sosreport is being generated.", dname);
             goto next;
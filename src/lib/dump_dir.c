@@ -17,9 +17,14 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 #include <sys/utsname.h>
-#include <libtar.h>
+#include <sys/syscall.h>
+#include <sys/inotify.h>
 #include "internal_libreport.h"
 
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+#endif
+
 // Locking logic:
 //
 // The directory is locked by creating a symlink named .lock inside it,
@@ -53,6 +58,14 @@
 // correctly. For example, dd_create should retry locking
 // its newly-created directory much faster than dd_opendir
 // tries to lock the directory it tries to open.
+//
+// Processes waiting for a lock do not poll blindly. Once the first locking
+// attempt fails, the waiter starts watching the directory via inotify and
+// goes to sleep until .lock is removed or the directory disappears. The sleep
+// intervals below are still used as timeouts, because a lock holder can die
+// without removing .lock and inotify does not see changes made by other
+// hosts on network file systems. The on-disk protocol is unchanged, so
+// waiting via inotify and via plain sleeping can be freely mixed.
 
 
 // How long to sleep between "symlink fails with EEXIST,
@@ -90,6 +103,10 @@
 // does not exist (backward compatibility).
 #define META_DATA_DIR_NAME             ".libreport"
 #define META_DATA_FILE_OWNER           "owner"
+// The threshold for storing text items compressed (see dd_set_item_compression())
+#define META_DATA_FILE_ITEM_COMPRESSION "item_compression"
+// The list of compressed items with their uncompressed and stored sizes
+#define META_DATA_FILE_COMPRESSED_ITEMS "compressed_items"
 
 enum {
     /* Try to create meta-data dir if it does not exist */
@@ -109,9 +126,12 @@ uid_t dd_g_super_user_uid = 0;
 /* Group of new dump directories */
 gid_t dd_g_fs_group_gid = (gid_t)-1;
 
+/* Number of compression threads used by dd_create_archive() */
+unsigned dd_g_archive_threads = 0;
+
 
 char *load_text_file(const char *path, unsigned flags);
-static char *load_text_file_at(int dir_fd, const char *name, unsigned flags);
+static char *load_text_file_at(int dir_fd, GHashTable *compressed_items, const char *name, unsigned flags);
 static void copy_file_from_chroot(struct dump_dir* dd, const char *name,
         const char *chroot_dir, const char *file_path);
 static bool save_binary_file_at(int dir_fd, const char *name, const char* data,
@@ -409,7 +429,7 @@ static const char *dd_check(struct dump_dir *dd)
     int load_flags = DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE;
     if (libreport_g_verbose < 2) load_flags |= DD_FAIL_QUIETLY_ENOENT;
 
-    dd->dd_type = load_text_file_at(dd->dd_fd, FILENAME_TYPE, load_flags);
+    dd->dd_type = load_text_file_at(dd->dd_fd, /*never compressed*/NULL, FILENAME_TYPE, load_flags);
     if (!dd->dd_type || (strlen(dd->dd_type) == 0))
     {
         log_debug("Missing or empty file: "FILENAME_TYPE);
@@ -419,6 +439,112 @@ static const char *dd_check(struct dump_dir *dd)
     return NULL;
 }
 
+/* Starts watching the dump directory for changes relevant to locking
+ *
+ * @return inotify file descriptor or -1 if inotify cannot be used
+ */
+static int dd_lock_watch_init(struct dump_dir *dd)
+{
+    int ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ifd < 0)
+    {
+        VERB2 perror_msg("inotify_init1");
+        return -1;
+    }
+
+    if (inotify_add_watch(ifd, dd->dd_dirname,
+                IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+                | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR) < 0)
+    {
+        VERB2 perror_msg("Can't watch '%s'", dd->dd_dirname);
+        close(ifd);
+        return -1;
+    }
+
+    return ifd;
+}
+
+/* Sleeps until .lock is removed (DD_LOCK_WAIT_UNLOCK), .lock is created
+ * (DD_LOCK_WAIT_LOCK), the directory is removed or renamed, or timeout_usec
+ * elapses.
+ *
+ * Falls back to plain sleeping if ifd is negative.
+ */
+enum {
+    DD_LOCK_WAIT_UNLOCK,
+    DD_LOCK_WAIT_LOCK,
+};
+
+static void dd_lock_wait(int ifd, unsigned timeout_usec, int what)
+{
+    if (ifd < 0)
+    {
+        usleep(timeout_usec);
+        return;
+    }
+
+    const uint32_t lock_mask = (what == DD_LOCK_WAIT_UNLOCK)
+            ? (IN_DELETE | IN_MOVED_FROM)
+            : (IN_CREATE | IN_MOVED_TO);
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    /* Forget our own creation of .lock, otherwise we would not sleep at all.
+     * Stale events are harmless when waiting for unlock: we just try to lock
+     * once more. */
+    if (what == DD_LOCK_WAIT_LOCK)
+        while (read(ifd, buf, sizeof(buf)) > 0)
+            continue;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_usec / 1000000;
+    deadline.tv_nsec += (timeout_usec % 1000000) * 1000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    while (1)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long timeout_ms = (deadline.tv_sec - now.tv_sec) * 1000LL
+                             + (deadline.tv_nsec - now.tv_nsec + 999999) / 1000000;
+        if (timeout_ms <= 0)
+            return;
+
+        struct pollfd pfd = { .fd = ifd, .events = POLLIN };
+        int r = poll(&pfd, 1, (int)timeout_ms);
+        if (r < 0 && errno != EINTR)
+        {
+            perror_msg("poll");
+            usleep(timeout_usec);
+            return;
+        }
+        if (r <= 0)
+            continue;
+
+        ssize_t len = read(ifd, buf, sizeof(buf));
+        if (len <= 0)
+            continue;
+
+        for (char *ptr = buf; ptr < buf + len; )
+        {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            ptr += sizeof(*event) + event->len;
+
+            /* The directory is gone or renamed, or we lost some events */
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED | IN_Q_OVERFLOW))
+                return;
+
+            if ((event->mask & lock_mask) && event->len != 0 && strcmp(event->name, ".lock") == 0)
+                return;
+        }
+    }
+}
+
 static int dd_lock(struct dump_dir *dd, unsigned sleep_usec, int flags)
 {
     if (dd->locked)
@@ -428,22 +554,32 @@ static int dd_lock(struct dump_dir *dd, unsigned sleep_usec, int flags)
     snprintf(pid_buf, sizeof(pid_buf), "%lu", (long)getpid());
 
     unsigned count = NO_TIME_FILE_COUNT;
+    int ifd = -1;
+    bool watching = false;
 
  retry:
     while (1)
     {
         int r = create_symlink_lockfile_at(dd->dd_fd, ".lock", pid_buf);
         if (r < 0)
-            return r; /* error */
+            goto fail; /* error */
         if (r > 0 || errno == EALREADY)
             break; /* locked successfully */
         if (flags & DD_DONT_WAIT_FOR_LOCK)
         {
             errno = EAGAIN;
-            return -1;
+            goto fail;
+        }
+        if (!watching)
+        {
+            watching = true;
+            ifd = dd_lock_watch_init(dd);
+            /* The lock might have been released before we started watching */
+            if (ifd >= 0)
+                continue;
         }
         /* Other process has the lock, wait for it to go away */
-        usleep(sleep_usec);
+        dd_lock_wait(ifd, sleep_usec, DD_LOCK_WAIT_UNLOCK);
     }
 
     /* Reset errno to 0 only if errno is EALREADY (used by
@@ -470,21 +606,45 @@ static int dd_lock(struct dump_dir *dd, unsigned sleep_usec, int flags)
             if (--count == 0 || flags & DD_DONT_WAIT_FOR_LOCK)
             {
                 errno = EISDIR; /* "this is an ordinary dir, not dump dir" */
-                return -1;
+                goto fail;
+            }
+            if (!watching)
+            {
+                watching = true;
+                ifd = dd_lock_watch_init(dd);
             }
-            usleep(NO_TIME_FILE_USLEEP);
+            /* Wait for the creator of the directory to lock it or for the
+             * deleter to remove it */
+            dd_lock_wait(ifd, NO_TIME_FILE_USLEEP, DD_LOCK_WAIT_LOCK);
             goto retry;
         }
     }
 
+    if (ifd >= 0)
+        close(ifd);
+
     dd->locked = true;
     return 0;
+
+ fail:
+    if (ifd >= 0)
+    {
+        const int err = errno;
+        close(ifd);
+        errno = err;
+    }
+    return -1;
 }
 
 static void dd_unlock(struct dump_dir *dd)
 {
     if (dd->locked)
     {
+        /* Update the index while the directory is still locked */
+        if (dd->modified)
+            spool_index_update_dump_dir(dd);
+        dd->modified = 0;
+
         if (dd->owns_lock)
             libreport_xunlinkat(dd->dd_fd, ".lock", /*only files*/0);
 
@@ -501,6 +661,7 @@ static inline struct dump_dir *dd_init(void)
     dd->dd_time = (time_t)-1;
     dd->dd_fd = -1;
     dd->dd_md_fd = -1;
+    dd->item_compression = -1;
     return dd;
 }
 
@@ -536,6 +697,8 @@ void dd_close(struct dump_dir *dd)
 
     dd_clear_next_file(dd);
 
+    if (dd->compressed_items != NULL)
+        g_hash_table_unref(dd->compressed_items);
     free(dd->dd_type);
     free(dd->dd_dirname);
     free(dd);
@@ -724,6 +887,8 @@ int dd_set_owner(struct dump_dir *dd, uid_t owner)
     const int ret = dd_meta_data_save_text(dd, META_DATA_FILE_OWNER, long_str);
     if (ret < 0)
         error_msg("The dump dir owner wasn't set to '%s'", long_str);
+    else
+        dd->modified = 1;
     return ret;
 }
 
@@ -800,6 +965,291 @@ time_t dd_get_last_occurrence(struct dump_dir *dd)
     return last_occurrence;
 }
 
+/* Compressed items
+ *
+ * The names of the compressed items are listed in one meta-data file together
+ * with their uncompressed and stored sizes. The list is read once per opened
+ * dump directory; dump directories without compressed items cost one failed
+ * openat() of the list and no reads of the item files.
+ *
+ * An item counts as compressed only if the size of its file agrees with the
+ * list. The list is written before the item's file, so an interrupted write
+ * leaves behind only an ignored entry.
+ */
+static const uint8_t s_zstd_magic[4] = { 0x28, 0xB5, 0x2F, 0xFD };
+
+struct compressed_item
+{
+    size_t size;
+    off_t stored_size;
+};
+
+static GHashTable *compressed_items_new(void)
+{
+    return g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
+}
+
+/* Parses lines in the form "<size> <stored size> <name>" */
+static void compressed_items_parse(GHashTable *items, char *list)
+{
+    for (char *line = list, *next; line != NULL && *line != '\0'; line = next)
+    {
+        next = strchr(line, '\n');
+        if (next != NULL)
+            *next++ = '\0';
+
+        unsigned long long size;
+        long long stored;
+        int name_offset = 0;
+        if (sscanf(line, "%llu %lld %n", &size, &stored, &name_offset) != 2
+         || name_offset == 0 || size > CD_MAX_TEXT_SIZE || stored < 0
+         || !libreport_str_is_correct_filename(line + name_offset))
+        {
+            log_notice("Ignoring invalid compressed item record '%s'", line);
+            continue;
+        }
+
+        struct compressed_item *item = libreport_xmalloc(sizeof(*item));
+        item->size = size;
+        item->stored_size = stored;
+        g_hash_table_replace(items, libreport_xstrdup(line + name_offset), item);
+    }
+}
+
+GHashTable *libreport_dd_get_compressed_items(struct dump_dir *dd)
+{
+    if (dd->compressed_items == NULL)
+    {
+        dd->compressed_items = compressed_items_new();
+
+        const int dd_md_fd = dd_get_meta_data_dir_fd(dd, /*no create*/0);
+        char *list = NULL;
+        if (dd_md_fd >= 0)
+            list = load_text_file_at(dd_md_fd, /*not items*/NULL, META_DATA_FILE_COMPRESSED_ITEMS,
+                    DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE | DD_FAIL_QUIETLY_ENOENT);
+
+        if (list != NULL)
+        {
+            compressed_items_parse(dd->compressed_items, list);
+            free(list);
+        }
+    }
+
+    return dd->compressed_items;
+}
+
+/* Writes the list of compressed items, removes it if it is empty */
+static int dd_save_compressed_items(struct dump_dir *dd)
+{
+    GHashTable *items = libreport_dd_get_compressed_items(dd);
+    if (g_hash_table_size(items) == 0)
+    {
+        const int dd_md_fd = dd_get_meta_data_dir_fd(dd, /*no create*/0);
+        if (dd_md_fd < 0 || unlinkat(dd_md_fd, META_DATA_FILE_COMPRESSED_ITEMS, /*only files*/0) == 0 || errno == ENOENT)
+            return 0;
+
+        const int ret = -errno;
+        perror_msg("Can't remove meta-data '%s'", META_DATA_FILE_COMPRESSED_ITEMS);
+        return ret;
+    }
+
+    struct strbuf *list = libreport_strbuf_new();
+
+    GHashTableIter iter;
+    gpointer name;
+    gpointer value;
+    g_hash_table_iter_init(&iter, items);
+    while (g_hash_table_iter_next(&iter, &name, &value))
+    {
+        const struct compressed_item *item = value;
+        libreport_strbuf_append_strf(list, "%zu %lld %s\n",
+                item->size, (long long)item->stored_size, (const char *)name);
+    }
+
+    const int ret = dd_meta_data_save_text(dd, META_DATA_FILE_COMPRESSED_ITEMS, list->buf);
+    libreport_strbuf_free(list);
+    return ret;
+}
+
+/* Returns the record of the item if the item stored as stored_size Bytes is
+ * compressed; otherwise NULL */
+static const struct compressed_item *find_compressed_item(GHashTable *items, const char *name, off_t stored_size)
+{
+    if (items == NULL)
+        return NULL;
+
+    const struct compressed_item *item = g_hash_table_lookup(items, name);
+    if (item == NULL || item->stored_size != stored_size)
+        return NULL; /* not compressed or stale record */
+
+    return item;
+}
+
+/* Decompresses data of a compressed item, returns a malloced buffer with
+ * the terminating '\0' Byte or NULL if the data are not compressed. */
+static char *decompress_item_data(GHashTable *items, const char *name, const char *data, size_t data_size, size_t *size)
+{
+    const struct compressed_item *item = find_compressed_item(items, name, data_size);
+    if (item == NULL
+     || data_size < sizeof(s_zstd_magic) || memcmp(data, s_zstd_magic, sizeof(s_zstd_magic)) != 0)
+        return NULL;
+
+#ifdef HAVE_ZSTD
+    char *buf = libreport_xmalloc(item->size + 1);
+    const size_t r = ZSTD_decompress(buf, item->size, data, data_size);
+    if (ZSTD_isError(r) || r != item->size)
+    {
+        error_msg("Can't decompress '%s': %s", name,
+                ZSTD_isError(r) ? ZSTD_getErrorName(r) : "Unexpected size");
+        free(buf);
+        return NULL;
+    }
+
+    buf[r] = '\0';
+    *size = r;
+    return buf;
+#else
+    error_msg("Can't decompress '%s': libreport was built without zstd", name);
+    return NULL;
+#endif
+}
+
+int libreport_decompress_item_fd(GHashTable *compressed_items, const char *name, int fd, bool *compressed)
+{
+    if (compressed)
+        *compressed = false;
+
+    /* The common case: no syscalls for uncompressed items */
+    if (compressed_items == NULL || !g_hash_table_contains(compressed_items, name))
+        return fd;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || find_compressed_item(compressed_items, name, st.st_size) == NULL)
+        return fd;
+
+    size_t data_size = st.st_size;
+    char *data = libreport_xmalloc(data_size);
+    const ssize_t r = pread(fd, data, data_size, 0);
+    if (r != (ssize_t)data_size)
+    {
+        free(data);
+        return fd;
+    }
+
+    size_t size = 0;
+    char *text = decompress_item_data(compressed_items, name, data, data_size, &size);
+    free(data);
+    if (text == NULL)
+    {
+        close(fd);
+        return -EBADMSG;
+    }
+
+    const int mem_fd = memfd_create(name, MFD_CLOEXEC);
+    if (mem_fd < 0 || libreport_full_write(mem_fd, text, size) != (ssize_t)size
+     || lseek(mem_fd, 0, SEEK_SET) != 0)
+    {
+        const int ret = -errno;
+        perror_msg("Can't create a file for decompressed '%s'", name);
+        if (mem_fd >= 0)
+            close(mem_fd);
+        free(text);
+        close(fd);
+        return ret;
+    }
+
+    free(text);
+    close(fd);
+
+    if (compressed)
+        *compressed = true;
+
+    return mem_fd;
+}
+
+int dd_decompress_item_fd(struct dump_dir *dd, const char *name, int fd, bool *compressed)
+{
+    return libreport_decompress_item_fd(libreport_dd_get_compressed_items(dd), name, fd, compressed);
+}
+
+/* Returns the threshold for storing text items compressed, 0 if disabled */
+static size_t dd_get_item_compression(struct dump_dir *dd)
+{
+    if (dd->item_compression < 0)
+    {
+        dd->item_compression = 0;
+
+        const int dd_md_fd = dd_get_meta_data_dir_fd(dd, /*no create*/0);
+        unsigned long long threshold = 0;
+        if (dd_md_fd >= 0
+         && read_number_from_file_at(dd_md_fd, META_DATA_FILE_ITEM_COMPRESSION, "size_t",
+                    sizeof(size_t), 0, SIZE_MAX, &threshold) == 0)
+            dd->item_compression = threshold;
+    }
+
+    return dd->item_compression;
+}
+
+int dd_set_item_compression(struct dump_dir *dd, size_t threshold)
+{
+#ifndef HAVE_ZSTD
+    if (threshold != 0)
+        return -ENOSYS;
+#endif
+    if (threshold != 0 && threshold < DD_ITEM_COMPRESSION_MIN_THRESHOLD)
+        return -EINVAL;
+
+    char threshold_str[sizeof(size_t) * 3 + 2];
+    sprintf(threshold_str, "%zu", threshold);
+
+    const int r = dd_meta_data_save_text(dd, META_DATA_FILE_ITEM_COMPRESSION, threshold_str);
+    if (r == 0)
+        dd->item_compression = threshold;
+
+    return r;
+}
+
+/* Removes the record of a compressed item; called whenever the item is
+ * overwritten or removed, regardless of the current threshold */
+static void dd_forget_compressed_item(struct dump_dir *dd, const char *name)
+{
+    if (g_hash_table_remove(libreport_dd_get_compressed_items(dd), name))
+        dd_save_compressed_items(dd);
+}
+
+/* Saves the text compressed if the dump directory stores large items
+ * compressed; returns false if the text must be saved uncompressed */
+static bool dd_save_compressed_text(struct dump_dir *dd, const char *name, const char *data, size_t size)
+{
+#ifdef HAVE_ZSTD
+    const size_t threshold = dd_get_item_compression(dd);
+    if (threshold == 0 || size < threshold || size > CD_MAX_TEXT_SIZE)
+        return false;
+
+    const size_t bound = ZSTD_compressBound(size);
+    char *buf = libreport_xmalloc(bound);
+    const size_t stored = ZSTD_compress(buf, bound, data, size, ZSTD_CLEVEL_DEFAULT);
+    if (ZSTD_isError(stored) || stored >= size)
+    {
+        free(buf);
+        return false;
+    }
+
+    struct compressed_item *item = libreport_xmalloc(sizeof(*item));
+    item->size = size;
+    item->stored_size = stored;
+    g_hash_table_replace(libreport_dd_get_compressed_items(dd), libreport_xstrdup(name), item);
+
+    const bool ok = dd_save_compressed_items(dd) == 0
+              && save_binary_file_at(dd->dd_fd, name, buf, stored, dd->dd_uid, dd->dd_gid, dd->mode);
+    free(buf);
+
+    return ok;
+#else
+    return false;
+#endif
+}
+
 /* A helper function useful for traversing directories.
  *
  * DIR* d opendir(dir_fd); ... closedir(d); closes also dir_fd but we want to
@@ -1272,6 +1722,7 @@ struct dump_dir *dd_create_skeleton(const char *dir, uid_t uid, mode_t mode, int
 
     /* Initialize dd_time to some sane value */
     dd->dd_time = time(NULL);
+    dd->modified = 1;
 
     return dd;
 
@@ -1604,6 +2055,10 @@ int dd_delete(struct dump_dir *dd)
         retval = -3;
     }
 
+    /* The directory is not a problem directory any more, even if it
+     * could not be removed */
+    spool_index_remove_dump_dir(dd->dd_dirname);
+
     dd->locked = 0; /* delete_file_dir already removed .lock */
 close:
     dd_close(dd);
@@ -1681,7 +2136,46 @@ next:
     return chown_res;
 }
 
-static char *load_text_from_file_descriptor(int fd, const char *path, int flags)
+/* Replaces '\0' by ' ', drops control characters other than white spaces and
+ * counts lines the same way the loader has always done.
+ *
+ * Works in place and returns the new length of the text.
+ */
+static size_t sanitize_loaded_text(char *text, size_t len, int *oneline)
+{
+    char *dst = text;
+    const char *src = text;
+    const char *const end = text + len;
+
+    /* Fast forward over the leading part which needs no modification. */
+    while (src < end && (unsigned char)*src >= ' ')
+        ++src;
+    dst += (src - text);
+
+    for (; src < end; ++src)
+    {
+        unsigned char ch = *src;
+        if (ch >= ' ') /* used !iscntrl, but it failed on unicode */
+        {
+            *dst++ = ch;
+            continue;
+        }
+//TODO? \r -> \n?
+//TODO? strip trailing spaces/tabs?
+        if (ch == '\n')
+            *oneline = (*oneline << 1) | 1;
+        if (ch == '\0')
+            ch = ' ';
+        if (isspace(ch))
+            *dst++ = ch;
+    }
+
+    return dst - text;
+}
+
+/* compressed_items is the list of compressed items of the dump directory for
+ * loading items; NULL for other files */
+static char *load_text_from_file_descriptor(GHashTable *compressed_items, int fd, const char *path, int flags)
 {
     if (fd == -1)
     {
@@ -1691,29 +2185,34 @@ static char *load_text_from_file_descriptor(int fd, const char *path, int flags)
     }
 
     /* Why? Because half a million read syscalls of one byte each isn't fun.
-     * FILE-based IO buffers reads.
+     * Read the whole file in one go (the buffer is sized by fstat) and
+     * normalize the text in a single pass over the buffer.
      */
-    FILE *fp = fdopen(fd, "r");
-    if (!fp)
-        libreport_die_out_of_memory();
-
-    struct strbuf *buf_content = libreport_strbuf_new();
-    int oneline = 0;
-    int ch;
-    while ((ch = fgetc(fp)) != EOF)
+    size_t len = SIZE_MAX - 1;
+    char *text = libreport_xmalloc_read(fd, &len);
+    close(fd);
+    if (text == NULL)
     {
-//TODO? \r -> \n?
-//TODO? strip trailing spaces/tabs?
-        if (ch == '\n')
-            oneline = (oneline << 1) | 1;
-        if (ch == '\0')
-            ch = ' ';
-        if (isspace(ch) || ch >= ' ') /* used !iscntrl, but it failed on unicode */
-            libreport_strbuf_append_char(buf_content, ch);
+        /* Reading with fgetc() would have returned an empty string too. */
+        text = libreport_xzalloc(1);
+        len = 0;
+    }
+    else if (compressed_items != NULL)
+    {
+        size_t size;
+        char *decompressed = decompress_item_data(compressed_items, path, text, len, &size);
+        if (decompressed != NULL)
+        {
+            free(text);
+            text = decompressed;
+            len = size;
+        }
     }
-    fclose(fp); /* this also closes fd */
 
-    char last = oneline != 0 ? buf_content->buf[buf_content->len - 1] : 0;
+    int oneline = 0;
+    len = sanitize_loaded_text(text, len, &oneline);
+
+    char last = oneline != 0 ? text[len - 1] : 0;
     if (last == '\n')
     {
         /* If file contains exactly one '\n' and it is at the end, remove it.
@@ -1721,7 +2220,7 @@ static char *load_text_from_file_descriptor(int fd, const char *path, int flags)
          * short string items in dump dirs.
          */
         if (oneline == 1)
-            buf_content->buf[--buf_content->len] = '\0';
+            --len;
     }
     else /* last != '\n' */
     {
@@ -1731,24 +2230,28 @@ static char *load_text_from_file_descriptor(int fd, const char *path, int flags)
         /* oneline=1: "qwe\nrty" - two lines in fact */
         /* oneline>1: "qwe\nrty\uio" */
         if (oneline >= 1)
-            libreport_strbuf_append_char(buf_content, '\n');
+        {
+            text = libreport_xrealloc(text, len + 2);
+            text[len++] = '\n';
+        }
     }
 
-    return libreport_strbuf_free_nobuf(buf_content);
+    text[len] = '\0';
+    return text;
 }
 
-static char *load_text_file_at(int dir_fd, const char *name, unsigned flags)
+static char *load_text_file_at(int dir_fd, GHashTable *compressed_items, const char *name, unsigned flags)
 {
     assert(name[0] != '/');
 
     const int fd = openat(dir_fd, name, O_RDONLY | ((flags & DD_OPEN_FOLLOW) ? 0 : O_NOFOLLOW));
-    return load_text_from_file_descriptor(fd, name, flags);
+    return load_text_from_file_descriptor(compressed_items, fd, name, flags);
 }
 
 char *load_text_file(const char *path, unsigned flags)
 {
     const int fd = open(path, O_RDONLY | ((flags & DD_OPEN_FOLLOW) ? 0 : O_NOFOLLOW));
-    return load_text_from_file_descriptor(fd, path, flags);
+    return load_text_from_file_descriptor(/*not an item*/NULL, fd, path, flags);
 }
 
 static void copy_file_from_chroot(struct dump_dir* dd, const char *name, const char *chroot_dir, const char *file_path)
@@ -1838,7 +2341,10 @@ char* dd_load_text_ext(const struct dump_dir *dd, const char *name, unsigned fla
     if (strcmp(name, "release") == 0)
         name = FILENAME_OS_RELEASE;
 
-    return load_text_file_at(dd->dd_fd, name, flags);
+    /* Loading the list of compressed items on demand does not change the
+     * dump directory */
+    GHashTable *compressed_items = libreport_dd_get_compressed_items((struct dump_dir *)dd);
+    return load_text_file_at(dd->dd_fd, compressed_items, name, flags);
 }
 
 char* dd_load_text(const struct dump_dir *dd, const char *name)
@@ -1896,10 +2402,14 @@ int dd_load_uint64(const struct dump_dir *dd, const char *name, uint64_t *value)
 
 int dd_get_env_variable(struct dump_dir *dd, const char *name, char **value)
 {
-    const int fd = openat(dd->dd_fd, FILENAME_ENVIRON, O_RDONLY | O_NOFOLLOW);
+    int fd = openat(dd->dd_fd, FILENAME_ENVIRON, O_RDONLY | O_NOFOLLOW);
     if (fd < 0)
         return -errno;
 
+    fd = dd_decompress_item_fd(dd, FILENAME_ENVIRON, fd, NULL);
+    if (fd < 0)
+        return fd;
+
     const int r  = libreport_get_env_variable_ext(fd, '\n', name, value);
     close(fd);
     return r;
@@ -1913,7 +2423,13 @@ void dd_save_text(struct dump_dir *dd, const char *name, const char *data)
     if (!dd_validate_element_name(name))
         error_msg_and_die("Cannot save text. '%s' is not a valid file name", name);
 
-    save_binary_file_at(dd->dd_fd, name, data, strlen(data), dd->dd_uid, dd->dd_gid, dd->mode);
+    const size_t size = strlen(data);
+    if (!dd_save_compressed_text(dd, name, data, size))
+    {
+        save_binary_file_at(dd->dd_fd, name, data, size, dd->dd_uid, dd->dd_gid, dd->mode);
+        dd_forget_compressed_item(dd, name);
+    }
+    dd->modified = 1;
 }
 
 void dd_save_binary(struct dump_dir* dd, const char* name, const char* data, unsigned size)
@@ -1925,6 +2441,8 @@ void dd_save_binary(struct dump_dir* dd, const char* name, const char* data, uns
         error_msg_and_die("Cannot save binary. '%s' is not a valid file name", name);
 
     save_binary_file_at(dd->dd_fd, name, data, size, dd->dd_uid, dd->dd_gid, dd->mode);
+    dd_forget_compressed_item(dd, name);
+    dd->modified = 1;
 }
 
 int dd_item_stat(struct dump_dir *dd, const char *name, struct stat *statbuf)
@@ -1940,6 +2458,11 @@ int dd_item_stat(struct dump_dir *dd, const char *name, struct stat *statbuf)
     if (!S_ISREG(statbuf->st_mode))
         return -EMEDIUMTYPE;
 
+    const struct compressed_item *item = find_compressed_item(libreport_dd_get_compressed_items(dd),
+            name, statbuf->st_size);
+    if (item != NULL)
+        statbuf->st_size = item->size;
+
     return 0;
 }
 
@@ -1987,6 +2510,10 @@ int dd_delete_item(struct dump_dir *dd, const char *name)
         else
             perror_msg("Can't delete file '%s'", name);
     }
+    else
+        dd->modified = 1;
+
+    dd_forget_compressed_item(dd, name);
 
     return res;
 }
@@ -2000,13 +2527,23 @@ int dd_open_item(struct dump_dir *dd, const char *name, int flag)
     }
 
     if (flag == O_RDONLY)
-        return openat(dd->dd_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    {
+        const int fd = openat(dd->dd_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0)
+            return fd;
+
+        return dd_decompress_item_fd(dd, name, fd, NULL);
+    }
 
     if (!dd->locked)
         error_msg_and_die("dump_dir is not locked"); /* bug */
 
     if (flag == O_RDWR)
+    {
+        dd->modified = 1;
+        dd_forget_compressed_item(dd, name);
         return create_new_file_at(dd->dd_fd, O_RDWR, name, dd->dd_uid, dd->dd_gid, dd->mode);
+    }
 
     error_msg("invalid open item flag");
     return -ENOTSUP;
@@ -2064,20 +2601,15 @@ off_t dd_compute_size(struct dump_dir *dd, int flags)
 {
     off_t retval = 0;
 
-    if (dd_init_next_file(dd) == NULL)
+    struct dd_item_iterator iter;
+    if (dd_item_iterator_init(dd, &iter, DD_ITEM_ITERATOR_STAT) < 0)
         return -EIO;
 
-    struct stat statbuf;
-    struct dirent *dent;
-    while (_dd_get_next_file_dent(dd, &dent))
+    struct dd_item_info info;
+    int r;
+    while ((r = dd_item_iterator_next(&iter, &info)) > 0)
     {
-        if (fstatat(dd->dd_fd, dent->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0)
-        {
-            retval = -errno;
-            goto finito;
-        }
-
-        retval += statbuf.st_size;
+        retval += info.size;
         /* Check overflow */
         if (retval < 0)
         {
@@ -2086,8 +2618,11 @@ off_t dd_compute_size(struct dump_dir *dd, int flags)
         }
     }
 
+    if (r < 0)
+        retval = r;
+
 finito:
-    dd_clear_next_file(dd);
+    dd_item_iterator_destroy(&iter);
     return retval;
 }
 
@@ -2137,6 +2672,137 @@ int dd_get_next_file(struct dump_dir *dd, char **short_name, char **full_name)
     return 1;
 }
 
+/* The layout of entries returned by getdents64 (man 2 getdents). Older glibc
+ * does not provide neither the structure nor the function.
+ */
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+int dd_item_iterator_init(struct dump_dir *dd, struct dd_item_iterator *iter, int flags)
+{
+    iter->flags = flags;
+    iter->pos = iter->end = 0;
+
+    /* Do not dup() dd_fd, the duplicate would share the file offset. */
+    iter->dir_fd = openat(dd->dd_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (iter->dir_fd < 0)
+    {
+        const int r = -errno;
+        perror_msg("Can't open directory '%s'", dd->dd_dirname);
+        return r;
+    }
+
+    return 0;
+}
+
+static int dd_item_iterator_stat(struct dd_item_iterator *iter, const char *name, struct dd_item_info *info)
+{
+#ifdef STATX_TYPE
+    struct statx stx;
+    if (statx(iter->dir_fd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+              STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_INO, &stx) != 0)
+        return -errno;
+
+    info->type = IFTODT(stx.stx_mode);
+    info->inode = stx.stx_ino;
+    info->size = stx.stx_size;
+    info->mtime = stx.stx_mtime.tv_sec;
+#else
+    struct stat st;
+    if (fstatat(iter->dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+        return -errno;
+
+    info->type = IFTODT(st.st_mode);
+    info->inode = st.st_ino;
+    info->size = st.st_size;
+    info->mtime = st.st_mtime;
+#endif
+    return 0;
+}
+
+int dd_item_iterator_next(struct dd_item_iterator *iter, struct dd_item_info *info)
+{
+    if (iter->dir_fd < 0)
+        return 0;
+
+    while (1)
+    {
+        if (iter->pos >= iter->end)
+        {
+            long r;
+            do
+                r = syscall(SYS_getdents64, iter->dir_fd, iter->buf, sizeof(iter->buf));
+            while (r < 0 && errno == EINTR);
+
+            if (r < 0)
+            {
+                r = -errno;
+                perror_msg("getdents64");
+                dd_item_iterator_destroy(iter);
+                return r;
+            }
+
+            if (r == 0)
+            {
+                dd_item_iterator_destroy(iter);
+                return 0;
+            }
+
+            iter->pos = 0;
+            iter->end = r;
+        }
+
+        const struct linux_dirent64 *dent = (const struct linux_dirent64 *)((const char *)iter->buf + iter->pos);
+        iter->pos += dent->d_reclen;
+
+        if (libreport_dot_or_dotdot(dent->d_name))
+            continue;
+
+        info->name = dent->d_name;
+        info->type = dent->d_type;
+        info->inode = dent->d_ino;
+        info->size = -1;
+        info->mtime = -1;
+
+        if ((iter->flags & DD_ITEM_ITERATOR_STAT) || info->type == DT_UNKNOWN)
+        {
+            const int r = dd_item_iterator_stat(iter, dent->d_name, info);
+            if (r == -ENOENT) /* deleted in the meantime */
+                continue;
+            if (r < 0)
+            {
+                perror_msg("Can't stat '%s'", dent->d_name);
+                return r;
+            }
+
+            /* Only the type was asked for */
+            if (!(iter->flags & DD_ITEM_ITERATOR_STAT))
+            {
+                info->size = -1;
+                info->mtime = -1;
+            }
+        }
+
+        if (info->type == DT_REG)
+            return 1;
+    }
+}
+
+void dd_item_iterator_destroy(struct dd_item_iterator *iter)
+{
+    if (iter->dir_fd < 0)
+        return;
+
+    close(iter->dir_fd);
+    iter->dir_fd = -1;
+}
+
 /* reported_to handling */
 
 void libreport_add_reported_to(struct dump_dir *dd, const char *line)
@@ -2203,8 +2869,11 @@ int dd_rename(struct dump_dir *dd, const char *new_path)
     int res = rename(dd->dd_dirname, new_path);
     if (res == 0)
     {
+        spool_index_remove_dump_dir(dd->dd_dirname);
+
         free(dd->dd_dirname);
         dd->dd_dirname = rm_trailing_slashes(new_path);
+        dd->modified = 1;
     }
     return res;
 }
@@ -2370,6 +3039,7 @@ int dd_copy_file(struct dump_dir *dd, const char *name, const char *source_path)
     log_debug("copying '%s' to '%s' at '%s'", source_path, name, dd->dd_dirname);
 
     unlinkat(dd->dd_fd, name, /*remove only files*/0);
+    dd_forget_compressed_item(dd, name);
     off_t copied = libreport_copy_file_ext_at(source_path, dd->dd_fd, name, DEFAULT_DUMP_DIR_MODE,
             dd->dd_uid, dd->dd_gid, O_RDONLY, O_WRONLY | O_TRUNC | O_EXCL | O_CREAT);
 
@@ -2378,6 +3048,8 @@ int dd_copy_file(struct dump_dir *dd, const char *name, const char *source_path)
     else
         log_debug("copied %li bytes", (unsigned long)copied);
 
+    dd->modified = 1;
+
     return copied < 0;
 }
 
@@ -2389,6 +3061,7 @@ int dd_copy_file_at(struct dump_dir *dd, const char *name, int src_dir_fd, const
     log_debug("copying file '%s' to element '%s' at '%s'", src_name, name, dd->dd_dirname);
 
     unlinkat(dd->dd_fd, name, /*remove only files*/0);
+    dd_forget_compressed_item(dd, name);
     off_t copied = libreport_copy_file_ext_2at(src_dir_fd, src_name, dd->dd_fd, name,
             DEFAULT_DUMP_DIR_MODE,
             dd->dd_uid, dd->dd_gid,
@@ -2400,6 +3073,8 @@ int dd_copy_file_at(struct dump_dir *dd, const char *name, int src_dir_fd, const
     else
         log_debug("copied %li bytes", (unsigned long)copied);
 
+    dd->modified = 1;
+
     return copied < 0;
 }
 
@@ -2411,6 +3086,7 @@ int dd_copy_file_unpack(struct dump_dir *dd, const char *name, const char *sourc
     log_debug("unpacking '%s' to '%s' at '%s'", source_path, name, dd->dd_dirname);
 
     unlinkat(dd->dd_fd, name, /*remove only files*/0);
+    dd_forget_compressed_item(dd, name);
     off_t copied = libreport_decompress_file_ext_at(source_path, dd->dd_fd, name, DEFAULT_DUMP_DIR_MODE,
             dd->dd_uid, dd->dd_gid, O_RDONLY, O_WRONLY | O_TRUNC | O_EXCL | O_CREAT);
 
@@ -2419,121 +3095,123 @@ int dd_copy_file_unpack(struct dump_dir *dd, const char *name, const char *sourc
     else
         log_debug("unpackaged file '%s'", source_path);
 
+    dd->modified = 1;
+
     return copied < 0;
 
 }
 
-/* flags - for future needs */
-int dd_create_archive(struct dump_dir *dd, const char *archive_name,
-        const_string_vector_const_ptr_t exclude_elements, int flags)
+int dd_write_archive(struct dump_dir *dd, enum archive_compression compression,
+        const_string_vector_const_ptr_t exclude_elements, archive_sink_fn sink, void *sink_param)
 {
-    if (libreport_suffixcmp(archive_name, ".tar.gz") != 0)
-        return -ENOSYS;
+    struct archive_writer *aw = archive_writer_new(compression, dd_g_archive_threads,
+            sink, sink_param);
 
-    int result = 0;
-    pid_t child;
-    TAR* tar = NULL;
-    int pipe_from_parent_to_child[2];
-    libreport_xpipe(pipe_from_parent_to_child);
-    child = fork();
-    if (child < 0)
-    {
-        result = -errno;
-        /* Don't die, let the caller to execute his clean-up code. */
-        perror_msg("vfork");
-        return result;
-    }
-    if (child == 0)
+    /* Write data to the tarball */
+    struct dd_item_iterator iter;
+    int result = dd_item_iterator_init(dd, &iter, /*flags*/0);
+    if (result != 0)
+        goto finito;
+
+    struct dd_item_info info;
+    int r;
+    while ((r = dd_item_iterator_next(&iter, &info)) > 0)
     {
-        /* child */
-        close(pipe_from_parent_to_child[1]);
-        libreport_xmove_fd(pipe_from_parent_to_child[0], 0);
+        if (exclude_elements && libreport_is_in_string_list(info.name, exclude_elements))
+            continue;
 
-        int fd = open(archive_name, O_WRONLY | O_CREAT | O_EXCL, 0600);
-        if (fd < 0)
+        int item_fd = openat(dd->dd_fd, info.name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (item_fd < 0)
         {
-            /* This r might interfer with exit status of gzip, but it is
-             * very unlikely (man 1 gzip):
-             *   Exit status is normally 0; if an error occurs, exit status is
-             *   1. If a warning occurs, exit status is 2.
-             */
-            result = errno == EEXIST ? 100 : 3;
-            perror_msg("Can't open '%s'", archive_name);
-            exit(result);
-        }
-
-        libreport_xmove_fd(fd, 1);
-        execlp("gzip", "gzip", NULL);
-        perror_msg_and_die("Can't execute '%s'", "gzip");
-    }
-    close(pipe_from_parent_to_child[0]);
+            /* The item was removed in the meantime */
+            if (errno == ENOENT)
+                continue;
 
-    /* If child died (say, in libreport_xopen), then parent might get SIGPIPE.
-     * We want to properly unlock dd, therefore we must not die on SIGPIPE:
-     */
-    sighandler_t old_handler = signal(SIGPIPE, SIG_IGN);
+            result = -errno;
+            perror_msg("Can't open '%s' at '%s'", info.name, dd->dd_dirname);
+            break;
+        }
 
-    /* Create tar writer object */
-    if (tar_fdopen(&tar, pipe_from_parent_to_child[1], archive_name,
-                /*fileops:(standard)*/ NULL, O_WRONLY | O_CREAT, 0644, TAR_GNU) != 0)
-    {
-        result = -errno;
-        log_warning(_("Failed to open TAR writer"));
-        goto finito;
-    }
+        struct stat st;
+        if (fstat(item_fd, &st) != 0)
+        {
+            result = -errno;
+            perror_msg("Can't stat '%s' at '%s'", info.name, dd->dd_dirname);
+            close(item_fd);
+            break;
+        }
 
-    /* Write data to the tarball */
-    dd_init_next_file(dd);
-    char *short_name, *full_name;
-    while (dd_get_next_file(dd, &short_name, &full_name))
-    {
-        if (!(exclude_elements && libreport_is_in_string_list(short_name, exclude_elements)))
+        /* Archives contain the items as they were saved; the anonymous file
+         * with the contents does not have the item's mode */
+        const struct compressed_item *compressed = find_compressed_item(
+                libreport_dd_get_compressed_items(dd), info.name, st.st_size);
+        if (compressed != NULL)
         {
-           if (tar_append_file(tar, full_name, short_name))
-               result = -errno;
+            st.st_size = compressed->size;
+            item_fd = dd_decompress_item_fd(dd, info.name, item_fd, NULL);
+            if (item_fd < 0)
+            {
+                result = item_fd;
+                break;
+            }
         }
 
-        free(short_name);
-        free(full_name);
+        if (S_ISREG(st.st_mode))
+            result = archive_writer_add_fd(aw, info.name, item_fd, &st);
+
+        close(item_fd);
 
         if (result != 0)
-            goto finito;
+            break;
     }
+    dd_item_iterator_destroy(&iter);
 
-    /* Close tar writer... */
-    if (tar_append_eof(tar) != 0)
-    {
-        result = -errno;
-        log_warning(_("Failed to finalize TAR archive"));
+    if (r < 0)
+        result = r;
+
+    if (result != 0)
         goto finito;
-    }
+
+    /* Write the end of archive and flush compressed data */
+    result = archive_writer_finish(aw);
+    if (result != 0)
+        log_warning(_("Failed to finalize TAR archive"));
 
 finito:
-    signal(SIGPIPE, old_handler);
+    archive_writer_free(aw);
+    return result;
+}
+
+/* flags - for future needs */
+int dd_create_archive(struct dump_dir *dd, const char *archive_name,
+        const_string_vector_const_ptr_t exclude_elements, int flags)
+{
+    const int compression = archive_compression_from_name(archive_name);
+    if (compression < 0)
+        return compression;
 
-    if (tar != NULL && tar_close(tar) != 0)
+    int fd = open(archive_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0)
     {
-        result = -errno;
-        log_warning(_("Failed to close TAR writer"));
+        const int result = -errno;
+        perror_msg("Can't open '%s'", archive_name);
+        return result;
     }
 
-    /* ...and check that gzip child finished successfully */
-    int status;
-    libreport_safe_waitpid(child, &status, 0);
-    if (status != 0)
+    /* If the archive is on a pipe-like file system and the reader dies, we
+     * might get SIGPIPE. We want to properly unlock dd, therefore we must not
+     * die on SIGPIPE:
+     */
+    sighandler_t old_handler = signal(SIGPIPE, SIG_IGN);
+
+    int result = dd_write_archive(dd, compression, exclude_elements, archive_fd_sink, &fd);
+
+    signal(SIGPIPE, old_handler);
+
+    if (close(fd) != 0 && result == 0)
     {
-        result = -ECHILD;
-        if (WIFSIGNALED(status))
-            log_warning(_("gzip killed with signal %d"), WTERMSIG(status));
-        else if (WIFEXITED(status))
-        {
-            if (WEXITSTATUS(status) == 100)
-                result = -EEXIST;
-            else
-                log_warning(_("gzip exited with %d"), WEXITSTATUS(status));
-        }
-        else
-            log_warning(_("gzip process failed"));
+        result = -errno;
+        perror_msg("Can't close '%s'", archive_name);
     }
 
     return result;
@@ -2547,6 +3225,7 @@ off_t dd_copy_fd(struct dump_dir *dd, const char *name, int fd, int copy_flags,
     log_debug("Saving data from file descriptor %d to '%s' at '%s'", fd, name, dd->dd_dirname);
 
     unlinkat(dd->dd_fd, name, /*remove only files*/0);
+    dd_forget_compressed_item(dd, name);
     off_t read = libreport_copyfd_ext_at(fd, dd->dd_fd, name, DEFAULT_DUMP_DIR_MODE,
             dd->dd_uid, dd->dd_gid, O_WRONLY | O_CREAT | O_EXCL, copy_flags, maxsize);
 
@@ -0,0 +1,237 @@
+/*
+    Copyright (C) 2024  ABRT team
+    Copyright (C) 2024  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <sys/file.h>
+#include "internal_libreport.h"
+
+// The cache file holds a single serialized GVariant:
+//
+//   (s                          format version
+//    a{s                        tracker URL, product, version, component and
+//                               duphash
+//      (isx)})                  bug id, bug status, time of storing
+//
+// Lookups only read the file, it is always replaced atomically. Updates
+// re-read the file under flock() on the cache directory and write it back
+// without the expired entries, so concurrent reporters don't lose each
+// other's entries.
+
+#define DUPHASH_CACHE_FORMAT "libreport-duphash-cache-1"
+#define DUPHASH_CACHE_ENTRY_TYPE "(isx)"
+#define DUPHASH_CACHE_FILE "duphash.cache"
+
+/* Disables the cache, e.g. to always search the trackers */
+#define DUPHASH_CACHE_DISABLE_ENV "LIBREPORT_NO_DUPHASH_CACHE"
+/* Overrides the cache directory, e.g. for tests */
+#define DUPHASH_CACHE_DIR_ENV "LIBREPORT_DUPHASH_CACHE_DIR"
+/* Overrides DUPHASH_CACHE_TTL_DEFAULT, in seconds */
+#define DUPHASH_CACHE_TTL_ENV "LIBREPORT_DUPHASH_CACHE_TTL"
+
+static gint64 duphash_cache_ttl(void)
+{
+    const char *ttl = getenv(DUPHASH_CACHE_TTL_ENV);
+    if (ttl == NULL || ttl[0] == '\0')
+        return DUPHASH_CACHE_TTL_DEFAULT;
+
+    char *end;
+    errno = 0;
+    const long long value = strtoll(ttl, &end, 10);
+    if (errno != 0 || *end != '\0' || value < 0)
+    {
+        log_debug("Invalid %s '%s', using %d", DUPHASH_CACHE_TTL_ENV, ttl, DUPHASH_CACHE_TTL_DEFAULT);
+        return DUPHASH_CACHE_TTL_DEFAULT;
+    }
+
+    return value;
+}
+
+static gint64 now_sec(void)
+{
+    return g_get_real_time() / G_USEC_PER_SEC;
+}
+
+static bool duphash_cache_expired(gint64 stored, gint64 now, gint64 ttl)
+{
+    /* Entries from the future were stored before the clock was set back */
+    return stored > now || now - stored >= ttl;
+}
+
+static char *duphash_cache_key(const char *tracker_url, const char *product,
+        const char *version, const char *component, const char *duphash)
+{
+    return libreport_xasprintf("%s\n%s\n%s\n%s\n%s", tracker_url,
+            product ? product : "", version ? version : "",
+            component ? component : "", duphash);
+}
+
+/* @return The cached entries as a{s(isx)} or NULL */
+static GVariant *duphash_cache_read(const char *path)
+{
+    return libreport_cache_file_read(path, DUPHASH_CACHE_FORMAT,
+            "a{s" DUPHASH_CACHE_ENTRY_TYPE "}");
+}
+
+/* Replaces the entry of key by entry, or removes it if entry is NULL, and
+ * drops the expired entries
+ */
+static void duphash_cache_update(const char *key, GVariant *entry)
+{
+    if (entry != NULL)
+        g_variant_ref_sink(entry);
+
+    char *dir = libreport_cache_dir(DUPHASH_CACHE_DIR_ENV);
+    if (g_mkdir_with_parents(dir, geteuid() == 0 ? 0755 : 0700) != 0)
+    {
+        log_debug("Can't create duphash cache directory '%s': %s", dir, strerror(errno));
+        goto out;
+    }
+
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0)
+    {
+        log_debug("Can't open duphash cache directory '%s': %s", dir, strerror(errno));
+        goto out;
+    }
+
+    while (flock(dir_fd, LOCK_EX) != 0)
+    {
+        if (errno == EINTR)
+            continue;
+
+        /* The worst case is an entry lost to a concurrent update */
+        log_debug("Can't lock duphash cache directory '%s': %s", dir, strerror(errno));
+        break;
+    }
+
+    char *path = libreport_concat_path_file(dir, DUPHASH_CACHE_FILE);
+
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{s" DUPHASH_CACHE_ENTRY_TYPE "}"));
+
+    if (entry != NULL)
+        g_variant_builder_add(&builder, "{s@" DUPHASH_CACHE_ENTRY_TYPE "}", key, entry);
+
+    bool changed = (entry != NULL);
+    GVariant *entries = duphash_cache_read(path);
+    if (entries != NULL)
+    {
+        const gint64 now = now_sec();
+        const gint64 ttl = duphash_cache_ttl();
+
+        GVariantIter iter;
+        g_variant_iter_init(&iter, entries);
+        const char *entry_key;
+        GVariant *value;
+        while (g_variant_iter_next(&iter, "{&s@" DUPHASH_CACHE_ENTRY_TYPE "}", &entry_key, &value))
+        {
+            gint64 stored;
+            g_variant_get(value, "(i&sx)", NULL, NULL, &stored);
+
+            if (strcmp(entry_key, key) == 0 || duphash_cache_expired(stored, now, ttl))
+                changed = true;
+            else
+                g_variant_builder_add(&builder, "{s@" DUPHASH_CACHE_ENTRY_TYPE "}", entry_key, value);
+
+            g_variant_unref(value);
+        }
+    }
+
+    GVariant *new_entries = g_variant_builder_end(&builder);
+    if (changed)
+        libreport_cache_file_write(path, DUPHASH_CACHE_FORMAT, new_entries);
+    else
+        g_variant_unref(g_variant_ref_sink(new_entries));
+
+    if (entries != NULL)
+        g_variant_unref(entries);
+    free(path);
+
+    /* Closing the descriptor releases the lock */
+    close(dir_fd);
+
+ out:
+    free(dir);
+    if (entry != NULL)
+        g_variant_unref(entry);
+}
+
+bool libreport_duphash_cache_lookup(const char *tracker_url, const char *product,
+        const char *version, const char *component, const char *duphash,
+        int *bug_id, char **status)
+{
+    if (getenv(DUPHASH_CACHE_DISABLE_ENV) != NULL || duphash == NULL)
+        return false;
+
+    char *dir = libreport_cache_dir(DUPHASH_CACHE_DIR_ENV);
+    char *path = libreport_concat_path_file(dir, DUPHASH_CACHE_FILE);
+    free(dir);
+
+    GVariant *entries = duphash_cache_read(path);
+    free(path);
+    if (entries == NULL)
+        return false;
+
+    char *key = duphash_cache_key(tracker_url, product, version, component, duphash);
+    GVariant *entry = g_variant_lookup_value(entries, key, G_VARIANT_TYPE(DUPHASH_CACHE_ENTRY_TYPE));
+    free(key);
+    g_variant_unref(entries);
+    if (entry == NULL)
+        return false;
+
+    gint32 id;
+    const char *entry_status;
+    gint64 stored;
+    g_variant_get(entry, "(i&sx)", &id, &entry_status, &stored);
+
+    const bool found = id > 0 && !duphash_cache_expired(stored, now_sec(), duphash_cache_ttl());
+    if (found)
+    {
+        log_debug("Using cached bug %i (%s) for duphash '%s'", (int)id, entry_status, duphash);
+        if (bug_id != NULL)
+            *bug_id = id;
+        if (status != NULL)
+            *status = libreport_xstrdup(entry_status);
+    }
+
+    g_variant_unref(entry);
+    return found;
+}
+
+void libreport_duphash_cache_store(const char *tracker_url, const char *product,
+        const char *version, const char *component, const char *duphash,
+        int bug_id, const char *status)
+{
+    if (getenv(DUPHASH_CACHE_DISABLE_ENV) != NULL || duphash == NULL || bug_id <= 0)
+        return;
+
+    char *key = duphash_cache_key(tracker_url, product, version, component, duphash);
+    duphash_cache_update(key, g_variant_new(DUPHASH_CACHE_ENTRY_TYPE,
+                (gint32)bug_id, status ? status : "", now_sec()));
+    free(key);
+}
+
+void libreport_duphash_cache_invalidate(const char *tracker_url, const char *product,
+        const char *version, const char *component, const char *duphash)
+{
+    if (getenv(DUPHASH_CACHE_DISABLE_ENV) != NULL || duphash == NULL)
+        return;
+
+    char *key = duphash_cache_key(tracker_url, product, version, component, duphash);
+    duphash_cache_update(key, NULL);
+    free(key);
+}
@@ -20,6 +20,10 @@
  */
 #include "internal_libreport.h" /* libreport_xmalloc */
 
+#if defined(__x86_64__) && defined(__GNUC__)
+# include <immintrin.h>
+#endif
+
 /* Conversion table for base 64 */
 static const char tbl_base64[65 /*+ 2*/] = {
 	'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H',
@@ -48,46 +52,418 @@ const char tbl_uuencode[65] ALIGN1 = {
 };
 */
 
+/* Values of the base64 chars, 0xff for the other chars */
+static const unsigned char tbl_unbase64[256] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+	0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+	0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
 /*
- * Encode bytes at S of length LENGTH.
- * Result will be 0-terminated, and must point to a writable
- * buffer of at least 1+BASE64_LENGTH(length) bytes,
- * where BASE64_LENGTH(len) = 4 * ((LENGTH + 2) / 3)
+ * Vector kernels
+ *
+ * The kernels process whole blocks of input and return the number of
+ * consumed bytes (chars); the callers deal with the rest. Which
+ * implementation is used is decided at run time according to the features
+ * of the CPU.
+ *
+ * Encoding: the 3 bytes of every group are spread into a 32-bit lane, the
+ * four 6-bit indices are moved to separate bytes by multiplications and
+ * turned into chars by adding an offset looked up by pshufb.
+ * Decoding: the chars are validated and turned into indices by two nibble
+ * lookups, the indices are merged by multiply-adds and packed by pshufb.
+ * See Wojciech Muła's articles on base64 with SIMD for the details.
  */
-static void encode_64bit(char *p, const void *src, int length, const char *tbl)
+static size_t encode_blocks_none(char *dst, const unsigned char *src, size_t length)
 {
-	const unsigned char *s = (const unsigned char *)src;
+	return 0;
+}
+
+static size_t decode_blocks_none(unsigned char *dst, const char *src, size_t length)
+{
+	return 0;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("ssse3")))
+static inline __m128i encode_indices_ssse3(__m128i in)
+{
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	const __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+	                                   _mm_set1_epi32(0x04000040));
+	const __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+	                                   _mm_set1_epi32(0x01000010));
+	const __m128i indices = _mm_or_si128(t0, t1);
+
+	/* 0-25 -> 13, 26-51 -> 0, 52-61 -> 1-10, 62 -> 11, 63 -> 12 */
+	__m128i offset_index = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+	offset_index = _mm_or_si128(offset_index,
+	                            _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+	const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	                                      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+	                                      '/' - 63, 'A', 0, 0);
+	return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, offset_index));
+}
+
+__attribute__((target("ssse3")))
+static size_t encode_blocks_ssse3(char *dst, const unsigned char *src, size_t length)
+{
+	size_t i = 0;
+	/* 16 bytes are loaded, 12 of them are encoded */
+	for (; i + 16 <= length; i += 12, dst += 16) {
+		const __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)dst, encode_indices_ssse3(in));
+	}
+	return i;
+}
+
+/* Returns false if any of the chars is not a base64 char */
+__attribute__((target("ssse3")))
+static inline bool decode_indices_ssse3(__m128i in, __m128i *out)
+{
+	const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0f));
+	const __m128i lo_nibbles = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+
+	/* The bit of the high nibble is set in the mask of the low nibble
+	 * for the valid chars */
+	const __m128i lo_masks = _mm_setr_epi8(0xa8, 0xf8, 0xf8, 0xf8, 0xf8, 0xf8, 0xf8, 0xf8,
+	                                       0xf8, 0xf8, 0xf0, 0x54, 0x50, 0x50, 0x50, 0x54);
+	const __m128i hi_bits = _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+	                                      0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i valid = _mm_and_si128(_mm_shuffle_epi8(lo_masks, lo_nibbles),
+	                                    _mm_shuffle_epi8(hi_bits, hi_nibbles));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(valid, _mm_setzero_si128())) != 0)
+		return false;
+
+	/* '/' is the only char whose offset differs from its high nibble group */
+	const __m128i offsets = _mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i is_slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+	const __m128i offset = _mm_or_si128(_mm_andnot_si128(is_slash, _mm_shuffle_epi8(offsets, hi_nibbles)),
+	                                    _mm_and_si128(is_slash, _mm_set1_epi8(16)));
+	const __m128i indices = _mm_add_epi8(in, offset);
+
+	const __m128i pairs = _mm_maddubs_epi16(indices, _mm_set1_epi32(0x01400140));
+	const __m128i quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+	*out = _mm_shuffle_epi8(quads, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+	return true;
+}
+
+__attribute__((target("ssse3")))
+static size_t decode_blocks_ssse3(unsigned char *dst, const char *src, size_t length)
+{
+	size_t i = 0;
+	/* 16 bytes are stored, 12 of them are decoded; the rest is overwritten
+	 * by the output of the following chars, which are at least 16 */
+	for (; i + 32 <= length; i += 16, dst += 12) {
+		__m128i out;
+		if (!decode_indices_ssse3(_mm_loadu_si128((const __m128i *)(src + i)), &out))
+			break;
+		_mm_storeu_si128((__m128i *)dst, out);
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t encode_blocks_avx2(char *dst, const unsigned char *src, size_t length)
+{
+	const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+	                                         1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	                                         '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+	                                         '/' - 63, 'A', 0, 0,
+	                                         'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	                                         '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+	                                         '/' - 63, 'A', 0, 0);
+	size_t i = 0;
+	/* Every lane gets 12 bytes, 28 bytes are loaded */
+	for (; i + 28 <= length; i += 24, dst += 32) {
+		__m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + i))),
+		                                     _mm_loadu_si128((const __m128i *)(src + i + 12)), 1);
+		in = _mm256_shuffle_epi8(in, shuffle);
+		const __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)),
+		                                      _mm256_set1_epi32(0x04000040));
+		const __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)),
+		                                      _mm256_set1_epi32(0x01000010));
+		const __m256i indices = _mm256_or_si256(t0, t1);
+
+		__m256i offset_index = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+		offset_index = _mm256_or_si256(offset_index,
+		                               _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices),
+		                                                _mm256_set1_epi8(13)));
+		_mm256_storeu_si256((__m256i *)dst, _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, offset_index)));
+	}
+	return i + encode_blocks_ssse3(dst, src + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t decode_blocks_avx2(unsigned char *dst, const char *src, size_t length)
+{
+	const __m256i lo_masks = _mm256_setr_epi8(0xa8, 0xf8, 0xf8, 0xf8, 0xf8, 0xf8, 0xf8, 0xf8,
+	                                          0xf8, 0xf8, 0xf0, 0x54, 0x50, 0x50, 0x50, 0x54,
+	                                          0xa8, 0xf8, 0xf8, 0xf8, 0xf8, 0xf8, 0xf8, 0xf8,
+	                                          0xf8, 0xf8, 0xf0, 0x54, 0x50, 0x50, 0x50, 0x54);
+	const __m256i hi_bits = _mm256_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+	                                         0, 0, 0, 0, 0, 0, 0, 0,
+	                                         0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+	                                         0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i offsets = _mm256_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+	                                         0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+	                                      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	size_t i = 0;
+	/* 32 bytes are stored, 24 of them are decoded, see decode_blocks_ssse3() */
+	for (; i + 64 <= length; i += 32, dst += 24) {
+		const __m256i in = _mm256_loadu_si256((const __m256i *)(src + i));
+		const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), _mm256_set1_epi8(0x0f));
+		const __m256i lo_nibbles = _mm256_and_si256(in, _mm256_set1_epi8(0x0f));
+		const __m256i valid = _mm256_and_si256(_mm256_shuffle_epi8(lo_masks, lo_nibbles),
+		                                       _mm256_shuffle_epi8(hi_bits, hi_nibbles));
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(valid, _mm256_setzero_si256())) != 0)
+			break;
+
+		const __m256i is_slash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+		const __m256i offset = _mm256_or_si256(_mm256_andnot_si256(is_slash, _mm256_shuffle_epi8(offsets, hi_nibbles)),
+		                                       _mm256_and_si256(is_slash, _mm256_set1_epi8(16)));
+		const __m256i indices = _mm256_add_epi8(in, offset);
+
+		const __m256i pairs = _mm256_maddubs_epi16(indices, _mm256_set1_epi32(0x01400140));
+		const __m256i quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+		const __m256i lanes = _mm256_shuffle_epi8(quads, pack);
+		_mm256_storeu_si256((__m256i *)dst,
+		                    _mm256_permutevar8x32_epi32(lanes, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7)));
+	}
+	return i + decode_blocks_ssse3(dst, src + i, length - i);
+}
+#endif
 
-	/* Transform the 3x8 bits to 4x6 bits */
-	while (length > 0) {
-		unsigned s1, s2;
-
-		/* Are s[1], s[2] valid or should be assumed 0? */
-		s1 = s2 = 0;
-		length -= 3; /* can be >=0, -1, -2 */
-		if (length >= -1) {
-			s1 = s[1];
-			if (length >= 0)
-				s2 = s[2];
+static size_t encode_blocks(char *dst, const unsigned char *src, size_t length)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+	const unsigned simd = libreport_simd_features();
+	if (simd & LIBREPORT_SIMD_AVX2)
+		return encode_blocks_avx2(dst, src, length);
+	if (simd & LIBREPORT_SIMD_SSSE3)
+		return encode_blocks_ssse3(dst, src, length);
+#endif
+	return encode_blocks_none(dst, src, length);
+}
+
+static size_t decode_blocks(unsigned char *dst, const char *src, size_t length)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+	const unsigned simd = libreport_simd_features();
+	if (simd & LIBREPORT_SIMD_AVX2)
+		return decode_blocks_avx2(dst, src, length);
+	if (simd & LIBREPORT_SIMD_SSSE3)
+		return decode_blocks_ssse3(dst, src, length);
+#endif
+	return decode_blocks_none(dst, src, length);
+}
+
+/* Encodes groups of 3 bytes at S to 4 chars each. Returns the end of the
+ * written chars, no terminator is written.
+ */
+static char *encode_base64_groups(char *p, const unsigned char *s, size_t groups)
+{
+	const char *tbl = tbl_base64;
+
+	const size_t done = encode_blocks(p, s, groups * 3);
+	p += done / 3 * 4;
+	s += done;
+	groups -= done / 3;
+
+	/* Four groups per iteration, without any branch inside */
+	for (; groups >= 4; groups -= 4) {
+		for (int i = 0; i < 4; i++) {
+			uint32_t v = ((uint32_t)s[0] << 16) | ((uint32_t)s[1] << 8) | s[2];
+			p[0] = tbl[v >> 18];
+			p[1] = tbl[(v >> 12) & 0x3f];
+			p[2] = tbl[(v >> 6) & 0x3f];
+			p[3] = tbl[v & 0x3f];
+			p += 4;
+			s += 3;
 		}
-		*p++ = tbl[s[0] >> 2];
-		*p++ = tbl[((s[0] & 3) << 4) + (s1 >> 4)];
-		*p++ = tbl[((s1 & 0xf) << 2) + (s2 >> 6)];
-		*p++ = tbl[s2 & 0x3f];
+	}
+	for (; groups > 0; groups--) {
+		uint32_t v = ((uint32_t)s[0] << 16) | ((uint32_t)s[1] << 8) | s[2];
+		p[0] = tbl[v >> 18];
+		p[1] = tbl[(v >> 12) & 0x3f];
+		p[2] = tbl[(v >> 6) & 0x3f];
+		p[3] = tbl[v & 0x3f];
+		p += 4;
 		s += 3;
 	}
-	/* Zero-terminate */
+	return p;
+}
+
+/* Encodes the last 1 or 2 bytes at S with padding */
+static char *encode_base64_tail(char *p, const unsigned char *s, size_t length)
+{
+	unsigned s1 = (length > 1 ? s[1] : 0);
+
+	p[0] = tbl_base64[s[0] >> 2];
+	p[1] = tbl_base64[((s[0] & 3) << 4) + (s1 >> 4)];
+	p[2] = (length > 1 ? tbl_base64[(s1 & 0xf) << 2] : tbl_base64[64]);
+	p[3] = tbl_base64[64];
+	return p + 4;
+}
+
+char *libreport_encode_base64(const void *src, int length)
+{
+	const unsigned char *s = (const unsigned char *)src;
+	char *dst = (char *)libreport_xmalloc(LIBREPORT_BASE64_LENGTH(length) + 1);
+
+	char *p = encode_base64_groups(dst, s, length / 3);
+	if (length % 3)
+		p = encode_base64_tail(p, s + length - length % 3, length % 3);
 	*p = '\0';
-	/* If length is -2 or -1, pad last char or two */
-	while (length) {
-		*--p = tbl[64];
-		length++;
+	return dst;
+}
+
+void libreport_base64_encoder_init(struct base64_encoder *enc)
+{
+	enc->pending_len = 0;
+}
+
+size_t libreport_base64_encode_update(struct base64_encoder *enc, char *dst,
+		const void *src, size_t length)
+{
+	const unsigned char *s = (const unsigned char *)src;
+	char *p = dst;
+
+	/* Complete the group started by the previous chunk */
+	if (enc->pending_len != 0) {
+		while (enc->pending_len < 3 && length > 0) {
+			enc->pending[enc->pending_len++] = *s++;
+			length--;
+		}
+		if (enc->pending_len < 3)
+			return 0;
+		p = encode_base64_groups(p, enc->pending, 1);
+		enc->pending_len = 0;
 	}
+
+	p = encode_base64_groups(p, s, length / 3);
+
+	/* Keep the incomplete group for the next chunk */
+	s += length - length % 3;
+	for (size_t i = 0; i < length % 3; i++)
+		enc->pending[enc->pending_len++] = s[i];
+
+	return p - dst;
 }
 
-char *libreport_encode_base64(const void *src, int length)
+size_t libreport_base64_encode_final(struct base64_encoder *enc, char *dst)
+{
+	if (enc->pending_len == 0)
+		return 0;
+
+	char *p = encode_base64_tail(dst, enc->pending, enc->pending_len);
+	enc->pending_len = 0;
+	return p - dst;
+}
+
+/* Writes LENGTH bytes of the group of base64 values at VALUES */
+static unsigned char *decode_base64_group(unsigned char *p, const unsigned char *values, unsigned length)
 {
-	char *dst = (char *)libreport_xmalloc(4 * ((length + 2) / 3) + 1);
-	encode_64bit(dst, src, length, tbl_base64);
+	uint32_t v = ((uint32_t)values[0] << 18) | ((uint32_t)values[1] << 12)
+	           | ((uint32_t)values[2] << 6) | values[3];
+	p[0] = v >> 16;
+	if (length > 1)
+		p[1] = v >> 8;
+	if (length > 2)
+		p[2] = v;
+	return p + length;
+}
+
+void libreport_base64_decoder_init(struct base64_decoder *dec)
+{
+	dec->pending_len = 0;
+	dec->padding = 0;
+}
+
+ssize_t libreport_base64_decode_update(struct base64_decoder *dec, void *dst,
+		const char *src, size_t length)
+{
+	unsigned char *p = (unsigned char *)dst;
+	size_t i = 0;
+
+	while (i < length) {
+		/* Whole groups of chars without white space go through the kernels */
+		if (dec->pending_len == 0 && dec->padding == 0 && length - i >= 32) {
+			const size_t done = decode_blocks(p, src + i, length - i);
+			p += done / 4 * 3;
+			i += done;
+			if (i == length)
+				break;
+		}
+
+		const unsigned char c = src[i++];
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+			continue;
+
+		/* Nothing but white space may follow the padding */
+		if (dec->padding != 0 && dec->pending_len == 0)
+			return -1;
+
+		if (c == '=') {
+			/* Padding completes a group of 2 or 3 chars */
+			if (dec->pending_len < 2)
+				return -1;
+			if (++dec->padding + dec->pending_len == 4) {
+				dec->pending[dec->pending_len] = 0;
+				dec->pending[3] = 0;
+				p = decode_base64_group(p, dec->pending, dec->pending_len - 1);
+				dec->pending_len = 0;
+			}
+			continue;
+		}
+
+		const unsigned char value = tbl_unbase64[c];
+		if (value == 0xff || dec->padding != 0)
+			return -1;
+
+		dec->pending[dec->pending_len++] = value;
+		if (dec->pending_len == 4) {
+			p = decode_base64_group(p, dec->pending, 3);
+			dec->pending_len = 0;
+		}
+	}
+
+	return p - (unsigned char *)dst;
+}
+
+int libreport_base64_decode_final(struct base64_decoder *dec)
+{
+	return dec->pending_len == 0 ? 0 : -1;
+}
+
+char *libreport_decode_base64(const char *src, size_t length, size_t *size_p)
+{
+	struct base64_decoder dec;
+	char *dst = (char *)libreport_xmalloc(LIBREPORT_BASE64_DECODED_LENGTH(length) + 1);
+
+	libreport_base64_decoder_init(&dec);
+	const ssize_t size = libreport_base64_decode_update(&dec, dst, src, length);
+	if (size < 0 || libreport_base64_decode_final(&dec) != 0) {
+		free(dst);
+		return NULL;
+	}
+
+	if (size_p)
+		*size_p = size;
 	return dst;
 }
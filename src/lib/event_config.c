@@ -256,6 +256,8 @@ GHashTable *load_event_config_data(void)
                 /*value_destroy_func:*/ free
         );
 
+    struct config_cache *cache = libreport_config_cache_open("events");
+
     GList *event_files = libreport_get_file_list(EVENTS_DIR, "xml");
     while (event_files)
     {
@@ -264,9 +266,12 @@ GHashTable *load_event_config_data(void)
         event_config_t *event_config = get_event_config(file->filename);
         bool new_config = (!event_config);
         if (new_config)
-           event_config = new_event_config(file->filename);
-
-        load_event_description_from_file(event_config, file->fullpath);
+        {
+            event_config = new_event_config(file->filename);
+            libreport_load_event_description_cached(cache, event_config, file->fullpath);
+        }
+        else
+            load_event_description_from_file(event_config, file->fullpath);
 
         if (new_config)
             g_hash_table_replace(g_event_config_list, libreport_xstrdup(ec_get_name(event_config)), event_config);
@@ -275,6 +280,8 @@ GHashTable *load_event_config_data(void)
         event_files = g_list_delete_link(event_files, event_files);
     }
 
+    libreport_config_cache_close(cache);
+
     /* EVENTS_DIR      -> /usr/share/libreport/events/$EVENT_NAME.xml
      *   - event xml definition files
      *
@@ -590,3 +590,143 @@ void load_event_description_from_file(event_config_t *event_config, const char*
     free(parse_data.attribute_lang); /* just in case */
     free(parse_data.cur_locale);
 }
+
+/* Cached event descriptions are stored as:
+ * screen name, description, long description, creates, requires, exclude by
+ * default, include by default, exclude always and restricted access option
+ * items (ms); exclude binary items (b); minimal rating (x); skip review,
+ * sending sensitive data, supports restricted access, requires details (b);
+ * imported event names (as); options: name, value, label, note, type, allow
+ * empty, advanced (a(msmsmsmsibb)).
+ */
+#define EVENT_CONFIG_CACHE_TYPE "(msmsmsmsmsmsmsmsmsbxbbbbasa(msmsmsmsibb))"
+
+/* The descriptions are localized */
+static char *event_config_cache_key(const char *filename)
+{
+    return libreport_xasprintf("%s#%s", filename, setlocale(LC_ALL, NULL));
+}
+
+static GVariant *event_config_to_variant(event_config_t *ec)
+{
+    GVariantBuilder imported;
+    g_variant_builder_init(&imported, G_VARIANT_TYPE("as"));
+    for (GList *n = ec->ec_imported_event_names; n != NULL; n = g_list_next(n))
+        g_variant_builder_add(&imported, "s", (const char *)n->data);
+
+    GVariantBuilder options;
+    g_variant_builder_init(&options, G_VARIANT_TYPE("a(msmsmsmsibb)"));
+    for (GList *o = ec->options; o != NULL; o = g_list_next(o))
+    {
+        const event_option_t *opt = o->data;
+        g_variant_builder_add(&options, "(msmsmsmsibb)",
+                opt->eo_name, opt->eo_value, opt->eo_label, opt->eo_note_html,
+                (gint32)opt->eo_type, (gboolean)opt->eo_allow_empty, (gboolean)opt->is_advanced);
+    }
+
+    return g_variant_new(EVENT_CONFIG_CACHE_TYPE,
+            ec_get_screen_name(ec), ec_get_description(ec), ec_get_long_desc(ec),
+            ec->ec_creates_items, ec->ec_requires_items,
+            ec->ec_exclude_items_by_default, ec->ec_include_items_by_default,
+            ec->ec_exclude_items_always, ec->ec_restricted_access_option,
+            (gboolean)ec->ec_exclude_binary_items, (gint64)ec->ec_minimal_rating,
+            (gboolean)ec->ec_skip_review, (gboolean)ec->ec_sending_sensitive_data,
+            (gboolean)ec->ec_supports_restricted_access, (gboolean)ec->ec_requires_details,
+            &imported, &options);
+}
+
+static char *xstrdup_or_null(const char *str)
+{
+    return str != NULL ? libreport_xstrdup(str) : NULL;
+}
+
+static void event_config_from_variant(event_config_t *ec, GVariant *value)
+{
+    const char *screen_name, *description, *long_desc;
+    const char *creates, *requires, *excl_by_default, *incl_by_default, *excl_always, *restricted_option;
+    gboolean exclude_binary, skip_review, sending_sensitive, supports_restricted, requires_details;
+    gint64 minimal_rating;
+    GVariantIter *imported;
+    GVariantIter *options;
+
+    g_variant_get(value, "(m&sm&sm&sm&sm&sm&sm&sm&sm&sbxbbbbasa(msmsmsmsibb))",
+            &screen_name, &description, &long_desc,
+            &creates, &requires, &excl_by_default, &incl_by_default, &excl_always, &restricted_option,
+            &exclude_binary, &minimal_rating,
+            &skip_review, &sending_sensitive, &supports_restricted, &requires_details,
+            &imported, &options);
+
+    if (screen_name != NULL)
+        ec_set_screen_name(ec, screen_name);
+    if (description != NULL)
+        ec_set_description(ec, description);
+    if (long_desc != NULL)
+        ec_set_long_desc(ec, long_desc);
+
+    ec->ec_creates_items = xstrdup_or_null(creates);
+    ec->ec_requires_items = xstrdup_or_null(requires);
+    ec->ec_exclude_items_by_default = xstrdup_or_null(excl_by_default);
+    ec->ec_include_items_by_default = xstrdup_or_null(incl_by_default);
+    ec->ec_exclude_items_always = xstrdup_or_null(excl_always);
+    ec->ec_restricted_access_option = xstrdup_or_null(restricted_option);
+    ec->ec_exclude_binary_items = exclude_binary;
+    ec->ec_minimal_rating = minimal_rating;
+    ec->ec_skip_review = skip_review;
+    ec->ec_sending_sensitive_data = sending_sensitive;
+    ec->ec_supports_restricted_access = supports_restricted;
+    ec->ec_requires_details = requires_details;
+
+    const char *name;
+    while (g_variant_iter_next(imported, "&s", &name))
+        ec->ec_imported_event_names = g_list_append(ec->ec_imported_event_names, libreport_xstrdup(name));
+    g_variant_iter_free(imported);
+
+    const char *value_str, *label, *note_html;
+    gint32 type;
+    gboolean allow_empty, is_advanced;
+    while (g_variant_iter_next(options, "(m&sm&sm&sm&sibb)",
+                &name, &value_str, &label, &note_html, &type, &allow_empty, &is_advanced))
+    {
+        event_option_t *opt = new_event_option();
+        opt->eo_name = xstrdup_or_null(name);
+        opt->eo_value = xstrdup_or_null(value_str);
+        opt->eo_label = xstrdup_or_null(label);
+        opt->eo_note_html = xstrdup_or_null(note_html);
+        opt->eo_type = type;
+        opt->eo_allow_empty = allow_empty;
+        opt->is_advanced = is_advanced;
+        ec->options = g_list_append(ec->options, opt);
+    }
+    g_variant_iter_free(options);
+}
+
+void libreport_load_event_description_cached(struct config_cache *cache,
+        event_config_t *event_config, const char *filename)
+{
+    if (cache == NULL)
+    {
+        load_event_description_from_file(event_config, filename);
+        return;
+    }
+
+    char *key = event_config_cache_key(filename);
+
+    GVariant *value = libreport_config_cache_lookup(cache, key, /*sources:*/ NULL);
+    if (value != NULL)
+    {
+        event_config_from_variant(event_config, value);
+        g_variant_unref(value);
+    }
+    else
+    {
+        struct config_cache_sources *sources = libreport_config_cache_sources_new();
+        libreport_config_cache_sources_add(sources, filename);
+
+        load_event_description_from_file(event_config, filename);
+
+        libreport_config_cache_store(cache, key, sources, event_config_to_variant(event_config));
+        libreport_config_cache_sources_free(sources);
+    }
+
+    free(key);
+}
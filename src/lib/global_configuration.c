@@ -22,10 +22,12 @@
 
 #define OPT_NAME_SCRUBBED_VARIABLES "ScrubbedENVVariables"
 #define OPT_NAME_EXCLUDED_ELEMENTS "AlwaysExcludedElements"
+#define OPT_NAME_ARCHIVE_COMPRESSION_THREADS "ArchiveCompressionThreads"
 
 static const char *const s_recognized_options[] = {
     OPT_NAME_SCRUBBED_VARIABLES,
     OPT_NAME_EXCLUDED_ELEMENTS,
+    OPT_NAME_ARCHIVE_COMPRESSION_THREADS,
     NULL,
 };
 
@@ -137,6 +139,17 @@ string_vector_ptr_t libreport_get_global_always_excluded_elements(void)
     return ret;
 }
 
+unsigned libreport_get_global_archive_compression_threads(void)
+{
+    assert_global_configuration_initialized();
+
+    /* 0 means the number of online processors */
+    unsigned threads = 0;
+    libreport_try_get_map_string_item_as_uint(s_global_settings, OPT_NAME_ARCHIVE_COMPRESSION_THREADS, &threads);
+
+    return threads;
+}
+
 bool libreport_get_global_create_private_ticket(void)
 {
     assert_global_configuration_initialized();
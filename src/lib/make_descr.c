@@ -105,7 +105,7 @@ char *libreport_make_description(problem_data_t *problem_data, char **names_to_s
             && rejected_name(key, names_to_skip, desc_flags))
             continue;
 
-        struct problem_item *item = g_hash_table_lookup(problem_data, key);
+        struct problem_item *item = problem_data_get_item_or_NULL(problem_data, key);
         if (!item)
             continue;
 
@@ -206,7 +206,7 @@ char *libreport_make_description(problem_data_t *problem_data, char **names_to_s
                 && rejected_name(key, names_to_skip, desc_flags))
                 continue;
 
-            struct problem_item *item = g_hash_table_lookup(problem_data, key);
+            struct problem_item *item = problem_data_get_item_or_NULL(problem_data, key);
             if (!item)
                 continue;
 
@@ -260,7 +260,7 @@ char *libreport_make_description(problem_data_t *problem_data, char **names_to_s
                 && rejected_name(key, names_to_skip, desc_flags))
                 continue;
 
-            struct problem_item *item = g_hash_table_lookup(problem_data, key);
+            struct problem_item *item = problem_data_get_item_or_NULL(problem_data, key);
             if (!item)
                 continue;
 
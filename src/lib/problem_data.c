@@ -20,11 +20,34 @@
 
 #include <nettle/sha1.h>
 
+/* The dump directory of lazily loaded items. All items loaded by one call of
+ * problem_data_load_from_dump_dir_lazy() share one instance.
+ */
+struct problem_item_source
+{
+    unsigned refs;
+    int dir_fd;
+    char *dir_name;
+    GHashTable *compressed_items;
+};
+
+static void problem_item_source_unref(struct problem_item_source *source)
+{
+    if (source == NULL || --source->refs > 0)
+        return;
+
+    close(source->dir_fd);
+    free(source->dir_name);
+    g_hash_table_unref(source->compressed_items);
+    free(source);
+}
+
 static void free_problem_item(void *ptr)
 {
     if (ptr)
     {
         struct problem_item *item = (struct problem_item *)ptr;
+        problem_item_source_unref(item->source);
         free(item->content);
         free(item);
     }
@@ -138,7 +161,7 @@ void problem_data_add_basics(problem_data_t *pd)
             {
                 const char *key = l->data;
                 l = l->next;
-                struct problem_item *item = g_hash_table_lookup(pd, key);
+                struct problem_item *item = problem_data_get_item_or_NULL(pd, key);
                 /* do not hash items which are binary (item->flags & CD_FLAG_BIN).
                  * Their ->content is full file name, with path. Path is always
                  * different and will make hash differ even if files are the same.
@@ -245,6 +268,16 @@ void problem_data_add_file(problem_data_t *pd, const char *name, const char *pat
 }
 
 
+static void problem_item_load_lazy(struct problem_item *item, const char *name);
+
+struct problem_item *problem_data_get_item_or_NULL(problem_data_t *problem_data, const char *key)
+{
+    struct problem_item *item = (struct problem_item *)g_hash_table_lookup(problem_data, key);
+    if (item && item->source)
+        problem_item_load_lazy(item, key);
+    return item;
+}
+
 char *problem_data_get_content_or_die(problem_data_t *problem_data, const char *key)
 {
     INITIALIZE_LIBREPORT();
@@ -319,7 +352,7 @@ static const char *const always_text_files[] = {
     FILENAME_OS_RELEASE,
     NULL
 };
-static int is_text_file_at(int dir_fd, const char *name, char **content, ssize_t *sz, int *file_fd)
+static int is_text_file_at(int dir_fd, GHashTable *compressed_items, const char *name, char **content, ssize_t *sz, int *file_fd)
 {
     /* We were using magic.h API to check for file being text, but it thinks
      * that file containing just "0" is not text (!!)
@@ -330,6 +363,12 @@ static int is_text_file_at(int dir_fd, const char *name, char **content, ssize_t
     if (fd < 0)
         return fd; /* it's not text (because it does not exist! :) */
 
+    /* Only text is stored compressed */
+    bool compressed = false;
+    fd = libreport_decompress_item_fd(compressed_items, name, fd, &compressed);
+    if (fd < 0)
+        return fd;
+
     off_t size = lseek(fd, 0, SEEK_END);
     if (size < 0)
     {
@@ -357,6 +396,9 @@ static int is_text_file_at(int dir_fd, const char *name, char **content, ssize_t
         buf[r] = '\0';
     *sz = r;
 
+    if (compressed)
+        goto text;
+
     /* Some files in our dump directories are known to always be textual */
     const char *base = strrchr(name, '/');
     if (base)
@@ -377,38 +419,20 @@ static int is_text_file_at(int dir_fd, const char *name, char **content, ssize_t
      * Replaced crude "buf[r] > 0x7e is bad" logic with
      * "if it is a broken Unicode, then it's bad".
      */
-    const unsigned RATIO = 10;
-    unsigned total_chars = r + RATIO;
-    unsigned bad_chars = 1; /* 1 prevents division by 0 later */
-    bool prev_was_unicode = 0;
-    ssize_t i = -1;
-    while (++i < r)
+    const long bad_bytes = libreport_utf8_count_bad_bytes((const char *)buf, r);
+    if (bad_bytes < 0)
     {
-        /* Among control chars, only '\t','\n' etc are allowed */
-        if (buf[i] < ' ' && !isspace(buf[i]))
-        {
-            /* We don't like NULs and other control chars very much.
-             * Not text for sure!
-             */
-            free(buf);
-            return CD_FLAG_BIN;
-        }
-        if (buf[i] == 0x7f)
-            bad_chars++;
-        else if (buf[i] > 0x7f)
-        {
-            /* We test two possible bad cases with one comparison:
-             * (1) prev byte was unicode AND cur byte is 11xxxxxx:
-             * BAD - unicode start byte can't be in the middle of unicode char
-             * (2) prev byte wasnt unicode AND cur byte is 10xxxxxx:
-             * BAD - unicode continuation byte can't start unicode char
-             */
-            if (prev_was_unicode == ((buf[i] & 0x40) == 0x40))
-                bad_chars++;
-        }
-        prev_was_unicode = (buf[i] > 0x7f);
+        /* We don't like NULs and other control chars very much.
+         * Not text for sure!
+         */
+        free(buf);
+        return CD_FLAG_BIN;
     }
 
+    const unsigned RATIO = 10;
+    unsigned total_chars = r + RATIO;
+    unsigned bad_chars = 1 + bad_bytes; /* 1 prevents division by 0 later */
+
     if ((total_chars / bad_chars) >= RATIO)
         goto text; /* looks like text to me */
 
@@ -427,7 +451,7 @@ static int is_text_file_at(int dir_fd, const char *name, char **content, ssize_t
 }
 
 
-static int _problem_data_load_dump_dir_element(struct dump_dir *dd, const char *name, char **content, int *type_flags, int *fd)
+static int load_dump_dir_element_at(int dir_fd, GHashTable *compressed_items, const char *name, char **content, int *type_flags, int *fd)
 {
     int file_fd = -1;
     int *file_fd_ptr = fd == NULL ? &file_fd : fd;
@@ -436,7 +460,7 @@ static int _problem_data_load_dump_dir_element(struct dump_dir *dd, const char *
 
     ssize_t sz = IS_TEXT_FILE_AT_PROBE_SIZE;
     char *text = NULL;
-    int r = is_text_file_at(dd->dd_fd, name, &text, &sz, file_fd_ptr);
+    int r = is_text_file_at(dir_fd, compressed_items, name, &text, &sz, file_fd_ptr);
 
     if (r < 0)
         return r;
@@ -493,77 +517,159 @@ int problem_data_load_dump_dir_element(struct dump_dir *dd, const char *name, ch
     if (!libreport_str_is_correct_filename(name))
         return -EINVAL;
 
-    return _problem_data_load_dump_dir_element(dd, name, content, type_flags, fd);
+    return load_dump_dir_element_at(dd->dd_fd, libreport_dd_get_compressed_items(dd), name, content, type_flags, fd);
 }
 
-void problem_data_load_from_dump_dir(problem_data_t *problem_data, struct dump_dir *dd, char **excluding)
+/* Adds the flags derived from the element name to the flags of a text element */
+static int text_element_flags(const char *short_name, int flags)
 {
-    char *short_name;
-    char *full_name;
+    if (is_editable_file(short_name))
+        flags |= CD_FLAG_ISEDITABLE;
+    else
+        flags |= CD_FLAG_ISNOTEDITABLE;
 
-    dd_init_next_file(dd);
-    while (dd_get_next_file(dd, &short_name, &full_name))
+    static const char *const list_files[] = {
+        FILENAME_UID       ,
+        FILENAME_PACKAGE   ,
+        FILENAME_CMDLINE   ,
+        FILENAME_TIME      ,
+        FILENAME_COUNT     ,
+        FILENAME_REASON    ,
+        NULL
+    };
+    if (libreport_is_in_string_list(short_name, list_files))
+        flags |= CD_FLAG_LIST;
+
+    if (strcmp(short_name, FILENAME_TIME) == 0)
+        flags |= CD_FLAG_UNIXTIME;
+
+    return flags;
+}
+
+static bool is_excluded_element(const char *short_name, char **excluding)
+{
+    if (excluding && libreport_is_in_string_list(short_name, (const char *const *)excluding))
     {
-        if (excluding && libreport_is_in_string_list(short_name, (const char *const *)excluding))
-        {
-            //log_warning("Excluded:'%s'", short_name);
-            goto next;
-        }
+        //log_warning("Excluded:'%s'", short_name);
+        return true;
+    }
 
-        if (short_name[0] == '#'
-         || (short_name[0] && short_name[strlen(short_name) - 1] == '~')
-        ) {
-            //log_warning("Excluded (editor backup file):'%s'", short_name);
-            goto next;
-        }
+    if (short_name[0] == '#'
+     || (short_name[0] && short_name[strlen(short_name) - 1] == '~')
+    ) {
+        //log_warning("Excluded (editor backup file):'%s'", short_name);
+        return true;
+    }
+
+    return false;
+}
+
+static void problem_item_load_lazy(struct problem_item *item, const char *name)
+{
+    struct problem_item_source *source = item->source;
+    item->source = NULL;
+
+    char *content = NULL;
+    int flags = 0;
+    int r = load_dump_dir_element_at(source->dir_fd, source->compressed_items, name, &content, &flags, /*fd*/NULL);
+    if (r < 0)
+    {
+        /* The item cannot disappear from the problem data now, because
+         * the caller might be holding its name. */
+        error_msg("Failed to load element %s: %s", name, strerror(-r));
+        content = libreport_xstrdup("");
+        flags = CD_FLAG_TXT | CD_FLAG_ISNOTEDITABLE;
+    }
+    else if (flags & CD_FLAG_TXT)
+        flags = text_element_flags(name, flags);
+    else
+        content = libreport_concat_path_file(source->dir_name, name);
+
+    /* Same as problem_data_add_ext() */
+    if (!(flags & CD_FLAG_ISEDITABLE))
+        flags |= CD_FLAG_ISNOTEDITABLE;
+
+    item->content = content;
+    item->flags = flags;
+
+    problem_item_source_unref(source);
+}
+
+void problem_data_load_from_dump_dir(problem_data_t *problem_data, struct dump_dir *dd, char **excluding)
+{
+    struct dd_item_iterator iter;
+    if (dd_item_iterator_init(dd, &iter, /*flags*/0) < 0)
+        return;
+
+    GHashTable *compressed_items = libreport_dd_get_compressed_items(dd);
+    struct dd_item_info info;
+    while (dd_item_iterator_next(&iter, &info) > 0)
+    {
+        if (is_excluded_element(info.name, excluding))
+            continue;
 
         char *content = NULL;
         int flags = 0;
-        int r = _problem_data_load_dump_dir_element(dd, short_name, &content, &flags, /*fd*/NULL);
+        int r = load_dump_dir_element_at(dd->dd_fd, compressed_items, info.name, &content, &flags, /*fd*/NULL);
         if (r < 0)
         {
-            error_msg("Failed to load element %s: %s", short_name, strerror(-r));
-            goto next;
+            error_msg("Failed to load element %s: %s", info.name, strerror(-r));
+            continue;
         }
 
         if (flags & CD_FLAG_TXT)
-        {
-            if (is_editable_file(short_name))
-                flags |= CD_FLAG_ISEDITABLE;
-            else
-                flags |= CD_FLAG_ISNOTEDITABLE;
-
-            static const char *const list_files[] = {
-                FILENAME_UID       ,
-                FILENAME_PACKAGE   ,
-                FILENAME_CMDLINE   ,
-                FILENAME_TIME      ,
-                FILENAME_COUNT     ,
-                FILENAME_REASON    ,
-                NULL
-            };
-            if (libreport_is_in_string_list(short_name, list_files))
-                flags |= CD_FLAG_LIST;
-
-            if (strcmp(short_name, FILENAME_TIME) == 0)
-                flags |= CD_FLAG_UNIXTIME;
-        }
+            flags = text_element_flags(info.name, flags);
         else
-        {
-            content = full_name;
-            full_name = NULL;
-        }
+            content = libreport_concat_path_file(dd->dd_dirname, info.name);
 
         problem_data_add(problem_data,
-                short_name,
+                info.name,
                 content,
                 flags
         );
         free(content);
- next:
-        free(short_name);
-        free(full_name);
     }
+
+    dd_item_iterator_destroy(&iter);
+}
+
+void problem_data_load_from_dump_dir_lazy(problem_data_t *problem_data, struct dump_dir *dd, char **excluding)
+{
+    struct problem_item_source *source = libreport_xzalloc(sizeof(*source));
+    source->refs = 1;
+    source->dir_fd = dup(dd->dd_fd);
+    if (source->dir_fd < 0)
+    {
+        perror_msg("Can't duplicate file descriptor of '%s'", dd->dd_dirname);
+        free(source);
+        return;
+    }
+    source->dir_name = libreport_xstrdup(dd->dd_dirname);
+    source->compressed_items = g_hash_table_ref(libreport_dd_get_compressed_items(dd));
+
+    struct dd_item_iterator iter;
+    if (dd_item_iterator_init(dd, &iter, /*flags*/0) < 0)
+    {
+        problem_item_source_unref(source);
+        return;
+    }
+
+    struct dd_item_info info;
+    while (dd_item_iterator_next(&iter, &info) > 0)
+    {
+        if (is_excluded_element(info.name, excluding))
+            continue;
+
+        struct problem_item *item = libreport_xzalloc(sizeof(*item));
+        item->size = PROBLEM_ITEM_UNINITIALIZED_SIZE;
+        item->source = source;
+        ++source->refs;
+
+        g_hash_table_replace(problem_data, libreport_xstrdup(info.name), item);
+    }
+
+    dd_item_iterator_destroy(&iter);
+    problem_item_source_unref(source);
 }
 
 problem_data_t *create_problem_data_from_dump_dir(struct dump_dir *dd)
@@ -573,6 +679,13 @@ problem_data_t *create_problem_data_from_dump_dir(struct dump_dir *dd)
     return problem_data;
 }
 
+problem_data_t *create_problem_data_from_dump_dir_lazy(struct dump_dir *dd)
+{
+    problem_data_t *problem_data = problem_data_new();
+    problem_data_load_from_dump_dir_lazy(problem_data, dd, NULL);
+    return problem_data;
+}
+
 problem_data_t *create_problem_data_for_reporting(const char *dump_dir_name)
 {
     struct dump_dir *dd = dd_opendir(dump_dir_name, /*flags:*/ 0);
@@ -606,7 +606,7 @@ append_item(struct strbuf *result, const char *item_name, problem_data_t *pd, GL
     {
         const char *name = l->data;
         l = l->next;
-        struct problem_item *item = g_hash_table_lookup(pd, name);
+        struct problem_item *item = problem_data_get_item_or_NULL(pd, name);
         if (!item)
             continue; /* paranoia, won't happen */
 
@@ -712,7 +712,7 @@ get_special_items(const char *item_name, problem_data_t *pd, GList *comment_fmt_
     {
         const char *name = l->data;
         l = l->next;
-        struct problem_item *item = g_hash_table_lookup(pd, name);
+        struct problem_item *item = problem_data_get_item_or_NULL(pd, name);
         if (!item)
             continue; /* paranoia, won't happen */
 
@@ -18,6 +18,7 @@
 */
 #include <glob.h>
 #include <regex.h>
+#include <sys/epoll.h>
 #include "client.h"
 #include "internal_libreport.h"
 
@@ -138,84 +139,98 @@ void free_rule_list(GList *rule_list)
 /* Stop-gap measure against infinite recursion */
 #define MAX_recursion_depth 32
 
-GList *load_rule_list(GList *rule_list,
-                const char *conf_file_name,
-                unsigned recursion_depth
-) {
-    FILE *conffile = fopen(conf_file_name, "r");
-    if (!conffile)
+struct rule_loader
+{
+    GList *rules;     /* in reversed order */
+    struct config_cache_sources *sources; /* NULL if sources are not tracked */
+    bool untracked;   /* some sources can't be tracked */
+};
+
+static void rule_loader_add_source(struct rule_loader *loader, const char *path)
+{
+    if (loader->sources != NULL)
+        libreport_config_cache_sources_add(loader->sources, path);
+}
+
+/* New files matching an include pattern show up in the pattern's directory */
+static void rule_loader_add_glob_source(struct rule_loader *loader, const char *pattern)
+{
+    if (loader->sources == NULL)
+        return;
+
+    const char *last_slash = strrchr(pattern, '/');
+    char *dir = last_slash != NULL
+            ? libreport_xstrndup(pattern, last_slash > pattern ? last_slash - pattern : 1)
+            : libreport_xstrdup(".");
+
+    if (strpbrk(dir, "*?[") != NULL)
+        loader->untracked = true;
+    else
+        rule_loader_add_source(loader, dir);
+
+    free(dir);
+}
+
+/* Terminates the line and returns the beginning of the next line */
+static char *split_line(char *line)
+{
+    char *eol = strchrnul(line, '\n');
+    if (*eol == '\0')
+        return eol;
+
+    *eol = '\0';
+    return eol + 1;
+}
+
+static void load_rules(struct rule_loader *loader, const char *conf_file_name, unsigned recursion_depth)
+{
+    rule_loader_add_source(loader, conf_file_name);
+
+    char *data = libreport_xmalloc_open_read_close(conf_file_name, /*maxsize:*/ NULL);
+    if (!data)
     {
         error_msg("Can't open '%s'", conf_file_name);
-        return rule_list;
+        return;
     }
 
-    /* Used only for better warning message */
-    int line_counter = 0;
     /* Read and remember rules */
-    char *next_line;
-    while (1)
+    char *next_line = data;
+    while (*next_line != '\0')
     {
-        next_line = libreport_xmalloc_fgetline(conffile);
-        if(!next_line)
-        {
-            log_parser("EOF");
-            break;
-        }
+        char *line = next_line;
+        next_line = split_line(line);
 
-        if (*next_line == '\0' || *next_line == '#')
+        if (*line == '\0' || *line == '#')
         {
             log_parser("empty or comment, skipping");
-            free(next_line);
             continue;
         }
 
-        log_parser("current line '%s'", next_line);
-        /* Read and concatenate all lines in a rule */
-        char *line = next_line;
-        ++line_counter;
+        log_parser("current line '%s'", line);
 
         if(strncmp(line, "EVENT", strlen("EVENT")) == 0)
         {
             log_parser("found EVENT");
 
-            while (1)
-            {
-                long prev = ftell(conffile);
-                if (prev < 0)
-                    perror_msg_and_die("ftell");
-
-                next_line = libreport_xmalloc_fgetline(conffile);
-
-                log_parser("next_line is: '%s'", next_line ? next_line : "EOF");
-                /* stop merging new lines into this event
-                 * if we reach
-                 * EOF
-                 * line starting with:
-                 ** # (comment)
-                 ** EVENT
-                 ** include
-                 *
-                 * When adding another directive don't forget to add it to this if!
-                 */
-                if (    !next_line
-                     || *next_line == '#'
-                     || strncmp(next_line, "EVENT", strlen("EVENT")) == 0
-                     || strncmp(next_line, "include", strlen("include")) == 0
-                ){
-                    log_parser("found next EVENT or EOF, seeking back to prev line");
-
-                    if (fseek(conffile, prev, SEEK_SET) < 0)
-                        perror_msg_and_die("fseek");
-
-                    free(next_line);
-                    break;
-                }
-
-                ++line_counter;
-                char *tmp = libreport_xasprintf("%s\n%s", line, next_line);
-                free(line);
-                free(next_line);
-                line = tmp;
+            /* stop merging new lines into this event
+             * if we reach
+             * EOF
+             * line starting with:
+             ** # (comment)
+             ** EVENT
+             ** include
+             *
+             * When adding another directive don't forget to add it to this condition!
+             */
+            while (    *next_line != '\0'
+                    && *next_line != '#'
+                    && strncmp(next_line, "EVENT", strlen("EVENT")) != 0
+                    && strncmp(next_line, "include", strlen("include")) != 0
+            ){
+                log_parser("merging next line");
+                /* The lines are adjacent - join them back in place */
+                next_line[-1] = '\n';
+                next_line = split_line(next_line);
             }
 
             char *p = libreport_skip_whitespace(line);
@@ -260,7 +275,7 @@ GList *load_rule_list(GList *rule_list,
 
             cur_rule->command = libreport_xstrdup(p);
 
-            rule_list = g_list_append(rule_list, cur_rule);
+            loader->rules = g_list_prepend(loader->rules, cur_rule);
         }
         else if (   recursion_depth < MAX_recursion_depth
                  && strncmp(line, "include", strlen("include")) == 0
@@ -286,6 +301,8 @@ GList *load_rule_list(GList *rule_list,
                  */
                 name_to_glob = libreport_xstrdup(p);
 
+            rule_loader_add_glob_source(loader, name_to_glob);
+
             glob_t globbuf;
             memset(&globbuf, 0, sizeof(globbuf));
             log_parser("globbing '%s'", name_to_glob);
@@ -295,7 +312,7 @@ GList *load_rule_list(GList *rule_list,
             if (name) while (*name)
             {
                 log_parser("recursing into '%s'", *name);
-                rule_list = load_rule_list(rule_list, *name, recursion_depth + 1);
+                load_rules(loader, *name, recursion_depth + 1);
                 log_parser("returned from '%s'", *name);
                 name++;
             }
@@ -303,416 +320,1390 @@ GList *load_rule_list(GList *rule_list,
         }
         else
             log_parser("Unknown line found, ignoring: '%s'", line);
-
-        free(line);
     } /* end of line loop */
 
-    fclose(conffile);
-
-    return rule_list;
+    free(data);
 }
 
-static int regcmp_lines(char *val, const char *regex)
-{
-    regex_t rx;
-    int r = regcomp(&rx, regex, REG_NOSUB); //TODO: and REG_EXTENDED?
-    //log_warning("REGEX:'%s':%d", regex, r);
-    if (r)
-    {
-        //char errbuf[256];
-        //size_t needsz = regerror(r, &rx, errbuf, sizeof(errbuf));
-        error_msg("Bad regexp '%s'", regex); // TODO: use errbuf?
-        return r;
-    }
+GList *load_rule_list(GList *rule_list,
+                const char *conf_file_name,
+                unsigned recursion_depth
+) {
+    struct rule_loader loader = { 0 };
+    load_rules(&loader, conf_file_name, recursion_depth);
 
-    /* Check every line */
-    while (1)
-    {
-        char *eol = strchr(val, '\n');
-        if (eol)
-            *eol = '\0';
-        r = regexec(&rx, val, 0, NULL, /*eflags:*/ 0);
-        //log_warning("REGCMP:'%s':%d", val, r);
-        if (eol)
-            *eol = '\n';
-        if (r == 0 || !eol)
-            break;
-        val = eol + 1;
-    }
-    /* Here, r == 0 if match was found */
-    regfree(&rx);
-    return r;
+    return g_list_concat(rule_list, g_list_reverse(loader.rules));
 }
 
-/* Checks rules in *pp_rule_list, starting from first (remaining) rule,
- * until it finds a rule with all conditions satisfied.
- * In this case, it deletes this rule and returns this rule's cmd.
- * Else (if it didn't find such rule), it returns NULL.
- * In case of error (dump_dir can't be opened), returns NULL.
- *
- * Intended usage:
- * list = load_rule_list(...);
- * while ((cmd = pop_next_command(&list, ...)) != NULL)
- *     run(cmd);
- */
-static char* pop_next_command(GList **pp_rule_list,
-        char **pp_event_name,    /* reports EVENT value thru this, if not NULL on entry */
-        struct dump_dir **pp_dd, /* use *pp_dd for access to dump dir, if non-NULL */
-        problem_data_t *pd,      /* use *pd for access to problem data, if non-NULL */
-        const char *dump_dir_name,
-        const char *pfx,
-        unsigned pfx_len
-)
-{
-    /* It is an error to pass both, but we can recover from it and use only
-     * problem_data_t in that case */
-    if (pp_dd != NULL && pd != NULL)
-        error_msg("BUG: both dump dir and problem data passed to %s()", __func__);
-
-    char *command = NULL;
-    struct dump_dir *dd = pp_dd ? *pp_dd : NULL;
+/* Compiled rules */
 
-    GList *rule_list = *pp_rule_list;
-    while (rule_list)
-    {
-        struct rule *cur_rule = rule_list->data;
+enum rule_condition_op
+{
+    RULE_CONDITION_EQ,    /* VAR=VAL */
+    RULE_CONDITION_NE,    /* VAR!=VAL */
+    RULE_CONDITION_REGEX, /* VAR~=REGEX */
+};
 
-        GList *condition = cur_rule->conditions;
-        while (condition)
-        {
-            const char *cond_str = condition->data;
-            const char *eq_sign = strchr(cond_str, '=');
+struct rule_condition
+{
+    enum rule_condition_op op;
+    unsigned element;   /* index to rule_set.elements */
+    char *value;
+    bool regex_valid;
+    regex_t regex;
+};
+
+struct compiled_rule
+{
+    /* Values of EVENT=... conditions, NULL terminated */
+    char **events;
+    struct rule_condition *conditions;
+    unsigned condition_count;
+    char *command;
+    /* Words of the command executed without the shell,
+     * NULL if the command needs the shell */
+    char **argv;
+    /* Value of HANDLER=..., rules without it run alone */
+    char *handler;
+    /* Values of AFTER=..., NULL if there are none */
+    GPtrArray *after;
+};
+
+/* Rules whose first EVENT condition has the same value */
+struct rule_event_index
+{
+    const char *event;
+    GArray *rules;      /* unsigned indexes to rule_set.rules */
+};
 
-            /* Is it "EVENT=foo"? */
-            if (strncmp(cond_str, "EVENT=", 6) == 0)
-            {
-                if (strncmp(eq_sign + 1, pfx, pfx_len) != 0)
-                    goto next_rule; /* prefix doesn't match */
-                if (pp_event_name)
-                {
-                    free(*pp_event_name);
-                    *pp_event_name = libreport_xstrdup(eq_sign + 1);
-                }
-            }
-            else
-            {
-                /* Read from dump dir and compare */
-                if (!dd && pd == NULL)
-                {
-                    /* Without dir to match, we assume match for all conditions */
-                    if (!dump_dir_name)
-                        goto next_cond;
-                    dd = dd_opendir(dump_dir_name, /*flags:*/ DD_OPEN_READONLY);
-                    if (!dd)
-                    {
-                        free_rule_list(rule_list);
-                        *pp_rule_list = NULL;
-                        goto ret; /* error (note: dd_opendir logged error msg) */
-                    }
-                }
-                /* Is it "VAR~=REGEX"? */
-                int regex = (eq_sign > cond_str && eq_sign[-1] == '~');
-                /* Is it "VAR!=VAL"? */
-                int inverted = (eq_sign > cond_str && eq_sign[-1] == '!');
-                char *var_name = libreport_xstrndup(cond_str, eq_sign - cond_str - (regex|inverted));
-                char *real_val = NULL;
-                char *free_me = NULL;
-                if (pd == NULL)
-                    free_me = real_val = dd_load_text_ext(dd, var_name, DD_FAIL_QUIETLY_ENOENT);
-                else
-                {
-                    real_val = problem_data_get_content_or_NULL(pd, var_name);
-                    if (real_val == NULL)
-                        free_me = real_val = libreport_xstrdup("");
-                }
-                free(var_name);
-                int vals_differ = regex ? regcmp_lines(real_val, eq_sign + 1) : strcmp(real_val, eq_sign + 1);
-                free(free_me);
-                if (inverted)
-                    vals_differ = !vals_differ;
-
-                /* Do values match? */
-                if (vals_differ) /* no */
-                {
-                    goto next_rule;
-                }
-            }
- next_cond:
-            /* We are here if current condition is satisfied */
-
-            condition = condition->next;
-        } /* while (condition) */
-        /* We are here if all conditions are satisfied */
-        /* IOW, we found rule to run, delete it and return its command */
-        *pp_rule_list = g_list_remove(*pp_rule_list, cur_rule);
-        libreport_list_free_with_free(cur_rule->conditions);
-        command = cur_rule->command;
-        /*free(cur_rule->command); - WRONG! we are returning it! */
-        free(cur_rule);
-        break;
+struct rule_set
+{
+    gint ref;
+    struct compiled_rule *rules;
+    unsigned rule_count;
+    /* Names of elements referenced in conditions */
+    GPtrArray *elements;
+    /* struct rule_event_index sorted by event for prefix look ups */
+    GPtrArray *events;
+    /* event -> struct rule_event_index */
+    GHashTable *event_index;
+    /* Rules without EVENT condition are applicable to all events */
+    GArray *any_event_rules;
+    /* Files the rules were read from */
+    struct config_cache_sources *sources;
+    bool untracked;
+};
+
+static void free_rule_event_index(gpointer data)
+{
+    struct rule_event_index *index = data;
+    g_array_free(index->rules, TRUE);
+    free(index);
+}
 
- next_rule:
-        rule_list = rule_list->next;
-    } /* while (rule_list) */
+static gint cmp_rule_event_index(gconstpointer a, gconstpointer b)
+{
+    const struct rule_event_index *lhs = *(const struct rule_event_index **)a;
+    const struct rule_event_index *rhs = *(const struct rule_event_index **)b;
+    return strcmp(lhs->event, rhs->event);
+}
 
- ret:
-    if (pp_dd)
-        *pp_dd = dd;
-    else
-        dd_close(dd);
-    return command;
+static gint cmp_rule_number(gconstpointer a, gconstpointer b)
+{
+    const unsigned lhs = *(const unsigned *)a;
+    const unsigned rhs = *(const unsigned *)b;
+    return lhs < rhs ? -1 : lhs > rhs;
 }
 
-void free_commands(struct run_event_state *state)
+static unsigned rule_set_element(struct rule_set *set, GHashTable *elements, const char *name, size_t len)
 {
-    free_rule_list(state->rule_list);
-    state->rule_list = NULL;
-    state->command_out_fd = -1;
-    state->command_pid = 0;
+    char *key = libreport_xstrndup(name, len);
+    gpointer value;
+    if (g_hash_table_lookup_extended(elements, key, NULL, &value))
+    {
+        free(key);
+        return GPOINTER_TO_UINT(value);
+    }
+
+    const unsigned element = set->elements->len;
+    g_ptr_array_add(set->elements, key);
+    g_hash_table_insert(elements, key, GUINT_TO_POINTER(element));
+    return element;
 }
 
-int prepare_commands(struct run_event_state *state)
+/* Characters having a special meaning for the shell; commands containing
+ * any of them are executed by the shell */
+#define SHELL_SPECIAL_CHARS "|&;<>()$`\\\"'*?[]#~{}!\n"
+
+/* Characters of the first word of commands executed without the shell, other
+ * words (e.g. "[[" or "!") may have a special meaning for the shell */
+#define PLAIN_NAME_CHARS "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_.,+-/"
+
+/* Shell keywords and built-in commands (POSIX and bash); the commands having
+ * an equivalent program, like echo or test, are left to the shell as well as
+ * the program might behave differently */
+static const char *const shell_words[] = {
+    ".", ":", "alias", "bg", "bind", "break", "builtin", "caller", "case",
+    "cd", "command", "compgen", "complete", "compopt", "continue", "coproc",
+    "declare", "dirs", "disown", "do", "done", "echo", "elif", "else",
+    "enable", "esac", "eval", "exec", "exit", "export", "false", "fc", "fg",
+    "fi", "for", "function", "getopts", "hash", "help", "history", "if",
+    "in", "jobs", "kill", "let", "local", "logout", "mapfile", "popd",
+    "printf", "pushd", "pwd", "read", "readarray", "readonly", "return",
+    "select", "set", "shift", "shopt", "source", "suspend", "test", "then",
+    "time", "times", "trap", "true", "type", "typeset", "ulimit", "umask",
+    "unalias", "unset", "until", "wait", "while",
+    NULL
+};
+
+/* Splits the command into words if it can be executed without the shell,
+ * returns NULL otherwise. If force is true, the command is split at
+ * whitespace even if it contains shell special characters.
+ */
+static char **split_simple_command(const char *command, bool force)
 {
-    free_commands(state);
+    /* Trailing newlines of the rule are not command separators */
+    size_t len = strlen(command);
+    while (len > 0 && isspace(command[len - 1]))
+        --len;
 
-    state->children_count = 0;
-    libreport_strbuf_clear(state->command_output);
+    if (len == 0)
+        return NULL;
+
+    if (!force)
+    {
+        const size_t special = strcspn(command, SHELL_SPECIAL_CHARS);
+        if (special < len)
+            return NULL;
+
+        /* "VAR=VAL prog", words like "[[" and shell keywords and built-ins */
+        const size_t first_len = strcspn(command, " \t");
+        if (strspn(command, PLAIN_NAME_CHARS) < first_len)
+            return NULL;
+
+        for (const char *const *word = shell_words; *word != NULL; ++word)
+            if (strlen(*word) == first_len && strncmp(command, *word, first_len) == 0)
+                return NULL;
+    }
+
+    GPtrArray *words = g_ptr_array_new();
+    for (const char *p = command; p < command + len;)
+    {
+        const char *end = libreport_skip_non_whitespace(p);
+        if (end > command + len)
+            end = command + len;
+        if (end > p)
+            g_ptr_array_add(words, libreport_xstrndup(p, end - p));
+        p = libreport_skip_whitespace(end);
+    }
+    g_ptr_array_add(words, NULL);
 
-    GList *rule_list = load_rule_list(NULL, CONF_DIR"/report_event.conf", /*recursion_depth:*/ 0);
-    state->rule_list = rule_list;
-    return rule_list != NULL;
+    return (char **)g_ptr_array_free(words, FALSE);
 }
 
-int spawn_next_command(struct run_event_state *state,
-                const char *dump_dir_name,
-                const char *event,
-                unsigned execflags
-) {
-    char *cmd = pop_next_command(&state->rule_list,
-                NULL,          /* don't return event_name */
-                NULL,          /* NULL dd: we match by... */
-                NULL,          /* no problem data */
-                dump_dir_name, /* ...dirname */
-                event, strlen(event)+1 /* for this event name exactly (not prefix) */
-    );
-    if (!cmd)
-        return -1;
+static void compile_rule(struct rule_set *set, GHashTable *elements, struct compiled_rule *compiled, struct rule *rule)
+{
+    const unsigned count = g_list_length(rule->conditions);
+    unsigned event_count = 0;
+    /* Value of SHELL=..., -1 if the command decides */
+    int use_shell = -1;
 
-    /* We count it even if fork fails. The counter isn't meant
-     * to count *successful* forks, it is meant to let caller know
-     * whether the event we run has *any* handlers configured, or not.
-     */
-    state->children_count++;
+    compiled->events = libreport_xzalloc((count + 1) * sizeof(compiled->events[0]));
+    compiled->conditions = libreport_xzalloc((count + 1) * sizeof(compiled->conditions[0]));
 
-    log_info("Next command: '%s'", cmd);
+    for (GList *c = rule->conditions; c != NULL; c = g_list_next(c))
+    {
+        char *cond_str = c->data;
+        const char *eq_sign = strchr(cond_str, '=');
 
-    /* Just exporting dump_dir_name isn't always ok: it can be "."
-     * and some children want to cd to other directory but still
-     * be able to find problem directory by using $DUMP_DIR...
-     */
-    char *full_name = realpath(dump_dir_name, NULL);
-    /* Export some useful environment variables for children */
-    GPtrArray *env_array;
+        /* Is it "EVENT=foo"? */
+        if (strncmp(cond_str, "EVENT=", 6) == 0)
+        {
+            compiled->events[event_count++] = libreport_xstrdup(eq_sign + 1);
+            continue;
+        }
 
-    env_array = g_ptr_array_new();
+        /* Scheduling annotations: "HANDLER=name", "AFTER=name1,name2" */
+        if (strncmp(cond_str, "HANDLER=", 8) == 0)
+        {
+            free(compiled->handler);
+            compiled->handler = libreport_xstrdup(eq_sign + 1);
+            continue;
+        }
 
-    g_ptr_array_add(env_array, libreport_xasprintf("DUMP_DIR=%s", (full_name ? full_name : dump_dir_name)));
-    g_ptr_array_add(env_array, libreport_xasprintf("EVENT=%s", event));
-    g_ptr_array_add(env_array, libreport_xasprintf("REPORT_CLIENT_SLAVE=1"));
-    for (unsigned int i = 0; i < state->extra_environment->len; i++)
-    {
-        char *variable;
+        if (strncmp(cond_str, "AFTER=", 6) == 0)
+        {
+            if (compiled->after == NULL)
+                compiled->after = g_ptr_array_new_with_free_func(free);
 
-        variable = g_ptr_array_index(state->extra_environment, i);
+            for (const char *name = eq_sign + 1; *name != '\0';)
+            {
+                const size_t len = strcspn(name, ",");
+                if (len != 0)
+                    g_ptr_array_add(compiled->after, libreport_xstrndup(name, len));
+                name += len + (name[len] == ',');
+            }
+            continue;
+        }
 
-        g_ptr_array_add(env_array, g_strdup(variable));
-    }
-    g_ptr_array_add(env_array, NULL);
+        /* Execution mode: "SHELL=yes", "SHELL=no" */
+        if (strncmp(cond_str, "SHELL=", 6) == 0)
+        {
+            if (strcmp(eq_sign + 1, "yes") == 0)
+                use_shell = 1;
+            else if (strcmp(eq_sign + 1, "no") == 0)
+                use_shell = 0;
+            else
+                error_msg("Bad value of SHELL condition '%s'", eq_sign + 1);
+            continue;
+        }
 
-    free(full_name);
+        struct rule_condition *cond = compiled->conditions + compiled->condition_count++;
+        size_t name_len = eq_sign - cond_str;
+        if (eq_sign > cond_str && eq_sign[-1] == '~')
+        {
+            cond->op = RULE_CONDITION_REGEX;
+            --name_len;
+        }
+        else if (eq_sign > cond_str && eq_sign[-1] == '!')
+        {
+            cond->op = RULE_CONDITION_NE;
+            --name_len;
+        }
+        else
+            cond->op = RULE_CONDITION_EQ;
 
-    char *argv[4];
-    argv[0] = (char*)"/bin/sh"; // TODO: honor $SHELL?
-    argv[1] = (char*)"-c";
-    argv[2] = cmd;
-    argv[3] = NULL;
+        cond->element = rule_set_element(set, elements, cond_str, name_len);
+        cond->value = libreport_xstrdup(eq_sign + 1);
 
-    int pipefds[2];
-    state->command_pid = libreport_fork_execv_on_steroids(
-                EXECFLG_INPUT | EXECFLG_OUTPUT | EXECFLG_ERR2OUT | execflags,
-                argv,
-                pipefds,
-                /* env_vec: */ (char **)env_array->pdata,
-                /* dir: */ dump_dir_name,
-                /* uid(unused): */ 0
-    );
-    state->command_out_fd = pipefds[0];
-    state->command_in_fd = pipefds[1];
+        if (cond->op == RULE_CONDITION_REGEX)
+        {
+            cond->regex_valid = (regcomp(&cond->regex, cond->value, REG_NOSUB) == 0); //TODO: and REG_EXTENDED?
+            if (!cond->regex_valid)
+                error_msg("Bad regexp '%s'", cond->value);
+        }
+    }
 
-    g_ptr_array_free(env_array, TRUE);
-    free(cmd);
+    compiled->command = rule->command;
+    rule->command = NULL;
 
-    return 0;
+    if (use_shell != 1)
+        compiled->argv = split_simple_command(compiled->command, /*force:*/ use_shell == 0);
 }
 
-int consume_event_command_output(struct run_event_state *state, const char *dump_dir_name)
+static void rule_set_index(struct rule_set *set)
 {
-    int r = 0;
-    char buf[256];
-    errno = 0;
-    struct strbuf *cmd_output = state->command_output;
-    while ((r = libreport_safe_read(state->command_out_fd, buf, sizeof(buf) - 1)) > 0)
+    set->events = g_ptr_array_new_with_free_func(free_rule_event_index);
+    set->event_index = g_hash_table_new(g_str_hash, g_str_equal);
+    set->any_event_rules = g_array_new(FALSE, FALSE, sizeof(unsigned));
+
+    for (unsigned i = 0; i < set->rule_count; ++i)
     {
-        char *newline;
-        char *raw;
-        buf[r] = '\0';
-        raw = buf;
+        const char *event = set->rules[i].events[0];
+        if (event == NULL)
+        {
+            g_array_append_val(set->any_event_rules, i);
+            continue;
+        }
 
-        while ((newline = strchr(raw, '\n')) != NULL)
+        struct rule_event_index *index = g_hash_table_lookup(set->event_index, event);
+        if (index == NULL)
         {
-            *newline = '\0';
-            libreport_strbuf_append_str(cmd_output, raw);
-            char *msg = cmd_output->buf;
+            index = libreport_xzalloc(sizeof(*index));
+            index->event = event;
+            index->rules = g_array_new(FALSE, FALSE, sizeof(unsigned));
+            g_ptr_array_add(set->events, index);
+            g_hash_table_insert(set->event_index, (gpointer)event, index);
+        }
 
-            char *response = NULL;
+        g_array_append_val(index->rules, i);
+    }
 
-            /* just cut off prefix, no waiting */
-            if (libreport_prefixcmp(msg, REPORT_PREFIX_ALERT) == 0)
-            {
-                state->alert_callback(msg + sizeof(REPORT_PREFIX_ALERT) - 1 , state->interaction_param);
-            }
-            /* wait for y/N/f response on the same line */
-            else if (libreport_prefixcmp(msg, REPORT_PREFIX_ASK_YES_NO_YESFOREVER) == 0)
-            {
-                /* example:
-                 *   ASK_YES_NO_YESFOREVER ask_before_delete Do you want to delete selected files?
-                 */
-                char *key = msg + sizeof(REPORT_PREFIX_ASK_YES_NO_YESFOREVER) - 1;
-                char *key_end = strchr(key, ' ');
+    g_ptr_array_sort(set->events, cmp_rule_event_index);
+}
 
-                bool ans = false;
+static struct rule_set *rule_set_ref(struct rule_set *set)
+{
+    if (set != NULL)
+        g_atomic_int_inc(&set->ref);
 
-                if (!key_end)
-                {   /* example:
-                     *  ASK_YES_NO_YESFOREVER Continue?
-                     *
-                     * Print a wraning only and do not scary users with error messages.
-                     */
-                    log_warning("invalid input format (missing option name), using simple ask yes/no");
+    return set;
+}
 
-                    /* can't simply use 'goto ask_yes_no' because of different lenght of prefixes */
-                    ans = state->ask_yes_no_callback(key, state->interaction_param);
-                }
-                else
-                {
-                    key_end[0] = '\0'; /* split 'key msg' to 'key' and 'msg' */
-                    ans = state->ask_yes_no_yesforever_callback(key, key + strlen(key) + 1, state->interaction_param);
-                    key_end[0] = ' '; /* restore original message, not sure if it is necessary */
-                }
+/* Takes ownership of rules and sources */
+static struct rule_set *rule_set_compile(GList *rules,
+        struct config_cache_sources *sources, bool untracked)
+{
+    struct rule_set *set = libreport_xzalloc(sizeof(*set));
+    set->ref = 1;
+    set->rule_count = g_list_length(rules);
+    set->rules = libreport_xzalloc((set->rule_count + 1) * sizeof(set->rules[0]));
+    set->elements = g_ptr_array_new_with_free_func(free);
+    set->sources = sources;
+    set->untracked = untracked;
+
+    GHashTable *elements = g_hash_table_new(g_str_hash, g_str_equal);
+    unsigned i = 0;
+    for (GList *r = rules; r != NULL; r = g_list_next(r))
+        compile_rule(set, elements, set->rules + i++, r->data);
+    g_hash_table_destroy(elements);
+    free_rule_list(rules);
+
+    rule_set_index(set);
+
+    return set;
+}
 
-                response = libreport_xstrdup(ans ? "y" : "N");
-            }
-            /* wait for y/N/f/e response on the same line */
-            else if (libreport_prefixcmp(msg, REPORT_PREFIX_ASK_YES_NO_SAVE_RESULT) == 0)
-            {
-                /* example:
-                 *   ASK_YES_NO_SAVE_RESULT ask_before_delete Do you want to delete selected files?
-                 */
-                char *key = msg + sizeof(REPORT_PREFIX_ASK_YES_NO_SAVE_RESULT) - 1;
-                char *key_end = strchr(key, ' ');
+struct rule_set *rule_set_load(const char *conf_file_name)
+{
+    struct rule_loader loader = {
+        .sources = libreport_config_cache_sources_new(),
+    };
 
-                bool ans = false;
+    load_rules(&loader, conf_file_name, /*recursion_depth:*/ 0);
 
-                if (!key_end)
-                {   /* example:
-                     *  ASK_YES_NO_YESFOREVER Continue?
-                     *
-                     * Print a wraning only and do not scary users with error messages.
-                     */
-                    log_warning("invalid input format (missing option name), using simple ask yes/no");
+    struct rule_set *set = rule_set_compile(g_list_reverse(loader.rules),
+            loader.sources, loader.untracked);
 
-                    /* can't simply use 'goto ask_yes_no' because of different lenght of prefixes */
-                    ans = state->ask_yes_no_callback(key, state->interaction_param);
-                }
-                else
-                {
-                    key_end[0] = '\0'; /* split 'key msg' to 'key' and 'msg' */
-                    ans = state->ask_yes_no_save_result_callback(key, key + strlen(key) + 1, state->interaction_param);
-                    key_end[0] = ' '; /* restore original message, not sure if it is necessary */
-                }
+    log_debug("Compiled %u rules from '%s'", set->rule_count, conf_file_name);
+    return set;
+}
 
-                response = libreport_xstrdup(ans ? "y" : "N");
-            }
-            /* wait for y/N response on the same line */
-            else if (libreport_prefixcmp(msg, REPORT_PREFIX_ASK_YES_NO) == 0)
-            {
-                const bool ans = state->ask_yes_no_callback(msg + sizeof(REPORT_PREFIX_ASK_YES_NO) - 1, state->interaction_param);
-                response = libreport_xstrdup(ans ? "y" : "N");
-            }
-            /* wait for the string on the same line */
-            else if (libreport_prefixcmp(msg, REPORT_PREFIX_ASK) == 0)
-            {
-                response = state->ask_callback(msg + sizeof(REPORT_PREFIX_ASK) - 1, state->interaction_param);
-            }
-            /* set echo off and wait for password on the same line */
-            else if (libreport_prefixcmp(msg, REPORT_PREFIX_ASK_PASSWORD) == 0)
-            {
-                response = state->ask_password_callback(msg + sizeof(REPORT_PREFIX_ASK_PASSWORD) - 1, state->interaction_param);
-            }
-            /* no special prefix -> forward to log if applicable
-             * note that callback may take ownership of buf by returning NULL */
-            else if (state->logging_callback)
-            {
-                char *logged = state->logging_callback(libreport_xstrdup(msg), state->logging_param);
-                free(logged);
-            }
+/* Cached rules are stored as a(ass): conditions and command of every rule */
+#define RULE_SET_CACHE_TYPE "a(ass)"
 
-            if (response)
-            {
-                size_t len = strlen(response);
-                response[len++] = '\n';
+static GVariant *rule_set_to_variant(GList *rules)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE(RULE_SET_CACHE_TYPE));
 
-                if (libreport_full_write(state->command_in_fd, response, len) != len)
-                {
-                    if (state->error_callback)
-                        state->error_callback("<WRITE ERROR>", state->error_param);
-                    else
-                        perror_msg_and_die("Can't write %zu bytes to child's stdin", len);
-                }
+    for (GList *r = rules; r != NULL; r = g_list_next(r))
+    {
+        const struct rule *rule = r->data;
+
+        g_variant_builder_open(&builder, G_VARIANT_TYPE("(ass)"));
+        g_variant_builder_open(&builder, G_VARIANT_TYPE("as"));
+        for (GList *c = rule->conditions; c != NULL; c = g_list_next(c))
+            g_variant_builder_add(&builder, "s", (const char *)c->data);
+        g_variant_builder_close(&builder);
+        g_variant_builder_add(&builder, "s", rule->command);
+        g_variant_builder_close(&builder);
+    }
 
-                free(response);
-            }
+    return g_variant_builder_end(&builder);
+}
+
+static GList *rule_set_from_variant(GVariant *value)
+{
+    GList *rules = NULL;
 
-            libreport_strbuf_clear(cmd_output);
+    GVariantIter iter;
+    g_variant_iter_init(&iter, value);
+    GVariantIter *conditions;
+    char *command;
+    while (g_variant_iter_next(&iter, "(ass)", &conditions, &command))
+    {
+        struct rule *rule = libreport_xzalloc(sizeof(*rule));
+        rule->command = libreport_xstrdup(command);
+        g_free(command);
 
-            /* jump to next line */
-            raw = newline + 1;
-        }
+        const char *condition;
+        while (g_variant_iter_next(conditions, "&s", &condition))
+            rule->conditions = g_list_prepend(rule->conditions, libreport_xstrdup(condition));
+        rule->conditions = g_list_reverse(rule->conditions);
+        g_variant_iter_free(conditions);
 
-        /* beginning of next line. the line continues by next read() */
-        libreport_strbuf_append_str(cmd_output, raw);
+        rules = g_list_prepend(rules, rule);
     }
 
-    /* Hope that child's stdout fd was set to O_NONBLOCK */
-    if (r == -1 && errno == EAGAIN)
-        return -1;
+    return g_list_reverse(rules);
+}
 
-    libreport_strbuf_clear(cmd_output);
+/* Like rule_set_load() but the parsed rules are taken from and saved to
+ * the configuration cache. The regular expressions are compiled in any case.
+ */
+static struct rule_set *rule_set_load_cached(const char *conf_file_name)
+{
+    struct config_cache *cache = libreport_config_cache_open("rules");
+    struct rule_set *set = NULL;
 
-    /* Wait for child to actually exit, collect status */
-    libreport_safe_waitpid(state->command_pid, &(state->process_status), 0);
+    struct config_cache_sources *sources = NULL;
+    GVariant *value = libreport_config_cache_lookup(cache, conf_file_name, &sources);
+    if (value != NULL)
+    {
+        set = rule_set_compile(rule_set_from_variant(value), sources, /*untracked:*/ false);
+        g_variant_unref(value);
+        log_debug("Compiled %u cached rules of '%s'", set->rule_count, conf_file_name);
+    }
+    else
+    {
+        struct rule_loader loader = {
+            .sources = libreport_config_cache_sources_new(),
+        };
 
-    int retval = WEXITSTATUS(state->process_status);
-    if (WIFSIGNALED(state->process_status))
-        retval = WTERMSIG(state->process_status) + 128;
+        load_rules(&loader, conf_file_name, /*recursion_depth:*/ 0);
+        loader.rules = g_list_reverse(loader.rules);
 
-    if (retval == 0 && state->post_run_callback)
-        retval = state->post_run_callback(dump_dir_name, state->post_run_param);
+        /* Rules included by a pattern with wildcards in directory names
+         * can't be validated */
+        if (!loader.untracked)
+            libreport_config_cache_store(cache, conf_file_name, loader.sources, rule_set_to_variant(loader.rules));
 
-    return retval;
+        set = rule_set_compile(loader.rules, loader.sources, loader.untracked);
+        log_debug("Compiled %u rules from '%s'", set->rule_count, conf_file_name);
+    }
+
+    libreport_config_cache_close(cache);
+    return set;
 }
 
-/* Synchronous command execution:
+void rule_set_free(struct rule_set *set)
+{
+    if (set == NULL || !g_atomic_int_dec_and_test(&set->ref))
+        return;
+
+    for (unsigned i = 0; i < set->rule_count; ++i)
+    {
+        struct compiled_rule *rule = set->rules + i;
+        g_strfreev(rule->events);
+        for (unsigned j = 0; j < rule->condition_count; ++j)
+        {
+            free(rule->conditions[j].value);
+            if (rule->conditions[j].regex_valid)
+                regfree(&rule->conditions[j].regex);
+        }
+        free(rule->conditions);
+        free(rule->command);
+        g_strfreev(rule->argv);
+        free(rule->handler);
+        if (rule->after != NULL)
+            g_ptr_array_free(rule->after, TRUE);
+    }
+    free(set->rules);
+
+    g_ptr_array_free(set->elements, TRUE);
+    g_hash_table_destroy(set->event_index);
+    g_ptr_array_free(set->events, TRUE);
+    g_array_free(set->any_event_rules, TRUE);
+
+    libreport_config_cache_sources_free(set->sources);
+
+    free(set);
+}
+
+unsigned rule_set_count(const struct rule_set *set)
+{
+    return set->rule_count;
+}
+
+bool rule_set_is_up_to_date(const struct rule_set *set)
+{
+    return !set->untracked && !libreport_config_cache_sources_changed(set->sources);
+}
+
+/* Returns indexes of rules, in the configuration order, which can be
+ * applicable to the event (or to all events with the prefix)
+ */
+static GArray *rule_set_candidates(const struct rule_set *set, const char *event, bool prefix)
+{
+    GArray *candidates = g_array_new(FALSE, FALSE, sizeof(unsigned));
+    g_array_append_vals(candidates, set->any_event_rules->data, set->any_event_rules->len);
+
+    if (!prefix)
+    {
+        const struct rule_event_index *index = g_hash_table_lookup(set->event_index, event);
+        if (index != NULL)
+            g_array_append_vals(candidates, index->rules->data, index->rules->len);
+    }
+    else
+    {
+        const size_t event_len = strlen(event);
+
+        /* Find the first event which is not less than the prefix */
+        unsigned lo = 0;
+        unsigned hi = set->events->len;
+        while (lo < hi)
+        {
+            const unsigned mid = lo + (hi - lo) / 2;
+            const struct rule_event_index *index = g_ptr_array_index(set->events, mid);
+            if (strcmp(index->event, event) < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        for (; lo < set->events->len; ++lo)
+        {
+            const struct rule_event_index *index = g_ptr_array_index(set->events, lo);
+            if (strncmp(index->event, event, event_len) != 0)
+                break;
+
+            g_array_append_vals(candidates, index->rules->data, index->rules->len);
+        }
+    }
+
+    g_array_sort(candidates, cmp_rule_number);
+    return candidates;
+}
+
+/* The source of values for conditions */
+struct rule_eval
+{
+    struct dump_dir *dd;
+    bool close_dd;
+    problem_data_t *pd;
+    const char *dump_dir_name;
+    /* Loaded values indexed by element */
+    char **values;
+    unsigned value_count;
+    /* The dump directory can't be opened */
+    bool failed;
+};
+
+static void rule_eval_init(struct rule_eval *eval, const struct rule_set *set,
+        struct dump_dir *dd, problem_data_t *pd, const char *dump_dir_name)
+{
+    /* It is an error to pass both, but we can recover from it and use only
+     * problem_data_t in that case */
+    if (dd != NULL && pd != NULL)
+        error_msg("BUG: both dump dir and problem data passed to %s()", __func__);
+
+    memset(eval, 0, sizeof(*eval));
+    eval->dd = pd == NULL ? dd : NULL;
+    eval->pd = pd;
+    eval->dump_dir_name = dump_dir_name;
+    eval->value_count = set->elements->len;
+    eval->values = libreport_xzalloc((eval->value_count + 1) * sizeof(eval->values[0]));
+}
+
+static void rule_eval_destroy(struct rule_eval *eval)
+{
+    for (unsigned i = 0; i < eval->value_count; ++i)
+        free(eval->values[i]);
+    free(eval->values);
+
+    if (eval->close_dd)
+        dd_close(eval->dd);
+}
+
+/* Returns the value of the element; each element is loaded at most once.
+ * Returns NULL in case of error.
+ */
+static char *rule_eval_value(struct rule_eval *eval, const struct rule_set *set, unsigned element)
+{
+    if (eval->values[element] != NULL)
+        return eval->values[element];
+
+    const char *name = g_ptr_array_index(set->elements, element);
+    if (eval->pd != NULL)
+    {
+        const char *content = problem_data_get_content_or_NULL(eval->pd, name);
+        eval->values[element] = libreport_xstrdup(content ? content : "");
+        return eval->values[element];
+    }
+
+    if (eval->dd == NULL)
+    {
+        eval->dd = dd_opendir(eval->dump_dir_name, /*flags:*/ DD_OPEN_READONLY);
+        if (eval->dd == NULL)
+        {
+            /* note: dd_opendir logged error msg */
+            eval->failed = true;
+            return NULL;
+        }
+        eval->close_dd = true;
+    }
+
+    eval->values[element] = dd_load_text_ext(eval->dd, name, DD_FAIL_QUIETLY_ENOENT);
+    return eval->values[element];
+}
+
+static int regexec_lines(const regex_t *rx, char *val)
+{
+    int r;
+    /* Check every line */
+    while (1)
+    {
+        char *eol = strchr(val, '\n');
+        if (eol)
+            *eol = '\0';
+        r = regexec(rx, val, 0, NULL, /*eflags:*/ 0);
+        if (eol)
+            *eol = '\n';
+        if (r == 0 || !eol)
+            break;
+        val = eol + 1;
+    }
+    /* Here, r == 0 if match was found */
+    return r;
+}
+
+/* Returns true if all conditions of the rule are satisfied.
+ *
+ * EVENT values must begin with the first pfx_len bytes of pfx.
+ */
+static bool rule_matches(const struct rule_set *set, const struct compiled_rule *rule,
+        struct rule_eval *eval, const char *pfx, size_t pfx_len)
+{
+    for (char **event = rule->events; *event != NULL; ++event)
+        if (strncmp(*event, pfx, pfx_len) != 0)
+            return false; /* prefix doesn't match */
+
+    /* Without dir to match, we assume match for all conditions */
+    if (eval->dd == NULL && eval->pd == NULL && eval->dump_dir_name == NULL)
+        return true;
+
+    for (unsigned i = 0; i < rule->condition_count; ++i)
+    {
+        const struct rule_condition *cond = rule->conditions + i;
+
+        char *real_val = rule_eval_value(eval, set, cond->element);
+        if (real_val == NULL)
+            return false;
+
+        int vals_differ;
+        if (cond->op == RULE_CONDITION_REGEX)
+            vals_differ = cond->regex_valid ? regexec_lines(&cond->regex, real_val) : 1;
+        else
+            vals_differ = strcmp(real_val, cond->value);
+
+        if (cond->op == RULE_CONDITION_NE)
+            vals_differ = !vals_differ;
+
+        /* Do values match? */
+        if (vals_differ) /* no */
+            return false;
+    }
+
+    return true;
+}
+
+char *rule_set_list_possible_events(struct rule_set *set,
+        struct dump_dir *dd,
+        problem_data_t *pd,
+        const char *dump_dir_name,
+        const char *pfx)
+{
+    struct strbuf *result = libreport_strbuf_new();
+
+    struct rule_eval eval;
+    rule_eval_init(&eval, set, dd, pd, dump_dir_name);
+
+    GHashTable *listed = g_hash_table_new(g_str_hash, g_str_equal);
+    GArray *candidates = rule_set_candidates(set, pfx, /*prefix:*/ true);
+    const size_t pfx_len = strlen(pfx);
+
+    for (unsigned i = 0; i < candidates->len && !eval.failed; ++i)
+    {
+        const struct compiled_rule *rule = set->rules + g_array_index(candidates, unsigned, i);
+
+        /* Rules without EVENT are not events */
+        if (rule->events[0] == NULL || !rule_matches(set, rule, &eval, pfx, pfx_len))
+            continue;
+
+        /* The last EVENT=foo value names the event */
+        const char *event_name = rule->events[g_strv_length(rule->events) - 1];
+
+        /* Append "EVENT\n" - only if it is not there yet */
+        if (g_hash_table_add(listed, (gpointer)event_name))
+            libreport_strbuf_append_strf(result, "%s\n", event_name);
+    }
+
+    g_array_free(candidates, TRUE);
+    g_hash_table_destroy(listed);
+    rule_eval_destroy(&eval);
+
+    return libreport_strbuf_free_nobuf(result);
+}
+
+/* Rules of CONF_DIR/report_event.conf are compiled once per process and
+ * re-loaded only if their files change.
+ */
+static GMutex s_report_event_rules_lock;
+static struct rule_set *s_report_event_rules;
+
+static struct rule_set *get_report_event_rules(void)
+{
+    const char *debug_conf_file = getenv("LIBREPORT_DEBUG_REPORT_EVENT_CONF");
+    if (debug_conf_file != NULL)
+        return rule_set_load(debug_conf_file);
+
+    g_mutex_lock(&s_report_event_rules_lock);
+
+    if (s_report_event_rules != NULL && !rule_set_is_up_to_date(s_report_event_rules))
+    {
+        rule_set_free(s_report_event_rules);
+        s_report_event_rules = NULL;
+    }
+
+    if (s_report_event_rules == NULL)
+        s_report_event_rules = rule_set_load_cached(CONF_DIR"/report_event.conf");
+
+    struct rule_set *set = rule_set_ref(s_report_event_rules);
+
+    g_mutex_unlock(&s_report_event_rules_lock);
+
+    return set;
+}
+
+/* Checks the remaining rules of the event, starting from first rule,
+ * until it finds a rule with all conditions satisfied.
+ * In this case, it marks this rule as done and returns this rule.
+ * Else (if it didn't find such rule), it returns NULL.
+ * In case of error (dump_dir can't be opened), returns NULL.
+ */
+static const struct compiled_rule *pop_next_command(struct run_event_state *state,
+        const char *dump_dir_name,
+        const char *event
+)
+{
+    struct rule_set *set = state->rule_set;
+    if (set == NULL)
+        return NULL;
+
+    const struct compiled_rule *command = NULL;
+
+    struct rule_eval eval;
+    rule_eval_init(&eval, set, NULL, NULL, dump_dir_name);
+
+    GArray *candidates = rule_set_candidates(set, event, /*prefix:*/ false);
+    for (unsigned i = 0; i < candidates->len; ++i)
+    {
+        const unsigned rule_no = g_array_index(candidates, unsigned, i);
+        if (state->rules_done[rule_no])
+            continue;
+
+        /* for this event name exactly (not prefix) */
+        if (rule_matches(set, set->rules + rule_no, &eval, event, strlen(event) + 1))
+        {
+            /* We found rule to run, remove it and return it */
+            state->rules_done[rule_no] = true;
+            command = set->rules + rule_no;
+            break;
+        }
+
+        if (eval.failed)
+        {
+            /* Give up all remaining rules */
+            memset(state->rules_done, true, set->rule_count);
+            break;
+        }
+    }
+
+    g_array_free(candidates, TRUE);
+    rule_eval_destroy(&eval);
+
+    return command;
+}
+
+void free_commands(struct run_event_state *state)
+{
+    rule_set_free(state->rule_set);
+    state->rule_set = NULL;
+    free(state->rules_done);
+    state->rules_done = NULL;
+    state->command_out_fd = -1;
+    state->command_pid = 0;
+}
+
+int prepare_commands(struct run_event_state *state)
+{
+    free_commands(state);
+
+    state->children_count = 0;
+    libreport_strbuf_clear(state->command_output);
+
+    struct rule_set *set = get_report_event_rules();
+    state->rule_set = set;
+    state->rules_done = libreport_xzalloc(set->rule_count + 1);
+    return set->rule_count != 0;
+}
+
+/* Starts the command of the rule, in the shell if the command needs it;
+ * pipefds receives the command's stdout and stdin */
+static pid_t spawn_command(struct run_event_state *state,
+                const char *dump_dir_name,
+                const char *event,
+                const struct compiled_rule *rule,
+                unsigned execflags,
+                int pipefds[2]
+) {
+    log_info("Next command: '%s'", rule->command);
+
+    /* Just exporting dump_dir_name isn't always ok: it can be "."
+     * and some children want to cd to other directory but still
+     * be able to find problem directory by using $DUMP_DIR...
+     */
+    char *full_name = realpath(dump_dir_name, NULL);
+    /* Export some useful environment variables for children */
+    GPtrArray *env_array;
+
+    env_array = g_ptr_array_new();
+
+    g_ptr_array_add(env_array, libreport_xasprintf("DUMP_DIR=%s", (full_name ? full_name : dump_dir_name)));
+    g_ptr_array_add(env_array, libreport_xasprintf("EVENT=%s", event));
+    g_ptr_array_add(env_array, libreport_xasprintf("REPORT_CLIENT_SLAVE=1"));
+    for (unsigned int i = 0; i < state->extra_environment->len; i++)
+    {
+        char *variable;
+
+        variable = g_ptr_array_index(state->extra_environment, i);
+
+        g_ptr_array_add(env_array, g_strdup(variable));
+    }
+    g_ptr_array_add(env_array, NULL);
+
+    free(full_name);
+
+    char *sh_argv[4];
+    char **argv = rule->argv;
+    if (argv == NULL)
+    {
+        sh_argv[0] = (char*)"/bin/sh"; // TODO: honor $SHELL?
+        sh_argv[1] = (char*)"-c";
+        sh_argv[2] = rule->command;
+        sh_argv[3] = NULL;
+        argv = sh_argv;
+    }
+
+    pid_t pid = libreport_fork_execv_on_steroids(
+                EXECFLG_INPUT | EXECFLG_OUTPUT | EXECFLG_ERR2OUT | execflags,
+                argv,
+                pipefds,
+                /* env_vec: */ (char **)env_array->pdata,
+                /* dir: */ dump_dir_name,
+                /* uid(unused): */ 0
+    );
+
+    g_ptr_array_free(env_array, TRUE);
+
+    return pid;
+}
+
+int spawn_next_command(struct run_event_state *state,
+                const char *dump_dir_name,
+                const char *event,
+                unsigned execflags
+) {
+    const struct compiled_rule *rule = pop_next_command(state, dump_dir_name, event);
+    if (!rule)
+        return -1;
+
+    /* We count it even if fork fails. The counter isn't meant
+     * to count *successful* forks, it is meant to let caller know
+     * whether the event we run has *any* handlers configured, or not.
+     */
+    state->children_count++;
+
+    int pipefds[2];
+    state->command_pid = spawn_command(state, dump_dir_name, event, rule, execflags, pipefds);
+    state->command_out_fd = pipefds[0];
+    state->command_in_fd = pipefds[1];
+
+    return 0;
+}
+
+/* Size of reads of the command's output */
+#define COMMAND_OUTPUT_READ_SIZE (64 * 1024)
+
+static bool has_prefix(const char *line, size_t len, const char *prefix, size_t prefix_len)
+{
+    return len >= prefix_len && memcmp(line, prefix, prefix_len) == 0;
+}
+
+#define HAS_PREFIX(line, len, prefix) has_prefix(line, len, prefix, sizeof(prefix) - 1)
+
+/* Handles the command's request for an interaction; returns false if msg
+ * is not a request */
+static bool handle_command_request(struct run_event_state *state, int in_fd, char *msg, size_t len)
+{
+    char *response = NULL;
+
+    /* just cut off prefix, no waiting */
+    if (HAS_PREFIX(msg, len, REPORT_PREFIX_ALERT))
+    {
+        state->alert_callback(msg + sizeof(REPORT_PREFIX_ALERT) - 1 , state->interaction_param);
+        return true;
+    }
+    /* wait for y/N/f response on the same line */
+    else if (HAS_PREFIX(msg, len, REPORT_PREFIX_ASK_YES_NO_YESFOREVER))
+    {
+        /* example:
+         *   ASK_YES_NO_YESFOREVER ask_before_delete Do you want to delete selected files?
+         */
+        char *key = msg + sizeof(REPORT_PREFIX_ASK_YES_NO_YESFOREVER) - 1;
+        char *key_end = strchr(key, ' ');
+
+        bool ans = false;
+
+        if (!key_end)
+        {   /* example:
+             *  ASK_YES_NO_YESFOREVER Continue?
+             *
+             * Print a wraning only and do not scary users with error messages.
+             */
+            log_warning("invalid input format (missing option name), using simple ask yes/no");
+
+            /* can't simply use 'goto ask_yes_no' because of different lenght of prefixes */
+            ans = state->ask_yes_no_callback(key, state->interaction_param);
+        }
+        else
+        {
+            key_end[0] = '\0'; /* split 'key msg' to 'key' and 'msg' */
+            ans = state->ask_yes_no_yesforever_callback(key, key + strlen(key) + 1, state->interaction_param);
+            key_end[0] = ' '; /* restore original message, not sure if it is necessary */
+        }
+
+        response = libreport_xstrdup(ans ? "y" : "N");
+    }
+    /* wait for y/N/f/e response on the same line */
+    else if (HAS_PREFIX(msg, len, REPORT_PREFIX_ASK_YES_NO_SAVE_RESULT))
+    {
+        /* example:
+         *   ASK_YES_NO_SAVE_RESULT ask_before_delete Do you want to delete selected files?
+         */
+        char *key = msg + sizeof(REPORT_PREFIX_ASK_YES_NO_SAVE_RESULT) - 1;
+        char *key_end = strchr(key, ' ');
+
+        bool ans = false;
+
+        if (!key_end)
+        {   /* example:
+             *  ASK_YES_NO_YESFOREVER Continue?
+             *
+             * Print a wraning only and do not scary users with error messages.
+             */
+            log_warning("invalid input format (missing option name), using simple ask yes/no");
+
+            /* can't simply use 'goto ask_yes_no' because of different lenght of prefixes */
+            ans = state->ask_yes_no_callback(key, state->interaction_param);
+        }
+        else
+        {
+            key_end[0] = '\0'; /* split 'key msg' to 'key' and 'msg' */
+            ans = state->ask_yes_no_save_result_callback(key, key + strlen(key) + 1, state->interaction_param);
+            key_end[0] = ' '; /* restore original message, not sure if it is necessary */
+        }
+
+        response = libreport_xstrdup(ans ? "y" : "N");
+    }
+    /* wait for y/N response on the same line */
+    else if (HAS_PREFIX(msg, len, REPORT_PREFIX_ASK_YES_NO))
+    {
+        const bool ans = state->ask_yes_no_callback(msg + sizeof(REPORT_PREFIX_ASK_YES_NO) - 1, state->interaction_param);
+        response = libreport_xstrdup(ans ? "y" : "N");
+    }
+    /* wait for the string on the same line */
+    else if (HAS_PREFIX(msg, len, REPORT_PREFIX_ASK))
+    {
+        response = state->ask_callback(msg + sizeof(REPORT_PREFIX_ASK) - 1, state->interaction_param);
+    }
+    /* set echo off and wait for password on the same line */
+    else if (HAS_PREFIX(msg, len, REPORT_PREFIX_ASK_PASSWORD))
+    {
+        response = state->ask_password_callback(msg + sizeof(REPORT_PREFIX_ASK_PASSWORD) - 1, state->interaction_param);
+    }
+    else
+        return false;
+
+    if (response)
+    {
+        size_t len = strlen(response);
+        response[len++] = '\n';
+
+        if (libreport_full_write(in_fd, response, len) != len)
+        {
+            if (state->error_callback)
+                state->error_callback("<WRITE ERROR>", state->error_param);
+            else
+                perror_msg_and_die("Can't write %zu bytes to child's stdin", len);
+        }
+
+        free(response);
+    }
+
+    return true;
+}
+
+/* Forwards one line of the command's output to the logging callbacks */
+static void log_command_output_line(struct run_event_state *state, char *msg, size_t len)
+{
+    if (state->logging_line_callback)
+        state->logging_line_callback(msg, len, state->logging_param);
+    else if (state->logging_callback)
+    {
+        /* note that callback may take ownership of buf by returning NULL */
+        char *logged = state->logging_callback(libreport_xstrndup(msg, len), state->logging_param);
+        free(logged);
+    }
+}
+
+/* Handles one line of the command's output; msg is NUL terminated
+ * and may be modified */
+static void handle_command_output_line(struct run_event_state *state, int in_fd, char *msg, size_t len)
+{
+    /* All request prefixes start with 'A' */
+    switch (msg[0])
+    {
+        case 'A':
+            if (handle_command_request(state, in_fd, msg, len))
+                return;
+            break;
+    }
+
+    /* no special prefix -> forward to log if applicable */
+    log_command_output_line(state, msg, len);
+}
+
+/* Passes the command's output lines to the callbacks and answers its
+ * questions; incomplete lines are kept in cmd_output. A line ends at the
+ * first NUL byte, the rest up to the newline is dropped. At the end of the
+ * output, the last line without a newline is logged as well.
+ *
+ * The output is read in large chunks directly behind the incomplete line and
+ * the complete lines are handled in place, only the incomplete line at the
+ * end is moved to the beginning of the buffer.
+ *
+ * Returns 0 at the end of the output, COMMAND_OUTPUT_PENDING if out_fd is
+ * non-blocking and there is no more output for now, or -1 with errno set.
+ */
+#define COMMAND_OUTPUT_PENDING 1
+static int consume_command_output(struct run_event_state *state,
+        int out_fd, int in_fd, struct strbuf *cmd_output)
+{
+    int r = 0;
+    while (1)
+    {
+        const int need = cmd_output->len + COMMAND_OUTPUT_READ_SIZE + 1;
+        if (cmd_output->alloc < need)
+        {
+            cmd_output->alloc = MAX(need, cmd_output->alloc * 2);
+            cmd_output->buf = libreport_xrealloc(cmd_output->buf, cmd_output->alloc);
+        }
+
+        r = libreport_safe_read(out_fd, cmd_output->buf + cmd_output->len, COMMAND_OUTPUT_READ_SIZE);
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return COMMAND_OUTPUT_PENDING;
+        if (r <= 0)
+            break;
+
+        char *line = cmd_output->buf;
+        char *const end = cmd_output->buf + cmd_output->len + r;
+        /* The incomplete line has no newline */
+        char *search = cmd_output->buf + cmd_output->len;
+        char *newline;
+        while ((newline = memchr(search, '\n', end - search)) != NULL)
+        {
+            *newline = '\0';
+            handle_command_output_line(state, in_fd, line, strlen(line));
+
+            /* jump to next line */
+            line = search = newline + 1;
+        }
+
+        /* beginning of next line. the line continues by next read() */
+        cmd_output->len = end - line;
+        memmove(cmd_output->buf, line, cmd_output->len);
+        cmd_output->buf[cmd_output->len] = '\0';
+    }
+
+    /* Nobody waits for an answer to an unterminated request */
+    if (r == 0 && cmd_output->len != 0)
+    {
+        log_command_output_line(state, cmd_output->buf, strlen(cmd_output->buf));
+        libreport_strbuf_clear(cmd_output);
+    }
+
+    return r;
+}
+
+/* Waits for the command to exit and returns its exit code, or the return
+ * value of post_run_callback */
+static int command_exit_status(struct run_event_state *state, pid_t pid, const char *dump_dir_name)
+{
+    /* Wait for child to actually exit, collect status */
+    libreport_safe_waitpid(pid, &(state->process_status), 0);
+
+    int retval = WEXITSTATUS(state->process_status);
+    if (WIFSIGNALED(state->process_status))
+        retval = WTERMSIG(state->process_status) + 128;
+
+    if (retval == 0 && state->post_run_callback)
+        retval = state->post_run_callback(dump_dir_name, state->post_run_param);
+
+    return retval;
+}
+
+int consume_event_command_output(struct run_event_state *state, const char *dump_dir_name)
+{
+    const int r = consume_command_output(state, state->command_out_fd, state->command_in_fd,
+            state->command_output);
+
+    /* Hope that child's stdout fd was set to O_NONBLOCK */
+    if (r == COMMAND_OUTPUT_PENDING)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    libreport_strbuf_clear(state->command_output);
+
+    return command_exit_status(state, state->command_pid, dump_dir_name);
+}
+
+/* Concurrent execution of event handlers
+ *
+ * A rule with HANDLER=name condition may run concurrently with other such
+ * rules. AFTER=name1,name2 delays the rule until no rule of the named
+ * handlers is running or can run. Rules without HANDLER= run alone: they
+ * wait until all earlier rules have run and nothing overtakes them, hence
+ * configurations without these annotations are processed exactly as before.
+ *
+ * Conditions are still checked directly before a rule is started, and the
+ * rules which have not run yet are re-checked whenever a command finishes.
+ * Output of the commands is processed line by line in this process, so the
+ * callbacks are never called concurrently.
+ */
+struct running_command
+{
+    unsigned rule_no;
+    pid_t pid;
+    int out_fd;
+    int in_fd;
+    struct strbuf *output;
+};
+
+struct command_scheduler
+{
+    struct run_event_state *state;
+    const char *dump_dir_name;
+    const char *event;
+    unsigned max_running;
+    /* Rules which can be applicable to the event */
+    GArray *candidates;
+    /* Indexed by rule number */
+    bool *running;
+    /* struct running_command */
+    GArray *commands;
+};
+
+static unsigned online_processors(void)
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? cpus : 1;
+}
+
+static void command_scheduler_init(struct command_scheduler *sched, struct run_event_state *state,
+        const char *dump_dir_name, const char *event)
+{
+    memset(sched, 0, sizeof(*sched));
+    sched->state = state;
+    sched->dump_dir_name = dump_dir_name;
+    sched->event = event;
+
+    sched->max_running = state->max_concurrent_commands;
+    if (sched->max_running == 0)
+        sched->max_running = online_processors();
+
+    sched->candidates = rule_set_candidates(state->rule_set, event, /*prefix:*/ false);
+    sched->running = libreport_xzalloc(state->rule_set->rule_count + 1);
+    sched->commands = g_array_new(FALSE, FALSE, sizeof(struct running_command));
+}
+
+static void command_scheduler_destroy(struct command_scheduler *sched)
+{
+    g_array_free(sched->commands, TRUE);
+    free(sched->running);
+    g_array_free(sched->candidates, TRUE);
+}
+
+static void command_scheduler_start(struct command_scheduler *sched, unsigned rule_no, unsigned execflags)
+{
+    struct run_event_state *state = sched->state;
+
+    state->rules_done[rule_no] = true;
+    state->children_count++;
+
+    int pipefds[2];
+    struct running_command command = { .rule_no = rule_no };
+    command.pid = spawn_command(state, sched->dump_dir_name, sched->event,
+            state->rule_set->rules + rule_no, execflags, pipefds);
+    command.out_fd = pipefds[0];
+    command.in_fd = pipefds[1];
+    command.output = libreport_strbuf_new();
+    libreport_ndelay_on(command.out_fd);
+
+    sched->running[rule_no] = true;
+    g_array_append_val(sched->commands, command);
+}
+
+/* Returns true if a rule of the handler is running or can still run before
+ * the rule dependent_no. Rules behind a rule without HANDLER= which has not
+ * run yet can't run before the dependent rule, the rule without HANDLER=
+ * waits for it.
+ */
+static bool command_scheduler_handler_pending(struct command_scheduler *sched,
+        struct rule_eval *eval, unsigned dependent_no, const char *handler)
+{
+    const struct rule_set *set = sched->state->rule_set;
+
+    for (unsigned i = 0; i < sched->candidates->len; ++i)
+    {
+        const unsigned rule_no = g_array_index(sched->candidates, unsigned, i);
+        const struct compiled_rule *rule = set->rules + rule_no;
+        if (rule->handler == NULL)
+        {
+            if (rule_no > dependent_no
+             && !sched->state->rules_done[rule_no]
+             && rule_matches(set, rule, eval, sched->event, strlen(sched->event) + 1))
+                break;
+            continue;
+        }
+
+        if (strcmp(rule->handler, handler) != 0)
+            continue;
+
+        if (sched->running[rule_no])
+            return true;
+
+        if (!sched->state->rules_done[rule_no]
+         && rule_matches(set, rule, eval, sched->event, strlen(sched->event) + 1))
+            return true;
+    }
+
+    return false;
+}
+
+static bool command_scheduler_dependencies_pending(struct command_scheduler *sched,
+        struct rule_eval *eval, unsigned rule_no)
+{
+    const struct compiled_rule *rule = sched->state->rule_set->rules + rule_no;
+    if (rule->after == NULL)
+        return false;
+
+    for (unsigned i = 0; i < rule->after->len; ++i)
+        if (command_scheduler_handler_pending(sched, eval, rule_no, g_ptr_array_index(rule->after, i)))
+            return true;
+
+    return false;
+}
+
+/* Starts all rules which can run now */
+static void command_scheduler_start_ready(struct command_scheduler *sched, unsigned execflags)
+{
+    struct run_event_state *state = sched->state;
+    const struct rule_set *set = state->rule_set;
+    int blocked = -1;
+
+    struct rule_eval eval;
+    rule_eval_init(&eval, set, NULL, NULL, sched->dump_dir_name);
+
+    for (unsigned i = 0; i < sched->candidates->len && sched->commands->len < sched->max_running; ++i)
+    {
+        const unsigned rule_no = g_array_index(sched->candidates, unsigned, i);
+        if (state->rules_done[rule_no])
+            continue;
+
+        const struct compiled_rule *rule = set->rules + rule_no;
+        if (!rule_matches(set, rule, &eval, sched->event, strlen(sched->event) + 1))
+        {
+            if (eval.failed)
+            {
+                /* Give up all remaining rules */
+                memset(state->rules_done, true, set->rule_count);
+                blocked = -1;
+                break;
+            }
+            continue;
+        }
+
+        if (rule->handler == NULL)
+        {
+            /* Wait for all earlier rules, including the blocked ones */
+            if (sched->commands->len == 0 && blocked < 0)
+                command_scheduler_start(sched, rule_no, execflags);
+            break;
+        }
+
+        if (command_scheduler_dependencies_pending(sched, &eval, rule_no))
+        {
+            if (blocked < 0)
+                blocked = rule_no;
+            continue;
+        }
+
+        command_scheduler_start(sched, rule_no, execflags);
+    }
+
+    rule_eval_destroy(&eval);
+
+    /* Nothing runs, so the rule waits for itself through a cycle of
+     * dependencies. Run the rules in the configuration order then.
+     */
+    if (sched->commands->len == 0 && blocked >= 0)
+    {
+        error_msg("Dependencies of handler '%s' can't be satisfied, ignoring them",
+                set->rules[blocked].handler);
+        command_scheduler_start(sched, blocked, execflags);
+    }
+}
+
+/* Processes output of the running commands until one of them finishes
+ *
+ * Returns the exit status of the finished command (see
+ * consume_event_command_output()).
+ */
+static int command_scheduler_wait(struct command_scheduler *sched)
+{
+    struct run_event_state *state = sched->state;
+    const unsigned count = sched->commands->len;
+    struct pollfd *pfds = libreport_xzalloc(count * sizeof(pfds[0]));
+
+    while (1)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            pfds[i].fd = g_array_index(sched->commands, struct running_command, i).out_fd;
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+        }
+
+        if (poll(pfds, count, /*timeout:*/ -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror_msg_and_die("poll");
+        }
+
+        for (unsigned i = 0; i < count; ++i)
+        {
+            if (pfds[i].revents == 0)
+                continue;
+
+            struct running_command *command = &g_array_index(sched->commands, struct running_command, i);
+            if (consume_command_output(state, command->out_fd, command->in_fd, command->output)
+                    == COMMAND_OUTPUT_PENDING)
+                continue;
+
+            close(command->out_fd);
+            close(command->in_fd);
+            libreport_strbuf_free(command->output);
+
+            /* For post_run_callback */
+            state->command_pid = command->pid;
+            const int retval = command_exit_status(state, command->pid, sched->dump_dir_name);
+            state->command_pid = 0;
+
+            sched->running[command->rule_no] = false;
+            g_array_remove_index(sched->commands, i);
+
+            free(pfds);
+            return retval;
+        }
+    }
+}
+
+/* Synchronous command execution:
  */
 int run_event_on_dir_name(struct run_event_state *state,
                 const char *dump_dir_name,
@@ -722,19 +1713,148 @@ int run_event_on_dir_name(struct run_event_state *state,
 
     /* Execute every command in shell */
 
+    struct command_scheduler sched;
+    command_scheduler_init(&sched, state, dump_dir_name, event);
+
     int retval = 0;
-    while (spawn_next_command(state, dump_dir_name, event, /*execflags:*/ 0) >= 0)
+    while (1)
     {
-        retval = consume_event_command_output(state, dump_dir_name);
-        if (retval != 0)
+        /* Let the running commands finish after a failure */
+        if (retval == 0)
+            command_scheduler_start_ready(&sched, /*execflags:*/ 0);
+
+        if (sched.commands->len == 0)
             break;
+
+        const int r = command_scheduler_wait(&sched);
+        if (retval == 0)
+            retval = r;
     }
 
+    command_scheduler_destroy(&sched);
     free_commands(state);
 
     return retval;
 }
 
+/* Batch execution:
+ *
+ * Every directory runs its commands one by one through the asynchronous API
+ * of its own state; output pipes of all running commands are multiplexed by
+ * one epoll instance.
+ */
+static bool batch_spawn_next_command(struct run_event_state *state, const char *dump_dir_name,
+        const char *event, int epoll_fd, unsigned index)
+{
+    if (spawn_next_command(state, dump_dir_name, event, /*execflags:*/ 0) < 0)
+        return false;
+
+    libreport_ndelay_on(state->command_out_fd);
+
+    struct epoll_event ev = {
+        .events = EPOLLIN,
+        .data.u32 = index,
+    };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, state->command_out_fd, &ev) != 0)
+        perror_msg_and_die("epoll_ctl");
+
+    return true;
+}
+
+static void batch_close_command(struct run_event_state *state, int epoll_fd)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, state->command_out_fd, NULL);
+    close(state->command_out_fd);
+    close(state->command_in_fd);
+    state->command_out_fd = -1;
+    state->command_in_fd = -1;
+}
+
+unsigned run_event_on_dir_names(struct run_event_state *const *states,
+                const char *const *dump_dir_names,
+                unsigned count,
+                const char *event,
+                unsigned max_workers,
+                int *retvals
+) {
+    if (max_workers == 0)
+        max_workers = online_processors();
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+        perror_msg_and_die("epoll_create1");
+
+    unsigned next = 0;
+    unsigned running = 0;
+    unsigned failed = 0;
+
+    while (1)
+    {
+        /* Start processing of more directories */
+        while (running < max_workers && next < count)
+        {
+            const unsigned i = next++;
+            prepare_commands(states[i]);
+
+            if (batch_spawn_next_command(states[i], dump_dir_names[i], event, epoll_fd, i))
+                ++running;
+            else
+            {
+                /* Nothing to do for this directory */
+                free_commands(states[i]);
+                if (retvals != NULL)
+                    retvals[i] = 0;
+            }
+        }
+
+        if (running == 0)
+            break;
+
+        struct epoll_event events[16];
+        const int n = epoll_wait(epoll_fd, events, ARRAY_SIZE(events), /*timeout:*/ -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror_msg_and_die("epoll_wait");
+        }
+
+        for (int k = 0; k < n; ++k)
+        {
+            const unsigned i = events[k].data.u32;
+            struct run_event_state *state = states[i];
+
+            /* A negative post_run_callback result must not look like
+             * the EAGAIN case of consume_event_command_output() */
+            if (consume_command_output(state, state->command_out_fd, state->command_in_fd,
+                        state->command_output) == COMMAND_OUTPUT_PENDING)
+                continue;
+
+            libreport_strbuf_clear(state->command_output);
+            const int retval = command_exit_status(state, state->command_pid, dump_dir_names[i]);
+
+            batch_close_command(state, epoll_fd);
+
+            if (retval == 0 && batch_spawn_next_command(state, dump_dir_names[i], event, epoll_fd, i))
+                continue;
+
+            /* The directory is done */
+            log_info("Event '%s' on '%s' finished with %d", event, dump_dir_names[i], retval);
+            free_commands(state);
+            --running;
+
+            if (retval != 0)
+                ++failed;
+            if (retvals != NULL)
+                retvals[i] = retval;
+        }
+    }
+
+    close(epoll_fd);
+
+    return failed;
+}
+
 int run_event_on_problem_data(struct run_event_state *state, problem_data_t *data, const char *event)
 {
     state->children_count = 0;
@@ -760,57 +1880,18 @@ int run_event_on_problem_data(struct run_event_state *state, problem_data_t *dat
 }
 
 
-static char *_list_possible_events(struct dump_dir **dd, problem_data_t *pd, const char *dump_dir_name, const char *pfx)
+static char *_list_possible_events(struct dump_dir *dd, problem_data_t *pd, const char *dump_dir_name, const char *pfx)
 {
-    struct strbuf *result = libreport_strbuf_new();
-
-    GList *rule_list = load_rule_list(NULL, CONF_DIR"/report_event.conf", /*recursion_depth:*/ 0);
-
-    unsigned pfx_len = strlen(pfx);
-    for (;;)
-    {
-        /* Retrieve each cmd, and fetch its EVENT=foo value */
-        char *event_name = NULL;
-        char *cmd = pop_next_command(&rule_list,
-                &event_name,       /* return event_name */
-                dd,                /* match this dd... */
-                pd,                /* no problem data */
-                dump_dir_name,     /* ...or if NULL, this dirname */
-                pfx, pfx_len       /* for events with this prefix */
-        );
-        if (!cmd)
-        {
-            free_rule_list(rule_list);
-            free(event_name);
-            break;
-        }
-        free(cmd);
+    struct rule_set *set = get_report_event_rules();
+    char *events = rule_set_list_possible_events(set, dd, pd, dump_dir_name, pfx);
+    rule_set_free(set);
 
-        if (event_name)
-        {
-            /* Append "EVENT\n" - only if it is not there yet */
-            unsigned e_len = strlen(event_name);
-            char *p = result->buf;
-            while (p && *p)
-            {
-                if (strncmp(p, event_name, e_len) == 0 && p[e_len] == '\n')
-                    goto skip; /* This event is already in the result */
-                p = strchr(p, '\n');
-                if (p)
-                    p++;
-            }
-            libreport_strbuf_append_strf(result, "%s\n", event_name);
- skip:
-            free(event_name);
-        }
-    }
-
-    return libreport_strbuf_free_nobuf(result);
+    return events;
 }
 
 char *list_possible_events(struct dump_dir *dd, const char *dump_dir_name, const char *pfx)
 {
-    return _list_possible_events((dd ? &dd : NULL), NULL, dump_dir_name, pfx);
+    return _list_possible_events(dd, NULL, dump_dir_name, pfx);
 }
 
 char *list_possible_events_problem_data(problem_data_t *pd, const char *dump_dir_name, const char *pfx)
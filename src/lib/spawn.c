@@ -19,6 +19,7 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 #include "internal_libreport.h"
+#include <spawn.h>
 
 static char *concat_str_vector(char **strings)
 {
@@ -43,98 +44,283 @@ static char *concat_str_vector(char **strings)
 	return result;
 }
 
-/* Returns pid */
-pid_t libreport_fork_execv_on_steroids(int flags,
+/* Returns malloc'ed copy of environ with env_vec applied the same way
+ * putenv() would apply it. The strings are not copied. */
+static char **build_child_environ(char **env_vec)
+{
+	unsigned count = 0;
+	while (environ[count])
+		count++;
+	unsigned extra = 0;
+	while (env_vec[extra])
+		extra++;
+
+	char **envp = libreport_xmalloc((count + extra + 1) * sizeof(envp[0]));
+	memcpy(envp, environ, count * sizeof(envp[0]));
+
+	for (; *env_vec; env_vec++) {
+		char *var = *env_vec;
+		char *eq = strchr(var, '=');
+		size_t name_len = eq ? eq - var : strlen(var);
+
+		unsigned i = 0;
+		while (i < count) {
+			if (strncmp(envp[i], var, name_len) != 0 || envp[i][name_len] != '=') {
+				i++;
+				continue;
+			}
+			if (eq) {
+				envp[i] = var;
+				break;
+			}
+			/* "var" without '=' unsets $var */
+			envp[i] = envp[--count];
+		}
+		if (eq && i == count)
+			envp[count++] = var;
+	}
+	envp[count] = NULL;
+
+	return envp;
+}
+
+/* Tells whether posix_spawn can do everything the flags ask for */
+static bool can_posix_spawn(int flags, char **argv, char **env_vec, const char *dir)
+{
+	/* Credentials cannot be changed by posix_spawn */
+	if (flags & EXECFLG_SETGUID)
+		return false;
+#ifndef POSIX_SPAWN_SETSID
+	if (flags & EXECFLG_SETSID)
+		return false;
+#endif
+#ifndef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+	if (dir)
+		return false;
+#endif
+	/* posix_spawnp searches parent's $PATH, but execvp in the forked child
+	 * searches the one from env_vec */
+	if (env_vec && !strchr(argv[0], '/')) {
+		for (char **e = env_vec; *e; e++)
+			if (strncmp(*e, "PATH", 4) == 0 && ((*e)[4] == '=' || (*e)[4] == '\0'))
+				return false;
+	}
+	return true;
+}
+
+/* Starts the child without copying parent's page tables,
+ * which makes spawning from processes with large heaps cheap.
+ * Returns pid, or -1 and sets errno if the child could not be started.
+ */
+static pid_t posix_spawn_child(int flags,
 		char **argv,
-		int *pipefds,
+		int *pipe_to_child,
+		int *pipe_fm_child,
 		char **env_vec,
-		const char *dir,
-		uid_t uid)
+		const char *dir)
 {
-	pid_t child;
-	/* Reminder: [0] is read end, [1] is write end */
-	int pipe_to_child[2];
-	int pipe_fm_child[2];
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	int err = posix_spawn_file_actions_init(&actions);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	err = posix_spawnattr_init(&attr);
+	if (err) {
+		posix_spawn_file_actions_destroy(&actions);
+		errno = err;
+		return -1;
+	}
 
-	/* Sanitize flags */
-	if (!pipefds)
-		flags &= ~(EXECFLG_INPUT | EXECFLG_OUTPUT);
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+	if (dir)
+		err = posix_spawn_file_actions_addchdir_np(&actions, dir);
+#endif
 
-	if (flags & EXECFLG_INPUT)
-		libreport_xpipe(pipe_to_child);
-	if (flags & EXECFLG_OUTPUT)
-		libreport_xpipe(pipe_fm_child);
+	/* The same sequence of operations as in the forked child */
+	if (flags & EXECFLG_INPUT) {
+		if (!err)
+			err = posix_spawn_file_actions_addclose(&actions, pipe_to_child[1]);
+		if (!err && pipe_to_child[0] != STDIN_FILENO) {
+			err = posix_spawn_file_actions_adddup2(&actions, pipe_to_child[0], STDIN_FILENO);
+			if (!err)
+				err = posix_spawn_file_actions_addclose(&actions, pipe_to_child[0]);
+		}
+	} else if ((flags & EXECFLG_INPUT_NUL) && !err) {
+		err = posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDWR, 0);
+	}
+	if (flags & EXECFLG_OUTPUT) {
+		if (!err)
+			err = posix_spawn_file_actions_addclose(&actions, pipe_fm_child[0]);
+		if (!err && pipe_fm_child[1] != STDOUT_FILENO) {
+			err = posix_spawn_file_actions_adddup2(&actions, pipe_fm_child[1], STDOUT_FILENO);
+			if (!err)
+				err = posix_spawn_file_actions_addclose(&actions, pipe_fm_child[1]);
+		}
+	} else if ((flags & EXECFLG_OUTPUT_NUL) && !err) {
+		err = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_RDWR, 0);
+	}
+	if ((flags & EXECFLG_ERR2OUT) && !err)
+		err = posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+	else if ((flags & EXECFLG_ERR_NUL) && !err)
+		err = posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_RDWR, 0);
+
+	short spawn_flags = 0;
+#ifdef POSIX_SPAWN_SETSID
+	/* setsid makes the child a process group leader too,
+	 * and setpgid would fail afterwards */
+	if (flags & EXECFLG_SETSID)
+		spawn_flags |= POSIX_SPAWN_SETSID;
+	else
+#endif
+	if (flags & EXECFLG_SETPGID)
+		spawn_flags |= POSIX_SPAWN_SETPGROUP;
+	if (!err)
+		err = posix_spawnattr_setflags(&attr, spawn_flags);
+	if (!err && (spawn_flags & POSIX_SPAWN_SETPGROUP))
+		err = posix_spawnattr_setpgroup(&attr, 0);
 
+	char **envp = env_vec ? build_child_environ(env_vec) : environ;
+
+	pid_t child = -1;
+	if (!err)
+		err = posix_spawnp(&child, argv[0], &actions, &attr, argv, envp);
+
+	if (envp != environ)
+		free(envp);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return child;
+}
+
+static pid_t fork_child(int flags,
+		char **argv,
+		int *pipe_to_child,
+		int *pipe_fm_child,
+		char **env_vec,
+		const char *dir,
+		uid_t uid,
+		const char *prog_as_string)
+{
 	/* Prepare it before fork, to avoid thread-unsafe malloc there */
-	char *prog_as_string = NULL;
-	prog_as_string = concat_str_vector(argv);
 	gid_t gid;
 	if (flags & EXECFLG_SETGUID) {
 		struct passwd* pw = getpwuid(uid);
 		gid = pw ? pw->pw_gid : uid;
 	}
 
-	fflush(NULL);
-	child = fork();
+	pid_t child = fork();
 	if (child == -1) {
 		perror_msg_and_die("fork");
 	}
-	if (child == 0) {
-		/* Child */
+	if (child != 0)
+		return child;
 
-		if (dir)
-			libreport_xchdir(dir);
+	/* Child */
 
-		if (flags & EXECFLG_SETGUID) {
-			setgroups(1, &gid);
-			libreport_xsetregid(gid, gid);
-			libreport_xsetreuid(uid, uid);
-		}
+	if (dir)
+		libreport_xchdir(dir);
 
-		if (env_vec) {
-			/* Note: we use the glibc extension that putenv("var")
-			 * *unsets* $var if "var" string has no '=' */
-			while (*env_vec)
-				putenv(*env_vec++);
-		}
+	if (flags & EXECFLG_SETGUID) {
+		setgroups(1, &gid);
+		libreport_xsetregid(gid, gid);
+		libreport_xsetreuid(uid, uid);
+	}
 
-		/* Play with stdio descriptors */
-		if (flags & EXECFLG_INPUT) {
-			/* NB: close must be first, because
-			 * pipe_to_child[1] may be equal to STDIN_FILENO
-			 */
-			close(pipe_to_child[1]);
-			libreport_xmove_fd(pipe_to_child[0], STDIN_FILENO);
-		} else if (flags & EXECFLG_INPUT_NUL) {
-			libreport_xmove_fd(libreport_xopen("/dev/null", O_RDWR), STDIN_FILENO);
-		}
-		if (flags & EXECFLG_OUTPUT) {
-			close(pipe_fm_child[0]);
-			libreport_xmove_fd(pipe_fm_child[1], STDOUT_FILENO);
-		} else if (flags & EXECFLG_OUTPUT_NUL) {
-			libreport_xmove_fd(libreport_xopen("/dev/null", O_RDWR), STDOUT_FILENO);
-		}
+	if (env_vec) {
+		/* Note: we use the glibc extension that putenv("var")
+		 * *unsets* $var if "var" string has no '=' */
+		while (*env_vec)
+			putenv(*env_vec++);
+	}
 
-		/* This should be done BEFORE stderr redirect */
-		log_info("Executing: %s", prog_as_string);
+	/* Play with stdio descriptors */
+	if (flags & EXECFLG_INPUT) {
+		/* NB: close must be first, because
+		 * pipe_to_child[1] may be equal to STDIN_FILENO
+		 */
+		close(pipe_to_child[1]);
+		libreport_xmove_fd(pipe_to_child[0], STDIN_FILENO);
+	} else if (flags & EXECFLG_INPUT_NUL) {
+		libreport_xmove_fd(libreport_xopen("/dev/null", O_RDWR), STDIN_FILENO);
+	}
+	if (flags & EXECFLG_OUTPUT) {
+		close(pipe_fm_child[0]);
+		libreport_xmove_fd(pipe_fm_child[1], STDOUT_FILENO);
+	} else if (flags & EXECFLG_OUTPUT_NUL) {
+		libreport_xmove_fd(libreport_xopen("/dev/null", O_RDWR), STDOUT_FILENO);
+	}
 
-		if (flags & EXECFLG_ERR2OUT) {
-			/* Want parent to see errors in the same stream */
-			libreport_xdup2(STDOUT_FILENO, STDERR_FILENO);
-		} else if (flags & EXECFLG_ERR_NUL) {
-			libreport_xmove_fd(libreport_xopen("/dev/null", O_RDWR), STDERR_FILENO);
-		}
+	/* This should be done BEFORE stderr redirect */
+	log_info("Executing: %s", prog_as_string);
+
+	if (flags & EXECFLG_ERR2OUT) {
+		/* Want parent to see errors in the same stream */
+		libreport_xdup2(STDOUT_FILENO, STDERR_FILENO);
+	} else if (flags & EXECFLG_ERR_NUL) {
+		libreport_xmove_fd(libreport_xopen("/dev/null", O_RDWR), STDERR_FILENO);
+	}
+
+	if (flags & EXECFLG_SETSID)
+		setsid();
+	if (flags & EXECFLG_SETPGID)
+		setpgid(0, 0);
 
-		if (flags & EXECFLG_SETSID)
-			setsid();
-		if (flags & EXECFLG_SETPGID)
-			setpgid(0, 0);
+	execvp(argv[0], argv);
+	if (!(flags & EXECFLG_QUIET))
+		perror_msg("Can't execute '%s'", argv[0]);
+	_exit(127); /* shell uses this exit code in this case */
+}
 
-		execvp(argv[0], argv);
-		if (!(flags & EXECFLG_QUIET))
-			perror_msg("Can't execute '%s'", argv[0]);
-		_exit(127); /* shell uses this exit code in this case */
+/* Returns pid */
+pid_t libreport_fork_execv_on_steroids(int flags,
+		char **argv,
+		int *pipefds,
+		char **env_vec,
+		const char *dir,
+		uid_t uid)
+{
+	pid_t child = -1;
+	/* Reminder: [0] is read end, [1] is write end */
+	int pipe_to_child[2];
+	int pipe_fm_child[2];
+
+	/* Sanitize flags */
+	if (!pipefds)
+		flags &= ~(EXECFLG_INPUT | EXECFLG_OUTPUT);
+
+	/* Children spawned later, e.g. concurrently running commands, must not
+	 * inherit our ends, otherwise our child never sees EOF on its stdin */
+	if (flags & EXECFLG_INPUT) {
+		libreport_xpipe(pipe_to_child);
+		libreport_close_on_exec_on(pipe_to_child[1]);
+	}
+	if (flags & EXECFLG_OUTPUT) {
+		libreport_xpipe(pipe_fm_child);
+		libreport_close_on_exec_on(pipe_fm_child[0]);
+	}
+
+	char *prog_as_string = NULL;
+	prog_as_string = concat_str_vector(argv);
+
+	fflush(NULL);
+	if (can_posix_spawn(flags, argv, env_vec, dir)) {
+		/* The forked child logs it before redirecting stderr, i.e. to ours */
+		log_info("Executing: %s", prog_as_string);
+		child = posix_spawn_child(flags, argv, pipe_to_child, pipe_fm_child, env_vec, dir);
+		/* Failed exec or file action. Let the forked child fail the way
+		 * callers expect: with error message and exit code 127 */
+		if (child == -1)
+			log_debug("posix_spawn of '%s' failed: %s", argv[0], strerror(errno));
 	}
+	if (child == -1)
+		child = fork_child(flags, argv, pipe_to_child, pipe_fm_child, env_vec, dir, uid, prog_as_string);
 
 	/* Parent */
 	free(prog_as_string);
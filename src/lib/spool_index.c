@@ -0,0 +1,787 @@
+/*
+    Copyright (C) 2024  ABRT team
+    Copyright (C) 2024  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <sys/file.h>
+#include "internal_libreport.h"
+
+// See spool_index.h for the file layout.
+//
+// Consistency is guarded by flock() on the spool directory itself: updates
+// and rebuilds hold an exclusive lock. The lock is never held while waiting
+// for a dump directory lock, hence it cannot deadlock with dd_lock().
+//
+// Updates modify the records in place. The hash table is kept at most 3/4
+// full, a fuller one is written anew twice larger.
+//
+// Whether the records match the entries of the spool directory is checked by
+// reading the names of the entries, which is cheap compared to opening the
+// problem directories. Writers do it after they add or remove a record and
+// remember the mtime of the spool directory if the index matches it. Readers
+// do it only if the mtime is not the remembered one.
+
+/* The minimal number of records */
+#define SPOOL_INDEX_RECORDS_MIN 64
+
+uint32_t spool_index_name_hash(const char *name)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *c = (const unsigned char *)name; *c != '\0'; ++c)
+    {
+        hash ^= *c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void spool_index_header_init(struct spool_index_header *header)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, SPOOL_INDEX_MAGIC, sizeof(SPOOL_INDEX_MAGIC));
+    header->version = SPOOL_INDEX_VERSION;
+    header->record_size = sizeof(struct spool_index_record);
+}
+
+static bool spool_index_is_valid(const void *data, size_t size)
+{
+    const struct spool_index_header *header = data;
+
+    if (size < sizeof(*header)
+        || memcmp(header->magic, SPOOL_INDEX_MAGIC, sizeof(SPOOL_INDEX_MAGIC)) != 0
+        || header->version != SPOOL_INDEX_VERSION
+        || header->record_size != sizeof(struct spool_index_record))
+    {
+        return false;
+    }
+
+    return header->used < header->records
+        && header->records == (size - sizeof(*header)) / sizeof(struct spool_index_record)
+        && (size - sizeof(*header)) % sizeof(struct spool_index_record) == 0;
+}
+
+static struct spool_index_record *spool_index_records(void *data)
+{
+    return (struct spool_index_record *)((char *)data + sizeof(struct spool_index_header));
+}
+
+static bool spool_index_spool_mtime_matches(const struct spool_index_header *header, const struct stat *st)
+{
+    return header->spool_mtime_sec != 0
+        && header->spool_mtime_sec == st->st_mtim.tv_sec
+        && header->spool_mtime_nsec == st->st_mtim.tv_nsec;
+}
+
+/* Remembers the mtime of the spool directory whose entries match the records
+ *
+ * Changes within the timestamp granularity of the file system keep the mtime,
+ * so a recent mtime is not remembered and the readers compare the entries.
+ */
+static void spool_index_set_spool_mtime(struct spool_index_header *header, const struct stat *st)
+{
+    const bool racy = st == NULL || st->st_mtim.tv_sec + 1 >= time(NULL);
+    header->spool_mtime_sec = racy ? 0 : st->st_mtim.tv_sec;
+    header->spool_mtime_nsec = racy ? 0 : st->st_mtim.tv_nsec;
+}
+
+/* Returns the number of records for used records */
+static uint64_t spool_index_capacity(uint64_t used)
+{
+    return MAX(SPOOL_INDEX_RECORDS_MIN, used * 2);
+}
+
+static bool spool_index_is_full(const struct spool_index_header *header)
+{
+    return (header->used + 1) * 4 > header->records * 3;
+}
+
+/* Returns the record called name, or the unused record where it belongs
+ *
+ * @return NULL if there is no unused record, i.e. the index is corrupted
+ */
+static struct spool_index_record *spool_index_lookup(struct spool_index_record *records,
+        uint64_t count, const char *name, uint32_t hash)
+{
+    uint64_t i = hash % count;
+    for (uint64_t probed = 0; probed < count; ++probed, i = (i + 1) % count)
+    {
+        struct spool_index_record *cur = records + i;
+        if (!(cur->flags & SPOOL_INDEX_RECORD_USED))
+            return cur;
+
+        if (cur->name_hash == hash && strcmp(cur->dirname, name) == 0)
+            return cur;
+    }
+
+    return NULL;
+}
+
+/* Adds the record, which must not be in the records yet */
+static void spool_index_insert(struct spool_index_record *records, uint64_t count,
+        const struct spool_index_record *record)
+{
+    struct spool_index_record *slot = spool_index_lookup(records, count, record->dirname, record->name_hash);
+    memcpy(slot, record, sizeof(*slot));
+}
+
+/* Removes the record at position hole
+ *
+ * The following records are moved back into the hole so that the lookups
+ * don't stop at it.
+ */
+static void spool_index_erase(struct spool_index_record *records, uint64_t count, uint64_t hole)
+{
+    memset(records + hole, 0, sizeof(*records));
+
+    for (uint64_t i = (hole + 1) % count; records[i].flags & SPOOL_INDEX_RECORD_USED; i = (i + 1) % count)
+    {
+        /* The record stays if its first possible position lies in (hole, i] */
+        const uint64_t home = records[i].name_hash % count;
+        const bool stays = hole <= i ? (hole < home && home <= i) : (hole < home || home <= i);
+        if (stays)
+            continue;
+
+        memcpy(records + hole, records + i, sizeof(*records));
+        memset(records + i, 0, sizeof(*records));
+        hole = i;
+    }
+}
+
+/* @return true for the entries of the spool directory which have a record */
+static bool spool_entry_is_indexed(int dir_fd, const struct dirent *dent)
+{
+    /* The index itself and its temporary copies */
+    if (libreport_dot_or_dotdot(dent->d_name)
+        || strncmp(dent->d_name, SPOOL_INDEX_FILE_NAME, strlen(SPOOL_INDEX_FILE_NAME)) == 0)
+    {
+        return false;
+    }
+
+    unsigned char type = dent->d_type;
+    if (type == DT_UNKNOWN)
+    {
+        struct stat st;
+        if (fstatat(dir_fd, dent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            return false;
+        type = IFTODT(st.st_mode);
+    }
+
+    return type == DT_DIR || type == DT_REG;
+}
+
+/* Checks that every entry of the spool directory has a record and that there
+ * are no other records
+ */
+static bool spool_index_matches_dir(int dir_fd, const struct spool_index_header *header,
+        struct spool_index_record *records)
+{
+    if (header->flags & SPOOL_INDEX_INCOMPLETE)
+        return false;
+
+    /* Don't share the offset with dir_fd */
+    int fd = openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    DIR *dir = fdopendir(fd);
+    if (dir == NULL)
+    {
+        close(fd);
+        return false;
+    }
+
+    uint64_t entries = 0;
+    bool matches = true;
+    struct dirent *dent;
+    while (matches && (dent = readdir(dir)) != NULL)
+    {
+        if (!spool_entry_is_indexed(dir_fd, dent))
+            continue;
+
+        const struct spool_index_record *record = spool_index_lookup(records, header->records,
+                dent->d_name, spool_index_name_hash(dent->d_name));
+        matches = record != NULL && (record->flags & SPOOL_INDEX_RECORD_USED);
+        ++entries;
+    }
+    closedir(dir);
+
+    return matches && entries == header->used;
+}
+
+/* Opens the spool directory and locks it with flock()
+ *
+ * @return The directory file descriptor; otherwise -errno
+ */
+static int spool_dir_lock(const char *spool_dir, int operation)
+{
+    int dir_fd = open(spool_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0)
+        return -errno;
+
+    while (flock(dir_fd, operation) != 0)
+    {
+        if (errno == EINTR)
+            continue;
+
+        /* Some network file systems don't support flock() on directories,
+         * work without the lock rather than give up on the index. */
+        log_debug("Can't lock spool directory '%s': %s", spool_dir, strerror(errno));
+        break;
+    }
+
+    return dir_fd;
+}
+
+/* Reads a text element into dest
+ *
+ * The destination is left empty if the element does not exist or does not fit.
+ */
+static void load_element_to(struct dump_dir *dd, const char *name, char *dest, size_t size)
+{
+    char *value = dd_load_text_ext(dd, name,
+            DD_FAIL_QUIETLY_ENOENT | DD_FAIL_QUIETLY_EACCES | DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE);
+    if (value == NULL)
+        return;
+
+    const size_t len = strlen(value);
+    if (len < size)
+        memcpy(dest, value, len + 1);
+    else
+        log_info("Element '%s' is too long to be indexed", name);
+
+    free(value);
+}
+
+static int64_t load_number(struct dump_dir *dd, const char *name, int64_t def)
+{
+    char value[32] = { 0 };
+    load_element_to(dd, name, value, sizeof(value));
+
+    char *end;
+    errno = 0;
+    const long long number = strtoll(value, &end, 10);
+    if (value[0] == '\0' || *end != '\0' || errno != 0)
+        return def;
+
+    return number;
+}
+
+/* Starts the record of the entry called name
+ *
+ * The record describes an entry which is not a problem directory until the
+ * problem data are filled in.
+ *
+ * @return 0 on success; -ENAMETOOLONG if name does not fit into the record
+ */
+static int spool_index_record_init(struct spool_index_record *record, const char *name)
+{
+    memset(record, 0, sizeof(*record));
+
+    const size_t name_len = strlen(name);
+    if (name_len >= sizeof(record->dirname))
+        return -ENAMETOOLONG;
+
+    memcpy(record->dirname, name, name_len + 1);
+    record->name_hash = spool_index_name_hash(name);
+    record->flags = SPOOL_INDEX_RECORD_USED | SPOOL_INDEX_RECORD_NOT_PROBLEM;
+
+    return 0;
+}
+
+/* Fills the record of an entry which is not a problem directory
+ *
+ * @return 0 on success; -ENAMETOOLONG if name does not fit into the record
+ */
+static int spool_index_record_fill_other(struct spool_index_record *record,
+        const char *path, const struct stat *st, const char *name)
+{
+    const int r = spool_index_record_init(record, name);
+    if (r < 0)
+        return r;
+
+    record->size = S_ISDIR(st->st_mode) ? libreport_get_dirsize(path) : st->st_size;
+    return 0;
+}
+
+/* Fills the record with data of the dump directory
+ *
+ * A directory without the basic elements (e.g. one which is being created)
+ * gets the record of an entry which is not a problem directory.
+ *
+ * @return 0 on success; -ENAMETOOLONG if name does not fit into the record
+ */
+static int spool_index_record_fill(struct spool_index_record *record, struct dump_dir *dd, const char *name)
+{
+    const int r = spool_index_record_init(record, name);
+    if (r < 0)
+        return r;
+
+    /* The same size libreport_get_dirsize_find_largest_dir() works with */
+    record->size = libreport_get_dirsize(dd->dd_dirname);
+
+    record->time = load_number(dd, FILENAME_TIME, -1);
+    load_element_to(dd, FILENAME_TYPE, record->type, sizeof(record->type));
+    if (record->time < 0 || record->type[0] == '\0')
+    {
+        record->time = 0;
+        record->type[0] = '\0';
+        return 0;
+    }
+
+    record->flags &= ~SPOOL_INDEX_RECORD_NOT_PROBLEM;
+    record->last_occurrence = load_number(dd, FILENAME_LAST_OCCURRENCE, record->time);
+    record->count = (uint32_t)load_number(dd, FILENAME_COUNT, 1);
+    load_element_to(dd, FILENAME_UUID, record->uuid, sizeof(record->uuid));
+    load_element_to(dd, FILENAME_DUPHASH, record->duphash, sizeof(record->duphash));
+
+    record->owner = (uint32_t)dd_get_owner(dd);
+
+    return 0;
+}
+
+/* Atomically replaces the index of the spool directory
+ *
+ * @return 0 on success; otherwise -errno
+ */
+static int spool_index_write(int dir_fd, const char *spool_dir,
+        const struct spool_index_header *header, const struct spool_index_record *records)
+{
+    char *tmp_name = libreport_concat_path_file(spool_dir, SPOOL_INDEX_FILE_NAME".XXXXXX");
+    int tmp_fd = mkostemp(tmp_name, O_CLOEXEC);
+    if (tmp_fd < 0)
+    {
+        const int r = -errno;
+        free(tmp_name);
+        return r;
+    }
+
+    const size_t records_size = header->records * sizeof(*records);
+    int r = 0;
+    if (libreport_full_write(tmp_fd, header, sizeof(*header)) != sizeof(*header)
+        || libreport_full_write(tmp_fd, records, records_size) != (ssize_t)records_size
+        || fsync(tmp_fd) != 0)
+    {
+        r = errno ? -errno : -EIO;
+    }
+    else if (renameat(dir_fd, strrchr(tmp_name, '/') + 1, dir_fd, SPOOL_INDEX_FILE_NAME) != 0)
+    {
+        r = -errno;
+    }
+
+    close(tmp_fd);
+    if (r < 0)
+        unlink(tmp_name);
+    free(tmp_name);
+    return r;
+}
+
+int spool_index_rebuild(const char *spool_dir)
+{
+    int dir_fd = spool_dir_lock(spool_dir, LOCK_EX);
+    if (dir_fd < 0)
+    {
+        const int r = dir_fd;
+        error_msg("Can't open spool directory '%s': %s", spool_dir, strerror(-r));
+        return r;
+    }
+
+    struct spool_index_header header;
+    spool_index_header_init(&header);
+
+    size_t allocated = SPOOL_INDEX_RECORDS_MIN;
+    struct spool_index_record *found = libreport_xmalloc(allocated * sizeof(*found));
+    struct spool_index_record *records = NULL;
+    int problems = 0;
+    int r = 0;
+
+    /* Don't flood the log with "is not a problem directory" messages */
+    int sv_logmode = libreport_logmode;
+    libreport_logmode = 0;
+
+    DIR *dir = fdopendir(libreport_xdup(dir_fd));
+    if (dir == NULL)
+    {
+        r = -errno;
+        goto finito;
+    }
+
+    struct dirent *dent;
+    while ((dent = readdir(dir)) != NULL)
+    {
+        if (!spool_entry_is_indexed(dir_fd, dent))
+            continue;
+
+        struct stat st;
+        if (fstatat(dir_fd, dent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            continue;
+
+        if (header.used == allocated)
+        {
+            allocated *= 2;
+            found = libreport_xrealloc(found, allocated * sizeof(*found));
+        }
+
+        struct spool_index_record *record = found + header.used;
+        char *path = libreport_concat_path_file(spool_dir, dent->d_name);
+
+        /* Don't lock the problem directories, its holders might be waiting
+         * for our lock. They will update the index once we are done. */
+        struct dump_dir *dd = NULL;
+        if (S_ISDIR(st.st_mode))
+            dd = dd_opendir(path, DD_OPEN_FD_ONLY | DD_OPEN_READONLY
+                    | DD_FAIL_QUIETLY_ENOENT | DD_FAIL_QUIETLY_EACCES);
+
+        int fill;
+        if (dd != NULL)
+        {
+            fill = spool_index_record_fill(record, dd, dent->d_name);
+            dd_close(dd);
+        }
+        else
+            fill = spool_index_record_fill_other(record, path, &st, dent->d_name);
+
+        free(path);
+
+        if (fill == -ENAMETOOLONG)
+            header.flags |= SPOOL_INDEX_INCOMPLETE;
+        else if (fill == 0)
+        {
+            ++header.used;
+            if (!(record->flags & SPOOL_INDEX_RECORD_NOT_PROBLEM))
+                ++problems;
+        }
+    }
+    closedir(dir);
+
+    header.records = spool_index_capacity(header.used);
+    records = libreport_xzalloc(header.records * sizeof(*records));
+    for (uint64_t i = 0; i < header.used; ++i)
+        spool_index_insert(records, header.records, found + i);
+
+    /* Writing the index changes the spool directory, the first update or
+     * reader compares the entries with the records. */
+    r = spool_index_write(dir_fd, spool_dir, &header, records);
+    if (r == 0)
+        r = problems;
+
+finito:
+    libreport_logmode = sv_logmode;
+
+    if (r < 0)
+        error_msg("Can't rebuild index of '%s': %s", spool_dir, strerror(-r));
+
+    free(found);
+    free(records);
+    close(dir_fd);
+    return r;
+}
+
+/* Splits dump_dir_name to the spool directory and the base name */
+static char *split_dump_dir_name(const char *dump_dir_name, const char **name)
+{
+    const char *slash = strrchr(dump_dir_name, '/');
+    if (slash == NULL)
+    {
+        *name = dump_dir_name;
+        return libreport_xstrdup(".");
+    }
+
+    *name = slash + 1;
+    if (slash == dump_dir_name)
+        return libreport_xstrdup("/");
+
+    return libreport_xstrndup(dump_dir_name, slash - dump_dir_name);
+}
+
+/* Remembers the mtime of the spool directory if its entries match the records
+ * or forgets it if they don't
+ */
+static void spool_index_check_entries(int dir_fd, struct spool_index_header *header,
+        struct spool_index_record *records)
+{
+    /* The entries must be read after fstat(), the later changes must change
+     * the mtime again */
+    struct stat st;
+    if (fstat(dir_fd, &st) == 0 && spool_index_matches_dir(dir_fd, header, records))
+        spool_index_set_spool_mtime(header, &st);
+    else
+        spool_index_set_spool_mtime(header, NULL);
+}
+
+/* Finds or updates the record called name. If record is NULL, the record is
+ * removed. The header_flags are added to flags of the index.
+ *
+ * @return 0 on success or if there is no index; otherwise -errno
+ */
+static int spool_index_modify(const char *dump_dir_name, const struct spool_index_record *record,
+        uint32_t header_flags)
+{
+    const char *name;
+    char *spool_dir = split_dump_dir_name(dump_dir_name, &name);
+
+    int r = 0;
+    void *data = MAP_FAILED;
+    size_t size = 0;
+    int fd = -1;
+
+    int dir_fd = spool_dir_lock(spool_dir, LOCK_EX);
+    if (dir_fd < 0)
+    {
+        r = dir_fd;
+        goto finito;
+    }
+
+    fd = openat(dir_fd, SPOOL_INDEX_FILE_NAME, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+    {
+        /* No index, nothing to do */
+        if (errno != ENOENT)
+            r = -errno;
+        goto finito;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        r = -errno;
+        goto finito;
+    }
+
+    size = st.st_size;
+    if (size < sizeof(struct spool_index_header))
+    {
+        r = -EINVAL;
+        goto finito;
+    }
+
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        r = -errno;
+        goto finito;
+    }
+
+    if (!spool_index_is_valid(data, size))
+    {
+        r = -EINVAL;
+        goto finito;
+    }
+
+    struct spool_index_header *header = data;
+    struct spool_index_record *records = spool_index_records(data);
+
+    header->flags |= header_flags;
+
+    struct spool_index_record *found = spool_index_lookup(records, header->records,
+            name, spool_index_name_hash(name));
+    if (found == NULL)
+    {
+        r = -EINVAL;
+        goto finito;
+    }
+
+    const bool exists = (found->flags & SPOOL_INDEX_RECORD_USED);
+    if (record == NULL)
+    {
+        if (exists)
+        {
+            spool_index_erase(records, header->records, found - records);
+            --header->used;
+        }
+        goto check_entries;
+    }
+
+    if (exists || !spool_index_is_full(header))
+    {
+        if (!exists)
+            ++header->used;
+        memcpy(found, record, sizeof(*found));
+        goto check_entries;
+    }
+
+    /* Rehash all records into a larger index */
+    struct spool_index_header new_header = *header;
+    new_header.records = spool_index_capacity(header->used + 1);
+    struct spool_index_record *new_records = libreport_xzalloc(new_header.records * sizeof(*new_records));
+    for (uint64_t i = 0; i < header->records; ++i)
+        if (records[i].flags & SPOOL_INDEX_RECORD_USED)
+            spool_index_insert(new_records, new_header.records, records + i);
+
+    spool_index_insert(new_records, new_header.records, record);
+    ++new_header.used;
+
+    /* Writing the index changes the spool directory */
+    spool_index_set_spool_mtime(&new_header, NULL);
+    r = spool_index_write(dir_fd, spool_dir, &new_header, new_records);
+    free(new_records);
+    goto finito;
+
+ check_entries:
+    {
+        /* Records added or removed change the spool directory too, compare
+         * the entries again */
+        struct stat dir_st;
+        if (exists != (record != NULL)
+            || fstat(dir_fd, &dir_st) != 0
+            || !spool_index_spool_mtime_matches(header, &dir_st))
+        {
+            spool_index_check_entries(dir_fd, header, records);
+        }
+    }
+
+finito:
+    if (data != MAP_FAILED)
+        munmap(data, size);
+
+    if (fd >= 0)
+        close(fd);
+
+    if (dir_fd >= 0)
+        close(dir_fd);
+
+    if (r < 0)
+        log_info("Can't update index of '%s': %s", spool_dir, strerror(-r));
+
+    free(spool_dir);
+    return r;
+}
+
+int spool_index_update_dump_dir(struct dump_dir *dd)
+{
+    const char *name;
+    char *spool_dir = split_dump_dir_name(dd->dd_dirname, &name);
+
+    /* Don't load the elements if there is no index to update */
+    char *index_file = libreport_concat_path_file(spool_dir, SPOOL_INDEX_FILE_NAME);
+    const bool indexed = access(index_file, F_OK) == 0;
+    free(index_file);
+    free(spool_dir);
+
+    if (!indexed)
+        return 0;
+
+    struct spool_index_record record;
+    const int r = spool_index_record_fill(&record, dd, name);
+    if (r == -ENAMETOOLONG)
+        /* Readers must not trust the index any more */
+        return spool_index_modify(dd->dd_dirname, NULL, SPOOL_INDEX_INCOMPLETE);
+
+    return spool_index_modify(dd->dd_dirname, &record, /*header flags*/0);
+}
+
+int spool_index_remove_dump_dir(const char *dump_dir_name)
+{
+    return spool_index_modify(dump_dir_name, NULL, /*header flags*/0);
+}
+
+struct spool_index
+{
+    void *data;
+    size_t size;
+};
+
+struct spool_index *spool_index_open(const char *spool_dir)
+{
+    int dir_fd = spool_dir_lock(spool_dir, LOCK_SH);
+    if (dir_fd < 0)
+        return NULL;
+
+    struct spool_index *index = NULL;
+    void *data = NULL;
+
+    /* The entries must be read after fstat(), see spool_index_check_entries() */
+    struct stat st;
+    if (fstat(dir_fd, &st) != 0)
+        goto finito;
+
+    int fd = openat(dir_fd, SPOOL_INDEX_FILE_NAME, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (errno != ENOENT)
+            log_info("Can't open index of '%s': %s", spool_dir, strerror(errno));
+        goto finito;
+    }
+
+    /* Read the index in one go so that the lock is held as short as possible */
+    size_t size = SIZE_MAX - 1;
+    data = libreport_xmalloc_read(fd, &size);
+    close(fd);
+    flock(dir_fd, LOCK_UN);
+
+    if (data == NULL)
+    {
+        perror_msg("Can't read index of '%s'", spool_dir);
+        goto finito;
+    }
+
+    if (!spool_index_is_valid(data, size)
+        || (((struct spool_index_header *)data)->flags & SPOOL_INDEX_INCOMPLETE))
+    {
+        log_notice("Index of '%s' is corrupted or incomplete", spool_dir);
+        goto finito;
+    }
+
+    if (!spool_index_spool_mtime_matches(data, &st)
+        && !spool_index_matches_dir(dir_fd, data, spool_index_records(data)))
+    {
+        log_info("Index of '%s' does not match its entries", spool_dir);
+        goto finito;
+    }
+
+    index = libreport_xmalloc(sizeof(*index));
+    index->data = data;
+    index->size = size;
+    data = NULL;
+
+finito:
+    free(data);
+    close(dir_fd);
+    return index;
+}
+
+void spool_index_close(struct spool_index *index)
+{
+    if (index == NULL)
+        return;
+
+    free(index->data);
+    free(index);
+}
+
+const struct spool_index_record *spool_index_next(const struct spool_index *index, size_t *pos)
+{
+    const struct spool_index_header *header = index->data;
+    const struct spool_index_record *records = spool_index_records(index->data);
+
+    while (*pos < header->records)
+    {
+        const struct spool_index_record *record = records + (*pos)++;
+        if (record->flags & SPOOL_INDEX_RECORD_USED)
+            return record;
+    }
+
+    return NULL;
+}
+
+const struct spool_index_record *spool_index_find(const struct spool_index *index, const char *name)
+{
+    const struct spool_index_header *header = index->data;
+    const struct spool_index_record *record = spool_index_lookup(spool_index_records(index->data),
+            header->records, name, spool_index_name_hash(name));
+
+    return record != NULL && (record->flags & SPOOL_INDEX_RECORD_USED) ? record : NULL;
+}
@@ -802,7 +802,6 @@ libreport_ureport_do_post(const char *json, struct ureport_server_config *config
     const char *headers[] =
     {
         "Accept: application/json",
-        "Connection: close",
         NULL,
     };
     char *dest_url = libreport_concat_path_file(config->ur_url, url_sfx);
@@ -18,95 +18,278 @@
 */
 #include "internal_libreport.h"
 
-char *libreport_sanitize_utf8(const char *src, uint32_t control_chars_to_sanitize)
+#if defined(__SSE2__) || (defined(__x86_64__) && defined(__GNUC__))
+# include <immintrin.h>
+#endif
+
+/* The scanners below return the length of the leading run of "plain" bytes,
+ * i.e. printable ASCII characters 0x20-0x7e and, if allow_tab_lf is true, tabs
+ * and new lines. These bytes never need any attention, so we can skip them in
+ * big chunks and deal with the rest byte by byte.
+ *
+ * Which implementation is used is decided once, when the library is loaded,
+ * according to the features of the CPU.
+ */
+static inline bool is_plain_byte(unsigned char c, bool allow_tab_lf)
 {
-    const char *initial_src = src;
-    char *sanitized = NULL;
-    unsigned sanitized_pos = 0;
+    return (c >= ' ' && c < 0x7f) || (allow_tab_lf && (c == '\t' || c == '\n'));
+}
+
+static size_t plain_span_scalar(const unsigned char *s, size_t len, bool allow_tab_lf)
+{
+    size_t i = 0;
+    while (i < len && is_plain_byte(s[i], allow_tab_lf))
+        ++i;
+    return i;
+}
+
+#ifdef __SSE2__
+static size_t plain_span_sse2(const unsigned char *s, size_t len, bool allow_tab_lf)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i del = _mm_set1_epi8(0x7f);
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i lf = _mm_set1_epi8('\n');
 
-    while (*src)
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
     {
-        int bytes = 0;
+        const __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        /* Signed comparison: bytes >= 0x80 are negative, so they are caught
+         * together with the control characters. */
+        __m128i special = _mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del));
+        if (allow_tab_lf)
+            special = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, lf)),
+                                       special);
 
-        unsigned c = (unsigned char) *src;
-        if (c <= 0x7f)
+        const unsigned mask = _mm_movemask_epi8(special);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + plain_span_scalar(s + i, len - i, allow_tab_lf);
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2")))
+static size_t plain_span_avx2(const unsigned char *s, size_t len, bool allow_tab_lf)
+{
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        /* _mm256_cmpgt_epi8 is signed, see plain_span_sse2() */
+        __m256i special = _mm256_or_si256(_mm256_cmpgt_epi8(space, v), _mm256_cmpeq_epi8(v, del));
+        if (allow_tab_lf)
+            special = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(v, lf)),
+                                          special);
+
+        const unsigned mask = (unsigned)_mm256_movemask_epi8(special);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + plain_span_sse2(s + i, len - i, allow_tab_lf);
+}
+#endif
+
+/* Resolved once, the scanners run for every run of plain bytes */
+static size_t (*plain_span)(const unsigned char *s, size_t len, bool allow_tab_lf) =
+#ifdef __SSE2__
+    plain_span_sse2;
+#else
+    plain_span_scalar;
+#endif
+
+static void __attribute__((constructor)) plain_span_init(void)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (libreport_simd_features() & LIBREPORT_SIMD_AVX2)
+        plain_span = plain_span_avx2;
+#endif
+}
+
+/* Returns the length of the valid UTF-8 sequence at the beginning of s,
+ * 0 if the sequence is invalid or -1 if the sequence is valid but incomplete
+ * (truncated by len).
+ *
+ * Overlong encodings, surrogates and code points above U+10FFFF are invalid.
+ */
+static int utf8_sequence_length(const unsigned char *s, size_t len)
+{
+    /* Unicode -> utf8: */
+    /* 80-7FF -> 110yyyxx 10xxxxxx */
+    /* 800-FFFF -> 1110yyyy 10yyyyxx 10xxxxxx */
+    /* 10000-10FFFF -> 11110zzz 10zzyyyy 10yyyyxx 10xxxxxx */
+    const unsigned c = s[0];
+    unsigned bytes;
+    uint32_t code_point;
+    uint32_t min_code_point;
+
+    if (c < 0x80)
+        return 1;
+    else if (c < 0xc2) /* A bare "continuation" byte or overlong 2-byte sequence */
+        return 0;
+    else if (c < 0xe0)
+    {
+        bytes = 2;
+        code_point = c & 0x1f;
+        min_code_point = 0x80;
+    }
+    else if (c < 0xf0)
+    {
+        bytes = 3;
+        code_point = c & 0x0f;
+        min_code_point = 0x800;
+    }
+    else if (c < 0xf5)
+    {
+        bytes = 4;
+        code_point = c & 0x07;
+        min_code_point = 0x10000;
+    }
+    else
+        return 0;
+
+    for (unsigned i = 1; i < bytes; ++i)
+    {
+        if (i >= len)
+            return -1;
+
+        const unsigned ch = s[i];
+        if ((ch & 0xc0) != 0x80) /* Missing "continuation" byte. Example: e0 41 */
+            return 0;
+        code_point = (code_point << 6) | (ch & 0x3f);
+    }
+
+    /* Example: 11100000 10000001 10000000 converts to 0x40 */
+    if (code_point < min_code_point)
+        return 0;
+
+    if (code_point > 0x10ffff || (code_point >= 0xd800 && code_point <= 0xdfff))
+        return 0;
+
+    return bytes;
+}
+
+long libreport_utf8_count_bad_bytes(const char *buf, size_t len)
+{
+    const unsigned char *s = (const unsigned char *)buf;
+    long bad_bytes = 0;
+    size_t i = 0;
+
+    while (1)
+    {
+        i += plain_span(s + i, len - i, /*allow_tab_lf*/true);
+        if (i >= len)
+            break;
+
+        const unsigned c = s[i];
+        if (c < ' ')
         {
-            if (c < 32 && (((uint32_t)1 << c) & control_chars_to_sanitize))
-                goto bad_byte;
-            bytes = 1;
-            goto good_byte;
+            /* Among control chars, only '\t','\n' etc are allowed */
+            if (!isspace(c))
+                return -1;
+            ++i;
+            continue;
         }
 
-        /* Unicode -> utf8: */
-        /* 80-7FF -> 110yyyxx 10xxxxxx */
-        /* 800-FFFF -> 1110yyyy 10yyyyxx 10xxxxxx */
-        /* 10000-1FFFFF -> 11110zzz 10zzyyyy 10yyyyxx 10xxxxxx */
-        /* 200000-3FFFFFF -> 111110tt 10zzzzzz 10zzyyyy 10yyyyxx 10xxxxxx */
-        /* 4000000-FFFFFFFF -> 111111tt 10tttttt 10zzzzzz 10zzyyyy 10yyyyxx 10xxxxxx */
-        do {
-            c <<= 1;
-            bytes++;
-        } while ((c & 0x80) && bytes < 6);
-        if (bytes == 1)
+        if (c == 0x7f)
+        {
+            ++bad_bytes;
+            ++i;
+            continue;
+        }
+
+        const int bytes = utf8_sequence_length(s + i, len - i);
+        if (bytes < 0) /* The buffer might be a prefix of a longer text */
+            break;
+
+        if (bytes == 0)
         {
-            /* A bare "continuation" byte. Say, 80 */
-            goto bad_byte;
+            ++bad_bytes;
+            ++i;
         }
+        else
+            i += bytes;
+    }
+
+    return bad_bytes;
+}
 
-        c = (uint8_t)(c) >> bytes;
+char *libreport_sanitize_utf8(const char *src, uint32_t control_chars_to_sanitize)
+{
+    const unsigned char *const s = (const unsigned char *)src;
+    const size_t len = strlen(src);
+    const bool allow_tab_lf = !(control_chars_to_sanitize & (SANITIZE_TAB | SANITIZE_LF));
+
+    char *sanitized = NULL;
+    size_t sanitized_pos = 0;
+    size_t sanitized_size = 0;
+    /* Beginning of the good bytes which were not copied to sanitized yet */
+    size_t good_start = 0;
+    size_t i = 0;
+
+    while (1)
+    {
+        i += plain_span(s + i, len - i, allow_tab_lf);
+        if (i >= len)
+            break;
+
+        const unsigned c = s[i];
+        int bytes = 1;
+        if (c <= 0x7f)
         {
-            const char *pp = src;
-            int cnt = bytes;
-            while (--cnt)
-            {
-                unsigned ch = (unsigned char) *++pp;
-                if ((ch & 0xc0) != 0x80) /* Missing "continuation" byte. Example: e0 80 */
-                {
-                    goto bad_byte;
-                }
-                c = (c << 6) + (ch & 0x3f);
-            }
+            if (c < 32 && (((uint32_t)1 << c) & control_chars_to_sanitize))
+                bytes = 0;
         }
-        /* TODO */
-        /* Need to check that c isn't produced by overlong encoding */
-        /* Example: 11000000 10000000 converts to NUL */
-        /* 11110000 10000000 10000100 10000000 converts to 0x100 */
-        /* correct encoding: 11000100 10000000 */
-        if (c <= 0x7f) /* crude check: only catches bad encodings which map to chars <= 7f */
+        else
         {
-            goto bad_byte;
+            bytes = utf8_sequence_length(s + i, len - i);
+            /* NUL terminates the string, so no sequence can be incomplete */
+            if (bytes < 0)
+                bytes = 0;
         }
 
- good_byte:
-        while (--bytes >= 0)
+        if (bytes > 0)
         {
-            c = (unsigned char) *src++;
-            if (sanitized)
-            {
-                sanitized = (char*) libreport_xrealloc(sanitized, sanitized_pos + 2);
-                sanitized[sanitized_pos++] = c;
-                sanitized[sanitized_pos] = '\0';
-            }
+            i += bytes;
+            continue;
         }
-        continue;
 
- bad_byte:
-        if (!sanitized)
+        /* bad byte: flush the pending good bytes and append [XX] */
+        const size_t good_len = i - good_start;
+        if (sanitized_pos + good_len + 5 > sanitized_size)
         {
-            sanitized_pos = src - initial_src;
-            sanitized = libreport_xstrndup(initial_src, sanitized_pos);
+            sanitized_size = (sanitized_pos + good_len + 5) + (len - i) + (len - i) / 2;
+            sanitized = (char*) libreport_xrealloc(sanitized, sanitized_size);
         }
-        sanitized = (char*) libreport_xrealloc(sanitized, sanitized_pos + 5);
+        memcpy(sanitized + sanitized_pos, src + good_start, good_len);
+        sanitized_pos += good_len;
+
         sanitized[sanitized_pos++] = '[';
-        c = (unsigned char) *src++;
         sanitized[sanitized_pos++] = "0123456789ABCDEF"[c >> 4];
         sanitized[sanitized_pos++] = "0123456789ABCDEF"[c & 0xf];
         sanitized[sanitized_pos++] = ']';
-        sanitized[sanitized_pos] = '\0';
+
+        good_start = ++i;
     }
 
     if (sanitized)
-        log_info("note: bad utf8, converted '%s' -> '%s'", initial_src, sanitized);
+    {
+        const size_t good_len = len - good_start;
+        sanitized = (char*) libreport_xrealloc(sanitized, sanitized_pos + good_len + 1);
+        memcpy(sanitized + sanitized_pos, src + good_start, good_len);
+        sanitized[sanitized_pos + good_len] = '\0';
+
+        log_info("note: bad utf8, converted '%s' -> '%s'", src, sanitized);
+    }
 
     return sanitized; /* usually NULL: the whole string is ok */
 }
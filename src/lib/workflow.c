@@ -81,14 +81,16 @@ static gint file_obj_cmp(file_obj_t *file, const char *filename)
 
 static void load_workflow_config(const char *name,
                            GList *available_wfs,
-                           GHashTable *wf_list)
+                           GHashTable *wf_list,
+                           struct config_cache *workflow_cache,
+                           struct config_cache *event_cache)
 {
     GList *wf_file = g_list_find_custom(available_wfs, name, (GCompareFunc)file_obj_cmp);
     if (wf_file)
     {
         file_obj_t *file = (file_obj_t *)wf_file->data;
         workflow_t *workflow = new_workflow(file->filename);
-        load_workflow_description_from_file(workflow, file->fullpath);
+        libreport_load_workflow_description_cached(workflow_cache, event_cache, workflow, file->fullpath);
         log_info("Adding '%s' to workflows\n", file->filename);
         g_hash_table_insert(wf_list, libreport_xstrdup(file->filename), workflow);
     }
@@ -108,14 +110,20 @@ GHashTable *load_workflow_config_data_from_list(GList *wf_names,
     if (path == NULL)
         path = WORKFLOWS_DIR;
 
+    struct config_cache *workflow_cache = libreport_config_cache_open("workflows");
+    struct config_cache *event_cache = libreport_config_cache_open("events");
+
     GList *workflow_files = libreport_get_file_list(path, "xml");
     while(wfs)
     {
-        load_workflow_config((const char *)wfs->data, workflow_files, wf_list);
+        load_workflow_config((const char *)wfs->data, workflow_files, wf_list, workflow_cache, event_cache);
         wfs = g_list_next(wfs);
     }
     libreport_free_file_list(workflow_files);
 
+    libreport_config_cache_close(event_cache);
+    libreport_config_cache_close(workflow_cache);
+
     return wf_list;
 }
 
@@ -134,6 +142,9 @@ GHashTable *libreport_load_workflow_config_data(const char *path)
     if (path == NULL)
         path = WORKFLOWS_DIR;
 
+    struct config_cache *workflow_cache = libreport_config_cache_open("workflows");
+    struct config_cache *event_cache = libreport_config_cache_open("events");
+
     GList *workflow_files = libreport_get_file_list(path, "xml");
     while (workflow_files)
     {
@@ -142,9 +153,12 @@ GHashTable *libreport_load_workflow_config_data(const char *path)
         workflow_t *workflow = get_workflow(file->filename);
         bool nw_workflow = (!workflow);
         if (nw_workflow)
+        {
             workflow = new_workflow(file->filename);
-
-        load_workflow_description_from_file(workflow, file->fullpath);
+            libreport_load_workflow_description_cached(workflow_cache, event_cache, workflow, file->fullpath);
+        }
+        else
+            load_workflow_description_from_file(workflow, file->fullpath);
 
         if (nw_workflow)
             g_hash_table_replace(g_workflow_list, libreport_xstrdup(wf_get_name(workflow)), workflow);
@@ -153,6 +167,9 @@ GHashTable *libreport_load_workflow_config_data(const char *path)
         workflow_files = g_list_delete_link(workflow_files, workflow_files);
     }
 
+    libreport_config_cache_close(event_cache);
+    libreport_config_cache_close(workflow_cache);
+
     return g_workflow_list;
 }
 
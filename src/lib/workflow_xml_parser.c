@@ -28,6 +28,21 @@
 #define NAME_ELEMENT            "name"
 #define PRIORITY_ELEMENT        "priority"
 
+static void add_workflow_event(struct config_cache *event_cache, workflow_t *workflow, const char *event_name)
+{
+    event_config_t *ec = new_event_config(event_name);
+    g_autofree gchar *event_file = libreport_xasprintf(EVENTS_DIR"/%s.xml", event_name);
+
+    libreport_load_event_description_cached(event_cache, ec, event_file);
+    if (ec_get_screen_name(ec))
+    {
+        log_debug("adding event '%s' to workflow", event_name);
+        wf_add_event(workflow, ec);
+    }
+    else
+        free_event_config(ec);
+}
+
 static void start_element(GMarkupParseContext *context,
                   const gchar *element_name,
                   const gchar **attribute_names,
@@ -88,19 +103,10 @@ static void text(GMarkupParseContext *context,
 
         while (expanded_events)
         {
-            const gchar *event_name = expanded_events->data;
-
-            event_config_t *ec = new_event_config(event_name);
-            g_autofree gchar *event_file = libreport_xasprintf(EVENTS_DIR"/%s.xml", event_name);
+            gchar *event_name = expanded_events->data;
 
-            load_event_description_from_file(ec, event_file);
-            if (ec_get_screen_name(ec))
-            {
-                log_debug("adding event '%s' to workflow", event_name);
-                wf_add_event(workflow, ec);
-            }
-            else
-                free_event_config(ec);
+            add_workflow_event(parse_data->event_cache, workflow, event_name);
+            parse_data->event_names = g_list_prepend(parse_data->event_names, event_name);
 
             expanded_events = g_list_delete_link(expanded_events, expanded_events);
         }
@@ -190,10 +196,11 @@ static void error(GMarkupParseContext *context,
     error_msg("error in XML parsing");
 }
 
-void load_workflow_description_from_file(workflow_t *workflow, const char* filename)
+static void load_workflow_description(workflow_t *workflow, const char *filename,
+        struct config_cache *event_cache, GList **event_names)
 {
     log_info("loading workflow: '%s'", filename);
-    struct my_parse_data parse_data = { workflow, NULL, NULL, 0, 0, 0};
+    struct my_parse_data parse_data = { workflow, NULL, NULL, 0, 0, 0, event_cache, NULL };
     parse_data.cur_locale = libreport_xstrdup(setlocale(LC_ALL, NULL));
     strchrnul(parse_data.cur_locale, '.')[0] = '\0';
 
@@ -225,4 +232,88 @@ void load_workflow_description_from_file(workflow_t *workflow, const char* filen
 
     free(parse_data.attribute_lang); /* just in case */
     free(parse_data.cur_locale);
+
+    if (event_names != NULL)
+        *event_names = g_list_reverse(parse_data.event_names);
+    else
+        g_list_free_full(parse_data.event_names, free);
+}
+
+void load_workflow_description_from_file(workflow_t *workflow, const char* filename)
+{
+    load_workflow_description(workflow, filename, /*event_cache:*/ NULL, /*event_names:*/ NULL);
+}
+
+/* Cached workflow descriptions are stored as screen name, description, long
+ * description (ms), priority (i) and expanded event names (as).
+ */
+#define WORKFLOW_CACHE_TYPE "(msmsmsias)"
+
+static GVariant *workflow_to_variant(workflow_t *workflow, GList *event_names)
+{
+    GVariantBuilder names;
+    g_variant_builder_init(&names, G_VARIANT_TYPE("as"));
+    for (GList *n = event_names; n != NULL; n = g_list_next(n))
+        g_variant_builder_add(&names, "s", (const char *)n->data);
+
+    return g_variant_new(WORKFLOW_CACHE_TYPE,
+            wf_get_screen_name(workflow), wf_get_description(workflow), wf_get_long_desc(workflow),
+            (gint32)wf_get_priority(workflow), &names);
+}
+
+static void workflow_from_variant(workflow_t *workflow, GVariant *value, struct config_cache *event_cache)
+{
+    const char *screen_name, *description, *long_desc;
+    gint32 priority;
+    GVariantIter *names;
+
+    g_variant_get(value, "(m&sm&sm&sias)", &screen_name, &description, &long_desc, &priority, &names);
+
+    if (screen_name != NULL)
+        wf_set_screen_name(workflow, screen_name);
+    if (description != NULL)
+        wf_set_description(workflow, description);
+    if (long_desc != NULL)
+        wf_set_long_desc(workflow, long_desc);
+    wf_set_priority(workflow, priority);
+
+    const char *event_name;
+    while (g_variant_iter_next(names, "&s", &event_name))
+        add_workflow_event(event_cache, workflow, event_name);
+    g_variant_iter_free(names);
+}
+
+void libreport_load_workflow_description_cached(struct config_cache *workflow_cache,
+        struct config_cache *event_cache, workflow_t *workflow, const char *filename)
+{
+    if (workflow_cache == NULL)
+    {
+        load_workflow_description(workflow, filename, event_cache, /*event_names:*/ NULL);
+        return;
+    }
+
+    char *key = libreport_xasprintf("%s#%s", filename, setlocale(LC_ALL, NULL));
+
+    GVariant *value = libreport_config_cache_lookup(workflow_cache, key, /*sources:*/ NULL);
+    if (value != NULL)
+    {
+        workflow_from_variant(workflow, value, event_cache);
+        g_variant_unref(value);
+    }
+    else
+    {
+        /* Event name wildcards are expanded from the contents of EVENTS_DIR */
+        struct config_cache_sources *sources = libreport_config_cache_sources_new();
+        libreport_config_cache_sources_add(sources, filename);
+        libreport_config_cache_sources_add(sources, EVENTS_DIR);
+
+        GList *event_names = NULL;
+        load_workflow_description(workflow, filename, event_cache, &event_names);
+
+        libreport_config_cache_store(workflow_cache, key, sources, workflow_to_variant(workflow, event_names));
+        libreport_config_cache_sources_free(sources);
+        g_list_free_full(event_names, free);
+    }
+
+    free(key);
 }
@@ -808,6 +808,68 @@ mantisbt_attach_file(const mantisbt_settings_t *settings, const char *bug_id,
     return ret;
 }
 
+struct mantisbt_attach_job
+{
+    const mantisbt_settings_t *settings;
+    const char *bug_id;
+};
+
+static void
+mantisbt_attach_one(gpointer data, gpointer user_data)
+{
+    mantisbt_attachment_t *att = data;
+    const struct mantisbt_attach_job *job = user_data;
+
+    if (att->ma_data != NULL)
+        att->ma_result = mantisbt_attach_data(job->settings, job->bug_id,
+                                              att->ma_name, att->ma_data, att->ma_data_size);
+    else
+        att->ma_result = mantisbt_attach_file(job->settings, job->bug_id,
+                                              att->ma_name, att->ma_path);
+}
+
+unsigned
+mantisbt_attach_many(const mantisbt_settings_t *settings, const char *bug_id,
+                    mantisbt_attachment_t *attachments, unsigned count, unsigned max_parallel)
+{
+    struct mantisbt_attach_job job = {
+        .settings = settings,
+        .bug_id = bug_id,
+    };
+
+    /* Every SOAP call is a blocking HTTP request, hence the upload threads */
+    GThreadPool *pool = NULL;
+    if (count > 1 && max_parallel > 1)
+    {
+        GError *error = NULL;
+        pool = g_thread_pool_new(mantisbt_attach_one, &job, MIN(count, max_parallel),
+                                 /*exclusive*/TRUE, &error);
+        if (pool == NULL)
+        {
+            log_notice("Attaching files one by one: %s", error->message);
+            g_error_free(error);
+        }
+    }
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (pool == NULL || !g_thread_pool_push(pool, &attachments[i], NULL))
+            mantisbt_attach_one(&attachments[i], &job);
+    }
+
+    if (pool != NULL)
+        g_thread_pool_free(pool, /*immediate*/FALSE, /*wait*/TRUE);
+
+    unsigned failed = 0;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (attachments[i].ma_result <= 0)
+            ++failed;
+    }
+
+    return failed;
+}
+
 static void
 soap_filter_add_new_array_parameter(xmlNodePtr filter_node, const char *name, const char *type, const char *value)
 {
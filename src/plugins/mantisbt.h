@@ -120,6 +120,25 @@ int mantisbt_attach_data(const mantisbt_settings_t *settings, const char *bug_id
 int mantisbt_attach_file(const mantisbt_settings_t *settings, const char *bug_id,
                     const char *att_name, const char *data);
 
+typedef struct mantisbt_attachment
+{
+    const char *ma_name;
+    const char *ma_data;    /* the contents, or NULL to attach ma_path */
+    int ma_data_size;
+    const char *ma_path;
+    int ma_result;          /* the return value of the attach function */
+} mantisbt_attachment_t;
+
+/* Uploads the attachments over up to max_parallel connections at once.
+ * The attachments can be added in any order. Returns the number of
+ * attachments which were not added.
+ *
+ * The uploads run in threads, so the program must call curl_global_init()
+ * and xmlInitParser() before.
+ */
+unsigned mantisbt_attach_many(const mantisbt_settings_t *settings, const char *bug_id,
+                    mantisbt_attachment_t *attachments, unsigned count, unsigned max_parallel);
+
 GList * mantisbt_search_by_abrt_hash(mantisbt_settings_t *settings, const char *abrt_hash);
 GList * mantisbt_search_duplicate_issues(mantisbt_settings_t *settings, const char *category,
                     const char *version, const char *abrt_hash);
@@ -26,33 +26,17 @@
 
 #define DEFAULT_BUGZILLA_PRODUCT "Fedora"
 
-static
-int attach_text_item(struct abrt_xmlrpc *ax, const char *bug_id,
-                const char *item_name, struct problem_item *item)
-{
-    if (!(item->flags & CD_FLAG_TXT))
-        return 0;
-    log_debug("attaching '%s' as text", item_name);
-    int r = rhbz_attach_blob(ax, bug_id,
-                item_name, item->content, strlen(item->content),
-                RHBZ_MINOR_UPDATE
-    );
-    return (r == 0);
-}
+/* The number of attachments uploaded at once */
+#define PARALLEL_ATTACHMENTS 4
 
-static
-int attach_file_item(struct abrt_xmlrpc *ax, const char *bug_id,
-                const char *item_name, struct problem_item *item)
+/* Returns fd of the file, or -1 if it can't be attached */
+static int open_attachment(const char *filename)
 {
-    if (!(item->flags & CD_FLAG_BIN))
-        return 0;
-
-    char *filename = item->content;
     int fd = open(filename, O_RDONLY);
     if (fd < 0)
     {
         perror_msg("Can't open '%s'", filename);
-        return 0;
+        return -1;
     }
     errno = 0;
     struct stat st;
@@ -60,15 +44,64 @@ int attach_file_item(struct abrt_xmlrpc *ax, const char *bug_id,
     {
         perror_msg("'%s': not a regular file", filename);
         close(fd);
-        return 0;
+        return -1;
     }
-    log_debug("attaching '%s' as file", item_name);
-    int flag = RHBZ_MINOR_UPDATE;
-    if (!(item->flags & CD_FLAG_BIGTXT))
-        flag |= RHBZ_BINARY_ATTACHMENT;
-    int r = rhbz_attach_fd(ax, bug_id, item_name, fd, flag);
-    close(fd);
-    return (r == 0);
+    return fd;
+}
+
+static void attach_and_close(struct abrt_xmlrpc *ax, const char *bug_id,
+                struct rhbz_attachment *attachments, unsigned count)
+{
+    rhbz_attach_many(ax, bug_id, attachments, count, PARALLEL_ATTACHMENTS);
+
+    for (unsigned i = 0; i < count; ++i)
+        if (attachments[i].ra_fd >= 0)
+            close(attachments[i].ra_fd);
+}
+
+/* Attaches text items as text and binary items as files */
+static void attach_items(struct abrt_xmlrpc *ax, const char *bug_id,
+                problem_data_t *problem_data, GList *item_names)
+{
+    struct rhbz_attachment *attachments = libreport_xzalloc(
+                (g_list_length(item_names) + 1) * sizeof(attachments[0]));
+    unsigned count = 0;
+
+    for (GList *a = item_names; a != NULL; a = g_list_next(a))
+    {
+        const char *item_name = (const char *)a->data;
+        struct problem_item *item = problem_data_get_item_or_NULL(problem_data, item_name);
+        if (!item)
+            continue;
+
+        struct rhbz_attachment *att = attachments + count;
+        att->ra_name = item_name;
+        att->ra_fd = -1;
+        att->ra_flags = RHBZ_MINOR_UPDATE;
+
+        if (item->flags & CD_FLAG_TXT)
+        {
+            log_debug("attaching '%s' as text", item_name);
+            att->ra_data = item->content;
+            att->ra_data_len = strlen(item->content);
+        }
+        else if (item->flags & CD_FLAG_BIN)
+        {
+            att->ra_fd = open_attachment(item->content);
+            if (att->ra_fd < 0)
+                continue;
+            log_debug("attaching '%s' as file", item_name);
+            if (!(item->flags & CD_FLAG_BIGTXT))
+                att->ra_flags |= RHBZ_BINARY_ATTACHMENT;
+        }
+        else
+            continue;
+
+        ++count;
+    }
+
+    attach_and_close(ax, bug_id, attachments, count);
+    free(attachments);
 }
 
 /* Main */
@@ -396,7 +429,6 @@ int main(int argc, char **argv)
 
     struct abrt_xmlrpc *client;
     client = abrt_xmlrpc_new_client(rhbz.b_bugzilla_xmlrpc, rhbz.b_ssl_verify);
-    unsigned rhbz_ver = rhbz_version(client);
 
     if (abrt_hash)
     {
@@ -447,18 +479,16 @@ int main(int argc, char **argv)
         }
 
         log_debug("Using Bugzilla product '%s' to find duplicate bug", product);
-        xmlrpc_value *all_bugs = rhbz_search_duphash(client,
+        struct rhbz_duplicates dups;
+        rhbz_search_duplicates(client,
                                 /*product:*/ product,
                                 /*version:*/ NULL,
                                 /*component:*/ NULL,
-                                hash);
+                                hash, &dups);
         free(hash);
-        unsigned all_bugs_size = rhbz_array_size(all_bugs);
-        if (all_bugs_size > 0)
-        {
-            int bug_id = rhbz_get_bug_id_from_array0(all_bugs, rhbz_ver);
-            printf("%i\n", bug_id);
-        }
+        if (dups.rd_crossver_id >= 0)
+            printf("%i\n", dups.rd_crossver_id);
+        g_list_free(dups.rd_bug_ids);
 
         return EXIT_SUCCESS;
     }
@@ -520,29 +550,26 @@ int main(int argc, char **argv)
             rhbz_mail_to_cc(client, libreport_xatoi_positive(ticket_no), rhbz.b_login, /* require mail notify */ 0);
         else
         {   /* Attach files to existing BZ */
+            struct rhbz_attachment *attachments = libreport_xzalloc(
+                        (g_strv_length(argv) + 1) * sizeof(attachments[0]));
+            unsigned count = 0;
+
             while (*argv)
             {
                 const char *filename = *argv++;
                 log_notice("Attaching file '%s' to bug %s", filename, ticket_no);
 
-                int fd = open(filename, O_RDONLY);
+                int fd = open_attachment(filename);
                 if (fd < 0)
-                {
-                    perror_msg("Can't open '%s'", filename);
                     continue;
-                }
 
-                struct stat st;
-                if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
-                {
-                    error_msg("'%s': not a regular file", filename);
-                    close(fd);
-                    continue;
-                }
-
-                rhbz_attach_fd(client, ticket_no, filename, fd, /*flags*/ 0);
-                close(fd);
+                attachments[count].ra_name = filename;
+                attachments[count].ra_fd = fd;
+                ++count;
             }
+
+            attach_and_close(client, ticket_no, attachments, count);
+            free(attachments);
         }
 
         log_warning(_("Logging out"));
@@ -667,6 +694,32 @@ int main(int argc, char **argv)
     }
 
     struct bug_info *bz = NULL;
+    /* The bugs with the same duphash, the chain of duplicates of the reported
+     * bug likely leads through them */
+    GList *dup_ids = NULL;
+    /* Whether the bug the problem ends up in should be cached for duphash */
+    bool cache_bug = false;
+    /* Figure out whether we want to match component
+     * when doing dup search.
+     */
+    const char *component_substitute = libreport_is_in_comma_separated_list(component, rhbz.b_DontMatchComponents) ? NULL : component;
+    if (!bug_id && !rhbz.b_create_private)
+    {
+        int cached_id;
+        if (libreport_duphash_cache_lookup(rhbz.b_bugzilla_url, rhbz.b_product,
+                    rhbz.b_product_version, component_substitute, duphash, &cached_id, NULL))
+        {
+            log_warning(_("Found bug %i for the duplicate hash in the cache"), cached_id);
+            bug_id = cached_id;
+            cache_bug = true;
+            /* Do not let a cached bug that can't be read any more fail the
+             * reports until the entry expires; it is stored again when the
+             * bug has been updated. */
+            libreport_duphash_cache_invalidate(rhbz.b_bugzilla_url, rhbz.b_product,
+                    rhbz.b_product_version, component_substitute, duphash);
+        }
+    }
+
     if (!bug_id)
     {
         log_warning(_("Checking for duplicates"));
@@ -674,42 +727,25 @@ int main(int argc, char **argv)
         int existing_id = -1;
         int crossver_id = -1;
         {
-            /* Figure out whether we want to match component
-             * when doing dup search.
-             */
-            const char *component_substitute = libreport_is_in_comma_separated_list(component, rhbz.b_DontMatchComponents) ? NULL : component;
-
             /* We don't do dup detection across versions (see below why),
              * but we do add a note if cross-version potential dup exists.
-             * For that, we search for cross version dups first:
+             * For that, we search for cross version dups too.
+             *
+             * In dup detection we require match in product *and version*.
+             * Otherwise we sometimes have bugs in e.g. Fedora 17
+             * considered to be dups of Fedora 16 bugs.
+             * Imagine that F16 is "end-of-lifed" - allowing cross-version
+             * match will make all newly detected crashes DUPed
+             * to a bug in a dead release.
+             *
+             * Both searches are sent at once.
              */
-            xmlrpc_value *crossver_bugs = rhbz_search_duphash(client, rhbz.b_product, /*version:*/ NULL,
-                            component_substitute, duphash);
-            unsigned crossver_bugs_count = rhbz_array_size(crossver_bugs);
-            log_debug("Bugzilla has %i reports with duphash '%s' including cross-version ones",
-                    crossver_bugs_count, duphash);
-            if (crossver_bugs_count > 0)
-                crossver_id = rhbz_get_bug_id_from_array0(crossver_bugs, rhbz_ver);
-            xmlrpc_DECREF(crossver_bugs);
-
-            if (crossver_bugs_count > 0)
-            {
-                /* In dup detection we require match in product *and version*.
-                 * Otherwise we sometimes have bugs in e.g. Fedora 17
-                 * considered to be dups of Fedora 16 bugs.
-                 * Imagine that F16 is "end-of-lifed" - allowing cross-version
-                 * match will make all newly detected crashes DUPed
-                 * to a bug in a dead release.
-                 */
-                xmlrpc_value *dup_bugs = rhbz_search_duphash(client, rhbz.b_product,
-                                rhbz.b_product_version, component_substitute, duphash);
-                unsigned dup_bugs_count = rhbz_array_size(dup_bugs);
-                log_debug("Bugzilla has %i reports with duphash '%s'",
-                        dup_bugs_count, duphash);
-                if (dup_bugs_count > 0)
-                    existing_id = rhbz_get_bug_id_from_array0(dup_bugs, rhbz_ver);
-                xmlrpc_DECREF(dup_bugs);
-            }
+            struct rhbz_duplicates dups;
+            rhbz_search_duplicates(client, rhbz.b_product, rhbz.b_product_version,
+                            component_substitute, duphash, &dups);
+            existing_id = dups.rd_existing_id;
+            crossver_id = dups.rd_crossver_id;
+            dup_ids = dups.rd_bug_ids;
         }
 
         if (existing_id < 0 || rhbz.b_create_private)
@@ -821,21 +857,13 @@ int main(int argc, char **argv)
             char new_id_str[sizeof(int)*3 + 2];
             sprintf(new_id_str, "%i", new_id);
 
-            for (GList *a = problem_report_get_attachments(pr); a != NULL; a = g_list_next(a))
-            {
-                const char *item_name = (const char *)a->data;
-                struct problem_item *item = problem_data_get_item_or_NULL(problem_data, item_name);
-                if (!item)
-                    continue;
-                else if (item->flags & CD_FLAG_TXT)
-                    attach_text_item(client, new_id_str, item_name, item);
-                else if (item->flags & CD_FLAG_BIN)
-                    attach_file_item(client, new_id_str, item_name, item);
-            }
+            attach_items(client, new_id_str, problem_data, problem_report_get_attachments(pr));
 
             bz = new_bug_info();
             bz->bi_status = libreport_xstrdup("NEW");
             bz->bi_id = new_id;
+            /* Public reports must not be added to private bugs */
+            cache_bug = !rhbz.b_create_private;
 
             if (existing_id >= 0)
             {
@@ -847,24 +875,14 @@ int main(int argc, char **argv)
         }
 
         bug_id = existing_id;
+        cache_bug = true;
     }
 
-    bz = rhbz_bug_info(client, bug_id);
-
-    log_warning(_("Bug is already reported: %i"), bz->bi_id);
+    log_warning(_("Bug is already reported: %i"), (int)bug_id);
 
     /* Follow duplicates */
-    if ((strcmp(bz->bi_status, "CLOSED") == 0)
-     && (strcmp(bz->bi_resolution, "DUPLICATE") == 0)
-    ) {
-        struct bug_info *origin;
-        origin = rhbz_find_origin_bug_closed_duplicate(client, bz);
-        if (origin)
-        {
-            free_bug_info(bz);
-            bz = origin;
-        }
-    }
+    bz = rhbz_find_origin_bug(client, bug_id, dup_ids);
+    g_list_free(dup_ids);
 
     /* We used to skip adding the comment to CLOSED bugs:
      *
@@ -944,6 +962,13 @@ int main(int argc, char **argv)
     log_warning(_("Logging out"));
     rhbz_logout(client);
 
+    /* Stored after the updates of the bug, so the entry never predates them
+     * and the next report of the problem skips the duplicate search */
+    if (cache_bug)
+        libreport_duphash_cache_store(rhbz.b_bugzilla_url, rhbz.b_product,
+                rhbz.b_product_version, component_substitute, duphash,
+                bz->bi_id, bz->bi_status);
+
     log_warning(_("Status: %s%s%s %s/show_bug.cgi?id=%u"),
                 bz->bi_status,
                 bz->bi_resolution ? " " : "",
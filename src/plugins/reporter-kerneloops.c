@@ -53,9 +53,7 @@ static CURLcode http_post_to_kerneloops_site(const char *url, const char *oopsda
     struct curl_httppost *last = NULL;
     struct curl_slist *headers = NULL;
 
-    handle = curl_easy_init();
-    if (!handle)
-        error_msg_and_die("Can't create curl handle");
+    handle = xcurl_easy_init();
 
     headers = curl_slist_append(headers, "Accept: */*");
     headers = curl_slist_append(headers, "Expect:");
@@ -17,11 +17,16 @@
     Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <curl/curl.h>
+#include <libxml/parser.h>
 #include "internal_libreport.h"
 #include "client.h"
 #include "mantisbt.h"
 #include "problem_report.h"
 
+/* The number of attachments uploaded at once */
+#define PARALLEL_ATTACHMENTS 4
+
 static void
 parse_osinfo_for_mantisbt(map_string_t *osinfo, char** project, char** version)
 {
@@ -200,6 +205,11 @@ int main(int argc, char **argv)
 {
     abrt_init(argv);
 
+    /* Attachments are uploaded by threads, which must not initialize the
+     * libraries lazily */
+    curl_global_init(CURL_GLOBAL_ALL);
+    xmlInitParser();
+
     /* I18n */
     setlocale(LC_ALL, "");
 #if ENABLE_NLS
@@ -395,14 +405,23 @@ int main(int argc, char **argv)
         }
 
         /* Attach files to existing MantisBT issues */
+        mantisbt_attachment_t *attachments = libreport_xzalloc(
+                    (g_strv_length(argv) + 1) * sizeof(attachments[0]));
+        unsigned count = 0;
+
         while (*argv)
         {
             const char *path = *argv++;
             char *filename = basename(path);
             log_warning(_("Attaching file '%s' to issue %s"), filename, ticket_no);
-            mantisbt_attach_file(&mbt_settings, ticket_no, filename, path);
+            attachments[count].ma_name = filename;
+            attachments[count].ma_path = path;
+            ++count;
         }
 
+        mantisbt_attach_many(&mbt_settings, ticket_no, attachments, count, PARALLEL_ATTACHMENTS);
+        free(attachments);
+
         return 0;
     }
 
@@ -501,6 +520,27 @@ int main(int argc, char **argv)
     }
 
     mantisbt_issue_info_t *ii;
+    /* Whether the issue the problem ends up in should be cached for duphash */
+    bool cache_issue = false;
+    /* Figure out whether we want to match category
+     * when doing dup search.
+     */
+    const char *category_substitute = libreport_is_in_comma_separated_list(category, mbt_settings.m_DontMatchComponents) ? NULL : category;
+    if (!bug_id && !mbt_settings.m_create_private)
+    {
+        int cached_id;
+        if (libreport_duphash_cache_lookup(mbt_settings.m_mantisbt_url, mbt_settings.m_project,
+                    mbt_settings.m_project_version, category_substitute, duphash, &cached_id, NULL))
+        {
+            log_warning(_("Found issue %i for the duplicate hash in the cache"), cached_id);
+            bug_id = cached_id;
+            cache_issue = true;
+            /* Stored again when the issue has been updated */
+            libreport_duphash_cache_invalidate(mbt_settings.m_mantisbt_url, mbt_settings.m_project,
+                    mbt_settings.m_project_version, category_substitute, duphash);
+        }
+    }
+
     if (!bug_id)
     {
         log_warning(_("Checking for duplicates"));
@@ -508,11 +548,6 @@ int main(int argc, char **argv)
         int existing_id = -1;
         int crossver_id = -1;
         {
-            /* Figure out whether we want to match category
-             * when doing dup search.
-             */
-            const char *category_substitute = libreport_is_in_comma_separated_list(category, mbt_settings.m_DontMatchComponents) ? NULL : category;
-
             /* We don't do dup detection across versions (see below why),
              * but we do add a note if cross-version potential dup exists.
              * For that, we search for cross version dups first:
@@ -593,28 +628,47 @@ int main(int argc, char **argv)
             log_warning(_("Adding attachments to issue %i"), new_id);
             char *new_id_str = libreport_xasprintf("%u", new_id);
 
-            for (GList *a = problem_report_get_attachments(pr); a != NULL; a = g_list_next(a))
+            GList *item_names = problem_report_get_attachments(pr);
+            mantisbt_attachment_t *attachments = libreport_xzalloc(
+                        (g_list_length(item_names) + 1) * sizeof(attachments[0]));
+            unsigned count = 0;
+
+            for (GList *a = item_names; a != NULL; a = g_list_next(a))
             {
                 const char *item_name = (const char *)a->data;
                 struct problem_item *item = problem_data_get_item_or_NULL(problem_data, item_name);
                 if (!item)
                     continue;
                 else if (item->flags & CD_FLAG_TXT)
-                    mantisbt_attach_data(&mbt_settings, new_id_str, item_name, item->content, strlen(item->content));
+                {
+                    attachments[count].ma_data = item->content;
+                    attachments[count].ma_data_size = strlen(item->content);
+                }
                 else if (item->flags & CD_FLAG_BIN)
-                    mantisbt_attach_file(&mbt_settings, new_id_str, item_name, item->content);
+                    attachments[count].ma_path = item->content;
+                else
+                    continue;
+
+                attachments[count].ma_name = item_name;
+                ++count;
             }
 
+            mantisbt_attach_many(&mbt_settings, new_id_str, attachments, count, PARALLEL_ATTACHMENTS);
+
+            free(attachments);
             free(new_id_str);
             problem_report_free(pr);
             ii = mantisbt_issue_info_new();
             ii->mii_id = new_id;
             ii->mii_status = libreport_xstrdup("new");
+            /* Public reports must not be added to private issues */
+            cache_issue = !mbt_settings.m_create_private;
 
             goto finish;
         }
 
         bug_id = existing_id;
+        cache_issue = !mbt_settings.m_create_private;
     }
 
     ii = mantisbt_get_issue_info(&mbt_settings, bug_id);
@@ -699,6 +753,13 @@ int main(int argc, char **argv)
     }
 
 finish:
+    /* Stored after the updates of the issue, so the entry never predates
+     * them and the next report of the problem skips the duplicate search */
+    if (cache_issue)
+        libreport_duphash_cache_store(mbt_settings.m_mantisbt_url, mbt_settings.m_project,
+                mbt_settings.m_project_version, category_substitute, duphash,
+                ii->mii_id, ii->mii_status);
+
     log_warning(_("Status: %s%s%s %s/view.php?id=%u"),
                 ii->mii_status,
                 ii->mii_resolution ? " " : "",
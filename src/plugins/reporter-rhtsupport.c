@@ -16,7 +16,6 @@
     with this program; if not, write to the Free Software Foundation, Inc.,
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
-#include <libtar.h>
 #include "ureport.h"
 #include "internal_libreport.h"
 #include "client.h"
@@ -79,29 +78,19 @@ int create_tarball(const char *tempfile, struct dump_dir *dd,
      problem_data_t *problem_data)
 {
     reportfile_t *file = NULL;
+    struct archive_writer *aw = NULL;
     int retval = 0; /* everything is ok so far .. */
 
-    int pipe_from_parent_to_child[2];
-    libreport_xpipe(pipe_from_parent_to_child);
-    pid_t child = fork();
-    if (child == 0)
-    {
-        /* child */
-        close(pipe_from_parent_to_child[1]);
-        libreport_xmove_fd(libreport_xopen3(tempfile, O_WRONLY | O_CREAT | O_EXCL, 0600), 1);
-        libreport_xmove_fd(pipe_from_parent_to_child[0], 0);
-        execlp("gzip", "gzip", NULL);
-        perror_msg_and_die("Can't execute '%s'", "gzip");
-    }
-    close(pipe_from_parent_to_child[0]);
-
-    TAR *tar = NULL;
-    if (tar_fdopen(&tar, pipe_from_parent_to_child[1], (char*)tempfile,
-                /*fileops:(standard)*/ NULL, O_WRONLY | O_CREAT, 0644, TAR_GNU) != 0)
+    int fd = open(tempfile, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0)
     {
+        perror_msg("Can't open '%s'", tempfile);
         goto ret_fail;
     }
 
+    aw = archive_writer_new(ARCHIVE_COMPRESSION_GZIP,
+            libreport_get_global_archive_compression_threads(), archive_fd_sink, &fd);
+
     file = new_reportfile();
     {
         GHashTableIter iter;
@@ -135,20 +124,49 @@ int create_tarball(const char *tempfile, struct dump_dir *dd,
     }
 
     /* append all files from dump dir */
-    dd_init_next_file(dd);
-    char *short_name, *full_name;
-    while (dd_get_next_file(dd, &short_name, &full_name))
     {
-        char *uploaded_name = libreport_concat_path_file("content", short_name);
-        free(short_name);
+        struct dd_item_iterator iter;
+        if (dd_item_iterator_init(dd, &iter, /*flags*/0) < 0)
+            goto ret_fail;
 
-        if (tar_append_file(tar, full_name, uploaded_name) != 0)
+        struct dd_item_info info;
+        int r;
+        while ((r = dd_item_iterator_next(&iter, &info)) > 0)
         {
-            free(full_name);
-            goto ret_fail;
+            int item_fd = openat(dd->dd_fd, info.name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+            if (item_fd < 0)
+            {
+                perror_msg("Can't open '%s'", info.name);
+                r = -errno;
+                break;
+            }
+
+            /* The tarball contains the items as they were saved */
+            item_fd = dd_decompress_item_fd(dd, info.name, item_fd, NULL);
+            if (item_fd < 0)
+            {
+                r = item_fd;
+                break;
+            }
+
+            struct stat st;
+            char *uploaded_name = libreport_concat_path_file("content", info.name);
+
+            r = dd_item_stat(dd, info.name, &st);
+            if (r == 0)
+                r = archive_writer_add_fd(aw, uploaded_name, item_fd, &st);
+
+            free(uploaded_name);
+            close(item_fd);
+
+            if (r != 0)
+                break;
         }
 
-        free(full_name);
+        dd_item_iterator_destroy(&iter);
+
+        if (r != 0)
+            goto ret_fail;
     }
 
     const char *signature = reportfile_as_string(file);
@@ -158,64 +176,24 @@ int create_tarball(const char *tempfile, struct dump_dir *dd,
      */
 
     /* Write out content.xml in the tarball's root */
-    {
-        unsigned len = strlen(signature);
-        unsigned len512 = (len + 511) & ~511;
-        char *block = (char*)memcpy(libreport_xzalloc(len512), signature, len);
-
-        th_set_type(tar, S_IFREG | 0644);
-        th_set_mode(tar, S_IFREG | 0644);
-      //th_set_link(tar, char *linkname);
-      //th_set_device(tar, dev_t device);
-      //th_set_user(tar, uid_t uid);
-      //th_set_group(tar, gid_t gid);
-        th_set_mtime(tar, time(NULL));
-        th_set_path(tar, (char*)"content.xml");
-        th_set_size(tar, len);
-        th_finish(tar); /* caclulate and store th xsum etc */
-
-        if (th_write(tar) != 0 /* writes header block */
-            /* writes content.xml, padded to 512 bytes */
-         || libreport_full_write(tar_fd(tar), block, len512) != len512
-         || tar_append_eof(tar) != 0 /* writes EOF blocks */
-         || tar_close(tar) != 0
-        ) {
-            free(block);
-            goto ret_fail;
-        }
-        tar = NULL;
-        free(block);
-    }
-
-    /* We must be sure gzip finished, and finished successfully */
-    int status;
-    libreport_safe_waitpid(child, &status, 0);
-    child = -1;
-    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
-    {
-        /* Hopefully, by this time child emitted more meaningful
-         * error message. But just in case it didn't:
-         */
+    if (archive_writer_add_data(aw, "content.xml", signature, strlen(signature), 0644, time(NULL)) != 0
+     || archive_writer_finish(aw) != 0 /* writes EOF blocks */
+    ) {
         goto ret_fail;
     }
+
     goto ret_clean; /* success */
 
 ret_fail:
     retval = 1; /* failure */
-    /* We must close write fd first, or else child will wait forever */
-    if (tar)
-        tar_close(tar);
-    //close(pipe_from_parent_to_child[1]); - tar_close() does it itself
 
-    /* Now wait for child to exit */
-    if (child > 0)
+ret_clean:
+    archive_writer_free(aw);
+    if (fd >= 0 && close(fd) != 0)
     {
-        // Damn, selinux does not allow SIGKILLing our own child! wtf??
-        //kill(child, SIGKILL); /* just in case */
-        libreport_safe_waitpid(child, NULL, 0);
+        perror_msg("Can't close '%s'", tempfile);
+        retval = 1;
     }
-
-ret_clean:
     dd_close(dd);
     /* now it's safe to free file */
     free_reportfile(file);
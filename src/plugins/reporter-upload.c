@@ -32,7 +32,14 @@ static char *ask_url(const char *message)
     return url;
 }
 
+/* The server does not accept uploads of unknown size */
+#define UPLOAD_LENGTH_REQUIRED 411
+
+/* Uploads file_name or, if producer is not NULL, the data it generates under
+ * the base name of file_name
+ */
 static int interactive_upload_file(const char *url, const char *file_name,
+                                   upload_stream_producer_fn producer, void *producer_param,
                                    map_string_t *settings, char **remote_name)
 {
     post_state_t *state = new_post_state(POST_WANT_ERROR_MSG);
@@ -63,7 +70,17 @@ static int interactive_upload_file(const char *url, const char *file_name,
     if (state->client_ssh_private_keyfile != NULL)
         log_debug("Using SSH private key '%s'", state->client_ssh_private_keyfile);
 
-    char *tmp = libreport_upload_file_ext(state, url, file_name, UPLOAD_FILE_HANDLE_ACCESS_DENIALS);
+    char *tmp;
+    if (producer != NULL)
+        tmp = libreport_upload_stream_ext(state, url, file_name, producer, producer_param,
+                UPLOAD_FILE_HANDLE_ACCESS_DENIALS);
+    else
+        tmp = libreport_upload_file_ext(state, url, file_name, UPLOAD_FILE_HANDLE_ACCESS_DENIALS);
+
+    /* return 0 on success */
+    int result = tmp == NULL;
+    if (tmp == NULL && producer != NULL && state->http_resp_code == 411)
+        result = UPLOAD_LENGTH_REQUIRED;
 
     if (remote_name)
         *remote_name = tmp;
@@ -73,8 +90,27 @@ static int interactive_upload_file(const char *url, const char *file_name,
     free(password_inp);
     free_post_state(state);
 
-    /* return 0 on success */
-    return tmp == NULL;
+    return result;
+}
+
+struct archive_stream_param {
+    const char *dump_dir_name;
+    const_string_vector_const_ptr_t exclude_elements;
+};
+
+/* Compresses the problem directory directly to the upload stream */
+static int write_archive_to_stream(upload_stream_write_fn write, void *stream, void *param)
+{
+    struct archive_stream_param *asp = param;
+
+    struct dump_dir *dd = dd_opendir(asp->dump_dir_name, /*flags:*/ 0);
+    if (!dd)
+        return -ENOENT; /* error msg is already logged by dd_opendir */
+
+    const int r = dd_write_archive(dd, ARCHIVE_COMPRESSION_GZIP, asp->exclude_elements, write, stream);
+    dd_close(dd);
+
+    return r;
 }
 
 static int create_and_upload_archive(
@@ -94,8 +130,36 @@ static int create_and_upload_archive(
     tempfile = libreport_append_to_malloced_string(tempfile, ".tar.gz");
 
     string_vector_ptr_t exclude_from_report = libreport_get_global_always_excluded_elements();
+    dd_g_archive_threads = libreport_get_global_archive_compression_threads();
 
-    struct dump_dir *dd = dd_opendir(dump_dir_name, /*flags:*/ 0);
+    /* Upload from /tmp to /tmp + deletion -> BAD, exclude this possibility */
+    const bool upload = url && url[0] && strcmp(url, "file://"LARGE_DATA_TMP_DIR"/") != 0;
+
+    struct dump_dir *dd = NULL;
+
+    /* Stream the archive while it is being compressed, no temporary file */
+    if (upload && libreport_upload_stream_is_supported(url))
+    {
+        struct archive_stream_param asp = {
+            .dump_dir_name = dump_dir_name,
+            .exclude_elements = (const_string_vector_const_ptr_t)exclude_from_report,
+        };
+
+        log_warning(_("Compressing and uploading data"));
+        result = interactive_upload_file(url, tempfile, write_archive_to_stream, &asp, settings, remote_name);
+        if (result != UPLOAD_LENGTH_REQUIRED)
+        {
+            /* The name is used only for building the remote URL */
+            free(tempfile);
+            tempfile = NULL;
+            goto ret;
+        }
+
+        log_warning(_("The server requires the size of uploaded data, creating a temporary archive"));
+        result = 1; /* error */
+    }
+
+    dd = dd_opendir(dump_dir_name, /*flags:*/ 0);
     if (!dd)
         libreport_xfunc_die(); /* error msg is already logged by dd_opendir */
 
@@ -111,9 +175,9 @@ static int create_and_upload_archive(
     dd = NULL;
 
     /* Upload the archive */
-    /* Upload from /tmp to /tmp + deletion -> BAD, exclude this possibility */
-    if (url && url[0] && strcmp(url, "file://"LARGE_DATA_TMP_DIR"/") != 0)
-        result = interactive_upload_file(url, tempfile, settings, remote_name);
+    if (upload)
+        result = interactive_upload_file(url, tempfile, /*producer*/NULL, /*producer_param*/NULL,
+                                         settings, remote_name);
     else
     {
         result = 0; /* success */
@@ -131,6 +195,8 @@ static int create_and_upload_archive(
         free(tempfile);
     }
 
+    libreport_string_vector_free(exclude_from_report);
+
     return result;
 }
 
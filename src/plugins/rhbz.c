@@ -30,6 +30,9 @@
 
 #define MAX_HOPS            5
 #define MAX_SUMMARY_LENGTH  255
+/* The maximal number of the found bugs fetched together with the reported
+ * one, the duplicate chains usually lead through them */
+#define MAX_PREFETCHED_BUGS 20
 
 
 //#define DEBUG
@@ -68,7 +71,8 @@ void free_bug_info(struct bug_info *bi)
     free(bi);
 }
 
-static GList *rhbz_comments(struct abrt_xmlrpc *ax, int bug_id)
+/* Returns the comments of the bug from the Bug.comments response */
+static GList *rhbz_comments_from_response(xmlrpc_value *xml_response, int bug_id)
 {
     func_entry();
 
@@ -85,8 +89,7 @@ static GList *rhbz_comments(struct abrt_xmlrpc *ax, int bug_id)
      *           <value><array>
      * ...
      */
-    xmlrpc_value *xml_response = abrt_xmlrpc_call(ax, "Bug.comments", "{s:(i)}",
-                                                                      "ids", bug_id);
+
     /* bugs
      *     This is used for bugs specified in ids. This is a hash, where the
      *     keys are the numeric ids of the bugs, and the value is a hash with a
@@ -128,11 +131,22 @@ static GList *rhbz_comments(struct abrt_xmlrpc *ax, int bug_id)
     xmlrpc_DECREF(comments_memb);
     xmlrpc_DECREF(item_memb);
     xmlrpc_DECREF(bugs_memb);
-    xmlrpc_DECREF(xml_response);
 
     return g_list_reverse(comments);
 }
 
+static GList *rhbz_comments(struct abrt_xmlrpc *ax, int bug_id)
+{
+    func_entry();
+
+    xmlrpc_value *xml_response = abrt_xmlrpc_call(ax, "Bug.comments", "{s:(i)}",
+                                                                      "ids", bug_id);
+    GList *comments = rhbz_comments_from_response(xml_response, bug_id);
+    xmlrpc_DECREF(xml_response);
+
+    return comments;
+}
+
 static unsigned find_best_bt_rating_in_comments(GList *comments)
 {
     func_entry();
@@ -265,18 +279,14 @@ xmlrpc_value *rhbz_array_item_at(xmlrpc_value *xml, int pos)
     return item;
 }
 
-unsigned rhbz_version(struct abrt_xmlrpc *ax)
+/* Returns the version from the Bugzilla.version response */
+static unsigned rhbz_version_from_response(xmlrpc_value *result)
 {
-    func_entry();
-
-    xmlrpc_value *result;
-    result = abrt_xmlrpc_call(ax, "Bugzilla.version", "{}");
     char *version = NULL;
     if (result)
         version = rhbz_bug_read_item("version", result, RHBZ_READ_STR);
     if (!result || !version)
         error_msg_and_die("Can't determine %s", "Bugzilla.version");
-    xmlrpc_DECREF(result);
 
     strchrnul(version, '-')[0] = '\0';
 
@@ -298,8 +308,20 @@ unsigned rhbz_version(struct abrt_xmlrpc *ax)
     return BUGZILLA_VERSION(v[0], v[1], v[2]);
 }
 
+unsigned rhbz_version(struct abrt_xmlrpc *ax)
+{
+    func_entry();
+
+    xmlrpc_value *result;
+    result = abrt_xmlrpc_call(ax, "Bugzilla.version", "{}");
+    unsigned version = rhbz_version_from_response(result);
+    xmlrpc_DECREF(result);
+
+    return version;
+}
+
 /* die or return bug id; each bug must have bug id otherwise xml is corrupted */
-int rhbz_get_bug_id_from_array0(xmlrpc_value* xml, unsigned ver)
+static int rhbz_get_bug_id_at(xmlrpc_value* xml, unsigned pos, unsigned ver)
 {
     func_entry();
 
@@ -307,7 +329,7 @@ int rhbz_get_bug_id_from_array0(xmlrpc_value* xml, unsigned ver)
     xmlrpc_env_init(&env);
 
     xmlrpc_value *item = NULL;
-    xmlrpc_array_read_item(&env, xml, 0, &item);
+    xmlrpc_array_read_item(&env, xml, pos, &item);
     if (env.fault_occurred)
         abrt_xmlrpc_die(&env);
 
@@ -333,6 +355,11 @@ int rhbz_get_bug_id_from_array0(xmlrpc_value* xml, unsigned ver)
     return bug_id;
 }
 
+int rhbz_get_bug_id_from_array0(xmlrpc_value* xml, unsigned ver)
+{
+    return rhbz_get_bug_id_at(xml, 0, ver);
+}
+
 /* die when mandatory value is missing (set flag RHBZ_MANDATORY_MEMB)
  * or return appropriate string or NULL when fail;
  */
@@ -429,28 +456,13 @@ GList *rhbz_bug_cc(xmlrpc_value* result_xml)
     return cc_list;
 }
 
-struct bug_info *rhbz_bug_info(struct abrt_xmlrpc *ax, int bug_id)
+/* Returns the info of the bug item of a Bug.get response, without comments */
+static struct bug_info *rhbz_bug_info_from_item(xmlrpc_value *bug_item)
 {
     func_entry();
 
     struct bug_info *bz = new_bug_info();
 
-    /* http://www.bugzilla.org/docs/4.2/en/html/api/Bugzilla/WebService/Bug.html#get
-     *
-     * <methodResponse>
-     * <params>
-     *   <param><value><struct>
-     *     <member><name>faults</name><value><array><data/></array></value></member>
-     *     <member><name>bugs</name>
-     *        <value><array><data>
-     *        ...
-     */
-    xmlrpc_value *xml_bug_response = abrt_xmlrpc_call(ax, "Bug.get", "{s:(i)}",
-                                                          "ids", bug_id);
-
-    xmlrpc_value *bugs_memb = rhbz_get_member("bugs", xml_bug_response);
-    xmlrpc_value *bug_item = rhbz_array_item_at(bugs_memb, 0);
-
     int *ret = (int*)rhbz_bug_read_item("id", bug_item,
                                         RHBZ_MANDATORY_MEMB | RHBZ_READ_INT);
     bz->bi_id = *ret;
@@ -484,12 +496,184 @@ struct bug_info *rhbz_bug_info(struct abrt_xmlrpc *ax, int bug_id)
 
     bz->bi_cc_list = rhbz_bug_cc(bug_item);
 
-    bz->bi_comments = rhbz_comments(ax, bug_id);
-    bz->bi_best_bt_rating = find_best_bt_rating_in_comments(bz->bi_comments);
+    return bz;
+}
+
+/* The members of the bugs read by rhbz_bug_info_from_item() */
+static const char *const bug_info_fields[] = {
+    "id", "product", "creator", "status", "resolution", "platform", "dupe_of", "cc",
+};
+
+/* Fetches the bugs and the comments of the bug comments_id in one batch.
+ * The infos of the bugs are added to the table bugs, keyed by the bug ids.
+ */
+static GList *rhbz_get_bugs(struct abrt_xmlrpc *ax, GHashTable *bugs,
+                            GList *bug_ids, int comments_id)
+{
+    func_entry();
 
+    xmlrpc_env env;
+    xmlrpc_env_init(&env);
+
+    xmlrpc_value *ids = abrt_xmlrpc_array_new(&env);
+    for (GList *iter = bug_ids; iter; iter = g_list_next(iter))
+        abrt_xmlrpc_array_append_int(&env, ids, GPOINTER_TO_INT(iter->data));
+
+    xmlrpc_value *fields = abrt_xmlrpc_array_new(&env);
+    for (size_t i = 0; i < ARRAY_SIZE(bug_info_fields); ++i)
+        abrt_xmlrpc_array_append_string(&env, fields, bug_info_fields[i]);
+
+    /* http://www.bugzilla.org/docs/4.2/en/html/api/Bugzilla/WebService/Bug.html#get
+     *
+     * <methodResponse>
+     * <params>
+     *   <param><value><struct>
+     *     <member><name>faults</name><value><array><data/></array></value></member>
+     *     <member><name>bugs</name>
+     *        <value><array><data>
+     *        ...
+     */
+    xmlrpc_value *get_params = abrt_xmlrpc_params_new(&env);
+    abrt_xmlrpc_params_add_array(&env, get_params, "ids", ids);
+    abrt_xmlrpc_params_add_array(&env, get_params, "include_fields", fields);
+    xmlrpc_DECREF(fields);
+    xmlrpc_DECREF(ids);
+
+    xmlrpc_value *comments_params = NULL;
+    xmlrpc_build_value(&env, &comments_params, "{s:(i)}", "ids", comments_id);
+    if (env.fault_occurred)
+        abrt_xmlrpc_die(&env);
+
+    struct abrt_xmlrpc_batch_call calls[] = {
+        { .bc_method = "Bug.get", .bc_params = get_params },
+        { .bc_method = "Bug.comments", .bc_params = comments_params },
+    };
+    abrt_xmlrpc_call_batch(ax, calls, ARRAY_SIZE(calls));
+    xmlrpc_DECREF(comments_params);
+    xmlrpc_DECREF(get_params);
+
+    for (size_t i = 0; i < ARRAY_SIZE(calls); ++i)
+    {
+        if (calls[i].bc_fault.fault_occurred)
+            abrt_xmlrpc_die(&calls[i].bc_fault);
+    }
+
+    xmlrpc_value *bugs_memb = rhbz_get_member("bugs", calls[0].bc_result);
+    if (!bugs_memb)
+        error_msg_and_die(_("Bug.get return value did not contain member 'bugs'"));
+
+    const unsigned bugs_count = rhbz_array_size(bugs_memb);
+    for (unsigned i = 0; i < bugs_count; ++i)
+    {
+        xmlrpc_value *bug_item = rhbz_array_item_at(bugs_memb, i);
+        struct bug_info *bz = rhbz_bug_info_from_item(bug_item);
+        g_hash_table_replace(bugs, GINT_TO_POINTER(bz->bi_id), bz);
+        xmlrpc_DECREF(bug_item);
+    }
     xmlrpc_DECREF(bugs_memb);
-    xmlrpc_DECREF(bug_item);
-    xmlrpc_DECREF(xml_bug_response);
+
+    GList *comments = rhbz_comments_from_response(calls[1].bc_result, comments_id);
+
+    for (size_t i = 0; i < ARRAY_SIZE(calls); ++i)
+        abrt_xmlrpc_batch_call_clean(&calls[i]);
+
+    return comments;
+}
+
+static GHashTable *rhbz_bug_table_new(void)
+{
+    return g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                 NULL, (GDestroyNotify)free_bug_info);
+}
+
+/* Removes the bug from the table and returns it, dies if it is not there */
+static struct bug_info *rhbz_bug_table_take(GHashTable *bugs, int bug_id)
+{
+    struct bug_info *bz = g_hash_table_lookup(bugs, GINT_TO_POINTER(bug_id));
+    if (!bz)
+        error_msg_and_die(_("Bug.get return value did not contain bug %d"), bug_id);
+
+    g_hash_table_steal(bugs, GINT_TO_POINTER(bug_id));
+    return bz;
+}
+
+struct bug_info *rhbz_bug_info(struct abrt_xmlrpc *ax, int bug_id)
+{
+    func_entry();
+
+    GHashTable *bugs = rhbz_bug_table_new();
+    GList *ids = g_list_prepend(NULL, GINT_TO_POINTER(bug_id));
+    GList *comments = rhbz_get_bugs(ax, bugs, ids, bug_id);
+    g_list_free(ids);
+
+    struct bug_info *bz = rhbz_bug_table_take(bugs, bug_id);
+    g_hash_table_destroy(bugs);
+
+    bz->bi_comments = comments;
+    bz->bi_best_bt_rating = find_best_bt_rating_in_comments(bz->bi_comments);
+
+    return bz;
+}
+
+struct bug_info *rhbz_find_origin_bug(struct abrt_xmlrpc *ax, int bug_id, GList *dup_ids)
+{
+    func_entry();
+
+    GList *ids = g_list_prepend(NULL, GINT_TO_POINTER(bug_id));
+    unsigned prefetched = 0;
+    for (GList *iter = dup_ids; iter && prefetched < MAX_PREFETCHED_BUGS; iter = g_list_next(iter))
+    {
+        if (GPOINTER_TO_INT(iter->data) == bug_id)
+            continue;
+
+        ids = g_list_prepend(ids, iter->data);
+        ++prefetched;
+    }
+    ids = g_list_reverse(ids);
+
+    GHashTable *bugs = rhbz_bug_table_new();
+    int comments_id = bug_id;
+    GList *comments = rhbz_get_bugs(ax, bugs, ids, comments_id);
+    g_list_free(ids);
+
+    struct bug_info *bz = rhbz_bug_table_take(bugs, bug_id);
+    if (strcmp(bz->bi_status, "CLOSED") == 0
+     && strcmp(bz->bi_resolution, "DUPLICATE") == 0)
+    {
+        for (int ii = 0; ii <= MAX_HOPS; ii++)
+        {
+            if (ii == MAX_HOPS)
+                error_msg_and_die(_("Bugzilla couldn't find parent of bug %d"), bug_id);
+
+            log_warning("Bug %d is a duplicate, using parent bug %d", bz->bi_id, bz->bi_dup_id);
+            const int parent_id = bz->bi_dup_id;
+            free_bug_info(bz);
+
+            if (!g_hash_table_contains(bugs, GINT_TO_POINTER(parent_id)))
+            {
+                /* The parent is likely the origin, so its comments come along */
+                libreport_list_free_with_free(comments);
+                ids = g_list_prepend(NULL, GINT_TO_POINTER(parent_id));
+                comments_id = parent_id;
+                comments = rhbz_get_bugs(ax, bugs, ids, comments_id);
+                g_list_free(ids);
+            }
+            bz = rhbz_bug_table_take(bugs, parent_id);
+
+            // found a bug which is not CLOSED as DUPLICATE
+            if (bz->bi_dup_id == -1)
+                break;
+        }
+    }
+    g_hash_table_destroy(bugs);
+
+    if (bz->bi_id != comments_id)
+    {
+        libreport_list_free_with_free(comments);
+        comments = rhbz_comments(ax, bz->bi_id);
+    }
+    bz->bi_comments = comments;
+    bz->bi_best_bt_rating = find_best_bt_rating_in_comments(bz->bi_comments);
 
     return bz;
 }
@@ -606,20 +790,10 @@ int rhbz_new_bug(struct abrt_xmlrpc *ax,
 }
 
 /* suppress mail notify by {s:i} (minor_update:1) (driven by flag) */
-int rhbz_attach_blob(struct abrt_xmlrpc *ax, const char *bug_id,
-                const char *filename, const char *data, int data_len, int flags)
+static xmlrpc_value *rhbz_attachment_params(xmlrpc_env *env, const char *bug_id,
+                const char *filename, int flags)
 {
-    func_entry();
-
-    if (0 == data_len)
-    {
-        log_notice("not attaching an empty file: '%s'", filename);
-        /* Return SUCCESS */
-        return 0;
-    }
-
     char *fn = libreport_xasprintf("File: %s", filename);
-    xmlrpc_value* result;
     int minor_update = !!IS_MINOR_UPDATE(flags);
 
     /* http://www.bugzilla.org/docs/4.2/en/html/api/Bugzilla/WebService/Bug.html#add_attachment
@@ -627,18 +801,15 @@ int rhbz_attach_blob(struct abrt_xmlrpc *ax, const char *bug_id,
      * XMLRPC format options:
      *   s -> string,  single argument (char* value)
      *   i -> integer, single argument (int value)
-     *   6 -> base64,  two arguments (char* plain data which will be encoded by xmlrpc-c to base64,
-     *                                size_t number of bytes to encode)
+     *
+     * The base64 "data" member is added by the callers.
      */
-    result = abrt_xmlrpc_call(ax, "Bug.add_attachment", "{s:(s),s:s,s:s,s:s,s:6,s:i}",
+    xmlrpc_value *params = NULL;
+    xmlrpc_build_value(env, &params, "{s:(s),s:s,s:s,s:s,s:i}",
                 "ids", bug_id,
                 "summary", fn,
                 "file_name", filename,
                 "content_type", (flags & RHBZ_BINARY_ATTACHMENT) ? "application/octet-stream" : "text/plain",
-                /* base64 type requires two arguments: char* (plain data) and size_t (length)
-                 * ! xmlrpc-c takes care about encoding to base64 !
-                 */
-                "data", data, (size_t)data_len,
 
                 /* If set to true, this is considered a minor update and no mail is sent to users who do not want
                  * minor update emails. If current user is not in the minor_update_group, this parameter is simply
@@ -646,8 +817,50 @@ int rhbz_attach_blob(struct abrt_xmlrpc *ax, const char *bug_id,
                  */
                 "minor_update", minor_update
     );
+    if (env->fault_occurred)
+        abrt_xmlrpc_die(env);
 
     free(fn);
+    return params;
+}
+
+static xmlrpc_value *rhbz_attachment_params_with_data(xmlrpc_env *env, const char *bug_id,
+                const char *filename, const char *data, size_t data_len, int flags)
+{
+    xmlrpc_value *params = rhbz_attachment_params(env, bug_id, filename, flags);
+
+    /* xmlrpc-c takes care about encoding to base64 */
+    xmlrpc_value *value = xmlrpc_base64_new(env, data_len, (const unsigned char *)data);
+    if (env->fault_occurred)
+        abrt_xmlrpc_die(env);
+
+    xmlrpc_struct_set_value(env, params, "data", value);
+    if (env->fault_occurred)
+        abrt_xmlrpc_die(env);
+
+    xmlrpc_DECREF(value);
+    return params;
+}
+
+int rhbz_attach_blob(struct abrt_xmlrpc *ax, const char *bug_id,
+                const char *filename, const char *data, int data_len, int flags)
+{
+    func_entry();
+
+    if (0 == data_len)
+    {
+        log_notice("not attaching an empty file: '%s'", filename);
+        /* Return SUCCESS */
+        return 0;
+    }
+
+    xmlrpc_env env;
+    xmlrpc_env_init(&env);
+    xmlrpc_value *params = rhbz_attachment_params_with_data(&env, bug_id, filename, data, data_len, flags);
+    xmlrpc_value *result = abrt_xmlrpc_call_params(&env, ax, "Bug.add_attachment", params);
+    xmlrpc_DECREF(params);
+    xmlrpc_env_clean(&env);
+
     if (!result)
         return -1;
 
@@ -656,86 +869,252 @@ int rhbz_attach_blob(struct abrt_xmlrpc *ax, const char *bug_id,
     return 0;
 }
 
-int rhbz_attach_fd(struct abrt_xmlrpc *ax, const char *bug_id,
-                const char *att_name, int fd, int flags)
+/* Returns the size of the file and rewinds it, or -1 on error */
+static off_t rhbz_attachment_size(int fd, const char *att_name)
 {
-    func_entry();
-
     off_t size = lseek(fd, 0, SEEK_END);
-    if (size < 0)
+    if (size < 0 || lseek(fd, 0, SEEK_SET) < 0)
     {
         perror_msg("Can't lseek '%s'", att_name);
         return -1;
     }
 
-    /* bugzilla limit is 20MB
-     * attaching more then bugzilla's limit could cause that xmlrpc-c fails
-     * somewhere inside itself.
-     * https://bugzilla.redhat.com/show_bug.cgi?id=741980
-     */
-    if (size >= (20 * 1024 * 1024))
-    {
-        error_msg("Can't upload '%s', it's too large (%llu bytes)", att_name, (long long)size);
-        return -1;
-    }
-    lseek(fd, 0, SEEK_SET);
-
-//TODO: need to have a method of attaching huge files (IOW: 1Gb read isn't good).
+    return size;
+}
 
-    char *data = libreport_xmalloc(size);
+/* Returns malloced contents of the file, or NULL on error */
+static char *rhbz_read_attachment(int fd, const char *att_name, size_t size)
+{
+    char *data = libreport_xmalloc(size + 1);
     ssize_t r = libreport_full_read(fd, data, size);
     if (r < 0)
     {
         free(data);
         perror_msg("Can't read '%s'", att_name);
-        return -1;
+        return NULL;
     }
 
-    int res = rhbz_attach_blob(ax, bug_id, att_name, data, size, flags);
-    free(data);
-    return res;
+    return data;
 }
 
-void rhbz_logout(struct abrt_xmlrpc *ax)
+/* The file is read and encoded while it is being sent, so its size is limited
+ * only by the server's configuration (Bugzilla's maxattachmentsize).
+ */
+int rhbz_attach_fd(struct abrt_xmlrpc *ax, const char *bug_id,
+                const char *att_name, int fd, int flags)
 {
     func_entry();
 
-    xmlrpc_env env;
-    xmlrpc_value *result = abrt_xmlrpc_call_full(&env, ax, "User.logout", "{}");
+    off_t size = rhbz_attachment_size(fd, att_name);
+    if (size < 0)
+        return -1;
 
-    if (env.fault_occurred)
-        log_warning("xmlrpc fault: (%d) %s", env.fault_code, env.fault_string);
+    if (size == 0)
+    {
+        log_notice("not attaching an empty file: '%s'", att_name);
+        /* Return SUCCESS */
+        return 0;
+    }
+
+    xmlrpc_env env;
+    xmlrpc_env_init(&env);
+    xmlrpc_value *params = rhbz_attachment_params(&env, bug_id, att_name, flags);
+    xmlrpc_value *result = abrt_xmlrpc_call_params_with_fd(&env, ax, "Bug.add_attachment",
+                                                           params, "data", fd, size);
+    xmlrpc_DECREF(params);
 
+    int res = 0;
     if (result)
         xmlrpc_DECREF(result);
+    else
+    {
+        error_msg(_("Can't attach '%s': %s"), att_name, env.fault_string);
+        res = -1;
+    }
+
+    xmlrpc_env_clean(&env);
+    return res;
 }
 
-struct bug_info *rhbz_find_origin_bug_closed_duplicate(struct abrt_xmlrpc *ax,
-                                                       struct bug_info *bi)
+/* The attachments uploaded by the asynchronous calls */
+struct rhbz_attach_queue
+{
+    struct abrt_xmlrpc *ax;
+    const char *bug_id;
+    struct rhbz_attachment *attachments;
+    /* Indexes of the attachments which have not been started yet */
+    unsigned *pending;
+    unsigned pending_count;
+    unsigned next;
+    unsigned running;
+    unsigned max_parallel;
+};
+
+struct rhbz_attach_call
+{
+    struct rhbz_attachment *attachment;
+    struct rhbz_attach_queue *queue;
+};
+
+static void rhbz_attach_start_next(struct rhbz_attach_queue *queue);
+
+static void rhbz_attach_call_done(const char *server_url, const char *method_name,
+                xmlrpc_value *param_array, void *user_data,
+                xmlrpc_env *fault, xmlrpc_value *result)
+{
+    struct rhbz_attach_call *call = user_data;
+    struct rhbz_attach_queue *queue = call->queue;
+
+    if (fault->fault_occurred)
+        error_msg(_("Can't attach '%s': %s"), call->attachment->ra_name, fault->fault_string);
+    else
+    {
+        log_debug("attached '%s'", call->attachment->ra_name);
+        call->attachment->ra_result = 0;
+    }
+
+    free(call);
+
+    /* The finished call makes room for the next one */
+    --queue->running;
+    rhbz_attach_start_next(queue);
+}
+
+/* Starts the pending attachments until max_parallel calls are running */
+static void rhbz_attach_start_next(struct rhbz_attach_queue *queue)
+{
+    while (queue->running < queue->max_parallel && queue->next < queue->pending_count)
+    {
+        struct rhbz_attachment *att = queue->attachments + queue->pending[queue->next++];
+
+        size_t size = att->ra_data_len;
+        char *file_data = NULL;
+        if (att->ra_data == NULL)
+        {
+            off_t file_size = rhbz_attachment_size(att->ra_fd, att->ra_name);
+            if (file_size < 0)
+                continue;
+
+            size = file_size;
+            if (size != 0)
+            {
+                file_data = rhbz_read_attachment(att->ra_fd, att->ra_name, size);
+                if (file_data == NULL)
+                    continue;
+            }
+        }
+
+        if (size == 0)
+        {
+            log_notice("not attaching an empty file: '%s'", att->ra_name);
+            att->ra_result = 0;
+            free(file_data);
+            continue;
+        }
+
+        xmlrpc_env env;
+        xmlrpc_env_init(&env);
+        xmlrpc_value *params = rhbz_attachment_params_with_data(&env, queue->bug_id, att->ra_name,
+                file_data ? file_data : att->ra_data, size, att->ra_flags);
+        /* The parameters hold a copy of the data */
+        free(file_data);
+
+        struct rhbz_attach_call *call = libreport_xmalloc(sizeof(*call));
+        call->attachment = att;
+        call->queue = queue;
+
+        log_debug("attaching '%s'", att->ra_name);
+        abrt_xmlrpc_start_call_params(&env, queue->ax, "Bug.add_attachment", params,
+                rhbz_attach_call_done, call);
+        xmlrpc_DECREF(params);
+
+        if (env.fault_occurred)
+        {
+            error_msg(_("Can't attach '%s': %s"), att->ra_name, env.fault_string);
+            free(call);
+        }
+        else
+            ++queue->running;
+
+        xmlrpc_env_clean(&env);
+    }
+}
+
+unsigned rhbz_attach_many(struct abrt_xmlrpc *ax, const char *bug_id,
+                struct rhbz_attachment *attachments, unsigned count,
+                unsigned max_parallel)
 {
     func_entry();
 
-    struct bug_info *bi_tmp = new_bug_info();
-    bi_tmp->bi_id = bi->bi_id;
-    bi_tmp->bi_dup_id = bi->bi_dup_id;
+    struct rhbz_attach_queue queue = {
+        .ax = ax,
+        .bug_id = bug_id,
+        .attachments = attachments,
+        .pending = libreport_xmalloc(count * sizeof(unsigned) + 1),
+        .max_parallel = max_parallel ? max_parallel : 1,
+    };
+
+    unsigned *streamed = libreport_xmalloc(count * sizeof(*streamed) + 1);
+    unsigned streamed_count = 0;
 
-    for (int ii = 0; ii <= MAX_HOPS; ii++)
+    for (unsigned i = 0; i < count; ++i)
     {
-        if (ii == MAX_HOPS)
-            error_msg_and_die(_("Bugzilla couldn't find parent of bug %d"), bi->bi_id);
+        struct rhbz_attachment *att = attachments + i;
+        att->ra_result = -1;
 
-        log_warning("Bug %d is a duplicate, using parent bug %d", bi_tmp->bi_id, bi_tmp->bi_dup_id);
-        int bug_id = bi_tmp->bi_dup_id;
+        if (att->ra_data == NULL)
+        {
+            off_t file_size = rhbz_attachment_size(att->ra_fd, att->ra_name);
+            if (file_size < 0)
+                continue;
 
-        free_bug_info(bi_tmp);
-        bi_tmp = rhbz_bug_info(ax, bug_id);
+            if (file_size >= RHBZ_ATTACH_STREAM_SIZE)
+            {
+                streamed[streamed_count++] = i;
+                continue;
+            }
+        }
 
-        // found a bug which is not CLOSED as DUPLICATE
-        if (bi_tmp->bi_dup_id == -1)
-            break;
+        queue.pending[queue.pending_count++] = i;
+    }
+
+    /* The handlers of the finished calls start the next ones. A call may be
+     * started after the event loop has seen the last running one finish. */
+    rhbz_attach_start_next(&queue);
+    while (queue.running > 0)
+        abrt_xmlrpc_finish_calls(ax);
+
+    free(queue.pending);
+
+    /* Big files are sent one by one, so only one chunk of them is held
+     * in memory at a time */
+    for (unsigned i = 0; i < streamed_count; ++i)
+    {
+        struct rhbz_attachment *att = attachments + streamed[i];
+        if (rhbz_attach_fd(ax, bug_id, att->ra_name, att->ra_fd, att->ra_flags) == 0)
+            att->ra_result = 0;
     }
+    free(streamed);
 
-    return bi_tmp;
+    unsigned failed = 0;
+    for (unsigned i = 0; i < count; ++i)
+        failed += (attachments[i].ra_result != 0);
+
+    return failed;
+}
+
+void rhbz_logout(struct abrt_xmlrpc *ax)
+{
+    func_entry();
+
+    xmlrpc_env env;
+    xmlrpc_value *result = abrt_xmlrpc_call_full(&env, ax, "User.logout", "{}");
+
+    if (env.fault_occurred)
+        log_warning("xmlrpc fault: (%d) %s", env.fault_code, env.fault_string);
+
+    if (result)
+        xmlrpc_DECREF(result);
 }
 
 /* suppress mail notify by {s:i} (minor_update:1) */
@@ -842,7 +1221,7 @@ void rhbz_close_as_duplicate(struct abrt_xmlrpc *ax, int bug_id,
         xmlrpc_DECREF(result);
 }
 
-xmlrpc_value *rhbz_search_duphash(struct abrt_xmlrpc *ax,
+static xmlrpc_value *rhbz_search_duphash_params(xmlrpc_env *env,
                         const char *product,
                         const char *version,
                         const char *component,
@@ -863,14 +1242,105 @@ xmlrpc_value *rhbz_search_duphash(struct abrt_xmlrpc *ax,
 
     char *s = libreport_strbuf_free_nobuf(query);
     log_debug("search for '%s'", s);
-    xmlrpc_value *search = abrt_xmlrpc_call(ax, "Bug.search", "{s:s,s:(s)}", "quicksearch", s, "include_fields", "id");
+    xmlrpc_value *params = NULL;
+    xmlrpc_build_value(env, &params, "{s:s,s:(s)}", "quicksearch", s, "include_fields", "id");
+    if (env->fault_occurred)
+        abrt_xmlrpc_die(env);
 
     free(s);
+    return params;
+}
+
+/* Returns the array of the found bugs from the Bug.search response */
+static xmlrpc_value *rhbz_search_duphash_bugs(xmlrpc_value *search)
+{
     xmlrpc_value *bugs = rhbz_get_member("bugs", search);
-    xmlrpc_DECREF(search);
 
     if (!bugs)
         error_msg_and_die(_("Bug.search(quicksearch) return value did not contain member 'bugs'"));
 
     return bugs;
 }
+
+xmlrpc_value *rhbz_search_duphash(struct abrt_xmlrpc *ax,
+                        const char *product,
+                        const char *version,
+                        const char *component,
+                        const char *duphash)
+{
+    xmlrpc_env env;
+    xmlrpc_env_init(&env);
+
+    xmlrpc_value *params = rhbz_search_duphash_params(&env, product, version, component, duphash);
+    xmlrpc_value *search = abrt_xmlrpc_call_params(&env, ax, "Bug.search", params);
+    xmlrpc_DECREF(params);
+
+    xmlrpc_value *bugs = rhbz_search_duphash_bugs(search);
+    xmlrpc_DECREF(search);
+
+    return bugs;
+}
+
+void rhbz_search_duplicates(struct abrt_xmlrpc *ax,
+                        const char *product,
+                        const char *version,
+                        const char *component,
+                        const char *duphash,
+                        struct rhbz_duplicates *dups)
+{
+    func_entry();
+
+    xmlrpc_env env;
+    xmlrpc_env_init(&env);
+
+    /* The version is needed to read the results of the searches, but the
+     * searches don't have to wait for it */
+    struct abrt_xmlrpc_batch_call calls[] = {
+        { .bc_method = "Bugzilla.version", .bc_params = abrt_xmlrpc_params_new(&env) },
+        { .bc_method = "Bug.search",
+          .bc_params = rhbz_search_duphash_params(&env, product, /*version:*/ NULL, component, duphash) },
+        { .bc_method = "Bug.search",
+          .bc_params = version ? rhbz_search_duphash_params(&env, product, version, component, duphash) : NULL },
+    };
+    const unsigned count = version ? 3 : 2;
+    abrt_xmlrpc_call_batch(ax, calls, count);
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        xmlrpc_DECREF(calls[i].bc_params);
+        if (calls[i].bc_fault.fault_occurred)
+            abrt_xmlrpc_die(&calls[i].bc_fault);
+    }
+
+    dups->rd_version = rhbz_version_from_response(calls[0].bc_result);
+    dups->rd_existing_id = -1;
+    dups->rd_crossver_id = -1;
+    dups->rd_bug_ids = NULL;
+
+    xmlrpc_value *bugs = rhbz_search_duphash_bugs(calls[1].bc_result);
+    const unsigned crossver_count = rhbz_array_size(bugs);
+    log_debug("Bugzilla has %i reports with duphash '%s' including cross-version ones",
+              crossver_count, duphash);
+    for (unsigned i = 0; i < crossver_count; ++i)
+    {
+        const int bug_id = rhbz_get_bug_id_at(bugs, i, dups->rd_version);
+        dups->rd_bug_ids = g_list_prepend(dups->rd_bug_ids, GINT_TO_POINTER(bug_id));
+    }
+    dups->rd_bug_ids = g_list_reverse(dups->rd_bug_ids);
+    if (dups->rd_bug_ids)
+        dups->rd_crossver_id = GPOINTER_TO_INT(dups->rd_bug_ids->data);
+    xmlrpc_DECREF(bugs);
+
+    if (version)
+    {
+        bugs = rhbz_search_duphash_bugs(calls[2].bc_result);
+        const unsigned dup_count = rhbz_array_size(bugs);
+        log_debug("Bugzilla has %i reports with duphash '%s'", dup_count, duphash);
+        if (dup_count > 0)
+            dups->rd_existing_id = rhbz_get_bug_id_at(bugs, 0, dups->rd_version);
+        xmlrpc_DECREF(bugs);
+    }
+
+    for (unsigned i = 0; i < count; ++i)
+        abrt_xmlrpc_batch_call_clean(&calls[i]);
+}
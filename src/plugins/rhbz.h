@@ -105,19 +105,65 @@ int rhbz_attach_blob(struct abrt_xmlrpc *ax, const char *bug_id,
 int rhbz_attach_fd(struct abrt_xmlrpc *ax, const char *bug_id,
                 const char *att_name, int fd, int flags);
 
+/* rhbz_attach_many() streams the files of at least this size one by one,
+ * the smaller ones are read into memory and uploaded in parallel */
+#define RHBZ_ATTACH_STREAM_SIZE (1024 * 1024)
+
+struct rhbz_attachment {
+    const char *ra_name;
+    /* The data of the attachment, or NULL if it is read from ra_fd */
+    const char *ra_data;
+    size_t ra_data_len;
+    int ra_fd;
+    /* RHBZ_MINOR_UPDATE, RHBZ_BINARY_ATTACHMENT */
+    int ra_flags;
+    /* Set by rhbz_attach_many(): 0 if the attachment was added, -1 otherwise */
+    int ra_result;
+};
+
+/* Adds the attachments to the bug, at most max_parallel uploads run at once.
+ * Failures are reported by error_msg() and don't stop the other uploads.
+ *
+ * Returns the number of the attachments which were not added.
+ */
+unsigned rhbz_attach_many(struct abrt_xmlrpc *ax, const char *bug_id,
+                struct rhbz_attachment *attachments, unsigned count,
+                unsigned max_parallel);
+
 GList *rhbz_bug_cc(xmlrpc_value *result_xml);
 
 struct bug_info *rhbz_bug_info(struct abrt_xmlrpc *ax, int bug_id);
 
-
-struct bug_info *rhbz_find_origin_bug_closed_duplicate(struct abrt_xmlrpc *ax,
-                                                       struct bug_info *bi);
+/* Returns the info of the bug, or of the bug at the end of its chain of
+ * duplicates if it is CLOSED as DUPLICATE. The bugs of dup_ids are fetched
+ * together with the bug, so the chain usually takes no further requests.
+ */
+struct bug_info *rhbz_find_origin_bug(struct abrt_xmlrpc *ax, int bug_id, GList *dup_ids);
 unsigned rhbz_version(struct abrt_xmlrpc *ax);
 
 xmlrpc_value *rhbz_search_duphash(struct abrt_xmlrpc *ax,
                         const char *product, const char *version, const char *component,
                         const char *duphash);
 
+struct rhbz_duplicates {
+    /* BUGZILLA_VERSION() of the server */
+    unsigned rd_version;
+    /* The first bug with the duphash in the version, or -1 */
+    int rd_existing_id;
+    /* The first bug with the duphash in any version, or -1 */
+    int rd_crossver_id;
+    /* The ids of the bugs with the duphash in any version */
+    GList *rd_bug_ids;
+};
+
+/* Gets the server version and searches for the bugs with the duphash in any
+ * version and, if version is not NULL, in the version, all in one batch.
+ * rd_bug_ids must be freed by g_list_free().
+ */
+void rhbz_search_duplicates(struct abrt_xmlrpc *ax,
+                        const char *product, const char *version, const char *component,
+                        const char *duphash, struct rhbz_duplicates *dups);
+
 #ifdef __cplusplus
 }
 #endif